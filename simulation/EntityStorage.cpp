@@ -0,0 +1,356 @@
+#include "EntityStorage.h"
+
+#include <cstdlib>
+#include <cstring>
+#include "JobSystem.h"
+#include "SphereSimulation.h"
+
+namespace EntityStorage
+{
+    namespace
+    {
+        constexpr uint32_t MIN_SLOT_CAPACITY = 1024;
+
+        void *AllocateColumn(uint32_t rows, uint32_t size)
+        {
+            const size_t bytes = static_cast<size_t>(rows) * size;
+            void *pMemory = nullptr;
+#if defined(_MSC_VER)
+            pMemory = _aligned_malloc(bytes, SphereSimulation::SIMD_ALIGNMENT);
+#else
+            if (posix_memalign(&pMemory, SphereSimulation::SIMD_ALIGNMENT, bytes) != 0)
+            {
+                pMemory = nullptr;
+            }
+#endif
+            if (pMemory)
+            {
+                memset(pMemory, 0, bytes);
+            }
+            return pMemory;
+        }
+
+        void FreeColumn(void *pColumn)
+        {
+#if defined(_MSC_VER)
+            _aligned_free(pColumn);
+#else
+            std::free(pColumn);
+#endif
+        }
+
+        uint32_t PadRows(uint32_t rows)
+        {
+            const uint32_t width = SphereSimulation::SIMD_WIDTH;
+            return (rows + width - 1) / width * width;
+        }
+
+        uint32_t RoundChunkSize(uint32_t chunkSize)
+        {
+            const uint32_t alignment = SphereSimulation::CHUNK_ALIGNMENT;
+            chunkSize = (chunkSize + alignment - 1) / alignment * alignment;
+            return chunkSize == 0 ? alignment : chunkSize;
+        }
+
+        void GrowSlots(World *pWorld)
+        {
+            const uint32_t capacity = pWorld->mSlotCapacity ? pWorld->mSlotCapacity * 2 : MIN_SLOT_CAPACITY;
+            pWorld->pSlotArchetype =
+                static_cast<uint32_t *>(std::realloc(pWorld->pSlotArchetype, sizeof(uint32_t) * capacity));
+            pWorld->pSlotRow = static_cast<uint32_t *>(std::realloc(pWorld->pSlotRow, sizeof(uint32_t) * capacity));
+            pWorld->pSlotGeneration =
+                static_cast<uint32_t *>(std::realloc(pWorld->pSlotGeneration, sizeof(uint32_t) * capacity));
+            pWorld->mSlotCapacity = capacity;
+        }
+
+        uint32_t AllocateSlot(World *pWorld)
+        {
+            if (pWorld->mFreeSlot != INVALID_INDEX)
+            {
+                const uint32_t slot = pWorld->mFreeSlot;
+                pWorld->mFreeSlot = pWorld->pSlotRow[slot];
+                return slot;
+            }
+            if (pWorld->mSlotCount == pWorld->mSlotCapacity)
+            {
+                GrowSlots(pWorld);
+            }
+            const uint32_t slot = pWorld->mSlotCount++;
+            pWorld->pSlotGeneration[slot] = 0;
+            return slot;
+        }
+
+        void FreeSlot(World *pWorld, uint32_t slot)
+        {
+            pWorld->pSlotArchetype[slot] = INVALID_INDEX;
+            pWorld->pSlotGeneration[slot]++;
+            pWorld->pSlotRow[slot] = pWorld->mFreeSlot;
+            pWorld->mFreeSlot = slot;
+        }
+
+        bool HasComponents(const Archetype &archetype, uint32_t componentMask)
+        {
+            return (archetype.mComponentMask & componentMask) == componentMask;
+        }
+    } // namespace
+} // namespace EntityStorage
+
+void EntityStorage::AddWorld(World *pWorld) { *pWorld = {}; }
+
+void EntityStorage::RemoveWorld(World *pWorld)
+{
+    for (uint32_t a = 0; a < pWorld->mArchetypeCount; a++)
+    {
+        Archetype &archetype = pWorld->mArchetypes[a];
+        for (uint32_t component = 0; component < MAX_COMPONENTS; component++)
+        {
+            FreeColumn(archetype.pColumns[component]);
+        }
+        FreeColumn(archetype.pEntities);
+    }
+    std::free(pWorld->pSlotArchetype);
+    std::free(pWorld->pSlotRow);
+    std::free(pWorld->pSlotGeneration);
+    *pWorld = {};
+}
+
+uint32_t EntityStorage::AddComponentType(World *pWorld, uint32_t size)
+{
+    if (pWorld->mComponentCount == MAX_COMPONENTS)
+    {
+        return INVALID_INDEX;
+    }
+    pWorld->mComponentSize[pWorld->mComponentCount] = size;
+    return pWorld->mComponentCount++;
+}
+
+uint32_t EntityStorage::AddArchetype(World *pWorld, uint32_t componentMask, uint32_t capacity)
+{
+    for (uint32_t a = 0; a < pWorld->mArchetypeCount; a++)
+    {
+        if (pWorld->mArchetypes[a].mComponentMask == componentMask)
+        {
+            Reserve(pWorld, a, capacity);
+            return a;
+        }
+    }
+    if (pWorld->mArchetypeCount == MAX_ARCHETYPES)
+    {
+        return INVALID_INDEX;
+    }
+
+    const uint32_t a = pWorld->mArchetypeCount++;
+    pWorld->mArchetypes[a] = {};
+    pWorld->mArchetypes[a].mComponentMask = componentMask;
+    Reserve(pWorld, a, capacity);
+    return a;
+}
+
+void EntityStorage::Reserve(World *pWorld, uint32_t archetype, uint32_t capacity)
+{
+    Archetype &a = pWorld->mArchetypes[archetype];
+    if (capacity <= a.mCapacity && a.pEntities)
+    {
+        return;
+    }
+
+    const uint32_t rows = PadRows(capacity);
+    for (uint32_t component = 0; component < pWorld->mComponentCount; component++)
+    {
+        if (!(a.mComponentMask & (1u << component)))
+        {
+            continue;
+        }
+        const uint32_t size = pWorld->mComponentSize[component];
+        void *pColumn = AllocateColumn(rows, size);
+        if (a.pColumns[component])
+        {
+            memcpy(pColumn, a.pColumns[component], static_cast<size_t>(a.mCount) * size);
+            FreeColumn(a.pColumns[component]);
+        }
+        a.pColumns[component] = pColumn;
+    }
+    Entity *pEntities = static_cast<Entity *>(AllocateColumn(rows, sizeof(Entity)));
+    if (a.pEntities)
+    {
+        memcpy(pEntities, a.pEntities, sizeof(Entity) * a.mCount);
+        FreeColumn(a.pEntities);
+    }
+    a.pEntities = pEntities;
+    a.mCapacity = capacity;
+}
+
+uint32_t EntityStorage::CreateEntities(World *pWorld, uint32_t archetype, uint32_t count, Entity *pEntities)
+{
+    Archetype &a = pWorld->mArchetypes[archetype];
+    const uint32_t first = a.mCount;
+    if (first + count > a.mCapacity)
+    {
+        const uint32_t doubled = a.mCapacity * 2;
+        Reserve(pWorld, archetype, first + count > doubled ? first + count : doubled);
+    }
+
+    // Destroyed rows keep their old components until they are reused.
+    for (uint32_t component = 0; component < pWorld->mComponentCount; component++)
+    {
+        if (a.pColumns[component])
+        {
+            const uint32_t size = pWorld->mComponentSize[component];
+            memset(static_cast<char *>(a.pColumns[component]) + static_cast<size_t>(first) * size, 0,
+                   static_cast<size_t>(count) * size);
+        }
+    }
+
+    for (uint32_t row = first; row < first + count; row++)
+    {
+        const uint32_t slot = AllocateSlot(pWorld);
+        pWorld->pSlotArchetype[slot] = archetype;
+        pWorld->pSlotRow[slot] = row;
+        a.pEntities[row].mIndex = slot;
+        a.pEntities[row].mGeneration = pWorld->pSlotGeneration[slot];
+        if (pEntities)
+        {
+            pEntities[row - first] = a.pEntities[row];
+        }
+    }
+    a.mCount = first + count;
+    return first;
+}
+
+void EntityStorage::DestroyEntity(World *pWorld, Entity entity)
+{
+    if (!IsAlive(pWorld, entity))
+    {
+        return;
+    }
+
+    const uint32_t archetype = pWorld->pSlotArchetype[entity.mIndex];
+    const uint32_t row = pWorld->pSlotRow[entity.mIndex];
+    Archetype &a = pWorld->mArchetypes[archetype];
+    const uint32_t last = a.mCount - 1;
+    if (row != last)
+    {
+        for (uint32_t component = 0; component < pWorld->mComponentCount; component++)
+        {
+            if (a.pColumns[component])
+            {
+                const uint32_t size = pWorld->mComponentSize[component];
+                char *pColumn = static_cast<char *>(a.pColumns[component]);
+                memcpy(pColumn + static_cast<size_t>(row) * size, pColumn + static_cast<size_t>(last) * size, size);
+            }
+        }
+        a.pEntities[row] = a.pEntities[last];
+        pWorld->pSlotRow[a.pEntities[row].mIndex] = row;
+    }
+    a.mCount = last;
+    FreeSlot(pWorld, entity.mIndex);
+}
+
+void EntityStorage::DestroyLastEntities(World *pWorld, uint32_t archetype, uint32_t count)
+{
+    Archetype &a = pWorld->mArchetypes[archetype];
+    count = count < a.mCount ? count : a.mCount;
+    for (uint32_t row = a.mCount - count; row < a.mCount; row++)
+    {
+        FreeSlot(pWorld, a.pEntities[row].mIndex);
+    }
+    a.mCount -= count;
+}
+
+bool EntityStorage::IsAlive(const World *pWorld, Entity entity)
+{
+    return entity.mIndex < pWorld->mSlotCount && pWorld->pSlotArchetype[entity.mIndex] != INVALID_INDEX &&
+           pWorld->pSlotGeneration[entity.mIndex] == entity.mGeneration;
+}
+
+void *EntityStorage::GetComponent(World *pWorld, Entity entity, uint32_t component)
+{
+    if (!IsAlive(pWorld, entity) || component >= pWorld->mComponentCount)
+    {
+        return nullptr;
+    }
+    const Archetype &a = pWorld->mArchetypes[pWorld->pSlotArchetype[entity.mIndex]];
+    if (!a.pColumns[component])
+    {
+        return nullptr;
+    }
+    return static_cast<char *>(a.pColumns[component]) +
+           static_cast<size_t>(pWorld->pSlotRow[entity.mIndex]) * pWorld->mComponentSize[component];
+}
+
+uint32_t EntityStorage::GetEntityCount(const World *pWorld, uint32_t componentMask)
+{
+    uint32_t count = 0;
+    for (uint32_t a = 0; a < pWorld->mArchetypeCount; a++)
+    {
+        count += HasComponents(pWorld->mArchetypes[a], componentMask) ? pWorld->mArchetypes[a].mCount : 0;
+    }
+    return count;
+}
+
+void EntityStorage::ForEachChunk(World *pWorld, uint32_t componentMask, uint32_t chunkSize, ChunkFunc pFunc,
+                                 void *pUserData)
+{
+    struct ChunkJob
+    {
+        const World *pWorld;
+        uint32_t mChunkSize;
+        ChunkFunc pFunc;
+        void *pUserData;
+        uint32_t mArchetypeCount;
+        // Matching archetypes, the index of their first chunk and of their first row, with one entry past the end.
+        uint32_t mArchetypes[MAX_ARCHETYPES];
+        uint32_t mFirstChunk[MAX_ARCHETYPES + 1];
+        uint32_t mFirstRow[MAX_ARCHETYPES];
+    } job = {};
+    job.pWorld = pWorld;
+    job.mChunkSize = RoundChunkSize(chunkSize);
+    job.pFunc = pFunc;
+    job.pUserData = pUserData;
+
+    uint32_t chunkCount = 0;
+    uint32_t rowCount = 0;
+    for (uint32_t a = 0; a < pWorld->mArchetypeCount; a++)
+    {
+        const Archetype &archetype = pWorld->mArchetypes[a];
+        if (!HasComponents(archetype, componentMask) || archetype.mCount == 0)
+        {
+            continue;
+        }
+        job.mArchetypes[job.mArchetypeCount] = a;
+        job.mFirstChunk[job.mArchetypeCount] = chunkCount;
+        job.mFirstRow[job.mArchetypeCount] = rowCount;
+        job.mArchetypeCount++;
+        chunkCount += (archetype.mCount + job.mChunkSize - 1) / job.mChunkSize;
+        rowCount += archetype.mCount;
+    }
+    job.mFirstChunk[job.mArchetypeCount] = chunkCount;
+
+    // One chunk per job. A single threaded pool runs them all in one call.
+    JobSystem::ParallelFor(
+        chunkCount, 1,
+        [](void *pUserData, uint32_t begin, uint32_t end)
+        {
+            const ChunkJob *pJob = static_cast<const ChunkJob *>(pUserData);
+            uint32_t match = 0;
+            for (uint32_t index = begin; index < end; index++)
+            {
+                while (index >= pJob->mFirstChunk[match + 1])
+                {
+                    match++;
+                }
+                const uint32_t archetype = pJob->mArchetypes[match];
+                const Archetype &a = pJob->pWorld->mArchetypes[archetype];
+
+                Chunk chunk;
+                chunk.mArchetype = archetype;
+                chunk.mBegin = (index - pJob->mFirstChunk[match]) * pJob->mChunkSize;
+                chunk.mEnd = chunk.mBegin + pJob->mChunkSize < a.mCount ? chunk.mBegin + pJob->mChunkSize : a.mCount;
+                chunk.mFirst = pJob->mFirstRow[match] + chunk.mBegin;
+                chunk.pColumns = a.pColumns;
+                chunk.pEntities = a.pEntities;
+                pJob->pFunc(pJob->pUserData, &chunk);
+            }
+        },
+        &job);
+}
@@ -0,0 +1,108 @@
+#ifndef ENTITY_STORAGE_H
+#define ENTITY_STORAGE_H
+
+#include <cstdint>
+
+// Entities grouped by archetype, the set of components they have, with every component in a column of its own. Unlike
+// the usual chunked archetype storage, an archetype is not split into fixed-size memory blocks: each of its columns is
+// a single array over all of its rows, grown by moving it, and a Chunk is only a range of rows handed to one job. That
+// keeps the row of an entity its index in the SoA kernels and the GPU instance buffers.
+namespace EntityStorage
+{
+    // Component types are bits of a uint32_t mask.
+    constexpr uint32_t MAX_COMPONENTS = 32;
+    constexpr uint32_t MAX_ARCHETYPES = 16;
+    constexpr uint32_t INVALID_INDEX = 0xffffffffu;
+
+    // Handle to an entity. The generation tells a destroyed entity from the one reusing its slot.
+    struct Entity
+    {
+        uint32_t mIndex = INVALID_INDEX;
+        uint32_t mGeneration = 0;
+    };
+
+    // All entities with the same set of components. Every component is a column of its own, contiguous over the rows
+    // and laid out like the SphereState arrays: SIMD_ALIGNMENT aligned and padded to a multiple of SIMD_WIDTH rows, so
+    // the SoA kernels run on a column as they would on their own arrays. Rows are kept dense, [0, mCount) are live.
+    struct Archetype
+    {
+        uint32_t mComponentMask = 0;
+        uint32_t mCount = 0;
+        uint32_t mCapacity = 0;
+        // Entity living in each row.
+        Entity *pEntities = nullptr;
+        // Indexed by component type, nullptr for the components the archetype lacks.
+        void *pColumns[MAX_COMPONENTS] = {};
+    };
+
+    struct World
+    {
+        uint32_t mComponentCount = 0;
+        uint32_t mComponentSize[MAX_COMPONENTS] = {};
+        uint32_t mArchetypeCount = 0;
+        Archetype mArchetypes[MAX_ARCHETYPES];
+
+        // Archetype, row and generation per entity slot. A free slot keeps the next free one in its row instead.
+        uint32_t mSlotCapacity = 0;
+        uint32_t mSlotCount = 0;
+        uint32_t mFreeSlot = INVALID_INDEX;
+        uint32_t *pSlotArchetype = nullptr;
+        uint32_t *pSlotRow = nullptr;
+        uint32_t *pSlotGeneration = nullptr;
+    };
+
+    // The rows [mBegin, mEnd) of one archetype. pColumns are the whole columns, indexed by row like the SphereState
+    // arrays. mFirst is where mBegin lands when the rows of every archetype a ForEachChunk visits are put back to back,
+    // so a system can write its output for all of them into one array.
+    struct Chunk
+    {
+        uint32_t mArchetype;
+        uint32_t mBegin;
+        uint32_t mEnd;
+        uint32_t mFirst;
+        void *const *pColumns;
+        const Entity *pEntities;
+    };
+
+    typedef void (*ChunkFunc)(void *pUserData, const Chunk *pChunk);
+
+    void AddWorld(World *pWorld);
+    void RemoveWorld(World *pWorld);
+
+    // Registers a component of size bytes and returns its type. The components of an archetype do not need any
+    // alignment beyond their size.
+    uint32_t AddComponentType(World *pWorld, uint32_t size);
+
+    // Returns the archetype with exactly the components of componentMask, adding it with room for capacity entities
+    // if there is none yet.
+    uint32_t AddArchetype(World *pWorld, uint32_t componentMask, uint32_t capacity);
+
+    // Grows the columns of archetype to hold at least capacity entities. Moves the columns, so any pointer into them
+    // is stale afterwards.
+    void Reserve(World *pWorld, uint32_t archetype, uint32_t capacity);
+
+    // Appends count entities to archetype with their components zeroed and returns the row of the first one. Their
+    // handles go to pEntities unless it is nullptr. Grows the columns, doubling them, if they are full.
+    uint32_t CreateEntities(World *pWorld, uint32_t archetype, uint32_t count, Entity *pEntities);
+
+    // Moves the last row of the entity's archetype into its row, so the rows stay dense. Destroying the last row moves
+    // nothing. Handles of destroyed entities are ignored.
+    void DestroyEntity(World *pWorld, Entity entity);
+
+    // Destroys the last count entities of archetype, moving nothing.
+    void DestroyLastEntities(World *pWorld, uint32_t archetype, uint32_t count);
+
+    bool IsAlive(const World *pWorld, Entity entity);
+
+    // nullptr if the entity was destroyed or its archetype lacks the component.
+    void *GetComponent(World *pWorld, Entity entity, uint32_t component);
+
+    uint32_t GetEntityCount(const World *pWorld, uint32_t componentMask);
+
+    // Calls pFunc for every chunkSize rows (rounded up to CHUNK_ALIGNMENT) of every archetype having all components of
+    // componentMask, in archetype order, on the job system. Chunks never span two archetypes. Entities must not be
+    // created or destroyed meanwhile.
+    void ForEachChunk(World *pWorld, uint32_t componentMask, uint32_t chunkSize, ChunkFunc pFunc, void *pUserData);
+} // namespace EntityStorage
+
+#endif // ENTITY_STORAGE_H
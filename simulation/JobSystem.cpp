@@ -0,0 +1,245 @@
+#include "JobSystem.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace JobSystem
+{
+    namespace
+    {
+        struct Job
+        {
+            JobFunc pFunc;
+            void *pUserData;
+            uint32_t mBegin;
+            uint32_t mEnd;
+            std::atomic<uint32_t> *pPending;
+        };
+
+        // Owners push and pop at the back, thieves take from the front, so a stolen chunk is the one furthest away
+        // from what the owner is working on.
+        struct WorkQueue
+        {
+            std::mutex mMutex;
+            std::deque<Job> mJobs;
+        };
+
+        // Queues a thread the pool did not start can attach to, so its jobs never mix with those of the thread that
+        // called Init.
+        constexpr uint32_t MAX_ATTACHED_THREADS = 4;
+
+        // The pool's queues first, then one per attachable thread.
+        std::vector<std::unique_ptr<WorkQueue>> gQueues;
+        uint32_t gThreadCount = 0;
+        std::atomic<uint32_t> gAttachedMask(0);
+        std::vector<std::thread> gWorkers;
+        std::atomic<bool> gRunning(false);
+        std::atomic<uint32_t> gQueuedJobs(0);
+        std::mutex gSleepMutex;
+        std::condition_variable gWakeCondition;
+
+        // Queue 0 belongs to the thread that called Init.
+        thread_local uint32_t tQueueIndex = 0;
+
+        bool PopJob(uint32_t queueIndex, Job *pJob)
+        {
+            WorkQueue &queue = *gQueues[queueIndex];
+            std::lock_guard<std::mutex> lock(queue.mMutex);
+            if (queue.mJobs.empty())
+            {
+                return false;
+            }
+            *pJob = queue.mJobs.back();
+            queue.mJobs.pop_back();
+            return true;
+        }
+
+        bool StealJob(uint32_t thiefIndex, Job *pJob)
+        {
+            const uint32_t queueCount = static_cast<uint32_t>(gQueues.size());
+            for (uint32_t offset = 1; offset < queueCount; offset++)
+            {
+                WorkQueue &queue = *gQueues[(thiefIndex + offset) % queueCount];
+                std::lock_guard<std::mutex> lock(queue.mMutex);
+                if (!queue.mJobs.empty())
+                {
+                    *pJob = queue.mJobs.front();
+                    queue.mJobs.pop_front();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool TryRunJob(uint32_t queueIndex)
+        {
+            Job job;
+            if (!PopJob(queueIndex, &job) && !StealJob(queueIndex, &job))
+            {
+                return false;
+            }
+
+            gQueuedJobs.fetch_sub(1, std::memory_order_relaxed);
+            job.pFunc(job.pUserData, job.mBegin, job.mEnd);
+            job.pPending->fetch_sub(1, std::memory_order_release);
+            return true;
+        }
+
+        void WorkerMain(uint32_t queueIndex)
+        {
+            tQueueIndex = queueIndex;
+            while (gRunning.load(std::memory_order_acquire))
+            {
+                if (TryRunJob(queueIndex))
+                {
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> lock(gSleepMutex);
+                gWakeCondition.wait(lock, []
+                                    { return !gRunning.load() || gQueuedJobs.load() > 0; });
+            }
+        }
+    } // namespace
+} // namespace JobSystem
+
+void JobSystem::Init(uint32_t threadCount)
+{
+    if (threadCount == 0)
+    {
+        threadCount = std::thread::hardware_concurrency();
+    }
+    if (threadCount == 0)
+    {
+        threadCount = 1;
+    }
+
+    gQueues.clear();
+    for (uint32_t i = 0; i < threadCount + MAX_ATTACHED_THREADS; i++)
+    {
+        gQueues.emplace_back(new WorkQueue());
+    }
+
+    gThreadCount = threadCount;
+    gAttachedMask = 0;
+    tQueueIndex = 0;
+    gRunning = true;
+    for (uint32_t i = 1; i < threadCount; i++)
+    {
+        gWorkers.emplace_back(WorkerMain, i);
+    }
+}
+
+void JobSystem::Exit()
+{
+    {
+        std::lock_guard<std::mutex> lock(gSleepMutex);
+        gRunning = false;
+    }
+    gWakeCondition.notify_all();
+
+    for (std::thread &worker : gWorkers)
+    {
+        worker.join();
+    }
+    gWorkers.clear();
+    gQueues.clear();
+    gThreadCount = 0;
+}
+
+bool JobSystem::AttachThread()
+{
+    uint32_t mask = gAttachedMask.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        uint32_t slot = 0;
+        while (slot < MAX_ATTACHED_THREADS && (mask & (1u << slot)))
+        {
+            slot++;
+        }
+        if (slot == MAX_ATTACHED_THREADS)
+        {
+            return false;
+        }
+        if (gAttachedMask.compare_exchange_weak(mask, mask | (1u << slot), std::memory_order_relaxed))
+        {
+            tQueueIndex = gThreadCount + slot;
+            return true;
+        }
+    }
+}
+
+void JobSystem::DetachThread()
+{
+    if (tQueueIndex >= gThreadCount)
+    {
+        gAttachedMask.fetch_and(~(1u << (tQueueIndex - gThreadCount)), std::memory_order_relaxed);
+        tQueueIndex = 0;
+    }
+}
+
+uint32_t JobSystem::GetThreadCount() { return gThreadCount == 0 ? 1 : gThreadCount; }
+
+void JobSystem::ParallelFor(uint32_t count, uint32_t chunkSize, JobFunc pFunc, void *pUserData)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    chunkSize = chunkSize == 0 ? count : chunkSize;
+    const uint32_t jobCount = (count + chunkSize - 1) / chunkSize;
+    const uint32_t queueCount = GetThreadCount();
+    if (jobCount == 1 || queueCount == 1)
+    {
+        pFunc(pUserData, 0, count);
+        return;
+    }
+
+    std::atomic<uint32_t> pending(jobCount);
+    gQueuedJobs.fetch_add(jobCount);
+
+    // Deal the chunks out in contiguous runs, so each thread starts on neighbouring memory. An attached caller keeps
+    // the first run and hands the rest to the workers, never to the thread that called Init.
+    const bool attached = tQueueIndex >= queueCount;
+    const uint32_t jobsPerQueue = (jobCount + queueCount - 1) / queueCount;
+    for (uint32_t q = 0; q < queueCount; q++)
+    {
+        const uint32_t firstJob = q * jobsPerQueue;
+        const uint32_t lastJob = firstJob + jobsPerQueue < jobCount ? firstJob + jobsPerQueue : jobCount;
+        if (firstJob >= lastJob)
+        {
+            break;
+        }
+
+        const uint32_t queueIndex = attached ? (q == 0 ? tQueueIndex : q) : (tQueueIndex + q) % queueCount;
+        WorkQueue &queue = *gQueues[queueIndex];
+        std::lock_guard<std::mutex> lock(queue.mMutex);
+        // Pushed back to front so the owner pops them in ascending order.
+        for (uint32_t j = lastJob; j-- > firstJob;)
+        {
+            const uint32_t begin = j * chunkSize;
+            const uint32_t end = begin + chunkSize < count ? begin + chunkSize : count;
+            queue.mJobs.push_back({pFunc, pUserData, begin, end, &pending});
+        }
+    }
+
+    {
+        // Taking the lock orders the wake up after any worker that is about to check the predicate and sleep.
+        std::lock_guard<std::mutex> lock(gSleepMutex);
+    }
+    gWakeCondition.notify_all();
+
+    while (pending.load(std::memory_order_acquire) > 0)
+    {
+        if (!TryRunJob(tQueueIndex))
+        {
+            std::this_thread::yield();
+        }
+    }
+}
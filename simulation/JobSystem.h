@@ -0,0 +1,31 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <cstdint>
+
+namespace JobSystem
+{
+    // Runs the items [begin, end) of a parallel loop.
+    typedef void (*JobFunc)(void *pUserData, uint32_t begin, uint32_t end);
+
+    // Starts threadCount - 1 worker threads, the thread calling ParallelFor is the last one. 0 picks one thread per
+    // hardware thread.
+    void Init(uint32_t threadCount);
+    void Exit();
+
+    // Gives a thread the pool did not start a queue of its own for the ParallelFor calls it makes. Otherwise it shares
+    // queue 0 with the thread that called Init, and each ends up running the other's chunks before its own. Fails
+    // once every spare queue is taken. DetachThread hands the queue back before the thread ends.
+    bool AttachThread();
+    void DetachThread();
+
+    // Number of threads taking part in a ParallelFor, including the caller.
+    uint32_t GetThreadCount();
+
+    // Splits [0, count) into chunks of chunkSize items and runs them on the pool. Every thread owns a queue, idle
+    // threads steal from the others. The calling thread helps out and returns once all chunks are done. Safe to call
+    // from inside a job.
+    void ParallelFor(uint32_t count, uint32_t chunkSize, JobFunc pFunc, void *pUserData);
+} // namespace JobSystem
+
+#endif // JOB_SYSTEM_H
@@ -0,0 +1,755 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "EntityStorage.h"
+#include "JobSystem.h"
+#include "SphereBvh.h"
+#include "SphereSimulation.h"
+#include "SphereSystems.h"
+
+// Times the sphere simulation without the renderer: the update (which also packs the instance data), a respawn of
+// every sphere, the initial spawn, the two view culling, the render side interpolation between two steps, the
+// collision step, the BVH build, refit and ray queries and the update as a system over entity storage, for every
+// kernel the CPU supports. The `aos` kernel is the update loop the simulation replaced, kept as the baseline: spheres
+// as arrays of 16 byte vectors, rand() respawns and a 4x4 matrix product per sphere into 80 byte instances, on one
+// thread. It only has an update.
+//
+//   simulation-benchmark [--counts 1000,10000,100000,1000000] [--threads 1,2,4,...] [--chunk-size <count>]
+//                        [--kernel aos|scalar|sse|avx2] [--rays <count>] [--min-time <seconds>] [--csv]
+//   simulation-benchmark --verify
+//
+// Every thread count of --threads is a run of its own, one per hardware thread when it is not given. --verify checks
+// instead that the simulation replays bit for bit whatever the kernel, thread count and chunk size.
+
+namespace
+{
+    enum Operation
+    {
+        // Step with a frame sized time step. Moves the spheres, respawns the few leaving the bounds and writes the
+        // 20 byte instances.
+        OPERATION_UPDATE,
+        // Step with a time step so large that every sphere leaves the bounds and is respawned.
+        OPERATION_RESPAWN,
+        // Spawn over all spheres, on the calling thread as at startup.
+        OPERATION_SPAWN,
+        // CullViews with a camera and a light view and four LODs, as the scene does.
+        OPERATION_CULL,
+        // Interpolate halfway through a snapshot, as the scene does every frame while the simulation runs on its own
+        // thread.
+        OPERATION_INTERPOLATE,
+        // Collide, grid and narrowphase. Its stage times and pair counts are printed along with it.
+        OPERATION_COLLIDE,
+        // SphereBvh Build from scratch, Refit in place and Intersect with a batch of rays from the culling camera.
+        OPERATION_BVH_BUILD,
+        OPERATION_BVH_REFIT,
+        OPERATION_BVH_QUERY,
+        // The update as SphereSystems::Simulate over the same number of spheres stored as entities, half of them in an
+        // archetype with an extra component, so it walks two archetypes.
+        OPERATION_ECS_UPDATE,
+        OPERATION_COUNT,
+    };
+
+    const char *GetOperationName(Operation operation)
+    {
+        switch (operation)
+        {
+        case OPERATION_UPDATE:
+            return "update";
+        case OPERATION_RESPAWN:
+            return "respawn";
+        case OPERATION_SPAWN:
+            return "spawn";
+        case OPERATION_CULL:
+            return "cull";
+        case OPERATION_INTERPOLATE:
+            return "interpolate";
+        case OPERATION_COLLIDE:
+            return "collide";
+        case OPERATION_BVH_BUILD:
+            return "bvh-build";
+        case OPERATION_BVH_REFIT:
+            return "bvh-refit";
+        case OPERATION_BVH_QUERY:
+            return "bvh-query";
+        case OPERATION_ECS_UPDATE:
+            return "ecs-update";
+        default:
+            return "unknown";
+        }
+    }
+
+    struct BenchmarkSettings
+    {
+        std::vector<uint32_t> mCounts;
+        // 0 is one per hardware thread.
+        std::vector<uint32_t> mThreadCounts = {0};
+        uint32_t mChunkSize = SphereSimulation::DEFAULT_CHUNK_SIZE;
+        bool mKernelGiven = false;
+        SphereSimulation::KernelType mKernel = SphereSimulation::KernelType::Scalar;
+        // Time the AoS baseline, on its own with --kernel aos, before the kernels otherwise.
+        bool mAosBaseline = true;
+        uint32_t mRayCount = 65536;
+        // Every operation is repeated until it ran at least this long and MIN_ITERATIONS times.
+        double mMinTime = 0.25;
+        bool mCsv = false;
+        bool mVerify = false;
+    };
+
+    constexpr uint32_t MIN_ITERATIONS = 5;
+    constexpr uint32_t RAYS_PER_JOB = 256;
+    constexpr uint64_t SEED = 1;
+
+    struct Fixture
+    {
+        SphereSimulation::SphereState mState;
+        SphereSimulation::InstanceOutput mOutput;
+        SphereSimulation::CullState mCull;
+        SphereSimulation::CullDesc mCullDesc;
+        uint32_t *ppVisible[SphereSimulation::MAX_CULL_VIEWS];
+        SphereSimulation::VisibleCounts mVisibleCount;
+        SphereSimulation::Snapshot mSnapshot;
+        SphereSimulation::SphereState mInterpolated;
+        SphereSimulation::CollisionState mCollision;
+        // Of the last collide run.
+        SphereSimulation::CollisionStats mCollisionStats;
+        SphereBvh::Bvh mBvh;
+        std::vector<SphereBvh::Ray> mRays;
+        std::vector<SphereBvh::RayHit> mHits;
+        EntityStorage::World mWorld;
+        SphereSystems::SphereComponents mComponents;
+        uint32_t mWorldStep;
+        uint32_t mChunkSize;
+    };
+
+    // Perspective frustum looking down +z from cameraZ with a 90 degree field of view, so about a third of the cube
+    // is in view.
+    void SetCameraFrustum(SphereSimulation::Frustum *pFrustum, float cameraZ, float nearZ, float farZ)
+    {
+        const float s = 1.0f / std::sqrt(2.0f);
+        const float planes[6][4] = {
+            {s, 0.0f, s, -s * cameraZ},  {-s, 0.0f, s, -s * cameraZ},    {0.0f, s, s, -s * cameraZ},
+            {0.0f, -s, s, -s * cameraZ}, {0.0f, 0.0f, 1.0f, -cameraZ - nearZ}, {0.0f, 0.0f, -1.0f, cameraZ + farZ},
+        };
+        std::copy(&planes[0][0], &planes[0][0] + 6 * 4, &pFrustum->mPlanes[0][0]);
+    }
+
+    // Box around the whole cube, like the directional light's orthographic view.
+    void SetLightFrustum(SphereSimulation::Frustum *pFrustum)
+    {
+        const float extent = SphereSimulation::BOUNDS + 10.0f;
+        const float planes[6][4] = {
+            {1.0f, 0.0f, 0.0f, extent},  {-1.0f, 0.0f, 0.0f, extent}, {0.0f, 1.0f, 0.0f, extent},
+            {0.0f, -1.0f, 0.0f, extent}, {0.0f, 0.0f, 1.0f, extent},  {0.0f, 0.0f, -1.0f, extent},
+        };
+        std::copy(&planes[0][0], &planes[0][0] + 6 * 4, &pFrustum->mPlanes[0][0]);
+    }
+
+    void AddFixture(Fixture *pFixture, uint32_t count, uint32_t rayCount, uint32_t chunkSize)
+    {
+        SphereSimulation::AddState(&pFixture->mState, count, SEED);
+        pFixture->mState.mCount = count;
+        SphereSimulation::Spawn(&pFixture->mState, 0, count);
+
+        pFixture->mOutput.pPositionScale = static_cast<float *>(std::malloc(sizeof(float) * 4 * count));
+        pFixture->mOutput.pColor = static_cast<uint32_t *>(std::malloc(sizeof(uint32_t) * count));
+
+        SphereSimulation::AddCullState(&pFixture->mCull, count);
+        for (uint32_t view = 0; view < SphereSimulation::MAX_CULL_VIEWS; view++)
+        {
+            pFixture->ppVisible[view] = static_cast<uint32_t *>(std::malloc(sizeof(uint32_t) * count));
+        }
+
+        const float cameraZ = -1.5f * SphereSimulation::BOUNDS;
+        SphereSimulation::CullDesc &desc = pFixture->mCullDesc;
+        SetCameraFrustum(&desc.mFrusta[0], cameraZ, 0.1f, 1000.0f);
+        SetLightFrustum(&desc.mFrusta[1]);
+        desc.mViewCount = SphereSimulation::MAX_CULL_VIEWS;
+        desc.mLod.mCameraPosition[2] = cameraZ;
+        // 1080 pixels high at 90 degrees.
+        desc.mLod.mPixelScale = 540.0f;
+        desc.mLod.mThresholds[0] = 96.0f;
+        desc.mLod.mThresholds[1] = 32.0f;
+        desc.mLod.mThresholds[2] = 12.0f;
+        desc.mLod.mLodCount = SphereSimulation::MAX_LODS;
+        desc.mLod.mHysteresis = 0.1f;
+        desc.mLod.mBias[1] = 1;
+
+        pFixture->mVisibleCount = {};
+        pFixture->mChunkSize = chunkSize;
+
+        SphereSimulation::AddSnapshot(&pFixture->mSnapshot, count);
+        SphereSimulation::BeginSnapshot(&pFixture->mState, &pFixture->mSnapshot);
+        SphereSimulation::Step(&pFixture->mState, 1.0f / 60.0f, &pFixture->mSnapshot.mCurrent, chunkSize);
+        pFixture->mSnapshot.mCount = count;
+        SphereSimulation::AddState(&pFixture->mInterpolated, count, SEED);
+        SphereSimulation::AddCollisionState(&pFixture->mCollision, count);
+        pFixture->mCollisionStats = {};
+
+        SphereBvh::AddBvh(&pFixture->mBvh, count);
+        SphereBvh::Build(&pFixture->mBvh, &pFixture->mState, chunkSize);
+        // From the culling camera through a grid of points on the far face of the cube, so most rays cross it.
+        const uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(rayCount))));
+        pFixture->mRays.resize(rayCount);
+        pFixture->mHits.resize(rayCount);
+        for (uint32_t i = 0; i < rayCount; i++)
+        {
+            const float target[3] = {
+                SphereSimulation::BOUNDS * (2.0f * (i % side + 0.5f) / side - 1.0f),
+                SphereSimulation::BOUNDS * (2.0f * (i / side + 0.5f) / side - 1.0f),
+                SphereSimulation::BOUNDS,
+            };
+            SphereBvh::Ray &ray = pFixture->mRays[i];
+            ray.mOrigin[0] = 0.0f;
+            ray.mOrigin[1] = 0.0f;
+            ray.mOrigin[2] = cameraZ;
+            const float dx = target[0];
+            const float dy = target[1];
+            const float dz = target[2] - cameraZ;
+            const float length = std::sqrt(dx * dx + dy * dy + dz * dz);
+            ray.mDirection[0] = dx / length;
+            ray.mDirection[1] = dy / length;
+            ray.mDirection[2] = dz / length;
+            ray.mMaxDistance = 1000.0f;
+        }
+
+        EntityStorage::AddWorld(&pFixture->mWorld);
+        SphereSystems::AddSphereComponents(&pFixture->mWorld, &pFixture->mComponents);
+        const uint32_t sphereMask = pFixture->mComponents.mMask;
+        const uint32_t tag = EntityStorage::AddComponentType(&pFixture->mWorld, sizeof(uint32_t));
+        const uint32_t archetypes[2] = {
+            EntityStorage::AddArchetype(&pFixture->mWorld, sphereMask, count / 2),
+            EntityStorage::AddArchetype(&pFixture->mWorld, sphereMask | (1u << tag), count - count / 2),
+        };
+        SphereSystems::Resize(&pFixture->mWorld, &pFixture->mComponents, archetypes[0], count / 2, SEED);
+        SphereSystems::Resize(&pFixture->mWorld, &pFixture->mComponents, archetypes[1], count - count / 2, SEED);
+        pFixture->mWorldStep = 0;
+    }
+
+    void RemoveFixture(Fixture *pFixture)
+    {
+        EntityStorage::RemoveWorld(&pFixture->mWorld);
+        SphereBvh::RemoveBvh(&pFixture->mBvh);
+        SphereSimulation::RemoveCollisionState(&pFixture->mCollision);
+        SphereSimulation::RemoveState(&pFixture->mInterpolated);
+        SphereSimulation::RemoveSnapshot(&pFixture->mSnapshot);
+        for (uint32_t view = 0; view < SphereSimulation::MAX_CULL_VIEWS; view++)
+        {
+            std::free(pFixture->ppVisible[view]);
+        }
+        SphereSimulation::RemoveCullState(&pFixture->mCull);
+        std::free(pFixture->mOutput.pPositionScale);
+        std::free(pFixture->mOutput.pColor);
+        SphereSimulation::RemoveState(&pFixture->mState);
+    }
+
+    // The spheres as the scene kept them before SphereState, in the 16 byte vectors of the math library, and the
+    // instance data it uploaded, a world matrix and a float4 color per sphere.
+    struct alignas(16) AosVector
+    {
+        float mX, mY, mZ, mW;
+    };
+
+    // Column-major.
+    struct AosMatrix
+    {
+        AosVector mColumns[4];
+    };
+
+    struct AosFixture
+    {
+        std::vector<AosVector> mPosition;
+        std::vector<float> mSize;
+        std::vector<AosVector> mColor;
+        std::vector<AosVector> mSpeed;
+        std::vector<AosMatrix> mWorld;
+        std::vector<AosVector> mInstanceColor;
+    };
+
+    float RandomFloat(float min, float max) { return min + rand() / static_cast<float>(RAND_MAX) * (max - min); }
+
+    void AddAosFixture(AosFixture *pFixture, uint32_t count)
+    {
+        srand(static_cast<unsigned>(SEED));
+        pFixture->mPosition.resize(count);
+        pFixture->mSize.resize(count);
+        pFixture->mColor.resize(count);
+        pFixture->mSpeed.resize(count);
+        pFixture->mWorld.resize(count);
+        pFixture->mInstanceColor.resize(count);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            const float bounds = SphereSimulation::BOUNDS;
+            pFixture->mPosition[i] = {RandomFloat(-bounds, bounds), RandomFloat(-bounds, bounds),
+                                      RandomFloat(-bounds, bounds), 0.0f};
+            pFixture->mColor[i] = {RandomFloat(0.0f, 1.0f), RandomFloat(0.0f, 1.0f), RandomFloat(0.0f, 1.0f), 1.0f};
+            pFixture->mSize[i] = RandomFloat(1.0f, 10.0f);
+            pFixture->mSpeed[i] = {RandomFloat(-10.0f, 10.0f), RandomFloat(-10.0f, 10.0f), RandomFloat(-10.0f, 10.0f),
+                                   0.0f};
+        }
+    }
+
+    AosVector Transform(const AosMatrix &m, const AosVector &v)
+    {
+        const AosVector *c = m.mColumns;
+        return {c[0].mX * v.mX + c[1].mX * v.mY + c[2].mX * v.mZ + c[3].mX * v.mW,
+                c[0].mY * v.mX + c[1].mY * v.mY + c[2].mY * v.mZ + c[3].mY * v.mW,
+                c[0].mZ * v.mX + c[1].mZ * v.mY + c[2].mZ * v.mZ + c[3].mZ * v.mW,
+                c[0].mW * v.mX + c[1].mW * v.mY + c[2].mW * v.mZ + c[3].mW * v.mW};
+    }
+
+    // Generic product, as mat4::operator* did it, with no use of the zeros in a translation or a scale.
+    AosMatrix Multiply(const AosMatrix &a, const AosMatrix &b)
+    {
+        return {{Transform(a, b.mColumns[0]), Transform(a, b.mColumns[1]), Transform(a, b.mColumns[2]),
+                 Transform(a, b.mColumns[3])}};
+    }
+
+    // The scene's update loop before the SoA kernels, one sphere after the other.
+    void RunAos(AosFixture *pFixture, float deltaTime)
+    {
+        const float bounds = SphereSimulation::BOUNDS;
+        const uint32_t count = static_cast<uint32_t>(pFixture->mPosition.size());
+        for (uint32_t i = 0; i < count; i++)
+        {
+            AosVector &position = pFixture->mPosition[i];
+            const AosVector &speed = pFixture->mSpeed[i];
+            position = {position.mX + deltaTime * speed.mX, position.mY + deltaTime * speed.mY,
+                        position.mZ + deltaTime * speed.mZ, 0.0f};
+            if (std::fabs(position.mX) > bounds || std::fabs(position.mY) > bounds || std::fabs(position.mZ) > bounds)
+            {
+                position.mX = RandomFloat(-bounds, bounds);
+                position.mY = RandomFloat(-bounds, bounds);
+                position.mZ = RandomFloat(-bounds, bounds);
+
+                pFixture->mColor[i] = {RandomFloat(0.0f, 1.0f), RandomFloat(0.0f, 1.0f), RandomFloat(0.0f, 1.0f), 1.0f};
+                pFixture->mSize[i] = RandomFloat(1.0f, 10.0f);
+            }
+            pFixture->mInstanceColor[i] = pFixture->mColor[i];
+
+            const float size = pFixture->mSize[i];
+            const AosMatrix translation = {{
+                {1.0f, 0.0f, 0.0f, 0.0f},
+                {0.0f, 1.0f, 0.0f, 0.0f},
+                {0.0f, 0.0f, 1.0f, 0.0f},
+                {position.mX, position.mY, position.mZ, 1.0f},
+            }};
+            const AosMatrix scale = {{
+                {size, 0.0f, 0.0f, 0.0f},
+                {0.0f, size, 0.0f, 0.0f},
+                {0.0f, 0.0f, size, 0.0f},
+                {0.0f, 0.0f, 0.0f, 1.0f},
+            }};
+            pFixture->mWorld[i] = Multiply(translation, scale);
+        }
+    }
+
+    void Run(Fixture *pFixture, Operation operation)
+    {
+        switch (operation)
+        {
+        case OPERATION_UPDATE:
+            SphereSimulation::Step(&pFixture->mState, 1.0f / 60.0f, &pFixture->mOutput, pFixture->mChunkSize);
+            break;
+        case OPERATION_RESPAWN:
+            SphereSimulation::Step(&pFixture->mState, 1.0e4f, &pFixture->mOutput, pFixture->mChunkSize);
+            break;
+        case OPERATION_SPAWN:
+            SphereSimulation::Spawn(&pFixture->mState, 0, pFixture->mState.mCount);
+            break;
+        case OPERATION_CULL:
+            SphereSimulation::CullViews(&pFixture->mState, &pFixture->mCull, &pFixture->mCullDesc, pFixture->ppVisible,
+                                        &pFixture->mVisibleCount, pFixture->mChunkSize);
+            break;
+        case OPERATION_INTERPOLATE:
+            SphereSimulation::Interpolate(&pFixture->mSnapshot, 0.5f, &pFixture->mInterpolated, &pFixture->mOutput,
+                                          pFixture->mChunkSize);
+            break;
+        case OPERATION_COLLIDE:
+            SphereSimulation::Collide(&pFixture->mState, &pFixture->mCollision, pFixture->mChunkSize,
+                                      &pFixture->mCollisionStats);
+            break;
+        case OPERATION_BVH_BUILD:
+            SphereBvh::Build(&pFixture->mBvh, &pFixture->mState, pFixture->mChunkSize);
+            break;
+        case OPERATION_BVH_REFIT:
+            SphereBvh::Refit(&pFixture->mBvh, &pFixture->mState, pFixture->mChunkSize);
+            break;
+        case OPERATION_BVH_QUERY:
+            SphereBvh::Intersect(&pFixture->mBvh, pFixture->mRays.data(), static_cast<uint32_t>(pFixture->mRays.size()),
+                                 pFixture->mHits.data(), RAYS_PER_JOB);
+            break;
+        case OPERATION_ECS_UPDATE:
+            SphereSystems::Simulate(&pFixture->mWorld, &pFixture->mComponents, SEED, pFixture->mWorldStep++,
+                                    1.0f / 60.0f, &pFixture->mOutput, pFixture->mChunkSize);
+            break;
+        default:
+            break;
+        }
+    }
+
+    struct Result
+    {
+        uint32_t mIterations;
+        double mMin;
+        double mMedian;
+    };
+
+    // Times pFunc in milliseconds, after one untimed run to fault in the pages and warm the caches.
+    Result Measure(void (*pFunc)(void *pUserData), void *pUserData, double minTime)
+    {
+        typedef std::chrono::steady_clock Clock;
+
+        pFunc(pUserData);
+
+        std::vector<double> times;
+        double total = 0.0;
+        while (times.size() < MIN_ITERATIONS || total < minTime * 1000.0)
+        {
+            const Clock::time_point start = Clock::now();
+            pFunc(pUserData);
+            const double time = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            times.push_back(time);
+            total += time;
+        }
+
+        std::sort(times.begin(), times.end());
+        Result result;
+        result.mIterations = static_cast<uint32_t>(times.size());
+        result.mMin = times.front();
+        result.mMedian = times[times.size() / 2];
+        return result;
+    }
+
+    // --verify: VERIFY_STEPS collision steps and updates of VERIFY_COUNT spheres from SEED, dense enough to collide
+    // every step, once per kernel, thread count and chunk size.
+    constexpr uint32_t VERIFY_COUNT = 20000;
+    constexpr uint32_t VERIFY_STEPS = 50;
+    constexpr uint32_t VERIFY_THREAD_COUNTS[] = {1, 4};
+    constexpr uint32_t VERIFY_CHUNK_SIZES[] = {16, 4096};
+
+    // FNV-1a over the bytes.
+    uint64_t Hash(uint64_t hash, const void *pData, size_t size)
+    {
+        const uint8_t *pBytes = static_cast<const uint8_t *>(pData);
+        for (size_t i = 0; i < size; i++)
+        {
+            hash = (hash ^ pBytes[i]) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    // Hash of the spheres and their instance data after the steps, with the current kernel and job system.
+    uint64_t RunReplay(uint32_t chunkSize)
+    {
+        SphereSimulation::SphereState state{};
+        SphereSimulation::AddState(&state, VERIFY_COUNT, SEED);
+        state.mCount = VERIFY_COUNT;
+        SphereSimulation::Spawn(&state, 0, VERIFY_COUNT);
+        SphereSimulation::CollisionState collision{};
+        SphereSimulation::AddCollisionState(&collision, VERIFY_COUNT);
+        std::vector<float> positionScale(4 * VERIFY_COUNT);
+        std::vector<uint32_t> color(VERIFY_COUNT);
+        SphereSimulation::InstanceOutput output{};
+        output.pPositionScale = positionScale.data();
+        output.pColor = color.data();
+
+        for (uint32_t step = 0; step < VERIFY_STEPS; step++)
+        {
+            SphereSimulation::CollisionStats stats{};
+            SphereSimulation::Collide(&state, &collision, chunkSize, &stats);
+            SphereSimulation::Step(&state, 1.0f / 60.0f, &output, chunkSize);
+        }
+
+        const size_t floats = sizeof(float) * VERIFY_COUNT;
+        uint64_t hash = 1469598103934665603ull;
+        hash = Hash(hash, state.pPositionX, floats);
+        hash = Hash(hash, state.pPositionY, floats);
+        hash = Hash(hash, state.pPositionZ, floats);
+        hash = Hash(hash, state.pSpeedX, floats);
+        hash = Hash(hash, state.pSpeedY, floats);
+        hash = Hash(hash, state.pSpeedZ, floats);
+        hash = Hash(hash, state.pSize, floats);
+        hash = Hash(hash, state.pColor, sizeof(uint32_t) * VERIFY_COUNT);
+        hash = Hash(hash, positionScale.data(), sizeof(float) * positionScale.size());
+        hash = Hash(hash, color.data(), sizeof(uint32_t) * color.size());
+
+        SphereSimulation::RemoveCollisionState(&collision);
+        SphereSimulation::RemoveState(&state);
+        return hash;
+    }
+
+    // Replays with every combination and compares the hashes with the first one. Returns false on any difference.
+    bool Verify(const std::vector<SphereSimulation::KernelType> &kernels)
+    {
+        bool identical = true;
+        bool first = true;
+        uint64_t reference = 0;
+        for (uint32_t threadCount : VERIFY_THREAD_COUNTS)
+        {
+            JobSystem::Init(threadCount);
+            for (SphereSimulation::KernelType kernel : kernels)
+            {
+                SphereSimulation::SetKernel(kernel);
+                for (uint32_t chunkSize : VERIFY_CHUNK_SIZES)
+                {
+                    const uint64_t hash = RunReplay(chunkSize);
+                    reference = first ? hash : reference;
+                    first = false;
+                    const bool match = hash == reference;
+                    identical = identical && match;
+                    printf("%-8s %u threads, chunk size %5u: %016llx %s\n",
+                           SphereSimulation::GetKernelName(SphereSimulation::GetKernel()), JobSystem::GetThreadCount(),
+                           chunkSize, static_cast<unsigned long long>(hash), match ? "ok" : "MISMATCH");
+                }
+            }
+            JobSystem::Exit();
+        }
+        printf("%u spheres, %u steps: %s\n", VERIFY_COUNT, VERIFY_STEPS, identical ? "bit-identical" : "DIFFERENT");
+        return identical;
+    }
+
+    std::vector<uint32_t> ParseCounts(const char *pList)
+    {
+        std::vector<uint32_t> counts;
+        const char *p = pList;
+        while (*p)
+        {
+            char *pEnd = nullptr;
+            const unsigned long count = strtoul(p, &pEnd, 10);
+            if (pEnd == p)
+            {
+                break;
+            }
+            if (count > 0)
+            {
+                counts.push_back(static_cast<uint32_t>(count));
+            }
+            p = *pEnd == ',' ? pEnd + 1 : pEnd;
+        }
+        return counts;
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    BenchmarkSettings settings;
+    settings.mCounts = {1000, 10000, 100000, 1000000};
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+
+        if (arg == "--counts" && i + 1 < argc)
+        {
+            settings.mCounts = ParseCounts(argv[++i]);
+        }
+
+        if (arg == "--threads" && i + 1 < argc)
+        {
+            settings.mThreadCounts = ParseCounts(argv[++i]);
+            if (settings.mThreadCounts.empty())
+            {
+                settings.mThreadCounts.push_back(0);
+            }
+        }
+
+        if (arg == "--chunk-size" && i + 1 < argc)
+        {
+            settings.mChunkSize = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        }
+
+        if (arg == "--rays" && i + 1 < argc)
+        {
+            settings.mRayCount = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        }
+
+        if (arg == "--min-time" && i + 1 < argc)
+        {
+            settings.mMinTime = strtod(argv[++i], nullptr);
+        }
+
+        if (arg == "--csv")
+        {
+            settings.mCsv = true;
+        }
+
+        if (arg == "--verify")
+        {
+            settings.mVerify = true;
+        }
+
+        if (arg == "--kernel" && i + 1 < argc)
+        {
+            std::string kernel(argv[++i]);
+            settings.mKernelGiven = true;
+            settings.mAosBaseline = kernel == "aos";
+            if (kernel == "scalar")
+            {
+                settings.mKernel = SphereSimulation::KernelType::Scalar;
+            }
+            else if (kernel == "sse")
+            {
+                settings.mKernel = SphereSimulation::KernelType::SSE;
+            }
+            else if (kernel == "avx2")
+            {
+                settings.mKernel = SphereSimulation::KernelType::AVX2;
+            }
+            else if (!settings.mAosBaseline)
+            {
+                fprintf(stderr, "Unknown kernel %s\n", kernel.c_str());
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    std::vector<SphereSimulation::KernelType> kernels;
+    if (settings.mKernelGiven)
+    {
+        if (!settings.mAosBaseline)
+        {
+            kernels.push_back(settings.mKernel);
+        }
+    }
+    else
+    {
+        for (int kernel = 0; kernel <= static_cast<int>(SphereSimulation::DetectKernel()); kernel++)
+        {
+            kernels.push_back(static_cast<SphereSimulation::KernelType>(kernel));
+        }
+    }
+
+    if (settings.mVerify)
+    {
+        if (kernels.empty())
+        {
+            fprintf(stderr, "The aos kernel has no replay to verify\n");
+            return EXIT_FAILURE;
+        }
+        return Verify(kernels) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (settings.mCsv)
+    {
+        printf("kernel,threads,count,operation,iterations,min_ms,median_ms,ns_per_sphere,broadphase_ms,narrowphase_ms,"
+               "pair_tests,contacts,grid_resolution\n");
+    }
+
+    for (uint32_t threadCount : settings.mThreadCounts)
+    {
+        JobSystem::Init(threadCount);
+        if (!settings.mCsv)
+        {
+            printf("%u threads, chunk size %u, %u rays per bvh-query\n\n", JobSystem::GetThreadCount(),
+                   settings.mChunkSize, settings.mRayCount);
+            printf("%-8s %9s %-11s %6s %11s %11s %10s\n", "kernel", "count", "op", "iters", "min ms", "median ms",
+                   "ns/sphere");
+        }
+
+        // Single-threaded, so only timed with the first thread count.
+        if (settings.mAosBaseline && threadCount == settings.mThreadCounts.front())
+        {
+            for (uint32_t count : settings.mCounts)
+            {
+                AosFixture fixture;
+                AddAosFixture(&fixture, count);
+                const Result result = Measure(
+                    [](void *pUserData) { RunAos(static_cast<AosFixture *>(pUserData), 1.0f / 60.0f); }, &fixture,
+                    settings.mMinTime);
+                const double nsPerSphere = result.mMedian * 1.0e6 / count;
+                if (settings.mCsv)
+                {
+                    printf("aos,1,%u,update,%u,%.4f,%.4f,%.3f,0.0000,0.0000,0,0,0\n", count, result.mIterations,
+                           result.mMin, result.mMedian, nsPerSphere);
+                }
+                else
+                {
+                    printf("%-8s %9u %-11s %6u %11.4f %11.4f %10.3f\n", "aos", count, "update", result.mIterations,
+                           result.mMin, result.mMedian, nsPerSphere);
+                }
+                fflush(stdout);
+            }
+        }
+
+        for (SphereSimulation::KernelType kernel : kernels)
+        {
+            SphereSimulation::SetKernel(kernel);
+            // SetKernel falls back to what the CPU supports.
+            const char *pKernelName = SphereSimulation::GetKernelName(SphereSimulation::GetKernel());
+
+            for (uint32_t count : settings.mCounts)
+            {
+                Fixture fixture{};
+                AddFixture(&fixture, count, settings.mRayCount, settings.mChunkSize);
+
+                for (uint32_t operation = 0; operation < OPERATION_COUNT; operation++)
+                {
+                    struct Measured
+                    {
+                        Fixture *pFixture;
+                        Operation mOperation;
+                    } measured = {&fixture, static_cast<Operation>(operation)};
+                    const Result result = Measure(
+                        [](void *pUserData)
+                        {
+                            const Measured *pMeasured = static_cast<const Measured *>(pUserData);
+                            Run(pMeasured->pFixture, pMeasured->mOperation);
+                        },
+                        &measured, settings.mMinTime);
+                    const double nsPerSphere = result.mMedian * 1.0e6 / count;
+                    const char *pOperationName = GetOperationName(static_cast<Operation>(operation));
+                    // Zero for everything but collide.
+                    const SphereSimulation::CollisionStats stats =
+                        operation == OPERATION_COLLIDE ? fixture.mCollisionStats : SphereSimulation::CollisionStats{};
+                    if (settings.mCsv)
+                    {
+                        printf("%s,%u,%u,%s,%u,%.4f,%.4f,%.3f,%.4f,%.4f,%llu,%llu,%u\n", pKernelName,
+                               JobSystem::GetThreadCount(), count, pOperationName, result.mIterations, result.mMin,
+                               result.mMedian, nsPerSphere, stats.mBroadphaseTime, stats.mNarrowphaseTime,
+                               static_cast<unsigned long long>(stats.mPairTests),
+                               static_cast<unsigned long long>(stats.mContacts), stats.mGridResolution);
+                    }
+                    else
+                    {
+                        printf("%-8s %9u %-11s %6u %11.4f %11.4f %10.3f\n", pKernelName, count, pOperationName,
+                               result.mIterations, result.mMin, result.mMedian, nsPerSphere);
+                        if (operation == OPERATION_COLLIDE)
+                        {
+                            printf("%-8s %9s   grid %u^3 %.4f ms, narrowphase %.4f ms, %llu pair tests, "
+                                   "%llu contacts\n",
+                                   "", "", stats.mGridResolution, stats.mBroadphaseTime, stats.mNarrowphaseTime,
+                                   static_cast<unsigned long long>(stats.mPairTests),
+                                   static_cast<unsigned long long>(stats.mContacts));
+                        }
+                        if (operation == OPERATION_BVH_QUERY)
+                        {
+                            uint32_t hitCount = 0;
+                            for (const SphereBvh::RayHit &hit : fixture.mHits)
+                            {
+                                hitCount += hit.mSphere != SphereBvh::INVALID_INDEX ? 1 : 0;
+                            }
+                            printf("%-8s %9s   %.2f Mrays/s, %u of %u rays hit\n", "", "",
+                                   fixture.mRays.size() / (result.mMedian * 1000.0), hitCount,
+                                   static_cast<uint32_t>(fixture.mRays.size()));
+                        }
+                    }
+                    fflush(stdout);
+                }
+
+                RemoveFixture(&fixture);
+            }
+        }
+
+        JobSystem::Exit();
+        if (!settings.mCsv)
+        {
+            printf("\n");
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
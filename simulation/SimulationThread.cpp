@@ -0,0 +1,192 @@
+#include "SimulationThread.h"
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "JobSystem.h"
+#include "SphereSystems.h"
+
+namespace SimulationThread
+{
+    namespace
+    {
+        typedef std::chrono::steady_clock Clock;
+
+        constexpr uint32_t SNAPSHOT_COUNT = 3;
+        constexpr uint32_t SNAPSHOT_INDEX_MASK = 3;
+        // Set in gLatest until the reader has taken the snapshot it names.
+        constexpr uint32_t SNAPSHOT_FRESH = 4;
+        // A simulation further behind than this drops the missed steps instead of running them back to back.
+        constexpr uint32_t MAX_CATCH_UP_STEPS = 4;
+
+        // The spheres are the one archetype of gWorld. gState views its columns and carries the seed and step. Collide
+        // and the snapshot counts only see gState, so no other archetype may hold spheres.
+        EntityStorage::World gWorld{};
+        SphereSystems::SphereComponents gComponents{};
+        uint32_t gArchetype = 0;
+        SphereSimulation::SphereState gState{};
+        SphereSimulation::CollisionState gCollision{};
+        SphereSimulation::Snapshot gSnapshots[SNAPSHOT_COUNT];
+        // Wall clock time the current step of each snapshot was due.
+        Clock::time_point gSnapshotTime[SNAPSHOT_COUNT];
+        // Newest published snapshot. The writer and the reader each own one of the other two and swap theirs in here,
+        // so neither ever waits on the other.
+        std::atomic<uint32_t> gLatest(0);
+        uint32_t gWriteIndex = 1;
+        uint32_t gReadIndex = 2;
+
+        float gTickTime = DEFAULT_TICK_TIME;
+        uint32_t gStepLimit = 0;
+        std::atomic<uint32_t> gSphereCount(0);
+        std::atomic<uint32_t> gChunkSize(SphereSimulation::DEFAULT_CHUNK_SIZE);
+        std::atomic<bool> gCollisions(true);
+
+        std::thread gThread;
+        std::mutex gStopMutex;
+        std::condition_variable gStopCondition;
+        bool gStopRequested = false;
+
+        void Publish(Clock::time_point due)
+        {
+            SphereSimulation::Snapshot &snapshot = gSnapshots[gWriteIndex];
+            snapshot.mCount = gState.mCount;
+            snapshot.mStep = gState.mStep;
+            gSnapshotTime[gWriteIndex] = due;
+            const uint32_t previous = gLatest.exchange(gWriteIndex | SNAPSHOT_FRESH, std::memory_order_acq_rel);
+            gWriteIndex = previous & SNAPSHOT_INDEX_MASK;
+        }
+
+        void ThreadMain(Clock::time_point start)
+        {
+            // The render thread runs its own ParallelFor calls on queue 0 meanwhile.
+            JobSystem::AttachThread();
+            const Clock::duration tick =
+                std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(gTickTime));
+            Clock::time_point due = start;
+            while (gStepLimit == 0 || gState.mStep < gStepLimit)
+            {
+                due += tick;
+                {
+                    std::unique_lock<std::mutex> lock(gStopMutex);
+                    if (gStopCondition.wait_until(lock, due, [] { return gStopRequested; }))
+                    {
+                        break;
+                    }
+                }
+
+                // Spheres beyond the old count are spawned afresh. The archetype was sized for the capacity, so its
+                // columns never move.
+                uint32_t count = gSphereCount.load(std::memory_order_relaxed);
+                count = count < gState.mCapacity ? count : gState.mCapacity;
+                assert(SphereSystems::GetSphereArchetype(&gWorld, &gComponents) == gArchetype);
+                SphereSystems::Resize(&gWorld, &gComponents, gArchetype, count, gState.mSeed);
+                gState.mCount = gWorld.mArchetypes[gArchetype].mCount;
+
+                const uint32_t chunkSize = gChunkSize.load(std::memory_order_relaxed);
+                SphereSimulation::Snapshot &snapshot = gSnapshots[gWriteIndex];
+                SphereSimulation::BeginSnapshot(&gState, &snapshot);
+                snapshot.mCollisions = {};
+                if (gCollisions.load(std::memory_order_relaxed))
+                {
+                    SphereSimulation::Collide(&gState, &gCollision, chunkSize, &snapshot.mCollisions);
+                }
+                SphereSystems::Simulate(&gWorld, &gComponents, gState.mSeed, gState.mStep, gTickTime,
+                                        &snapshot.mCurrent, chunkSize);
+                gState.mStep++;
+                Publish(due);
+
+                if (Clock::now() - due > tick * MAX_CATCH_UP_STEPS)
+                {
+                    due = Clock::now();
+                }
+            }
+            JobSystem::DetachThread();
+        }
+    } // namespace
+} // namespace SimulationThread
+
+void SimulationThread::Start(const ThreadDesc *pDesc)
+{
+    EntityStorage::AddWorld(&gWorld);
+    SphereSystems::AddSphereComponents(&gWorld, &gComponents);
+    gArchetype = EntityStorage::AddArchetype(&gWorld, gComponents.mMask, pDesc->mCapacity);
+    const uint32_t count = pDesc->mCount < pDesc->mCapacity ? pDesc->mCount : pDesc->mCapacity;
+    SphereSystems::Resize(&gWorld, &gComponents, gArchetype, count, pDesc->mSeed);
+    gState = {};
+    SphereSystems::GetSphereState(&gWorld, &gComponents, gArchetype, &gState);
+    gState.mSeed = pDesc->mSeed;
+    SphereSimulation::AddCollisionState(&gCollision, gState.mCapacity);
+    for (uint32_t i = 0; i < SNAPSHOT_COUNT; i++)
+    {
+        SphereSimulation::AddSnapshot(&gSnapshots[i], gState.mCapacity);
+    }
+
+    gTickTime = pDesc->mTickTime > 0.0f ? pDesc->mTickTime : DEFAULT_TICK_TIME;
+    gStepLimit = pDesc->mStepLimit;
+    gSphereCount = pDesc->mCount;
+    gChunkSize = pDesc->mChunkSize;
+    gCollisions = pDesc->mCollisions;
+    gStopRequested = false;
+
+    // The spawn is published as a step that has not moved, so there is always something to draw.
+    gWriteIndex = 0;
+    gReadIndex = 2;
+    SphereSimulation::Snapshot &snapshot = gSnapshots[gWriteIndex];
+    SphereSimulation::BeginSnapshot(&gState, &snapshot);
+    SphereSystems::PackInstances(&gWorld, &gComponents, &snapshot.mCurrent, pDesc->mChunkSize);
+    gLatest = 1;
+    const Clock::time_point start = Clock::now();
+    Publish(start);
+
+    gThread = std::thread(ThreadMain, start);
+}
+
+void SimulationThread::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(gStopMutex);
+        gStopRequested = true;
+    }
+    gStopCondition.notify_all();
+
+    if (gThread.joinable())
+    {
+        gThread.join();
+    }
+}
+
+void SimulationThread::Exit()
+{
+    Stop();
+    for (uint32_t i = 0; i < SNAPSHOT_COUNT; i++)
+    {
+        SphereSimulation::RemoveSnapshot(&gSnapshots[i]);
+    }
+    SphereSimulation::RemoveCollisionState(&gCollision);
+    EntityStorage::RemoveWorld(&gWorld);
+    gState = {};
+}
+
+void SimulationThread::SetSphereCount(uint32_t count) { gSphereCount.store(count, std::memory_order_relaxed); }
+
+void SimulationThread::SetChunkSize(uint32_t chunkSize) { gChunkSize.store(chunkSize, std::memory_order_relaxed); }
+
+void SimulationThread::SetCollisions(bool collisions) { gCollisions.store(collisions, std::memory_order_relaxed); }
+
+const SphereSimulation::Snapshot *SimulationThread::AcquireSnapshot(float *pAlpha)
+{
+    if (gLatest.load(std::memory_order_relaxed) & SNAPSHOT_FRESH)
+    {
+        gReadIndex = gLatest.exchange(gReadIndex, std::memory_order_acq_rel) & SNAPSHOT_INDEX_MASK;
+    }
+
+    const float elapsed = std::chrono::duration<float>(Clock::now() - gSnapshotTime[gReadIndex]).count();
+    const float alpha = elapsed / gTickTime;
+    *pAlpha = alpha < 0.0f ? 0.0f : (alpha > 1.0f ? 1.0f : alpha);
+    return &gSnapshots[gReadIndex];
+}
+
+const SphereSimulation::SphereState *SimulationThread::GetState() { return &gState; }
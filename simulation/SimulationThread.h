@@ -0,0 +1,49 @@
+#ifndef SIMULATION_THREAD_H
+#define SIMULATION_THREAD_H
+
+#include <cstdint>
+#include "SphereSimulation.h"
+
+namespace SimulationThread
+{
+    // Tick length used when the scene does not ask for one, in seconds.
+    constexpr float DEFAULT_TICK_TIME = 1.0f / 60.0f;
+
+    struct ThreadDesc
+    {
+        uint32_t mCapacity = 0;
+        uint32_t mCount = 0;
+        uint64_t mSeed = 0;
+        // Simulated seconds per step. Steps are due every mTickTime of wall clock time, whatever the frame rate.
+        float mTickTime = DEFAULT_TICK_TIME;
+        uint32_t mChunkSize = SphereSimulation::DEFAULT_CHUNK_SIZE;
+        // Stop stepping after this many steps, 0 to run until Stop.
+        uint32_t mStepLimit = 0;
+        // Collide the spheres before every step.
+        bool mCollisions = true;
+    };
+
+    // Spawns mCount spheres as entities of one archetype with room for mCapacity, and starts stepping them on a thread
+    // of their own. Every step is published as a snapshot through a lock-free triple buffer; the steps themselves are
+    // split across the job system.
+    void Start(const ThreadDesc *pDesc);
+    // Joins the thread. The state stays readable until Exit.
+    void Stop();
+    void Exit();
+
+    // Picked up at the start of the next step. Raising the count spawns new spheres, lowering it destroys the last
+    // ones.
+    void SetSphereCount(uint32_t count);
+    void SetChunkSize(uint32_t chunkSize);
+    void SetCollisions(bool collisions);
+
+    // Latest published step, never waits. The snapshot stays valid and unchanged until the next call, which is
+    // only ever made from one thread. *pAlpha receives how far the wall clock has moved from the snapshot's previous
+    // step to its current one, clamped to [0, 1], so drawing the blend shows the spheres one tick in the past.
+    const SphereSimulation::Snapshot *AcquireSnapshot(float *pAlpha);
+
+    // The simulation's own spheres, viewing the columns of their archetype. Only safe to read once Stop has returned.
+    const SphereSimulation::SphereState *GetState();
+} // namespace SimulationThread
+
+#endif // SIMULATION_THREAD_H
@@ -0,0 +1,562 @@
+#include "SphereBvh.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include "JobSystem.h"
+
+namespace SphereBvh
+{
+    namespace
+    {
+        // Bits per axis of the Morton codes, which quantize the bounds into a 1024^3 grid.
+        constexpr uint32_t MORTON_BITS = 10;
+        constexpr uint32_t RADIX_BITS = 10;
+        constexpr uint32_t RADIX_BUCKETS = 1 << RADIX_BITS;
+        // Nodes per partial sum of the surface area. Fixed, so the total does not depend on the chunk size.
+        constexpr uint32_t AREA_BLOCK_SIZE = 4096;
+        // Keys are 62 bits long at most, and the tree is never deeper than one level per bit.
+        constexpr uint32_t STACK_SIZE = 64;
+
+        template <typename T>
+        T *AllocateArray(uint32_t count)
+        {
+            void *pMemory = nullptr;
+#if defined(_MSC_VER)
+            pMemory = _aligned_malloc(count * sizeof(T), SphereSimulation::SIMD_ALIGNMENT);
+#else
+            if (posix_memalign(&pMemory, SphereSimulation::SIMD_ALIGNMENT, count * sizeof(T)) != 0)
+            {
+                pMemory = nullptr;
+            }
+#endif
+            if (pMemory)
+            {
+                memset(pMemory, 0, count * sizeof(T));
+            }
+            return static_cast<T *>(pMemory);
+        }
+
+        void FreeArray(void *pArray)
+        {
+#if defined(_MSC_VER)
+            _aligned_free(pArray);
+#else
+            std::free(pArray);
+#endif
+        }
+
+        uint32_t RoundChunkSize(uint32_t chunkSize)
+        {
+            const uint32_t alignment = SphereSimulation::CHUNK_ALIGNMENT;
+            chunkSize = (chunkSize + alignment - 1) / alignment * alignment;
+            return chunkSize == 0 ? alignment : chunkSize;
+        }
+
+        // Spreads the low 10 bits of v two bits apart.
+        uint32_t ExpandBits(uint32_t v)
+        {
+            v = (v * 0x00010001u) & 0xFF0000FFu;
+            v = (v * 0x00000101u) & 0x0F00F00Fu;
+            v = (v * 0x00000011u) & 0xC30C30C3u;
+            v = (v * 0x00000005u) & 0x49249249u;
+            return v;
+        }
+
+        uint32_t Quantize(float position)
+        {
+            const float scale = static_cast<float>(1 << MORTON_BITS) / (2.0f * SphereSimulation::BOUNDS);
+            const float cell = (position + SphereSimulation::BOUNDS) * scale;
+            if (!(cell > 0.0f))
+            {
+                return 0;
+            }
+            const uint32_t maxCell = (1 << MORTON_BITS) - 1;
+            return cell < static_cast<float>(maxCell) ? static_cast<uint32_t>(cell) : maxCell;
+        }
+
+        uint32_t GetMortonCode(float x, float y, float z)
+        {
+            return (ExpandBits(Quantize(x)) << 2) | (ExpandBits(Quantize(y)) << 1) | ExpandBits(Quantize(z));
+        }
+
+        uint32_t CountLeadingZeros(uint64_t v)
+        {
+            uint32_t count = 0;
+            for (uint32_t shift = 32; shift > 0; shift >>= 1)
+            {
+                if ((v >> (64 - shift)) == 0)
+                {
+                    count += shift;
+                    v <<= shift;
+                }
+            }
+            return count + (v == 0 ? 1 : 0);
+        }
+
+        // Length of the prefix keys i and j share, -1 if j is out of range. The sphere index in the low bits keeps
+        // every key unique, so spheres in the same Morton cell still split cleanly.
+        int32_t GetCommonPrefix(const uint64_t *pKeys, uint32_t count, int64_t i, int64_t j)
+        {
+            if (j < 0 || j >= static_cast<int64_t>(count))
+            {
+                return -1;
+            }
+            return static_cast<int32_t>(CountLeadingZeros(pKeys[i] ^ pKeys[j]));
+        }
+
+        // Children of node i in a binary radix tree over the sorted keys, after Karras, "Maximizing Parallelism in
+        // the Construction of BVHs, Octrees, and k-d Trees", 2012.
+        void BuildNode(Bvh *pBvh, uint32_t nodeIndex)
+        {
+            const uint64_t *pKeys = pBvh->pKeys;
+            const uint32_t count = pBvh->mCount;
+            const int64_t i = nodeIndex;
+
+            // Direction the node's range extends in from i, and the prefix the key on the other side shares.
+            const int64_t d =
+                GetCommonPrefix(pKeys, count, i, i + 1) > GetCommonPrefix(pKeys, count, i, i - 1) ? 1 : -1;
+            const int32_t minPrefix = GetCommonPrefix(pKeys, count, i, i - d);
+
+            int64_t maxLength = 2;
+            while (GetCommonPrefix(pKeys, count, i, i + maxLength * d) > minPrefix)
+            {
+                maxLength *= 2;
+            }
+            int64_t length = 0;
+            for (int64_t t = maxLength / 2; t >= 1; t /= 2)
+            {
+                if (GetCommonPrefix(pKeys, count, i, i + (length + t) * d) > minPrefix)
+                {
+                    length += t;
+                }
+            }
+            const int64_t j = i + length * d;
+
+            // Split where the keys stop sharing the range's prefix.
+            const int32_t nodePrefix = GetCommonPrefix(pKeys, count, i, j);
+            int64_t split = 0;
+            int64_t t = length;
+            do
+            {
+                t = (t + 1) >> 1;
+                if (GetCommonPrefix(pKeys, count, i, i + (split + t) * d) > nodePrefix)
+                {
+                    split += t;
+                }
+            } while (t > 1);
+            const int64_t gamma = i + split * d + (d < 0 ? -1 : 0);
+
+            const int64_t first = i < j ? i : j;
+            const int64_t last = i < j ? j : i;
+            Node &node = pBvh->pNodes[nodeIndex];
+            if (first == gamma)
+            {
+                node.mLeft = static_cast<uint32_t>(gamma) | LEAF_FLAG;
+                pBvh->pLeafParent[gamma] = nodeIndex;
+            }
+            else
+            {
+                node.mLeft = static_cast<uint32_t>(gamma);
+                pBvh->pNodeParent[gamma] = nodeIndex;
+            }
+            if (last == gamma + 1)
+            {
+                node.mRight = static_cast<uint32_t>(gamma + 1) | LEAF_FLAG;
+                pBvh->pLeafParent[gamma + 1] = nodeIndex;
+            }
+            else
+            {
+                node.mRight = static_cast<uint32_t>(gamma + 1);
+                pBvh->pNodeParent[gamma + 1] = nodeIndex;
+            }
+        }
+
+        void GetChildBounds(const Bvh *pBvh, uint32_t child, float *pMin, float *pMax)
+        {
+            if (child & LEAF_FLAG)
+            {
+                const uint32_t leaf = child & ~LEAF_FLAG;
+                const float radius = pBvh->pLeafRadius[leaf];
+                pMin[0] = pBvh->pLeafX[leaf] - radius;
+                pMin[1] = pBvh->pLeafY[leaf] - radius;
+                pMin[2] = pBvh->pLeafZ[leaf] - radius;
+                pMax[0] = pBvh->pLeafX[leaf] + radius;
+                pMax[1] = pBvh->pLeafY[leaf] + radius;
+                pMax[2] = pBvh->pLeafZ[leaf] + radius;
+            }
+            else
+            {
+                const Node &node = pBvh->pNodes[child];
+                memcpy(pMin, node.mMin, sizeof(node.mMin));
+                memcpy(pMax, node.mMax, sizeof(node.mMax));
+            }
+        }
+
+        // Moves the leaves to the spheres' current positions and walks up from each. The first child to reach a
+        // node stops there, the second one computes the node from both and carries on, so every node is written
+        // once, after both of its children, without locks. min and max are exact, so the bounds do not depend on
+        // which thread gets there second.
+        void RefitLeaves(Bvh *pBvh, const SphereSimulation::SphereState *pState, uint32_t chunkSize)
+        {
+            struct RefitJob
+            {
+                Bvh *pBvh;
+                const SphereSimulation::SphereState *pState;
+            } job = {pBvh, pState};
+
+            JobSystem::ParallelFor(
+                pBvh->mCount, chunkSize,
+                [](void *pUserData, uint32_t begin, uint32_t end)
+                {
+                    const RefitJob *pJob = static_cast<const RefitJob *>(pUserData);
+                    Bvh *pBvh = pJob->pBvh;
+                    for (uint32_t leaf = begin; leaf < end; leaf++)
+                    {
+                        const uint32_t sphere = pBvh->pSphere[leaf];
+                        pBvh->pLeafX[leaf] = pJob->pState->pPositionX[sphere];
+                        pBvh->pLeafY[leaf] = pJob->pState->pPositionY[sphere];
+                        pBvh->pLeafZ[leaf] = pJob->pState->pPositionZ[sphere];
+                        pBvh->pLeafRadius[leaf] = pJob->pState->pSize[sphere];
+
+                        uint32_t nodeIndex = pBvh->pLeafParent[leaf];
+                        while (nodeIndex != INVALID_INDEX)
+                        {
+                            if (pBvh->pVisits[nodeIndex].fetch_add(1, std::memory_order_acq_rel) == 0)
+                            {
+                                break;
+                            }
+                            // Ready for the next refit, which the job system orders after this one.
+                            pBvh->pVisits[nodeIndex].store(0, std::memory_order_relaxed);
+
+                            Node &node = pBvh->pNodes[nodeIndex];
+                            float leftMin[3], leftMax[3], rightMin[3], rightMax[3];
+                            GetChildBounds(pBvh, node.mLeft, leftMin, leftMax);
+                            GetChildBounds(pBvh, node.mRight, rightMin, rightMax);
+                            for (uint32_t axis = 0; axis < 3; axis++)
+                            {
+                                node.mMin[axis] = leftMin[axis] < rightMin[axis] ? leftMin[axis] : rightMin[axis];
+                                node.mMax[axis] = leftMax[axis] > rightMax[axis] ? leftMax[axis] : rightMax[axis];
+                            }
+                            nodeIndex = pBvh->pNodeParent[nodeIndex];
+                        }
+                    }
+                },
+                &job);
+
+            // Summed per block, then the blocks in order, so the total is the same for any thread count.
+            const uint32_t nodeCount = pBvh->mCount > 0 ? pBvh->mCount - 1 : 0;
+            JobSystem::ParallelFor(
+                nodeCount, AREA_BLOCK_SIZE,
+                [](void *pUserData, uint32_t begin, uint32_t end)
+                {
+                    Bvh *pBvh = static_cast<const RefitJob *>(pUserData)->pBvh;
+                    for (uint32_t blockBegin = begin; blockBegin < end; blockBegin += AREA_BLOCK_SIZE)
+                    {
+                        const uint32_t blockEnd =
+                            blockBegin + AREA_BLOCK_SIZE < end ? blockBegin + AREA_BLOCK_SIZE : end;
+                        double area = 0.0;
+                        for (uint32_t nodeIndex = blockBegin; nodeIndex < blockEnd; nodeIndex++)
+                        {
+                            const Node &node = pBvh->pNodes[nodeIndex];
+                            const double dx = node.mMax[0] - node.mMin[0];
+                            const double dy = node.mMax[1] - node.mMin[1];
+                            const double dz = node.mMax[2] - node.mMin[2];
+                            area += 2.0 * (dx * dy + dy * dz + dz * dx);
+                        }
+                        pBvh->pBlockArea[blockBegin / AREA_BLOCK_SIZE] = area;
+                    }
+                },
+                &job);
+
+            pBvh->mArea = 0.0;
+            for (uint32_t block = 0; block < (nodeCount + AREA_BLOCK_SIZE - 1) / AREA_BLOCK_SIZE; block++)
+            {
+                pBvh->mArea += pBvh->pBlockArea[block];
+            }
+        }
+
+        // Slab test. Returns whether the ray enters the box before maxDistance, and where in *pNear.
+        bool IntersectBox(const float *pMin, const float *pMax, const Ray &ray, const float *pInverseDirection,
+                          float maxDistance, float *pNear)
+        {
+            float near = 0.0f;
+            float far = maxDistance;
+            for (uint32_t axis = 0; axis < 3; axis++)
+            {
+                float t0 = (pMin[axis] - ray.mOrigin[axis]) * pInverseDirection[axis];
+                float t1 = (pMax[axis] - ray.mOrigin[axis]) * pInverseDirection[axis];
+                if (t0 > t1)
+                {
+                    const float t = t0;
+                    t0 = t1;
+                    t1 = t;
+                }
+                near = t0 > near ? t0 : near;
+                far = t1 < far ? t1 : far;
+            }
+            *pNear = near;
+            return near <= far;
+        }
+
+        void IntersectLeaf(const Bvh *pBvh, uint32_t leaf, const Ray &ray, RayHit *pHit)
+        {
+            const float ox = ray.mOrigin[0] - pBvh->pLeafX[leaf];
+            const float oy = ray.mOrigin[1] - pBvh->pLeafY[leaf];
+            const float oz = ray.mOrigin[2] - pBvh->pLeafZ[leaf];
+            const float radius = pBvh->pLeafRadius[leaf];
+            const float b = ox * ray.mDirection[0] + oy * ray.mDirection[1] + oz * ray.mDirection[2];
+            const float c = ox * ox + oy * oy + oz * oz - radius * radius;
+            // Outside the sphere and facing away from it.
+            if (c > 0.0f && b > 0.0f)
+            {
+                return;
+            }
+            const float discriminant = b * b - c;
+            if (discriminant < 0.0f)
+            {
+                return;
+            }
+            // A ray starting inside the sphere hits it right away.
+            float distance = -b - sqrtf(discriminant);
+            distance = distance > 0.0f ? distance : 0.0f;
+            if (distance < pHit->mDistance)
+            {
+                pHit->mSphere = pBvh->pSphere[leaf];
+                pHit->mDistance = distance;
+            }
+        }
+
+        RayHit TraceRay(const Bvh *pBvh, const Ray &ray)
+        {
+            RayHit hit = {INVALID_INDEX, ray.mMaxDistance};
+            if (pBvh->mCount == 0)
+            {
+                return hit;
+            }
+
+            float inverseDirection[3];
+            for (uint32_t axis = 0; axis < 3; axis++)
+            {
+                inverseDirection[axis] = 1.0f / ray.mDirection[axis];
+            }
+
+            uint32_t stack[STACK_SIZE];
+            uint32_t stackSize = 0;
+            uint32_t current = pBvh->mCount == 1 ? LEAF_FLAG : 0;
+            while (true)
+            {
+                if (current & LEAF_FLAG)
+                {
+                    IntersectLeaf(pBvh, current & ~LEAF_FLAG, ray, &hit);
+                }
+                else
+                {
+                    // Nearer child first, the other one waits on the stack in case nothing closer turns up.
+                    const Node &node = pBvh->pNodes[current];
+                    float childMin[3], childMax[3];
+                    float leftNear = 0.0f;
+                    float rightNear = 0.0f;
+                    GetChildBounds(pBvh, node.mLeft, childMin, childMax);
+                    const bool left = IntersectBox(childMin, childMax, ray, inverseDirection, hit.mDistance, &leftNear);
+                    GetChildBounds(pBvh, node.mRight, childMin, childMax);
+                    const bool right =
+                        IntersectBox(childMin, childMax, ray, inverseDirection, hit.mDistance, &rightNear);
+
+                    if (left && right)
+                    {
+                        const bool leftFirst = leftNear <= rightNear;
+                        stack[stackSize++] = leftFirst ? node.mRight : node.mLeft;
+                        current = leftFirst ? node.mLeft : node.mRight;
+                        continue;
+                    }
+                    if (left || right)
+                    {
+                        current = left ? node.mLeft : node.mRight;
+                        continue;
+                    }
+                }
+
+                if (stackSize == 0)
+                {
+                    break;
+                }
+                current = stack[--stackSize];
+            }
+            return hit;
+        }
+    } // namespace
+} // namespace SphereBvh
+
+void SphereBvh::AddBvh(Bvh *pBvh, uint32_t capacity)
+{
+    const uint32_t nodeCapacity = capacity > 1 ? capacity - 1 : 1;
+
+    *pBvh = {};
+    pBvh->mCapacity = capacity;
+    pBvh->pNodes = AllocateArray<Node>(nodeCapacity);
+    pBvh->pNodeParent = AllocateArray<uint32_t>(nodeCapacity);
+    pBvh->pLeafParent = AllocateArray<uint32_t>(capacity);
+    pBvh->pVisits = new std::atomic<uint32_t>[nodeCapacity];
+    for (uint32_t i = 0; i < nodeCapacity; i++)
+    {
+        pBvh->pVisits[i].store(0, std::memory_order_relaxed);
+    }
+    pBvh->pKeys = AllocateArray<uint64_t>(capacity);
+    pBvh->pKeysScratch = AllocateArray<uint64_t>(capacity);
+    pBvh->pSphere = AllocateArray<uint32_t>(capacity);
+    pBvh->pLeafX = AllocateArray<float>(capacity);
+    pBvh->pLeafY = AllocateArray<float>(capacity);
+    pBvh->pLeafZ = AllocateArray<float>(capacity);
+    pBvh->pLeafRadius = AllocateArray<float>(capacity);
+    pBvh->pBlockArea = AllocateArray<double>((nodeCapacity + AREA_BLOCK_SIZE - 1) / AREA_BLOCK_SIZE);
+}
+
+void SphereBvh::RemoveBvh(Bvh *pBvh)
+{
+    FreeArray(pBvh->pNodes);
+    FreeArray(pBvh->pNodeParent);
+    FreeArray(pBvh->pLeafParent);
+    delete[] pBvh->pVisits;
+    FreeArray(pBvh->pKeys);
+    FreeArray(pBvh->pKeysScratch);
+    FreeArray(pBvh->pSphere);
+    FreeArray(pBvh->pLeafX);
+    FreeArray(pBvh->pLeafY);
+    FreeArray(pBvh->pLeafZ);
+    FreeArray(pBvh->pLeafRadius);
+    FreeArray(pBvh->pBlockArea);
+    *pBvh = {};
+}
+
+void SphereBvh::Build(Bvh *pBvh, const SphereSimulation::SphereState *pState, uint32_t chunkSize)
+{
+    chunkSize = RoundChunkSize(chunkSize);
+    pBvh->mCount = pState->mCount < pBvh->mCapacity ? pState->mCount : pBvh->mCapacity;
+
+    struct BuildJob
+    {
+        Bvh *pBvh;
+        const SphereSimulation::SphereState *pState;
+    } job = {pBvh, pState};
+
+    JobSystem::ParallelFor(
+        pBvh->mCount, chunkSize,
+        [](void *pUserData, uint32_t begin, uint32_t end)
+        {
+            const BuildJob *pJob = static_cast<const BuildJob *>(pUserData);
+            const SphereSimulation::SphereState *pState = pJob->pState;
+            for (uint32_t i = begin; i < end; i++)
+            {
+                const uint32_t code =
+                    GetMortonCode(pState->pPositionX[i], pState->pPositionY[i], pState->pPositionZ[i]);
+                pJob->pBvh->pKeys[i] = static_cast<uint64_t>(code) << 32 | i;
+            }
+        },
+        &job);
+
+    // LSD radix sort on the code alone. It is stable and the keys start out in index order, so the index bits come
+    // out sorted too.
+    for (uint32_t shift = 32; shift < 32 + 3 * MORTON_BITS; shift += RADIX_BITS)
+    {
+        uint32_t offsets[RADIX_BUCKETS] = {};
+        for (uint32_t i = 0; i < pBvh->mCount; i++)
+        {
+            offsets[(pBvh->pKeys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+        }
+        uint32_t first = 0;
+        for (uint32_t bucket = 0; bucket < RADIX_BUCKETS; bucket++)
+        {
+            const uint32_t count = offsets[bucket];
+            offsets[bucket] = first;
+            first += count;
+        }
+        for (uint32_t i = 0; i < pBvh->mCount; i++)
+        {
+            const uint64_t key = pBvh->pKeys[i];
+            pBvh->pKeysScratch[offsets[(key >> shift) & (RADIX_BUCKETS - 1)]++] = key;
+        }
+        uint64_t *pSorted = pBvh->pKeysScratch;
+        pBvh->pKeysScratch = pBvh->pKeys;
+        pBvh->pKeys = pSorted;
+    }
+
+    JobSystem::ParallelFor(
+        pBvh->mCount, chunkSize,
+        [](void *pUserData, uint32_t begin, uint32_t end)
+        {
+            Bvh *pBvh = static_cast<const BuildJob *>(pUserData)->pBvh;
+            for (uint32_t leaf = begin; leaf < end; leaf++)
+            {
+                pBvh->pSphere[leaf] = static_cast<uint32_t>(pBvh->pKeys[leaf]);
+            }
+            // The last leaf has no node of its own.
+            const uint32_t nodeEnd = end < pBvh->mCount ? end : pBvh->mCount - 1;
+            for (uint32_t nodeIndex = begin; nodeIndex < nodeEnd; nodeIndex++)
+            {
+                BuildNode(pBvh, nodeIndex);
+                pBvh->pVisits[nodeIndex].store(0, std::memory_order_relaxed);
+            }
+        },
+        &job);
+
+    if (pBvh->mCount > 1)
+    {
+        pBvh->pNodeParent[0] = INVALID_INDEX;
+    }
+    else if (pBvh->mCount == 1)
+    {
+        pBvh->pLeafParent[0] = INVALID_INDEX;
+    }
+
+    RefitLeaves(pBvh, pState, chunkSize);
+    pBvh->mBuildArea = pBvh->mArea;
+}
+
+void SphereBvh::Refit(Bvh *pBvh, const SphereSimulation::SphereState *pState, uint32_t chunkSize)
+{
+    RefitLeaves(pBvh, pState, RoundChunkSize(chunkSize));
+}
+
+bool SphereBvh::Update(Bvh *pBvh, const SphereSimulation::SphereState *pState, float rebuildThreshold,
+                       uint32_t chunkSize)
+{
+    const uint32_t count = pState->mCount < pBvh->mCapacity ? pState->mCount : pBvh->mCapacity;
+    if (count == pBvh->mCount && pBvh->mBuildArea > 0.0)
+    {
+        Refit(pBvh, pState, chunkSize);
+        if (GetQuality(pBvh) <= rebuildThreshold)
+        {
+            return false;
+        }
+    }
+    Build(pBvh, pState, chunkSize);
+    return true;
+}
+
+float SphereBvh::GetQuality(const Bvh *pBvh)
+{
+    return pBvh->mBuildArea > 0.0 ? static_cast<float>(pBvh->mArea / pBvh->mBuildArea) : 1.0f;
+}
+
+void SphereBvh::Intersect(const Bvh *pBvh, const Ray *pRays, uint32_t rayCount, RayHit *pHits, uint32_t chunkSize)
+{
+    struct IntersectJob
+    {
+        const Bvh *pBvh;
+        const Ray *pRays;
+        RayHit *pHits;
+    } job = {pBvh, pRays, pHits};
+
+    JobSystem::ParallelFor(
+        rayCount, chunkSize == 0 ? 1 : chunkSize,
+        [](void *pUserData, uint32_t begin, uint32_t end)
+        {
+            const IntersectJob *pJob = static_cast<const IntersectJob *>(pUserData);
+            for (uint32_t i = begin; i < end; i++)
+            {
+                pJob->pHits[i] = TraceRay(pJob->pBvh, pJob->pRays[i]);
+            }
+        },
+        &job);
+}
@@ -0,0 +1,90 @@
+#ifndef SPHERE_BVH_H
+#define SPHERE_BVH_H
+
+#include <atomic>
+#include <cstdint>
+#include "SphereSimulation.h"
+
+namespace SphereBvh
+{
+    constexpr uint32_t INVALID_INDEX = 0xffffffffu;
+    // Set on a child index that names a leaf rather than a node.
+    constexpr uint32_t LEAF_FLAG = 0x80000000u;
+    // A refit tree is rebuilt once its nodes' surface area grows past this many times that of the last build.
+    constexpr float DEFAULT_REBUILD_THRESHOLD = 1.5f;
+
+    struct Node
+    {
+        float mMin[3];
+        uint32_t mLeft;
+        float mMax[3];
+        uint32_t mRight;
+    };
+
+    // Linear BVH over spheres, one sphere per leaf and leaves in Morton order. The mCount - 1 nodes form a binary
+    // radix tree with the root at node 0; with a single sphere there are no nodes and the leaf is the root.
+    struct Bvh
+    {
+        uint32_t mCapacity = 0;
+        uint32_t mCount = 0;
+
+        Node *pNodes = nullptr;
+        uint32_t *pNodeParent = nullptr;
+        uint32_t *pLeafParent = nullptr;
+        // Children that reached each node during a refit. The second one computes the node's bounds and goes on up.
+        std::atomic<uint32_t> *pVisits = nullptr;
+
+        // (Morton code << 32 | sphere index) of each leaf, and the radix sort's other buffer.
+        uint64_t *pKeys = nullptr;
+        uint64_t *pKeysScratch = nullptr;
+        // Sphere index, position and radius of each leaf, as of the last build or refit.
+        uint32_t *pSphere = nullptr;
+        float *pLeafX = nullptr;
+        float *pLeafY = nullptr;
+        float *pLeafZ = nullptr;
+        float *pLeafRadius = nullptr;
+
+        // Surface area summed over all nodes, per block of nodes and in total, after the last build and now.
+        double *pBlockArea = nullptr;
+        double mBuildArea = 0.0;
+        double mArea = 0.0;
+    };
+
+    // Origin and normalized direction. Hits further than mMaxDistance are ignored.
+    struct Ray
+    {
+        float mOrigin[3];
+        float mDirection[3];
+        float mMaxDistance;
+    };
+
+    struct RayHit
+    {
+        // INVALID_INDEX if the ray hit nothing.
+        uint32_t mSphere;
+        float mDistance;
+    };
+
+    void AddBvh(Bvh *pBvh, uint32_t capacity);
+    void RemoveBvh(Bvh *pBvh);
+
+    // Builds the tree over the mCount spheres of pState from scratch. Morton codes, the hierarchy and the bounds run
+    // on the job system in chunks of chunkSize, only the radix sort of the codes is serial.
+    void Build(Bvh *pBvh, const SphereSimulation::SphereState *pState, uint32_t chunkSize);
+
+    // Moves the leaves to where the spheres of pState are now and recomputes the node bounds bottom up, keeping the
+    // tree as it was built. pState must hold as many spheres as the last build.
+    void Refit(Bvh *pBvh, const SphereSimulation::SphereState *pState, uint32_t chunkSize);
+
+    // Refits, or rebuilds if the sphere count changed or refitting has let the tree degrade past rebuildThreshold.
+    // Returns whether it rebuilt.
+    bool Update(Bvh *pBvh, const SphereSimulation::SphereState *pState, float rebuildThreshold, uint32_t chunkSize);
+
+    // Node surface area relative to the last build, 1 right after it.
+    float GetQuality(const Bvh *pBvh);
+
+    // Finds the closest sphere along each ray, chunkSize rays per job.
+    void Intersect(const Bvh *pBvh, const Ray *pRays, uint32_t rayCount, RayHit *pHits, uint32_t chunkSize);
+} // namespace SphereBvh
+
+#endif // SPHERE_BVH_H
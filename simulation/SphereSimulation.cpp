@@ -0,0 +1,1456 @@
+#include "SphereSimulation.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include "JobSystem.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SPHERE_SIMULATION_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define SPHERE_SIMULATION_TARGET_AVX2
+#else
+#define SPHERE_SIMULATION_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#else
+#define SPHERE_SIMULATION_X86 0
+#endif
+
+namespace SphereSimulation
+{
+    namespace
+    {
+        typedef void (*SimulateFunc)(SphereState *pState, float deltaTime, uint32_t begin, uint32_t end,
+                                     const InstanceOutput *pOutput);
+        typedef void (*CullFunc)(const SphereState *pState, const CullDesc *pDesc, uint32_t begin, uint32_t end,
+                                 uint8_t *pLod, const VisibleLists *pVisible, VisibleCounts *pCount);
+        typedef uint32_t (*OverlapFunc)(const CollisionState *pCollision, uint32_t begin, uint32_t end, float x,
+                                        float y, float z, float radius, uint32_t *pHits);
+
+        template <typename T>
+        T *AllocateArray(uint32_t count)
+        {
+            void *pMemory = nullptr;
+#if defined(_MSC_VER)
+            pMemory = _aligned_malloc(count * sizeof(T), SIMD_ALIGNMENT);
+#else
+            if (posix_memalign(&pMemory, SIMD_ALIGNMENT, count * sizeof(T)) != 0)
+            {
+                pMemory = nullptr;
+            }
+#endif
+            if (pMemory)
+            {
+                memset(pMemory, 0, count * sizeof(T));
+            }
+            return static_cast<T *>(pMemory);
+        }
+
+        void FreeArray(void *pArray)
+        {
+#if defined(_MSC_VER)
+            _aligned_free(pArray);
+#else
+            std::free(pArray);
+#endif
+        }
+
+        // Spawning uses its own key space so it never repeats the numbers of a respawn.
+        constexpr uint64_t SPAWN_KEY = 0x5350415755ull;
+
+        uint64_t SplitMix64(uint64_t *pState)
+        {
+            uint64_t z = (*pState += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            return z ^ (z >> 31);
+        }
+
+        // Short random stream for one sphere at one step. Stateless between calls, so any thread can create it.
+        struct Random
+        {
+            uint64_t mState;
+
+            Random(uint64_t seed, uint32_t index, uint64_t step)
+            {
+                mState = seed ^ (static_cast<uint64_t>(index) << 32);
+                mState = SplitMix64(&mState) ^ step;
+            }
+
+            float Float(float from, float to)
+            {
+                const float unit = static_cast<float>(SplitMix64(&mState) >> 40) * (1.0f / 16777216.0f);
+                return from + (to - from) * unit;
+            }
+        };
+
+        void Respawn(SphereState *pState, uint32_t i)
+        {
+            Random random(pState->mSeed, i, pState->mStep);
+            pState->pPositionX[i] = random.Float(-BOUNDS, BOUNDS);
+            pState->pPositionY[i] = random.Float(-BOUNDS, BOUNDS);
+            pState->pPositionZ[i] = random.Float(-BOUNDS, BOUNDS);
+            pState->pColor[i] =
+                PackColor(random.Float(0.0f, 1.0f), random.Float(0.0f, 1.0f), random.Float(0.0f, 1.0f), 1.0f);
+            pState->pSize[i] = random.Float(1.0f, 10.0f);
+        }
+
+        void SimulateScalar(SphereState *pState, float deltaTime, uint32_t begin, uint32_t end,
+                            const InstanceOutput *pOutput)
+        {
+            for (uint32_t i = begin; i < end; i++)
+            {
+                const float x = pState->pPositionX[i] + deltaTime * pState->pSpeedX[i];
+                const float y = pState->pPositionY[i] + deltaTime * pState->pSpeedY[i];
+                const float z = pState->pPositionZ[i] + deltaTime * pState->pSpeedZ[i];
+
+                pState->pPositionX[i] = x;
+                pState->pPositionY[i] = y;
+                pState->pPositionZ[i] = z;
+
+                const bool outside = (fabsf(x) > BOUNDS) | (fabsf(y) > BOUNDS) | (fabsf(z) > BOUNDS);
+                if (outside)
+                {
+                    Respawn(pState, i);
+                }
+
+                float *pPositionScale = pOutput->pPositionScale + i * 4;
+                pPositionScale[0] = pState->pPositionX[i];
+                pPositionScale[1] = pState->pPositionY[i];
+                pPositionScale[2] = pState->pPositionZ[i];
+                pPositionScale[3] = pState->pSize[i];
+                pOutput->pColor[i] = pState->pColor[i];
+            }
+        }
+
+        // Squared LOD thresholds, widened (coarse) and narrowed (fine) by the hysteresis. Comparing squares against
+        // size^2 * scale^2 / distance^2 saves the square root. Unused thresholds stay 0 and never match.
+        struct LodThresholds
+        {
+            float mFine[MAX_LODS - 1];
+            float mCoarse[MAX_LODS - 1];
+        };
+
+        LodThresholds MakeLodThresholds(const LodDesc *pLod)
+        {
+            LodThresholds thresholds = {};
+            for (uint32_t k = 0; k + 1 < pLod->mLodCount && k < MAX_LODS - 1; k++)
+            {
+                const float fine = pLod->mThresholds[k] * (1.0f - pLod->mHysteresis);
+                const float coarse = pLod->mThresholds[k] * (1.0f + pLod->mHysteresis);
+                thresholds.mFine[k] = fine * fine;
+                thresholds.mCoarse[k] = coarse * coarse;
+            }
+            return thresholds;
+        }
+
+        // fine and coarse are the LODs picked by the narrowed and widened thresholds. A sphere keeps its LOD while
+        // it lies between them, so it only switches once it is clearly past a threshold.
+        uint32_t UpdateLod(uint8_t *pLod, uint32_t i, uint32_t fine, uint32_t coarse)
+        {
+            uint32_t lod = pLod[i];
+            lod = lod < fine ? fine : lod;
+            lod = lod > coarse ? coarse : lod;
+            pLod[i] = static_cast<uint8_t>(lod);
+            return lod;
+        }
+
+        // Appends sphere i to the bucket of its biased LOD in every view whose bit is set in insideMask.
+        void AppendVisible(const CullDesc *pDesc, uint32_t i, uint32_t lod, uint32_t insideMask,
+                           const VisibleLists *pVisible, VisibleCounts *pCount)
+        {
+            const uint32_t coarsest = pDesc->mLod.mLodCount - 1;
+            for (uint32_t view = 0; view < pDesc->mViewCount; view++)
+            {
+                uint32_t viewLod = lod + pDesc->mLod.mBias[view];
+                viewLod = viewLod < coarsest ? viewLod : coarsest;
+
+                // Always written, only kept when the count moves past it.
+                uint32_t &count = pCount->mCount[view][viewLod];
+                pVisible->pIndices[view][viewLod][count] = i;
+                count += (insideMask >> view) & 1;
+            }
+        }
+
+        void CullScalar(const SphereState *pState, const CullDesc *pDesc, uint32_t begin, uint32_t end,
+                        uint8_t *pLod, const VisibleLists *pVisible, VisibleCounts *pCount)
+        {
+            const LodThresholds thresholds = MakeLodThresholds(&pDesc->mLod);
+            const float *pCamera = pDesc->mLod.mCameraPosition;
+
+            for (uint32_t i = begin; i < end; i++)
+            {
+                const float x = pState->pPositionX[i];
+                const float y = pState->pPositionY[i];
+                const float z = pState->pPositionZ[i];
+                const float radius = pState->pSize[i];
+
+                uint32_t insideMask = 0;
+                for (uint32_t view = 0; view < pDesc->mViewCount; view++)
+                {
+                    bool inside = true;
+                    for (uint32_t plane = 0; plane < 6; plane++)
+                    {
+                        const float *p = pDesc->mFrusta[view].mPlanes[plane];
+                        inside &= p[0] * x + p[1] * y + p[2] * z + p[3] >= -radius;
+                    }
+                    insideMask |= static_cast<uint32_t>(inside) << view;
+                }
+
+                const float dx = x - pCamera[0];
+                const float dy = y - pCamera[1];
+                const float dz = z - pCamera[2];
+                const float distanceSq = dx * dx + dy * dy + dz * dz;
+                const float projected = radius * pDesc->mLod.mPixelScale;
+                const float projectedSq = projected * projected;
+
+                uint32_t fine = 0;
+                uint32_t coarse = 0;
+                for (uint32_t k = 0; k < MAX_LODS - 1; k++)
+                {
+                    fine += projectedSq < thresholds.mFine[k] * distanceSq ? 1 : 0;
+                    coarse += projectedSq < thresholds.mCoarse[k] * distanceSq ? 1 : 0;
+                }
+
+                AppendVisible(pDesc, i, UpdateLod(pLod, i, fine, coarse), insideMask, pVisible, pCount);
+            }
+        }
+
+        // Candidates are tested in batches of at most this many, so the hits fit on the stack.
+        constexpr uint32_t OVERLAP_BATCH = 64;
+
+        // Writes the sorted index of every sphere in [begin, end) overlapping the sphere (x, y, z, radius) to pHits,
+        // in ascending order and the sphere itself included, and returns how many there are.
+        uint32_t OverlapScalar(const CollisionState *pCollision, uint32_t begin, uint32_t end, float x, float y,
+                               float z, float radius, uint32_t *pHits)
+        {
+            uint32_t count = 0;
+            for (uint32_t k = begin; k < end; k++)
+            {
+                const float dx = x - pCollision->pSortedX[k];
+                const float dy = y - pCollision->pSortedY[k];
+                const float dz = z - pCollision->pSortedZ[k];
+                const float reach = radius + pCollision->pSortedRadius[k];
+                pHits[count] = k;
+                count += dx * dx + dy * dy + dz * dz < reach * reach ? 1 : 0;
+            }
+            return count;
+        }
+
+#if SPHERE_SIMULATION_X86
+        void SimulateSSE(SphereState *pState, float deltaTime, uint32_t begin, uint32_t end,
+                         const InstanceOutput *pOutput)
+        {
+            const __m128 dt = _mm_set1_ps(deltaTime);
+            const __m128 bounds = _mm_set1_ps(BOUNDS);
+            const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+            uint32_t i = begin;
+            for (; i + 4 <= end; i += 4)
+            {
+                __m128 x = _mm_add_ps(_mm_loadu_ps(pState->pPositionX + i),
+                                      _mm_mul_ps(dt, _mm_loadu_ps(pState->pSpeedX + i)));
+                __m128 y = _mm_add_ps(_mm_loadu_ps(pState->pPositionY + i),
+                                      _mm_mul_ps(dt, _mm_loadu_ps(pState->pSpeedY + i)));
+                __m128 z = _mm_add_ps(_mm_loadu_ps(pState->pPositionZ + i),
+                                      _mm_mul_ps(dt, _mm_loadu_ps(pState->pSpeedZ + i)));
+
+                _mm_storeu_ps(pState->pPositionX + i, x);
+                _mm_storeu_ps(pState->pPositionY + i, y);
+                _mm_storeu_ps(pState->pPositionZ + i, z);
+
+                const __m128 outside = _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(_mm_and_ps(x, absMask), bounds),
+                                                           _mm_cmpgt_ps(_mm_and_ps(y, absMask), bounds)),
+                                                 _mm_cmpgt_ps(_mm_and_ps(z, absMask), bounds));
+
+                // Respawns are rare, so the lanes that need one are patched up in scalar code and reloaded.
+                const int respawnMask = _mm_movemask_ps(outside);
+                if (respawnMask != 0)
+                {
+                    for (uint32_t lane = 0; lane < 4; lane++)
+                    {
+                        if (respawnMask & (1 << lane))
+                        {
+                            Respawn(pState, i + lane);
+                        }
+                    }
+                    x = _mm_loadu_ps(pState->pPositionX + i);
+                    y = _mm_loadu_ps(pState->pPositionY + i);
+                    z = _mm_loadu_ps(pState->pPositionZ + i);
+                }
+
+                // Transpose (x, y, z, size) into one float4 per sphere.
+                __m128 s = _mm_loadu_ps(pState->pSize + i);
+                _MM_TRANSPOSE4_PS(x, y, z, s);
+
+                float *pPositionScale = pOutput->pPositionScale + i * 4;
+                _mm_storeu_ps(pPositionScale + 0, x);
+                _mm_storeu_ps(pPositionScale + 4, y);
+                _mm_storeu_ps(pPositionScale + 8, z);
+                _mm_storeu_ps(pPositionScale + 12, s);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(pOutput->pColor + i),
+                                 _mm_loadu_si128(reinterpret_cast<const __m128i *>(pState->pColor + i)));
+            }
+
+            SimulateScalar(pState, deltaTime, i, end, pOutput);
+        }
+
+        SPHERE_SIMULATION_TARGET_AVX2
+        void SimulateAVX2(SphereState *pState, float deltaTime, uint32_t begin, uint32_t end,
+                          const InstanceOutput *pOutput)
+        {
+            const __m256 dt = _mm256_set1_ps(deltaTime);
+            const __m256 bounds = _mm256_set1_ps(BOUNDS);
+            const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+
+            uint32_t i = begin;
+            for (; i + 8 <= end; i += 8)
+            {
+                // Separate multiply and add rather than FMA, so the result matches the other kernels bit for bit.
+                __m256 x = _mm256_add_ps(_mm256_loadu_ps(pState->pPositionX + i),
+                                         _mm256_mul_ps(dt, _mm256_loadu_ps(pState->pSpeedX + i)));
+                __m256 y = _mm256_add_ps(_mm256_loadu_ps(pState->pPositionY + i),
+                                         _mm256_mul_ps(dt, _mm256_loadu_ps(pState->pSpeedY + i)));
+                __m256 z = _mm256_add_ps(_mm256_loadu_ps(pState->pPositionZ + i),
+                                         _mm256_mul_ps(dt, _mm256_loadu_ps(pState->pSpeedZ + i)));
+
+                _mm256_storeu_ps(pState->pPositionX + i, x);
+                _mm256_storeu_ps(pState->pPositionY + i, y);
+                _mm256_storeu_ps(pState->pPositionZ + i, z);
+
+                const __m256 outside =
+                    _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(_mm256_and_ps(x, absMask), bounds, _CMP_GT_OQ),
+                                              _mm256_cmp_ps(_mm256_and_ps(y, absMask), bounds, _CMP_GT_OQ)),
+                                 _mm256_cmp_ps(_mm256_and_ps(z, absMask), bounds, _CMP_GT_OQ));
+
+                const int respawnMask = _mm256_movemask_ps(outside);
+                if (respawnMask != 0)
+                {
+                    for (uint32_t lane = 0; lane < 8; lane++)
+                    {
+                        if (respawnMask & (1 << lane))
+                        {
+                            Respawn(pState, i + lane);
+                        }
+                    }
+                    x = _mm256_loadu_ps(pState->pPositionX + i);
+                    y = _mm256_loadu_ps(pState->pPositionY + i);
+                    z = _mm256_loadu_ps(pState->pPositionZ + i);
+                }
+
+                const __m256 s = _mm256_loadu_ps(pState->pSize + i);
+
+                // Transpose (x, y, z, size) into one float4 per sphere. Row n holds sphere n in its low half and
+                // sphere n + 4 in its high half.
+                const __m256 xy0 = _mm256_unpacklo_ps(x, y);
+                const __m256 xy1 = _mm256_unpackhi_ps(x, y);
+                const __m256 zs0 = _mm256_unpacklo_ps(z, s);
+                const __m256 zs1 = _mm256_unpackhi_ps(z, s);
+                const __m256 row0 = _mm256_shuffle_ps(xy0, zs0, _MM_SHUFFLE(1, 0, 1, 0));
+                const __m256 row1 = _mm256_shuffle_ps(xy0, zs0, _MM_SHUFFLE(3, 2, 3, 2));
+                const __m256 row2 = _mm256_shuffle_ps(xy1, zs1, _MM_SHUFFLE(1, 0, 1, 0));
+                const __m256 row3 = _mm256_shuffle_ps(xy1, zs1, _MM_SHUFFLE(3, 2, 3, 2));
+
+                float *pPositionScale = pOutput->pPositionScale + i * 4;
+                _mm256_storeu_ps(pPositionScale + 0, _mm256_permute2f128_ps(row0, row1, 0x20));
+                _mm256_storeu_ps(pPositionScale + 8, _mm256_permute2f128_ps(row2, row3, 0x20));
+                _mm256_storeu_ps(pPositionScale + 16, _mm256_permute2f128_ps(row0, row1, 0x31));
+                _mm256_storeu_ps(pPositionScale + 24, _mm256_permute2f128_ps(row2, row3, 0x31));
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(pOutput->pColor + i),
+                                    _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pState->pColor + i)));
+            }
+
+            SimulateScalar(pState, deltaTime, i, end, pOutput);
+        }
+
+        void CullSSE(const SphereState *pState, const CullDesc *pDesc, uint32_t begin, uint32_t end, uint8_t *pLod,
+                     const VisibleLists *pVisible, VisibleCounts *pCount)
+        {
+            __m128 planes[MAX_CULL_VIEWS][6][4];
+            for (uint32_t view = 0; view < pDesc->mViewCount; view++)
+            {
+                for (uint32_t plane = 0; plane < 6; plane++)
+                {
+                    for (uint32_t c = 0; c < 4; c++)
+                    {
+                        planes[view][plane][c] = _mm_set1_ps(pDesc->mFrusta[view].mPlanes[plane][c]);
+                    }
+                }
+            }
+            const LodThresholds thresholds = MakeLodThresholds(&pDesc->mLod);
+            __m128 fineThresholds[MAX_LODS - 1];
+            __m128 coarseThresholds[MAX_LODS - 1];
+            for (uint32_t k = 0; k < MAX_LODS - 1; k++)
+            {
+                fineThresholds[k] = _mm_set1_ps(thresholds.mFine[k]);
+                coarseThresholds[k] = _mm_set1_ps(thresholds.mCoarse[k]);
+            }
+            const __m128 cameraX = _mm_set1_ps(pDesc->mLod.mCameraPosition[0]);
+            const __m128 cameraY = _mm_set1_ps(pDesc->mLod.mCameraPosition[1]);
+            const __m128 cameraZ = _mm_set1_ps(pDesc->mLod.mCameraPosition[2]);
+            const __m128 pixelScale = _mm_set1_ps(pDesc->mLod.mPixelScale);
+            const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(static_cast<int>(0x80000000u)));
+
+            uint32_t i = begin;
+            for (; i + 4 <= end; i += 4)
+            {
+                const __m128 x = _mm_loadu_ps(pState->pPositionX + i);
+                const __m128 y = _mm_loadu_ps(pState->pPositionY + i);
+                const __m128 z = _mm_loadu_ps(pState->pPositionZ + i);
+                const __m128 radius = _mm_loadu_ps(pState->pSize + i);
+                const __m128 negRadius = _mm_xor_ps(radius, signMask);
+
+                int insideMasks[MAX_CULL_VIEWS] = {};
+                for (uint32_t view = 0; view < pDesc->mViewCount; view++)
+                {
+                    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+                    for (uint32_t plane = 0; plane < 6; plane++)
+                    {
+                        const __m128 *p = planes[view][plane];
+                        const __m128 distance = _mm_add_ps(
+                            _mm_add_ps(_mm_mul_ps(p[0], x), _mm_mul_ps(p[1], y)),
+                            _mm_add_ps(_mm_mul_ps(p[2], z), p[3]));
+                        inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negRadius));
+                    }
+                    insideMasks[view] = _mm_movemask_ps(inside);
+                }
+
+                const __m128 dx = _mm_sub_ps(x, cameraX);
+                const __m128 dy = _mm_sub_ps(y, cameraY);
+                const __m128 dz = _mm_sub_ps(z, cameraZ);
+                const __m128 distanceSq =
+                    _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+                const __m128 projected = _mm_mul_ps(radius, pixelScale);
+                const __m128 projectedSq = _mm_mul_ps(projected, projected);
+
+                // Compares are all ones where true, so subtracting them counts.
+                __m128i fine = _mm_setzero_si128();
+                __m128i coarse = _mm_setzero_si128();
+                for (uint32_t k = 0; k < MAX_LODS - 1; k++)
+                {
+                    fine = _mm_sub_epi32(fine, _mm_castps_si128(_mm_cmplt_ps(
+                                                   projectedSq, _mm_mul_ps(fineThresholds[k], distanceSq))));
+                    coarse = _mm_sub_epi32(coarse, _mm_castps_si128(_mm_cmplt_ps(
+                                                       projectedSq, _mm_mul_ps(coarseThresholds[k], distanceSq))));
+                }
+
+                uint32_t fineLanes[4];
+                uint32_t coarseLanes[4];
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(fineLanes), fine);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(coarseLanes), coarse);
+
+                // The bucket scatter is per lane anyway, so the LOD history and the views are finished in scalar.
+                for (uint32_t lane = 0; lane < 4; lane++)
+                {
+                    uint32_t insideMask = 0;
+                    for (uint32_t view = 0; view < pDesc->mViewCount; view++)
+                    {
+                        insideMask |= static_cast<uint32_t>((insideMasks[view] >> lane) & 1) << view;
+                    }
+                    const uint32_t lod = UpdateLod(pLod, i + lane, fineLanes[lane], coarseLanes[lane]);
+                    AppendVisible(pDesc, i + lane, lod, insideMask, pVisible, pCount);
+                }
+            }
+
+            CullScalar(pState, pDesc, i, end, pLod, pVisible, pCount);
+        }
+
+        SPHERE_SIMULATION_TARGET_AVX2
+        void CullAVX2(const SphereState *pState, const CullDesc *pDesc, uint32_t begin, uint32_t end, uint8_t *pLod,
+                      const VisibleLists *pVisible, VisibleCounts *pCount)
+        {
+            __m256 planes[MAX_CULL_VIEWS][6][4];
+            for (uint32_t view = 0; view < pDesc->mViewCount; view++)
+            {
+                for (uint32_t plane = 0; plane < 6; plane++)
+                {
+                    for (uint32_t c = 0; c < 4; c++)
+                    {
+                        planes[view][plane][c] = _mm256_set1_ps(pDesc->mFrusta[view].mPlanes[plane][c]);
+                    }
+                }
+            }
+            const LodThresholds thresholds = MakeLodThresholds(&pDesc->mLod);
+            __m256 fineThresholds[MAX_LODS - 1];
+            __m256 coarseThresholds[MAX_LODS - 1];
+            for (uint32_t k = 0; k < MAX_LODS - 1; k++)
+            {
+                fineThresholds[k] = _mm256_set1_ps(thresholds.mFine[k]);
+                coarseThresholds[k] = _mm256_set1_ps(thresholds.mCoarse[k]);
+            }
+            const __m256 cameraX = _mm256_set1_ps(pDesc->mLod.mCameraPosition[0]);
+            const __m256 cameraY = _mm256_set1_ps(pDesc->mLod.mCameraPosition[1]);
+            const __m256 cameraZ = _mm256_set1_ps(pDesc->mLod.mCameraPosition[2]);
+            const __m256 pixelScale = _mm256_set1_ps(pDesc->mLod.mPixelScale);
+            const __m256 signMask = _mm256_castsi256_ps(_mm256_set1_epi32(static_cast<int>(0x80000000u)));
+
+            uint32_t i = begin;
+            for (; i + 8 <= end; i += 8)
+            {
+                const __m256 x = _mm256_loadu_ps(pState->pPositionX + i);
+                const __m256 y = _mm256_loadu_ps(pState->pPositionY + i);
+                const __m256 z = _mm256_loadu_ps(pState->pPositionZ + i);
+                const __m256 radius = _mm256_loadu_ps(pState->pSize + i);
+                const __m256 negRadius = _mm256_xor_ps(radius, signMask);
+
+                int insideMasks[MAX_CULL_VIEWS] = {};
+                for (uint32_t view = 0; view < pDesc->mViewCount; view++)
+                {
+                    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+                    for (uint32_t plane = 0; plane < 6; plane++)
+                    {
+                        const __m256 *p = planes[view][plane];
+                        const __m256 distance =
+                            _mm256_fmadd_ps(p[0], x, _mm256_fmadd_ps(p[1], y, _mm256_fmadd_ps(p[2], z, p[3])));
+                        inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negRadius, _CMP_GE_OQ));
+                    }
+                    insideMasks[view] = _mm256_movemask_ps(inside);
+                }
+
+                const __m256 dx = _mm256_sub_ps(x, cameraX);
+                const __m256 dy = _mm256_sub_ps(y, cameraY);
+                const __m256 dz = _mm256_sub_ps(z, cameraZ);
+                const __m256 distanceSq = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+                const __m256 projected = _mm256_mul_ps(radius, pixelScale);
+                const __m256 projectedSq = _mm256_mul_ps(projected, projected);
+
+                __m256i fine = _mm256_setzero_si256();
+                __m256i coarse = _mm256_setzero_si256();
+                for (uint32_t k = 0; k < MAX_LODS - 1; k++)
+                {
+                    fine = _mm256_sub_epi32(fine, _mm256_castps_si256(_mm256_cmp_ps(
+                                                      projectedSq, _mm256_mul_ps(fineThresholds[k], distanceSq),
+                                                      _CMP_LT_OQ)));
+                    coarse = _mm256_sub_epi32(coarse, _mm256_castps_si256(_mm256_cmp_ps(
+                                                          projectedSq, _mm256_mul_ps(coarseThresholds[k], distanceSq),
+                                                          _CMP_LT_OQ)));
+                }
+
+                uint32_t fineLanes[8];
+                uint32_t coarseLanes[8];
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(fineLanes), fine);
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(coarseLanes), coarse);
+
+                for (uint32_t lane = 0; lane < 8; lane++)
+                {
+                    uint32_t insideMask = 0;
+                    for (uint32_t view = 0; view < pDesc->mViewCount; view++)
+                    {
+                        insideMask |= static_cast<uint32_t>((insideMasks[view] >> lane) & 1) << view;
+                    }
+                    const uint32_t lod = UpdateLod(pLod, i + lane, fineLanes[lane], coarseLanes[lane]);
+                    AppendVisible(pDesc, i + lane, lod, insideMask, pVisible, pCount);
+                }
+            }
+
+            CullScalar(pState, pDesc, i, end, pLod, pVisible, pCount);
+        }
+
+        uint32_t OverlapSSE(const CollisionState *pCollision, uint32_t begin, uint32_t end, float x, float y, float z,
+                            float radius, uint32_t *pHits)
+        {
+            const __m128 px = _mm_set1_ps(x);
+            const __m128 py = _mm_set1_ps(y);
+            const __m128 pz = _mm_set1_ps(z);
+            const __m128 pr = _mm_set1_ps(radius);
+
+            // The sorted arrays are padded, so a run ends on a partial vector with the lanes past it masked off.
+            uint32_t count = 0;
+            for (uint32_t k = begin; k < end; k += 4)
+            {
+                const __m128 dx = _mm_sub_ps(px, _mm_loadu_ps(pCollision->pSortedX + k));
+                const __m128 dy = _mm_sub_ps(py, _mm_loadu_ps(pCollision->pSortedY + k));
+                const __m128 dz = _mm_sub_ps(pz, _mm_loadu_ps(pCollision->pSortedZ + k));
+                const __m128 reach = _mm_add_ps(pr, _mm_loadu_ps(pCollision->pSortedRadius + k));
+                const __m128 distanceSq =
+                    _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+                const int validMask = end - k >= 4 ? 0xf : (1 << (end - k)) - 1;
+                const int hitMask = _mm_movemask_ps(_mm_cmplt_ps(distanceSq, _mm_mul_ps(reach, reach))) & validMask;
+                if (hitMask != 0)
+                {
+                    for (uint32_t lane = 0; lane < 4; lane++)
+                    {
+                        if (hitMask & (1 << lane))
+                        {
+                            pHits[count++] = k + lane;
+                        }
+                    }
+                }
+            }
+
+            return count;
+        }
+
+        SPHERE_SIMULATION_TARGET_AVX2
+        uint32_t OverlapAVX2(const CollisionState *pCollision, uint32_t begin, uint32_t end, float x, float y, float z,
+                             float radius, uint32_t *pHits)
+        {
+            const __m256 px = _mm256_set1_ps(x);
+            const __m256 py = _mm256_set1_ps(y);
+            const __m256 pz = _mm256_set1_ps(z);
+            const __m256 pr = _mm256_set1_ps(radius);
+
+            // The sorted arrays are padded, so a run ends on a partial vector with the lanes past it masked off.
+            uint32_t count = 0;
+            for (uint32_t k = begin; k < end; k += 8)
+            {
+                const __m256 dx = _mm256_sub_ps(px, _mm256_loadu_ps(pCollision->pSortedX + k));
+                const __m256 dy = _mm256_sub_ps(py, _mm256_loadu_ps(pCollision->pSortedY + k));
+                const __m256 dz = _mm256_sub_ps(pz, _mm256_loadu_ps(pCollision->pSortedZ + k));
+                const __m256 reach = _mm256_add_ps(pr, _mm256_loadu_ps(pCollision->pSortedRadius + k));
+                // No FMA here either: a hit has to be a hit for every kernel.
+                const __m256 distanceSq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                                                        _mm256_mul_ps(dz, dz));
+
+                const int validMask = end - k >= 8 ? 0xff : (1 << (end - k)) - 1;
+                const int hitMask =
+                    _mm256_movemask_ps(_mm256_cmp_ps(distanceSq, _mm256_mul_ps(reach, reach), _CMP_LT_OQ)) & validMask;
+                if (hitMask != 0)
+                {
+                    for (uint32_t lane = 0; lane < 8; lane++)
+                    {
+                        if (hitMask & (1 << lane))
+                        {
+                            pHits[count++] = k + lane;
+                        }
+                    }
+                }
+            }
+
+            return count;
+        }
+
+        bool SupportsAVX2()
+        {
+#if defined(_MSC_VER) && !defined(__clang__)
+            int info[4];
+            __cpuid(info, 0);
+            if (info[0] < 7)
+            {
+                return false;
+            }
+
+            __cpuid(info, 1);
+            const bool osxsave = (info[2] & (1 << 27)) != 0;
+            const bool fma = (info[2] & (1 << 12)) != 0;
+            if (!osxsave || !fma || (_xgetbv(0) & 0x6) != 0x6)
+            {
+                return false;
+            }
+
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+#else
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+        }
+#endif
+
+        KernelType gKernel = DetectKernel();
+
+        SimulateFunc GetSimulateFunc(KernelType kernel)
+        {
+            switch (kernel)
+            {
+#if SPHERE_SIMULATION_X86
+            case KernelType::AVX2:
+                return SimulateAVX2;
+            case KernelType::SSE:
+                return SimulateSSE;
+#endif
+            default:
+                return SimulateScalar;
+            }
+        }
+        CullFunc GetCullFunc(KernelType kernel)
+        {
+            switch (kernel)
+            {
+#if SPHERE_SIMULATION_X86
+            case KernelType::AVX2:
+                return CullAVX2;
+            case KernelType::SSE:
+                return CullSSE;
+#endif
+            default:
+                return CullScalar;
+            }
+        }
+        OverlapFunc GetOverlapFunc(KernelType kernel)
+        {
+            switch (kernel)
+            {
+#if SPHERE_SIMULATION_X86
+            case KernelType::AVX2:
+                return OverlapAVX2;
+            case KernelType::SSE:
+                return OverlapSSE;
+#endif
+            default:
+                return OverlapScalar;
+            }
+        }
+
+        // Cells per job when the grid offsets are summed up.
+        constexpr uint32_t CELL_CHUNK_SIZE = 1024;
+        // Elastic, so the box never runs out of energy.
+        constexpr float RESTITUTION = 1.0f;
+        // Spawn can produce spheres of almost no size, which would otherwise fly off at absurd speeds.
+        constexpr float MIN_MASS_RADIUS = 0.5f;
+
+        // Cells to an axis for count spheres no larger than maxRadius, see GRID_CELL_TARGET. Grows with count and
+        // shrinks with maxRadius, so GetGridResolution(capacity, 0) bounds every step's grid.
+        uint32_t GetGridResolution(uint32_t count, float maxRadius)
+        {
+            const float extent = 2.0f * BOUNDS;
+            float cellSize = extent * std::cbrt(static_cast<float>(GRID_CELL_TARGET) / (count > 0 ? count : 1));
+            cellSize = cellSize > 0.5f * maxRadius ? cellSize : 0.5f * maxRadius;
+            cellSize = cellSize < 2.0f * MAX_RADIUS ? cellSize : 2.0f * MAX_RADIUS;
+            const float resolution = std::ceil(extent / cellSize);
+            return resolution < static_cast<float>(MAX_GRID_RESOLUTION) ? static_cast<uint32_t>(resolution)
+                                                                        : MAX_GRID_RESOLUTION;
+        }
+
+        uint32_t GetGridChunkCount(uint32_t cellCount)
+        {
+            const uint32_t chunkCount = MAX_GRID_CHUNK_CELLS / cellCount;
+            return chunkCount < 1 ? 1 : (chunkCount > MAX_GRID_CHUNKS ? MAX_GRID_CHUNKS : chunkCount);
+        }
+
+        uint32_t GetCellCoordinate(const CollisionState *pCollision, float position)
+        {
+            // A collision can push a sphere past the bounds until the next Simulate respawns it. The outermost cells
+            // take it meanwhile.
+            const float cell = (position + BOUNDS) / pCollision->mCellSize;
+            const uint32_t last = pCollision->mResolution - 1;
+            if (!(cell > 0.0f))
+            {
+                return 0;
+            }
+            return cell < static_cast<float>(last) ? static_cast<uint32_t>(cell) : last;
+        }
+
+        float GetMass(float radius)
+        {
+            const float r = radius > MIN_MASS_RADIUS ? radius : MIN_MASS_RADIUS;
+            return r * r * r;
+        }
+
+        // Resolves every contact of the sphere at sorted index k against the sorted copy of the state and writes its
+        // new position and speed to pState. Contacts are visited in sorted order, so the sums come out the same
+        // whichever thread runs it.
+        void CollideSphere(const CollisionState *pCollision, OverlapFunc pOverlap, uint32_t k, SphereState *pState,
+                           uint64_t *pPairTests, uint64_t *pContacts)
+        {
+            const uint32_t i = pCollision->pSorted[k];
+            const float x = pCollision->pSortedX[k];
+            const float y = pCollision->pSortedY[k];
+            const float z = pCollision->pSortedZ[k];
+            const float radius = pCollision->pSortedRadius[k];
+            const float speedX = pCollision->pSortedSpeedX[k];
+            const float speedY = pCollision->pSortedSpeedY[k];
+            const float speedZ = pCollision->pSortedSpeedZ[k];
+            const float mass = GetMass(radius);
+
+            // Any sphere touching this one has its center within reach, and with it its cell.
+            const uint32_t resolution = pCollision->mResolution;
+            const float reach = radius + pCollision->mMaxRadius;
+            const uint32_t firstX = GetCellCoordinate(pCollision, x - reach);
+            const uint32_t lastX = GetCellCoordinate(pCollision, x + reach);
+            const uint32_t lastY = GetCellCoordinate(pCollision, y + reach);
+            const uint32_t lastZ = GetCellCoordinate(pCollision, z + reach);
+
+            float pushX = 0.0f;
+            float pushY = 0.0f;
+            float pushZ = 0.0f;
+            float impulseX = 0.0f;
+            float impulseY = 0.0f;
+            float impulseZ = 0.0f;
+            uint32_t hits[OVERLAP_BATCH];
+
+            for (uint32_t rowZ = GetCellCoordinate(pCollision, z - reach); rowZ <= lastZ; rowZ++)
+            {
+                for (uint32_t rowY = GetCellCoordinate(pCollision, y - reach); rowY <= lastY; rowY++)
+                {
+                    // The neighbouring cells along x are neighbours in the sorted arrays too, so a row is one run.
+                    const uint32_t row = (rowZ * resolution + rowY) * resolution;
+                    const uint32_t first = pCollision->pCellStart[row + firstX];
+                    const uint32_t last = pCollision->pCellStart[row + lastX + 1];
+                    *pPairTests += last - first;
+
+                    for (uint32_t batch = first; batch < last; batch += OVERLAP_BATCH)
+                    {
+                        const uint32_t batchEnd = batch + OVERLAP_BATCH < last ? batch + OVERLAP_BATCH : last;
+                        const uint32_t hitCount = pOverlap(pCollision, batch, batchEnd, x, y, z, radius, hits);
+                        for (uint32_t h = 0; h < hitCount; h++)
+                        {
+                            const uint32_t other = hits[h];
+                            const float dx = x - pCollision->pSortedX[other];
+                            const float dy = y - pCollision->pSortedY[other];
+                            const float dz = z - pCollision->pSortedZ[other];
+                            const float distanceSq = dx * dx + dy * dy + dz * dz;
+                            // Also skips the sphere itself. Two spheres on the same spot have no direction to part
+                            // in and are left to drift apart.
+                            if (other == k || distanceSq == 0.0f)
+                            {
+                                continue;
+                            }
+
+                            const float distance = sqrtf(distanceSq);
+                            const float inverseDistance = 1.0f / distance;
+                            const float nx = dx * inverseDistance;
+                            const float ny = dy * inverseDistance;
+                            const float nz = dz * inverseDistance;
+                            const float otherRadius = pCollision->pSortedRadius[other];
+                            const float otherMass = GetMass(otherRadius);
+                            // This sphere's part of any correction, the other sphere takes the rest from its side.
+                            const float share = otherMass / (mass + otherMass);
+
+                            const float overlap = radius + otherRadius - distance;
+                            pushX += nx * overlap * share;
+                            pushY += ny * overlap * share;
+                            pushZ += nz * overlap * share;
+
+                            const float approach = (speedX - pCollision->pSortedSpeedX[other]) * nx +
+                                                   (speedY - pCollision->pSortedSpeedY[other]) * ny +
+                                                   (speedZ - pCollision->pSortedSpeedZ[other]) * nz;
+                            if (approach < 0.0f)
+                            {
+                                const float impulse = -(1.0f + RESTITUTION) * approach * share;
+                                impulseX += nx * impulse;
+                                impulseY += ny * impulse;
+                                impulseZ += nz * impulse;
+                            }
+                            (*pContacts)++;
+                        }
+                    }
+                }
+            }
+
+            // Not tested against itself.
+            (*pPairTests)--;
+
+            pState->pPositionX[i] = x + pushX;
+            pState->pPositionY[i] = y + pushY;
+            pState->pPositionZ[i] = z + pushZ;
+            pState->pSpeedX[i] = speedX + impulseX;
+            pState->pSpeedY[i] = speedY + impulseY;
+            pState->pSpeedZ[i] = speedZ + impulseZ;
+        }
+    } // namespace
+} // namespace SphereSimulation
+
+void SphereSimulation::AddState(SphereState *pState, uint32_t capacity, uint64_t seed)
+{
+    const uint32_t paddedCapacity = (capacity + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+
+    *pState = {};
+    pState->mCapacity = capacity;
+    pState->mSeed = seed;
+    pState->pPositionX = AllocateArray<float>(paddedCapacity);
+    pState->pPositionY = AllocateArray<float>(paddedCapacity);
+    pState->pPositionZ = AllocateArray<float>(paddedCapacity);
+    pState->pSpeedX = AllocateArray<float>(paddedCapacity);
+    pState->pSpeedY = AllocateArray<float>(paddedCapacity);
+    pState->pSpeedZ = AllocateArray<float>(paddedCapacity);
+    pState->pSize = AllocateArray<float>(paddedCapacity);
+    pState->pColor = AllocateArray<uint32_t>(paddedCapacity);
+}
+
+void SphereSimulation::RemoveState(SphereState *pState)
+{
+    FreeArray(pState->pPositionX);
+    FreeArray(pState->pPositionY);
+    FreeArray(pState->pPositionZ);
+    FreeArray(pState->pSpeedX);
+    FreeArray(pState->pSpeedY);
+    FreeArray(pState->pSpeedZ);
+    FreeArray(pState->pSize);
+    FreeArray(pState->pColor);
+    *pState = {};
+}
+
+uint32_t SphereSimulation::PackColor(float r, float g, float b, float a)
+{
+    const uint32_t r8 = static_cast<uint32_t>(r * 255.0f + 0.5f);
+    const uint32_t g8 = static_cast<uint32_t>(g * 255.0f + 0.5f);
+    const uint32_t b8 = static_cast<uint32_t>(b * 255.0f + 0.5f);
+    const uint32_t a8 = static_cast<uint32_t>(a * 255.0f + 0.5f);
+    return r8 | (g8 << 8) | (b8 << 16) | (a8 << 24);
+}
+
+void SphereSimulation::Spawn(SphereState *pState, uint32_t begin, uint32_t end)
+{
+    for (uint32_t i = begin; i < end; i++)
+    {
+        Random random(pState->mSeed, i, SPAWN_KEY);
+        pState->pPositionX[i] = random.Float(-BOUNDS, BOUNDS);
+        pState->pPositionY[i] = random.Float(-BOUNDS, BOUNDS);
+        pState->pPositionZ[i] = random.Float(-BOUNDS, BOUNDS);
+        pState->pColor[i] =
+            PackColor(random.Float(0.0f, 1.0f), random.Float(0.0f, 1.0f), random.Float(0.0f, 1.0f), 1.0f);
+        pState->pSize[i] = random.Float(0.0f, 10.0f);
+        pState->pSpeedX[i] = random.Float(-10.0f, 10.0f);
+        pState->pSpeedY[i] = random.Float(-10.0f, 10.0f);
+        pState->pSpeedZ[i] = random.Float(-10.0f, 10.0f);
+    }
+}
+
+void SphereSimulation::Simulate(SphereState *pState, float deltaTime, uint32_t begin, uint32_t end,
+                                const InstanceOutput *pOutput)
+{
+    GetSimulateFunc(gKernel)(pState, deltaTime, begin, end, pOutput);
+}
+
+void SphereSimulation::Step(SphereState *pState, float deltaTime, const InstanceOutput *pOutput, uint32_t chunkSize)
+{
+    struct StepJob
+    {
+        SphereState *pState;
+        float mDeltaTime;
+        const InstanceOutput *pOutput;
+        SimulateFunc pSimulate;
+    } job = {pState, deltaTime, pOutput, GetSimulateFunc(gKernel)};
+
+    // Chunks start on a multiple of SIMD_WIDTH, so every sphere goes down the same vector or scalar path it would
+    // take in a serial run.
+    chunkSize = (chunkSize + CHUNK_ALIGNMENT - 1) / CHUNK_ALIGNMENT * CHUNK_ALIGNMENT;
+    chunkSize = chunkSize == 0 ? CHUNK_ALIGNMENT : chunkSize;
+
+    JobSystem::ParallelFor(
+        pState->mCount, chunkSize,
+        [](void *pUserData, uint32_t begin, uint32_t end)
+        {
+            const StepJob *pJob = static_cast<const StepJob *>(pUserData);
+            pJob->pSimulate(pJob->pState, pJob->mDeltaTime, begin, end, pJob->pOutput);
+        },
+        &job);
+
+    pState->mStep++;
+}
+
+void SphereSimulation::AddSnapshot(Snapshot *pSnapshot, uint32_t capacity)
+{
+    const uint32_t paddedCapacity = (capacity + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+
+    *pSnapshot = {};
+    pSnapshot->mCapacity = capacity;
+    pSnapshot->pPreviousX = AllocateArray<float>(paddedCapacity);
+    pSnapshot->pPreviousY = AllocateArray<float>(paddedCapacity);
+    pSnapshot->pPreviousZ = AllocateArray<float>(paddedCapacity);
+    pSnapshot->pPreviousSize = AllocateArray<float>(paddedCapacity);
+    pSnapshot->mCurrent.pPositionScale = AllocateArray<float>(paddedCapacity * 4);
+    pSnapshot->mCurrent.pColor = AllocateArray<uint32_t>(paddedCapacity);
+}
+
+void SphereSimulation::RemoveSnapshot(Snapshot *pSnapshot)
+{
+    FreeArray(pSnapshot->pPreviousX);
+    FreeArray(pSnapshot->pPreviousY);
+    FreeArray(pSnapshot->pPreviousZ);
+    FreeArray(pSnapshot->pPreviousSize);
+    FreeArray(pSnapshot->mCurrent.pPositionScale);
+    FreeArray(pSnapshot->mCurrent.pColor);
+    *pSnapshot = {};
+}
+
+void SphereSimulation::BeginSnapshot(const SphereState *pState, Snapshot *pSnapshot)
+{
+    const size_t size = sizeof(float) * pState->mCount;
+    memcpy(pSnapshot->pPreviousX, pState->pPositionX, size);
+    memcpy(pSnapshot->pPreviousY, pState->pPositionY, size);
+    memcpy(pSnapshot->pPreviousZ, pState->pPositionZ, size);
+    memcpy(pSnapshot->pPreviousSize, pState->pSize, size);
+}
+
+void SphereSimulation::Interpolate(const Snapshot *pSnapshot, float alpha, SphereState *pState,
+                                   const InstanceOutput *pOutput, uint32_t chunkSize)
+{
+    struct InterpolateJob
+    {
+        const Snapshot *pSnapshot;
+        float mAlpha;
+        SphereState *pState;
+        const InstanceOutput *pOutput;
+    } job = {pSnapshot, alpha, pState, pOutput};
+
+    pState->mCount = pSnapshot->mCount < pState->mCapacity ? pSnapshot->mCount : pState->mCapacity;
+    chunkSize = (chunkSize + CHUNK_ALIGNMENT - 1) / CHUNK_ALIGNMENT * CHUNK_ALIGNMENT;
+    chunkSize = chunkSize == 0 ? CHUNK_ALIGNMENT : chunkSize;
+
+    JobSystem::ParallelFor(
+        pState->mCount, chunkSize,
+        [](void *pUserData, uint32_t begin, uint32_t end)
+        {
+            const InterpolateJob *pJob = static_cast<const InterpolateJob *>(pUserData);
+            const Snapshot *pSnapshot = pJob->pSnapshot;
+            SphereState *pState = pJob->pState;
+            for (uint32_t i = begin; i < end; i++)
+            {
+                const float *pCurrent = pSnapshot->mCurrent.pPositionScale + i * 4;
+                // Respawn always draws a new size.
+                const float t = pSnapshot->pPreviousSize[i] == pCurrent[3] ? pJob->mAlpha : 1.0f;
+                const float x = pSnapshot->pPreviousX[i] + t * (pCurrent[0] - pSnapshot->pPreviousX[i]);
+                const float y = pSnapshot->pPreviousY[i] + t * (pCurrent[1] - pSnapshot->pPreviousY[i]);
+                const float z = pSnapshot->pPreviousZ[i] + t * (pCurrent[2] - pSnapshot->pPreviousZ[i]);
+
+                pState->pPositionX[i] = x;
+                pState->pPositionY[i] = y;
+                pState->pPositionZ[i] = z;
+                pState->pSize[i] = pCurrent[3];
+
+                float *pPositionScale = pJob->pOutput->pPositionScale + i * 4;
+                pPositionScale[0] = x;
+                pPositionScale[1] = y;
+                pPositionScale[2] = z;
+                pPositionScale[3] = pCurrent[3];
+                pJob->pOutput->pColor[i] = pSnapshot->mCurrent.pColor[i];
+            }
+        },
+        &job);
+}
+
+void SphereSimulation::AddCollisionState(CollisionState *pCollision, uint32_t capacity)
+{
+    const uint32_t paddedCapacity = (capacity + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+    const uint32_t maxChunkCount = (capacity + CHUNK_ALIGNMENT - 1) / CHUNK_ALIGNMENT;
+
+    *pCollision = {};
+    pCollision->mCapacity = capacity;
+    const uint32_t maxResolution = GetGridResolution(capacity, 0.0f);
+    const uint32_t maxCellCount = maxResolution * maxResolution * maxResolution;
+    pCollision->pChunkMaxRadius = AllocateArray<float>(MAX_GRID_CHUNKS);
+    pCollision->pCell = AllocateArray<uint32_t>(paddedCapacity);
+    // Fewer cells come with more chunks, but never with more cells over all chunks than this.
+    pCollision->pChunkCellCount = AllocateArray<uint32_t>(
+        MAX_GRID_CHUNKS * maxCellCount < MAX_GRID_CHUNK_CELLS ? MAX_GRID_CHUNKS * maxCellCount : MAX_GRID_CHUNK_CELLS);
+    pCollision->pCellStart = AllocateArray<uint32_t>(maxCellCount + 1);
+    pCollision->pSorted = AllocateArray<uint32_t>(paddedCapacity);
+    // The overlap kernels read up to a vector past the last sphere.
+    pCollision->pSortedX = AllocateArray<float>(paddedCapacity + SIMD_WIDTH);
+    pCollision->pSortedY = AllocateArray<float>(paddedCapacity + SIMD_WIDTH);
+    pCollision->pSortedZ = AllocateArray<float>(paddedCapacity + SIMD_WIDTH);
+    pCollision->pSortedRadius = AllocateArray<float>(paddedCapacity + SIMD_WIDTH);
+    pCollision->pSortedSpeedX = AllocateArray<float>(paddedCapacity);
+    pCollision->pSortedSpeedY = AllocateArray<float>(paddedCapacity);
+    pCollision->pSortedSpeedZ = AllocateArray<float>(paddedCapacity);
+    pCollision->pChunkPairTests = AllocateArray<uint64_t>(maxChunkCount);
+    pCollision->pChunkContacts = AllocateArray<uint64_t>(maxChunkCount);
+}
+
+void SphereSimulation::RemoveCollisionState(CollisionState *pCollision)
+{
+    FreeArray(pCollision->pChunkMaxRadius);
+    FreeArray(pCollision->pCell);
+    FreeArray(pCollision->pChunkCellCount);
+    FreeArray(pCollision->pCellStart);
+    FreeArray(pCollision->pSorted);
+    FreeArray(pCollision->pSortedX);
+    FreeArray(pCollision->pSortedY);
+    FreeArray(pCollision->pSortedZ);
+    FreeArray(pCollision->pSortedRadius);
+    FreeArray(pCollision->pSortedSpeedX);
+    FreeArray(pCollision->pSortedSpeedY);
+    FreeArray(pCollision->pSortedSpeedZ);
+    FreeArray(pCollision->pChunkPairTests);
+    FreeArray(pCollision->pChunkContacts);
+    *pCollision = {};
+}
+
+void SphereSimulation::Collide(SphereState *pState, CollisionState *pCollision, uint32_t chunkSize,
+                               CollisionStats *pStats)
+{
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point start = Clock::now();
+
+    const uint32_t count = pState->mCount < pCollision->mCapacity ? pState->mCount : pCollision->mCapacity;
+    chunkSize = (chunkSize + CHUNK_ALIGNMENT - 1) / CHUNK_ALIGNMENT * CHUNK_ALIGNMENT;
+    chunkSize = chunkSize == 0 ? CHUNK_ALIGNMENT : chunkSize;
+    // Never smaller than DEFAULT_CHUNK_SIZE, so a few thousand spheres do not pay for clearing and summing
+    // MAX_GRID_CHUNKS rows of cells.
+    uint32_t radiusChunkSize = (count + MAX_GRID_CHUNKS - 1) / MAX_GRID_CHUNKS;
+    radiusChunkSize = radiusChunkSize > DEFAULT_CHUNK_SIZE ? radiusChunkSize : DEFAULT_CHUNK_SIZE;
+    radiusChunkSize = (radiusChunkSize + CHUNK_ALIGNMENT - 1) / CHUNK_ALIGNMENT * CHUNK_ALIGNMENT;
+
+    struct CollideJob
+    {
+        SphereState *pState;
+        CollisionState *pCollision;
+        uint32_t mGridChunkSize;
+        uint32_t mGridChunkCount;
+        uint32_t mCellCount;
+        uint32_t mChunkSize;
+        OverlapFunc pOverlap;
+    } job = {pState, pCollision, radiusChunkSize, 0, 0, chunkSize, GetOverlapFunc(gKernel)};
+
+    // The maximum does not depend on the order, so the grid comes out the same for any chunking.
+    JobSystem::ParallelFor(
+        count, radiusChunkSize,
+        [](void *pUserData, uint32_t begin, uint32_t end)
+        {
+            const CollideJob *pJob = static_cast<const CollideJob *>(pUserData);
+            for (uint32_t chunkBegin = begin; chunkBegin < end; chunkBegin += pJob->mGridChunkSize)
+            {
+                const uint32_t chunkEnd =
+                    chunkBegin + pJob->mGridChunkSize < end ? chunkBegin + pJob->mGridChunkSize : end;
+                float maxRadius = 0.0f;
+                for (uint32_t i = chunkBegin; i < chunkEnd; i++)
+                {
+                    const float radius = pJob->pState->pSize[i];
+                    maxRadius = radius > maxRadius ? radius : maxRadius;
+                }
+                pJob->pCollision->pChunkMaxRadius[chunkBegin / pJob->mGridChunkSize] = maxRadius;
+            }
+        },
+        &job);
+
+    pCollision->mMaxRadius = 0.0f;
+    for (uint32_t chunk = 0; chunk < (count + radiusChunkSize - 1) / radiusChunkSize; chunk++)
+    {
+        const float radius = pCollision->pChunkMaxRadius[chunk];
+        pCollision->mMaxRadius = radius > pCollision->mMaxRadius ? radius : pCollision->mMaxRadius;
+    }
+    pCollision->mResolution = GetGridResolution(count, pCollision->mMaxRadius);
+    pCollision->mCellSize = 2.0f * BOUNDS / static_cast<float>(pCollision->mResolution);
+    const uint32_t cellCount = pCollision->mResolution * pCollision->mResolution * pCollision->mResolution;
+
+    // Fine grids are counted in fewer, larger chunks.
+    const uint32_t gridChunkCount = GetGridChunkCount(cellCount);
+    uint32_t gridChunkSize = (count + gridChunkCount - 1) / gridChunkCount;
+    gridChunkSize = gridChunkSize > radiusChunkSize ? gridChunkSize : radiusChunkSize;
+    gridChunkSize = (gridChunkSize + CHUNK_ALIGNMENT - 1) / CHUNK_ALIGNMENT * CHUNK_ALIGNMENT;
+    job.mGridChunkSize = gridChunkSize;
+    job.mGridChunkCount = (count + gridChunkSize - 1) / gridChunkSize;
+    job.mCellCount = cellCount;
+
+    // Counting sort by cell. Each chunk counts its spheres per cell, the counts are turned into where each chunk's
+    // spheres of a cell start, and each chunk scatters its spheres there. The sorted order is cell by cell, in
+    // ascending sphere index within a cell, whatever the chunking. A job may get several chunks, and with a single
+    // thread gets them all.
+    JobSystem::ParallelFor(
+        count, gridChunkSize,
+        [](void *pUserData, uint32_t begin, uint32_t end)
+        {
+            const CollideJob *pJob = static_cast<const CollideJob *>(pUserData);
+            const SphereState *pState = pJob->pState;
+            CollisionState *pCollision = pJob->pCollision;
+            for (uint32_t chunkBegin = begin; chunkBegin < end; chunkBegin += pJob->mGridChunkSize)
+            {
+                const uint32_t chunkEnd =
+                    chunkBegin + pJob->mGridChunkSize < end ? chunkBegin + pJob->mGridChunkSize : end;
+                uint32_t *pCellCount =
+                    pCollision->pChunkCellCount + chunkBegin / pJob->mGridChunkSize * pJob->mCellCount;
+                memset(pCellCount, 0, sizeof(uint32_t) * pJob->mCellCount);
+                const uint32_t resolution = pCollision->mResolution;
+                for (uint32_t i = chunkBegin; i < chunkEnd; i++)
+                {
+                    const uint32_t cell = (GetCellCoordinate(pCollision, pState->pPositionZ[i]) * resolution +
+                                           GetCellCoordinate(pCollision, pState->pPositionY[i])) *
+                                              resolution +
+                                          GetCellCoordinate(pCollision, pState->pPositionX[i]);
+                    pCollision->pCell[i] = cell;
+                    pCellCount[cell]++;
+                }
+            }
+        },
+        &job);
+
+    // Both passes walk the chunk rows front to back over a range of cells rather than down the chunks cell by cell.
+    JobSystem::ParallelFor(
+        cellCount, CELL_CHUNK_SIZE,
+        [](void *pUserData, uint32_t begin, uint32_t end)
+        {
+            const CollideJob *pJob = static_cast<const CollideJob *>(pUserData);
+            CollisionState *pCollision = pJob->pCollision;
+            memset(pCollision->pCellStart + begin, 0, sizeof(uint32_t) * (end - begin));
+            for (uint32_t chunk = 0; chunk < pJob->mGridChunkCount; chunk++)
+            {
+                const uint32_t *pCellCount = pCollision->pChunkCellCount + chunk * pJob->mCellCount;
+                for (uint32_t cell = begin; cell < end; cell++)
+                {
+                    pCollision->pCellStart[cell] += pCellCount[cell];
+                }
+            }
+        },
+        &job);
+
+    uint32_t first = 0;
+    for (uint32_t cell = 0; cell < cellCount; cell++)
+    {
+        const uint32_t total = pCollision->pCellStart[cell];
+        pCollision->pCellStart[cell] = first;
+        first += total;
+    }
+    pCollision->pCellStart[cellCount] = first;
+
+    JobSystem::ParallelFor(
+        cellCount, CELL_CHUNK_SIZE,
+        [](void *pUserData, uint32_t begin, uint32_t end)
+        {
+            const CollideJob *pJob = static_cast<const CollideJob *>(pUserData);
+            CollisionState *pCollision = pJob->pCollision;
+            uint32_t next[CELL_CHUNK_SIZE];
+            for (uint32_t blockBegin = begin; blockBegin < end; blockBegin += CELL_CHUNK_SIZE)
+            {
+                const uint32_t blockSize = end - blockBegin < CELL_CHUNK_SIZE ? end - blockBegin : CELL_CHUNK_SIZE;
+                memcpy(next, pCollision->pCellStart + blockBegin, sizeof(uint32_t) * blockSize);
+                for (uint32_t chunk = 0; chunk < pJob->mGridChunkCount; chunk++)
+                {
+                    uint32_t *pCellCount = pCollision->pChunkCellCount + chunk * pJob->mCellCount + blockBegin;
+                    for (uint32_t cell = 0; cell < blockSize; cell++)
+                    {
+                        const uint32_t cellCount = pCellCount[cell];
+                        pCellCount[cell] = next[cell];
+                        next[cell] += cellCount;
+                    }
+                }
+            }
+        },
+        &job);
+
+    JobSystem::ParallelFor(
+        count, gridChunkSize,
+        [](void *pUserData, uint32_t begin, uint32_t end)
+        {
+            const CollideJob *pJob = static_cast<const CollideJob *>(pUserData);
+            CollisionState *pCollision = pJob->pCollision;
+            for (uint32_t chunkBegin = begin; chunkBegin < end; chunkBegin += pJob->mGridChunkSize)
+            {
+                const uint32_t chunkEnd =
+                    chunkBegin + pJob->mGridChunkSize < end ? chunkBegin + pJob->mGridChunkSize : end;
+                uint32_t *pCellNext =
+                    pCollision->pChunkCellCount + chunkBegin / pJob->mGridChunkSize * pJob->mCellCount;
+                for (uint32_t i = chunkBegin; i < chunkEnd; i++)
+                {
+                    pCollision->pSorted[pCellNext[pCollision->pCell[i]]++] = i;
+                }
+            }
+        },
+        &job);
+
+    // Gathered in a pass of its own, which writes front to back instead of scattering to seven more arrays.
+    JobSystem::ParallelFor(
+        count, chunkSize,
+        [](void *pUserData, uint32_t begin, uint32_t end)
+        {
+            const CollideJob *pJob = static_cast<const CollideJob *>(pUserData);
+            const SphereState *pState = pJob->pState;
+            CollisionState *pCollision = pJob->pCollision;
+            for (uint32_t k = begin; k < end; k++)
+            {
+                const uint32_t i = pCollision->pSorted[k];
+                pCollision->pSortedX[k] = pState->pPositionX[i];
+                pCollision->pSortedY[k] = pState->pPositionY[i];
+                pCollision->pSortedZ[k] = pState->pPositionZ[i];
+                pCollision->pSortedRadius[k] = pState->pSize[i];
+                pCollision->pSortedSpeedX[k] = pState->pSpeedX[i];
+                pCollision->pSortedSpeedY[k] = pState->pSpeedY[i];
+                pCollision->pSortedSpeedZ[k] = pState->pSpeedZ[i];
+            }
+        },
+        &job);
+
+    const Clock::time_point sorted = Clock::now();
+
+    // Run in cell order, so neighbouring jobs read mostly the same candidates.
+    JobSystem::ParallelFor(
+        count, chunkSize,
+        [](void *pUserData, uint32_t begin, uint32_t end)
+        {
+            const CollideJob *pJob = static_cast<const CollideJob *>(pUserData);
+            const CollisionState *pCollision = pJob->pCollision;
+            for (uint32_t chunkBegin = begin; chunkBegin < end; chunkBegin += pJob->mChunkSize)
+            {
+                const uint32_t chunkEnd = chunkBegin + pJob->mChunkSize < end ? chunkBegin + pJob->mChunkSize : end;
+                uint64_t pairTests = 0;
+                uint64_t contacts = 0;
+                for (uint32_t k = chunkBegin; k < chunkEnd; k++)
+                {
+                    CollideSphere(pCollision, pJob->pOverlap, k, pJob->pState, &pairTests, &contacts);
+                }
+                pCollision->pChunkPairTests[chunkBegin / pJob->mChunkSize] = pairTests;
+                pCollision->pChunkContacts[chunkBegin / pJob->mChunkSize] = contacts;
+            }
+        },
+        &job);
+
+    if (pStats)
+    {
+        // Every pair was seen from both of its spheres.
+        const uint32_t chunkCount = (count + chunkSize - 1) / chunkSize;
+        *pStats = {};
+        for (uint32_t chunk = 0; chunk < chunkCount; chunk++)
+        {
+            pStats->mPairTests += pCollision->pChunkPairTests[chunk];
+            pStats->mContacts += pCollision->pChunkContacts[chunk];
+        }
+        pStats->mPairTests /= 2;
+        pStats->mContacts /= 2;
+        pStats->mBroadphaseTime = std::chrono::duration<float, std::milli>(sorted - start).count();
+        pStats->mNarrowphaseTime = std::chrono::duration<float, std::milli>(Clock::now() - sorted).count();
+        pStats->mGridResolution = pCollision->mResolution;
+    }
+}
+
+void SphereSimulation::AddCullState(CullState *pCull, uint32_t capacity)
+{
+    const uint32_t paddedCapacity = (capacity + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+    const uint32_t maxChunkCount = (capacity + CHUNK_ALIGNMENT - 1) / CHUNK_ALIGNMENT;
+
+    *pCull = {};
+    pCull->mCapacity = capacity;
+    pCull->pLod = AllocateArray<uint8_t>(paddedCapacity);
+    for (uint32_t view = 0; view < MAX_CULL_VIEWS; view++)
+    {
+        for (uint32_t lod = 0; lod < MAX_LODS; lod++)
+        {
+            pCull->mVisible.pIndices[view][lod] = AllocateArray<uint32_t>(paddedCapacity);
+        }
+    }
+    pCull->pChunkVisibleCount = AllocateArray<VisibleCounts>(maxChunkCount);
+}
+
+void SphereSimulation::RemoveCullState(CullState *pCull)
+{
+    FreeArray(pCull->pLod);
+    for (uint32_t view = 0; view < MAX_CULL_VIEWS; view++)
+    {
+        for (uint32_t lod = 0; lod < MAX_LODS; lod++)
+        {
+            FreeArray(pCull->mVisible.pIndices[view][lod]);
+        }
+    }
+    FreeArray(pCull->pChunkVisibleCount);
+    *pCull = {};
+}
+
+void SphereSimulation::Cull(const SphereState *pState, const CullDesc *pDesc, uint32_t begin, uint32_t end,
+                            uint8_t *pLod, const VisibleLists *pVisible, VisibleCounts *pCount)
+{
+    GetCullFunc(gKernel)(pState, pDesc, begin, end, pLod, pVisible, pCount);
+}
+
+void SphereSimulation::CullViews(const SphereState *pState, CullState *pCull, const CullDesc *pDesc,
+                                 uint32_t *const *ppOutput, VisibleCounts *pCount, uint32_t chunkSize)
+{
+    chunkSize = (chunkSize + CHUNK_ALIGNMENT - 1) / CHUNK_ALIGNMENT * CHUNK_ALIGNMENT;
+    chunkSize = chunkSize == 0 ? CHUNK_ALIGNMENT : chunkSize;
+
+    struct CullJob
+    {
+        const SphereState *pState;
+        CullState *pCull;
+        const CullDesc *pDesc;
+        uint32_t mChunkSize;
+        CullFunc pCullFunc;
+    } job = {pState, pCull, pDesc, chunkSize, GetCullFunc(gKernel)};
+
+    JobSystem::ParallelFor(
+        pState->mCount, chunkSize,
+        [](void *pUserData, uint32_t begin, uint32_t end)
+        {
+            const CullJob *pJob = static_cast<const CullJob *>(pUserData);
+            // ParallelFor runs the whole range as one call on a single thread, so every chunk in it gets its own
+            // lists and count, as the packing below expects.
+            for (uint32_t chunkBegin = begin; chunkBegin < end; chunkBegin += pJob->mChunkSize)
+            {
+                const uint32_t chunkEnd = chunkBegin + pJob->mChunkSize < end ? chunkBegin + pJob->mChunkSize : end;
+                VisibleLists visible = {};
+                for (uint32_t view = 0; view < pJob->pDesc->mViewCount; view++)
+                {
+                    for (uint32_t lod = 0; lod < pJob->pDesc->mLod.mLodCount; lod++)
+                    {
+                        visible.pIndices[view][lod] = pJob->pCull->mVisible.pIndices[view][lod] + chunkBegin;
+                    }
+                }
+
+                VisibleCounts *pChunkCount = pJob->pCull->pChunkVisibleCount + chunkBegin / pJob->mChunkSize;
+                *pChunkCount = {};
+                pJob->pCullFunc(pJob->pState, pJob->pDesc, chunkBegin, chunkEnd, pJob->pCull->pLod, &visible,
+                                pChunkCount);
+            }
+        },
+        &job);
+
+    // Packed serially. ppOutput is usually write-combined GPU memory, so it is only ever written front to back.
+    const uint32_t chunkCount = (pState->mCount + chunkSize - 1) / chunkSize;
+    *pCount = {};
+    for (uint32_t view = 0; view < pDesc->mViewCount; view++)
+    {
+        uint32_t *pOutput = ppOutput[view];
+        for (uint32_t lod = 0; lod < pDesc->mLod.mLodCount; lod++)
+        {
+            uint32_t total = 0;
+            for (uint32_t chunk = 0; chunk < chunkCount; chunk++)
+            {
+                const uint32_t count = pCull->pChunkVisibleCount[chunk].mCount[view][lod];
+                memcpy(pOutput, pCull->mVisible.pIndices[view][lod] + chunk * chunkSize, count * sizeof(uint32_t));
+                pOutput += count;
+                total += count;
+            }
+            pCount->mCount[view][lod] = total;
+        }
+    }
+}
+
+uint64_t SphereSimulation::HashState(const SphereState *pState)
+{
+    // FNV-1a over 32-bit words. Only compares runs, nothing depends on its distribution.
+    uint64_t hash = 0xCBF29CE484222325ull;
+    const auto mix = [&hash](const void *pData, uint32_t count)
+    {
+        const unsigned char *pBytes = static_cast<const unsigned char *>(pData);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint32_t word = 0;
+            memcpy(&word, pBytes + i * sizeof(uint32_t), sizeof(word));
+            hash = (hash ^ word) * 0x100000001B3ull;
+        }
+    };
+
+    mix(&pState->mStep, 1);
+    mix(pState->pPositionX, pState->mCapacity);
+    mix(pState->pPositionY, pState->mCapacity);
+    mix(pState->pPositionZ, pState->mCapacity);
+    mix(pState->pSpeedX, pState->mCapacity);
+    mix(pState->pSpeedY, pState->mCapacity);
+    mix(pState->pSpeedZ, pState->mCapacity);
+    mix(pState->pSize, pState->mCapacity);
+    mix(pState->pColor, pState->mCapacity);
+    return hash;
+}
+
+SphereSimulation::KernelType SphereSimulation::DetectKernel()
+{
+#if SPHERE_SIMULATION_X86
+    return SupportsAVX2() ? KernelType::AVX2 : KernelType::SSE;
+#else
+    return KernelType::Scalar;
+#endif
+}
+
+SphereSimulation::KernelType SphereSimulation::GetKernel() { return gKernel; }
+
+void SphereSimulation::SetKernel(KernelType kernel)
+{
+    const KernelType best = DetectKernel();
+    gKernel = static_cast<int>(kernel) <= static_cast<int>(best) ? kernel : best;
+}
+
+const char *SphereSimulation::GetKernelName(KernelType kernel)
+{
+    switch (kernel)
+    {
+    case KernelType::AVX2:
+        return "AVX2";
+    case KernelType::SSE:
+        return "SSE";
+    default:
+        return "Scalar";
+    }
+}
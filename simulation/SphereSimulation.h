@@ -0,0 +1,252 @@
+#ifndef SPHERE_SIMULATION_H
+#define SPHERE_SIMULATION_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace SphereSimulation
+{
+    // Half extent of the cube the spheres live in. Anything leaving it is respawned.
+    constexpr float BOUNDS = 200.0f;
+
+    enum class KernelType
+    {
+        Scalar,
+        SSE,
+        AVX2,
+    };
+
+    // Sphere state in structure-of-arrays form. Every array is SIMD_ALIGNMENT aligned and padded to a multiple of
+    // SIMD_WIDTH so the kernels can always run full-width over [0, mCapacity).
+    struct SphereState
+    {
+        uint32_t mCount = 0;
+        uint32_t mCapacity = 0;
+
+        // Random numbers are keyed on (mSeed, sphere index, mStep), so the result does not depend on which thread
+        // simulates which sphere.
+        uint64_t mSeed = 0;
+        uint32_t mStep = 0;
+
+        float *pPositionX = nullptr;
+        float *pPositionY = nullptr;
+        float *pPositionZ = nullptr;
+        float *pSpeedX = nullptr;
+        float *pSpeedY = nullptr;
+        float *pSpeedZ = nullptr;
+        float *pSize = nullptr;
+        uint32_t *pColor = nullptr; // RGBA8, red in the lowest byte.
+    };
+
+    // Where the kernel writes the per-instance render data, in the compact 20 bytes per instance layout the sphere
+    // shaders read. pPositionScale receives (x, y, z, size) per sphere, pColor the packed RGBA8 color.
+    struct InstanceOutput
+    {
+        float *pPositionScale = nullptr;
+        uint32_t *pColor = nullptr;
+    };
+
+    // Six planes (a, b, c, d) with the normals pointing inwards and normalized, so dot(abc, p) + d is the signed
+    // distance of p to the plane.
+    struct Frustum
+    {
+        float mPlanes[6][4];
+    };
+
+    struct CollisionStats
+    {
+        // Candidate pairs the narrowphase tested and pairs it found overlapping, each pair counted once.
+        uint64_t mPairTests = 0;
+        uint64_t mContacts = 0;
+        // Wall clock milliseconds spent building the grid and in the narrowphase with the impulse resolution.
+        float mBroadphaseTime = 0.0f;
+        float mNarrowphaseTime = 0.0f;
+        // Cells to an axis of the grid.
+        uint32_t mGridResolution = 0;
+    };
+
+    // One step as published by a simulation thread: where every sphere was before the step, in the SphereState
+    // layout, and the instance data after it. Renderers blend the two with Interpolate.
+    struct Snapshot
+    {
+        uint32_t mCount = 0;
+        uint32_t mCapacity = 0;
+        uint32_t mStep = 0;
+
+        float *pPreviousX = nullptr;
+        float *pPreviousY = nullptr;
+        float *pPreviousZ = nullptr;
+        float *pPreviousSize = nullptr;
+        InstanceOutput mCurrent;
+        // Of the Collide before the step, all zero if it had none.
+        CollisionStats mCollisions;
+    };
+
+    constexpr uint32_t MAX_CULL_VIEWS = 2;
+    constexpr uint32_t MAX_LODS = 4;
+
+    // Picks a LOD per sphere from its projected size as seen from one camera. The choice is shared by all views, each
+    // view only shifts it by its own bias.
+    struct LodDesc
+    {
+        float mCameraPosition[3] = {};
+        // Projected diameter in pixels is size * mPixelScale / distance.
+        float mPixelScale = 1.0f;
+        // Smallest projected diameter drawn with LOD 0 .. mLodCount - 2, descending. Anything smaller gets the last
+        // LOD.
+        float mThresholds[MAX_LODS - 1] = {};
+        uint32_t mLodCount = 1;
+        // A sphere only changes LOD once its size is this fraction past the threshold, so it does not flicker
+        // between two LODs.
+        float mHysteresis = 0.0f;
+        // Added to the LOD of each view, clamped to the coarsest.
+        uint32_t mBias[MAX_CULL_VIEWS] = {};
+    };
+
+    struct CullDesc
+    {
+        Frustum mFrusta[MAX_CULL_VIEWS];
+        uint32_t mViewCount = 0;
+        LodDesc mLod;
+    };
+
+    // Index lists per view and LOD.
+    struct VisibleLists
+    {
+        uint32_t *pIndices[MAX_CULL_VIEWS][MAX_LODS];
+    };
+
+    struct VisibleCounts
+    {
+        uint32_t mCount[MAX_CULL_VIEWS][MAX_LODS];
+    };
+
+    // LOD history and scratch space for CullViews. Every chunk compacts its visible spheres in place at its own
+    // offset, then the chunks are packed together.
+    struct CullState
+    {
+        uint32_t mCapacity = 0;
+        // Current LOD of each sphere, before the view bias.
+        uint8_t *pLod = nullptr;
+        VisibleLists mVisible = {};
+        // Visible spheres per chunk, view and LOD.
+        VisibleCounts *pChunkVisibleCount = nullptr;
+    };
+
+    // Largest sphere radius Spawn and Respawn produce.
+    constexpr float MAX_RADIUS = 10.0f;
+    // Collide sizes its grid every step from the sphere count and the largest radius in the state. Cells are made to
+    // hold about GRID_CELL_TARGET spheres, but are never wider than 2 * MAX_RADIUS, never narrower than half the
+    // largest radius and at most MAX_GRID_RESOLUTION to an axis. A sphere visits the cells within its own radius plus
+    // the largest one, so small spheres look at fewer candidates than large ones.
+    constexpr uint32_t GRID_CELL_TARGET = 4;
+    constexpr uint32_t MAX_GRID_RESOLUTION = 64;
+    // The grid is counted in at most this many chunks whatever the chunk size, and fine grids in fewer, so the chunks
+    // count at most MAX_GRID_CHUNK_CELLS cells together. That bounds pChunkCellCount.
+    constexpr uint32_t MAX_GRID_CHUNKS = 64;
+    constexpr uint32_t MAX_GRID_CHUNK_CELLS = 1u << 22;
+
+    // Uniform grid over the bounds for Collide, rebuilt every step by a counting sort of the spheres by cell.
+    struct CollisionState
+    {
+        uint32_t mCapacity = 0;
+        // Of the current step: cells to an axis, their width and the largest sphere radius.
+        uint32_t mResolution = 0;
+        float mCellSize = 0.0f;
+        float mMaxRadius = 0.0f;
+        // Largest radius per counting chunk.
+        float *pChunkMaxRadius = nullptr;
+        // Grid cell of each sphere.
+        uint32_t *pCell = nullptr;
+        // Spheres per counting chunk and cell, then where that chunk's spheres of the cell go in the sorted arrays.
+        uint32_t *pChunkCellCount = nullptr;
+        // First sorted sphere of each cell, mResolution^3 + 1 entries.
+        uint32_t *pCellStart = nullptr;
+        // Sphere index, position, radius and speed in cell order, so the candidates of a cell are contiguous.
+        uint32_t *pSorted = nullptr;
+        float *pSortedX = nullptr;
+        float *pSortedY = nullptr;
+        float *pSortedZ = nullptr;
+        float *pSortedRadius = nullptr;
+        float *pSortedSpeedX = nullptr;
+        float *pSortedSpeedY = nullptr;
+        float *pSortedSpeedZ = nullptr;
+        // Narrowphase pair tests and contacts per chunk.
+        uint64_t *pChunkPairTests = nullptr;
+        uint64_t *pChunkContacts = nullptr;
+    };
+
+    constexpr uint32_t SIMD_WIDTH = 8;
+    // Arrays start on a cache line and Step splits them on cache line boundaries, so no two threads write to the
+    // same line.
+    constexpr size_t SIMD_ALIGNMENT = 64;
+    constexpr uint32_t CHUNK_ALIGNMENT = SIMD_ALIGNMENT / sizeof(float);
+    constexpr uint32_t DEFAULT_CHUNK_SIZE = 4096;
+
+    void AddState(SphereState *pState, uint32_t capacity, uint64_t seed);
+    void RemoveState(SphereState *pState);
+
+    uint32_t PackColor(float r, float g, float b, float a);
+
+    // Fills [begin, end) with freshly spawned spheres.
+    void Spawn(SphereState *pState, uint32_t begin, uint32_t end);
+
+    // Advances [begin, end) by deltaTime, respawns any sphere that left the bounds and writes the instance data.
+    void Simulate(SphereState *pState, float deltaTime, uint32_t begin, uint32_t end, const InstanceOutput *pOutput);
+
+    // Simulates all mCount spheres on the job system in chunks of chunkSize (rounded up to CHUNK_ALIGNMENT), then
+    // advances mStep. The result is bit-identical to a single Simulate call over [0, mCount) for any chunk size and
+    // thread count.
+    void Step(SphereState *pState, float deltaTime, const InstanceOutput *pOutput, uint32_t chunkSize);
+
+    void AddSnapshot(Snapshot *pSnapshot, uint32_t capacity);
+    void RemoveSnapshot(Snapshot *pSnapshot);
+
+    // Copies the positions and sizes of the mCount spheres as the previous ones of pSnapshot, before the Step that
+    // writes pSnapshot->mCurrent.
+    void BeginSnapshot(const SphereState *pState, Snapshot *pSnapshot);
+
+    // Blends every sphere of pSnapshot from its previous to its current position by alpha in [0, 1] on the job
+    // system. A sphere whose size changed was respawned and is put at its current position instead of sliding across
+    // the bounds. Positions, sizes and mCount go to pState for culling, the instance data to pOutput.
+    void Interpolate(const Snapshot *pSnapshot, float alpha, SphereState *pState, const InstanceOutput *pOutput,
+                     uint32_t chunkSize);
+
+    void AddCollisionState(CollisionState *pCollision, uint32_t capacity);
+    void RemoveCollisionState(CollisionState *pCollision);
+
+    // Separates every overlapping pair of the mCount spheres and bounces the approaching ones off each other
+    // elastically, with the mass growing as the radius cubed. Each sphere sums up its contacts against the state
+    // before the call and only writes its own position and speed, so the chunks of chunkSize (rounded up to
+    // CHUNK_ALIGNMENT) run on the job system without locks and the result is bit-identical for any kernel, chunk size
+    // and thread count. pStats may be nullptr.
+    void Collide(SphereState *pState, CollisionState *pCollision, uint32_t chunkSize, CollisionStats *pStats);
+
+    void AddCullState(CullState *pCull, uint32_t capacity);
+    void RemoveCullState(CullState *pCull);
+
+    // Tests the spheres in [begin, end) against every view frustum and updates their LOD in pLod. The index of a
+    // sphere touching view v is appended to pVisible->pIndices[v][lod] at pCount->mCount[v][lod], which is advanced.
+    // Indices come out in ascending order.
+    void Cull(const SphereState *pState, const CullDesc *pDesc, uint32_t begin, uint32_t end, uint8_t *pLod,
+              const VisibleLists *pVisible, VisibleCounts *pCount);
+
+    // Culls all mCount spheres on the job system in chunks of chunkSize (rounded up to CHUNK_ALIGNMENT). ppOutput[v]
+    // receives the index lists of view v back to back in LOD order, pCount their lengths. The result matches a single
+    // Cull call over [0, mCount).
+    void CullViews(const SphereState *pState, CullState *pCull, const CullDesc *pDesc, uint32_t *const *ppOutput,
+                   VisibleCounts *pCount, uint32_t chunkSize);
+
+    // Hash of the sphere arrays over the whole capacity and of mStep. Two runs with the same seed and deltaTime
+    // sequence hash the same, whatever the kernel, chunk size or thread count.
+    uint64_t HashState(const SphereState *pState);
+
+    KernelType DetectKernel();
+    KernelType GetKernel();
+    // Overrides the kernel picked at startup. Falls back to the best supported kernel if the CPU lacks the requested
+    // instruction set.
+    void SetKernel(KernelType kernel);
+    const char *GetKernelName(KernelType kernel);
+} // namespace SphereSimulation
+
+#endif // SPHERE_SIMULATION_H
@@ -0,0 +1,168 @@
+#include "SphereSystems.h"
+
+namespace SphereSystems
+{
+    namespace
+    {
+        // Column of component in a chunk, as T.
+        template <typename T>
+        T *GetColumn(const EntityStorage::Chunk *pChunk, uint32_t component)
+        {
+            return static_cast<T *>(pChunk->pColumns[component]);
+        }
+
+        // The SphereState of the archetype a chunk belongs to, and the output moved on past the spheres of the
+        // archetypes before it, so that row i of the chunk lands at mFirst + i - mBegin.
+        void GetChunkState(const EntityStorage::Chunk *pChunk, const SphereComponents *pComponents,
+                           const SphereSimulation::InstanceOutput *pOutput, SphereSimulation::SphereState *pState,
+                           SphereSimulation::InstanceOutput *pChunkOutput)
+        {
+            pState->pPositionX = GetColumn<float>(pChunk, pComponents->mPositionX);
+            pState->pPositionY = GetColumn<float>(pChunk, pComponents->mPositionY);
+            pState->pPositionZ = GetColumn<float>(pChunk, pComponents->mPositionZ);
+            pState->pSpeedX = GetColumn<float>(pChunk, pComponents->mSpeedX);
+            pState->pSpeedY = GetColumn<float>(pChunk, pComponents->mSpeedY);
+            pState->pSpeedZ = GetColumn<float>(pChunk, pComponents->mSpeedZ);
+            pState->pSize = GetColumn<float>(pChunk, pComponents->mSize);
+            pState->pColor = GetColumn<uint32_t>(pChunk, pComponents->mColor);
+
+            const uint32_t shift = pChunk->mFirst - pChunk->mBegin;
+            pChunkOutput->pPositionScale = pOutput->pPositionScale + shift * 4;
+            pChunkOutput->pColor = pOutput->pColor + shift;
+        }
+    } // namespace
+} // namespace SphereSystems
+
+void SphereSystems::AddSphereComponents(EntityStorage::World *pWorld, SphereComponents *pComponents)
+{
+    pComponents->mPositionX = EntityStorage::AddComponentType(pWorld, sizeof(float));
+    pComponents->mPositionY = EntityStorage::AddComponentType(pWorld, sizeof(float));
+    pComponents->mPositionZ = EntityStorage::AddComponentType(pWorld, sizeof(float));
+    pComponents->mSpeedX = EntityStorage::AddComponentType(pWorld, sizeof(float));
+    pComponents->mSpeedY = EntityStorage::AddComponentType(pWorld, sizeof(float));
+    pComponents->mSpeedZ = EntityStorage::AddComponentType(pWorld, sizeof(float));
+    pComponents->mSize = EntityStorage::AddComponentType(pWorld, sizeof(float));
+    pComponents->mColor = EntityStorage::AddComponentType(pWorld, sizeof(uint32_t));
+    pComponents->mMask = (1u << pComponents->mPositionX) | (1u << pComponents->mPositionY) |
+                         (1u << pComponents->mPositionZ) | (1u << pComponents->mSpeedX) |
+                         (1u << pComponents->mSpeedY) | (1u << pComponents->mSpeedZ) | (1u << pComponents->mSize) |
+                         (1u << pComponents->mColor);
+}
+
+uint32_t SphereSystems::GetSphereArchetype(const EntityStorage::World *pWorld, const SphereComponents *pComponents)
+{
+    uint32_t sphereArchetype = EntityStorage::INVALID_INDEX;
+    for (uint32_t archetype = 0; archetype < pWorld->mArchetypeCount; archetype++)
+    {
+        if ((pWorld->mArchetypes[archetype].mComponentMask & pComponents->mMask) != pComponents->mMask)
+        {
+            continue;
+        }
+        if (sphereArchetype != EntityStorage::INVALID_INDEX)
+        {
+            return EntityStorage::INVALID_INDEX;
+        }
+        sphereArchetype = archetype;
+    }
+    return sphereArchetype;
+}
+
+void SphereSystems::GetSphereState(EntityStorage::World *pWorld, const SphereComponents *pComponents,
+                                   uint32_t archetype, SphereSimulation::SphereState *pState)
+{
+    const EntityStorage::Archetype &a = pWorld->mArchetypes[archetype];
+    pState->mCount = a.mCount;
+    pState->mCapacity = a.mCapacity;
+    pState->pPositionX = static_cast<float *>(a.pColumns[pComponents->mPositionX]);
+    pState->pPositionY = static_cast<float *>(a.pColumns[pComponents->mPositionY]);
+    pState->pPositionZ = static_cast<float *>(a.pColumns[pComponents->mPositionZ]);
+    pState->pSpeedX = static_cast<float *>(a.pColumns[pComponents->mSpeedX]);
+    pState->pSpeedY = static_cast<float *>(a.pColumns[pComponents->mSpeedY]);
+    pState->pSpeedZ = static_cast<float *>(a.pColumns[pComponents->mSpeedZ]);
+    pState->pSize = static_cast<float *>(a.pColumns[pComponents->mSize]);
+    pState->pColor = static_cast<uint32_t *>(a.pColumns[pComponents->mColor]);
+}
+
+uint64_t SphereSystems::GetArchetypeSeed(uint64_t seed, uint32_t archetype)
+{
+    return seed + static_cast<uint64_t>(archetype) * 0x9E3779B97F4A7C15ull;
+}
+
+void SphereSystems::Resize(EntityStorage::World *pWorld, const SphereComponents *pComponents, uint32_t archetype,
+                           uint32_t count, uint64_t seed)
+{
+    const uint32_t current = pWorld->mArchetypes[archetype].mCount;
+    if (count < current)
+    {
+        EntityStorage::DestroyLastEntities(pWorld, archetype, current - count);
+        return;
+    }
+    if (count == current)
+    {
+        return;
+    }
+
+    EntityStorage::CreateEntities(pWorld, archetype, count - current, nullptr);
+    SphereSimulation::SphereState state{};
+    GetSphereState(pWorld, pComponents, archetype, &state);
+    state.mSeed = GetArchetypeSeed(seed, archetype);
+    SphereSimulation::Spawn(&state, current, count);
+}
+
+void SphereSystems::Simulate(EntityStorage::World *pWorld, const SphereComponents *pComponents, uint64_t seed,
+                             uint32_t step, float deltaTime, const SphereSimulation::InstanceOutput *pOutput,
+                             uint32_t chunkSize)
+{
+    struct SimulateJob
+    {
+        const SphereComponents *pComponents;
+        uint64_t mSeed;
+        uint32_t mStep;
+        float mDeltaTime;
+        const SphereSimulation::InstanceOutput *pOutput;
+    } job = {pComponents, seed, step, deltaTime, pOutput};
+
+    EntityStorage::ForEachChunk(
+        pWorld, pComponents->mMask, chunkSize,
+        [](void *pUserData, const EntityStorage::Chunk *pChunk)
+        {
+            const SimulateJob *pJob = static_cast<const SimulateJob *>(pUserData);
+            SphereSimulation::SphereState state{};
+            SphereSimulation::InstanceOutput output{};
+            GetChunkState(pChunk, pJob->pComponents, pJob->pOutput, &state, &output);
+            state.mSeed = GetArchetypeSeed(pJob->mSeed, pChunk->mArchetype);
+            state.mStep = pJob->mStep;
+            SphereSimulation::Simulate(&state, pJob->mDeltaTime, pChunk->mBegin, pChunk->mEnd, &output);
+        },
+        &job);
+}
+
+void SphereSystems::PackInstances(EntityStorage::World *pWorld, const SphereComponents *pComponents,
+                                  const SphereSimulation::InstanceOutput *pOutput, uint32_t chunkSize)
+{
+    struct PackJob
+    {
+        const SphereComponents *pComponents;
+        const SphereSimulation::InstanceOutput *pOutput;
+    } job = {pComponents, pOutput};
+
+    EntityStorage::ForEachChunk(
+        pWorld, pComponents->mMask, chunkSize,
+        [](void *pUserData, const EntityStorage::Chunk *pChunk)
+        {
+            const PackJob *pJob = static_cast<const PackJob *>(pUserData);
+            SphereSimulation::SphereState state{};
+            SphereSimulation::InstanceOutput output{};
+            GetChunkState(pChunk, pJob->pComponents, pJob->pOutput, &state, &output);
+            for (uint32_t i = pChunk->mBegin; i < pChunk->mEnd; i++)
+            {
+                float *pPositionScale = output.pPositionScale + i * 4;
+                pPositionScale[0] = state.pPositionX[i];
+                pPositionScale[1] = state.pPositionY[i];
+                pPositionScale[2] = state.pPositionZ[i];
+                pPositionScale[3] = state.pSize[i];
+                output.pColor[i] = state.pColor[i];
+            }
+        },
+        &job);
+}
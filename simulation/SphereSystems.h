@@ -0,0 +1,56 @@
+#ifndef SPHERE_SYSTEMS_H
+#define SPHERE_SYSTEMS_H
+
+#include <cstdint>
+#include "EntityStorage.h"
+#include "SphereSimulation.h"
+
+namespace SphereSystems
+{
+    // Component types of a sphere, one per SphereState array, as registered in a world.
+    struct SphereComponents
+    {
+        uint32_t mPositionX;
+        uint32_t mPositionY;
+        uint32_t mPositionZ;
+        uint32_t mSpeedX;
+        uint32_t mSpeedY;
+        uint32_t mSpeedZ;
+        uint32_t mSize;
+        uint32_t mColor;
+        // All of the above. Any archetype with these is simulated and drawn as spheres, whatever else it has.
+        uint32_t mMask;
+    };
+
+    void AddSphereComponents(EntityStorage::World *pWorld, SphereComponents *pComponents);
+
+    // The one archetype of the world with the sphere components, EntityStorage::INVALID_INDEX if there are none or
+    // several. Collide, the snapshots, culling and the BVH take the single SphereState of GetSphereState, so a world
+    // feeding them has to keep all of its spheres in one archetype.
+    uint32_t GetSphereArchetype(const EntityStorage::World *pWorld, const SphereComponents *pComponents);
+
+    // Points pState at the sphere columns of archetype, with its mCount and mCapacity. mSeed and mStep are left to the
+    // caller. Valid until entities of the archetype are created or destroyed.
+    void GetSphereState(EntityStorage::World *pWorld, const SphereComponents *pComponents, uint32_t archetype,
+                        SphereSimulation::SphereState *pState);
+
+    // Seed of the spheres of archetype. Archetype 0 keeps seed, so a world with one sphere archetype simulates exactly
+    // like a SphereState.
+    uint64_t GetArchetypeSeed(uint64_t seed, uint32_t archetype);
+
+    // Destroys the last spheres of archetype, or appends freshly spawned ones, until it holds count.
+    void Resize(EntityStorage::World *pWorld, const SphereComponents *pComponents, uint32_t archetype, uint32_t count,
+                uint64_t seed);
+
+    // Steps every sphere of the world by deltaTime as SphereSimulation::Step does, one job per chunk of chunkSize
+    // spheres, and packs its instance data into pOutput, the spheres of each archetype after those of the one before.
+    // The result of an archetype matches a Step of its SphereState at the same step and seed.
+    void Simulate(EntityStorage::World *pWorld, const SphereComponents *pComponents, uint64_t seed, uint32_t step,
+                  float deltaTime, const SphereSimulation::InstanceOutput *pOutput, uint32_t chunkSize);
+
+    // Packs the instance data of every sphere into pOutput in the order Simulate writes it, without moving them.
+    void PackInstances(EntityStorage::World *pWorld, const SphereComponents *pComponents,
+                       const SphereSimulation::InstanceOutput *pOutput, uint32_t chunkSize);
+} // namespace SphereSystems
+
+#endif // SPHERE_SYSTEMS_H
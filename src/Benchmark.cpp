@@ -0,0 +1,304 @@
+#include "Benchmark.h"
+
+#include <IFileSystem.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+// Forge allocators, as in the rest of src. Last, it redefines the allocation functions.
+#include <IMemory.h>
+
+namespace Benchmark
+{
+    namespace
+    {
+        BenchmarkSettings gSettings = {};
+        // Frames ended so far, warm-up included.
+        uint32_t gFrame = 0;
+        // mFrameCount samples per phase. A phase without a sample in some frame keeps NaN there and is skipped.
+        float *pSamples[PHASE_COUNT] = {};
+        StartupTimes gStartupTimes = {};
+        PresentTiming gPresentTiming = PRESENT_TIMING_GPU_DONE;
+
+        // Sums over the measured frames, per phase.
+        struct StatisticsSum
+        {
+            uint32_t mCount;
+            double mVertexInvocations;
+            double mPrimitives;
+            double mFragmentInvocations;
+        };
+        StatisticsSum gStatistics[PHASE_COUNT] = {};
+
+        struct Summary
+        {
+            uint32_t mCount;
+            float mMin;
+            float mMean;
+            float mP50;
+            float mP95;
+            float mP99;
+            float mMax;
+        };
+
+        // Nearest-rank percentile of the sorted samples.
+        float Percentile(const float *pSorted, uint32_t count, float percent)
+        {
+            uint32_t rank = static_cast<uint32_t>(percent / 100.0f * static_cast<float>(count) + 0.999999f);
+            rank = rank < 1 ? 1 : (rank > count ? count : rank);
+            return pSorted[rank - 1];
+        }
+
+        Summary Summarize(Phase phase, float *pScratch)
+        {
+            Summary summary = {};
+            for (uint32_t i = 0; i < gSettings.mFrameCount; i++)
+            {
+                const float sample = pSamples[phase][i];
+                if (!std::isnan(sample))
+                {
+                    pScratch[summary.mCount++] = sample;
+                }
+            }
+            if (summary.mCount == 0)
+            {
+                return summary;
+            }
+
+            std::sort(pScratch, pScratch + summary.mCount);
+            double sum = 0.0;
+            for (uint32_t i = 0; i < summary.mCount; i++)
+            {
+                sum += pScratch[i];
+            }
+            summary.mMin = pScratch[0];
+            summary.mMean = static_cast<float>(sum / summary.mCount);
+            summary.mP50 = Percentile(pScratch, summary.mCount, 50.0f);
+            summary.mP95 = Percentile(pScratch, summary.mCount, 95.0f);
+            summary.mP99 = Percentile(pScratch, summary.mCount, 99.0f);
+            summary.mMax = pScratch[summary.mCount - 1];
+            return summary;
+        }
+    } // namespace
+} // namespace Benchmark
+
+void Benchmark::Init(const BenchmarkSettings *pSettings)
+{
+    gSettings = *pSettings;
+    gFrame = 0;
+    std::fill(gStatistics, gStatistics + PHASE_COUNT, StatisticsSum{});
+    if (gSettings.mFrameCount == 0)
+    {
+        return;
+    }
+
+    for (uint32_t phase = 0; phase < PHASE_COUNT; phase++)
+    {
+        pSamples[phase] = static_cast<float *>(tf_malloc(sizeof(float) * gSettings.mFrameCount));
+        std::fill(pSamples[phase], pSamples[phase] + gSettings.mFrameCount, NAN);
+    }
+}
+
+void Benchmark::Exit()
+{
+    for (uint32_t phase = 0; phase < PHASE_COUNT; phase++)
+    {
+        tf_free(pSamples[phase]);
+        pSamples[phase] = nullptr;
+    }
+    gSettings = {};
+}
+
+bool Benchmark::IsEnabled() { return gSettings.mFrameCount != 0; }
+
+void Benchmark::AddTime(Phase phase, float milliseconds)
+{
+    if (!IsEnabled() || gFrame < gSettings.mWarmupFrames)
+    {
+        return;
+    }
+
+    const uint32_t frame = gFrame - gSettings.mWarmupFrames;
+    if (frame < gSettings.mFrameCount)
+    {
+        pSamples[phase][frame] = milliseconds;
+    }
+}
+
+void Benchmark::AddPipelineStatistics(Phase phase, uint64_t vertexInvocations, uint64_t primitives,
+                                      uint64_t fragmentInvocations)
+{
+    if (!IsEnabled() || gFrame < gSettings.mWarmupFrames || gFrame >= gSettings.mWarmupFrames + gSettings.mFrameCount)
+    {
+        return;
+    }
+
+    StatisticsSum &sum = gStatistics[phase];
+    sum.mCount++;
+    sum.mVertexInvocations += static_cast<double>(vertexInvocations);
+    sum.mPrimitives += static_cast<double>(primitives);
+    sum.mFragmentInvocations += static_cast<double>(fragmentInvocations);
+}
+
+bool Benchmark::EndFrame()
+{
+    if (!IsEnabled())
+    {
+        return false;
+    }
+
+    gFrame++;
+    return gFrame == gSettings.mWarmupFrames + gSettings.mFrameCount;
+}
+
+void Benchmark::SetStartupTimes(const StartupTimes *pTimes) { gStartupTimes = *pTimes; }
+
+void Benchmark::SetPresentTiming(PresentTiming timing) { gPresentTiming = timing; }
+
+bool Benchmark::WriteResults(const SceneSettings *pSceneSettings, const FrameSettings *pFrameSettings)
+{
+    float *pScratch = static_cast<float *>(tf_malloc(sizeof(float) * gSettings.mFrameCount));
+    Summary summaries[PHASE_COUNT];
+    for (uint32_t phase = 0; phase < PHASE_COUNT; phase++)
+    {
+        summaries[phase] = Summarize(static_cast<Phase>(phase), pScratch);
+    }
+    tf_free(pScratch);
+
+    char fileName[FS_MAX_PATH] = {};
+    snprintf(fileName, sizeof(fileName), "%s.json", gSettings.pOutputPath);
+    FileStream json = {};
+    if (!fsOpenStreamFromPath(RD_OTHER_FILES, fileName, FM_WRITE, &json))
+    {
+        return false;
+    }
+    fsPrintToStream(&json, "{\n");
+    fsPrintToStream(&json, "  \"frames\": %u,\n", gSettings.mFrameCount);
+    fsPrintToStream(&json, "  \"warmupFrames\": %u,\n", gSettings.mWarmupFrames);
+    fsPrintToStream(&json, "  \"spheres\": %u,\n", pSceneSettings->mSphereCount);
+    fsPrintToStream(&json, "  \"fixedTimestep\": %g,\n", pSceneSettings->mFixedDeltaTime);
+    fsPrintToStream(&json, "  \"seed\": %llu,\n", static_cast<unsigned long long>(pSceneSettings->mSeed));
+    fsPrintToStream(&json, "  \"gpuSimulation\": %s,\n", pSceneSettings->mGpuSimulation ? "true" : "false");
+    fsPrintToStream(&json, "  \"gpuCulling\": %s,\n", pSceneSettings->mGpuCulling ? "true" : "false");
+    fsPrintToStream(&json, "  \"impostors\": %s,\n", pSceneSettings->mImpostors ? "true" : "false");
+    fsPrintToStream(&json, "  \"framesInFlight\": %u,\n", pFrameSettings->mFramesInFlight);
+    fsPrintToStream(&json, "  \"framePacing\": \"%s\",\n",
+                    pFrameSettings->mPacing == FramePacing::LowLatency ? "low-latency" : "throughput");
+    fsPrintToStream(&json, "  \"presentTiming\": \"%s\",\n",
+                    gPresentTiming == PRESENT_TIMING_DISPLAY ? "display" : "gpuDone");
+    fsPrintToStream(&json, "  \"unit\": \"ms\",\n");
+    fsPrintToStream(&json,
+                    "  \"startup\": {\"pipelineCache\": \"%s\", \"init\": %.4f, \"load\": %.4f, \"firstFrame\": %.4f, "
+                    "\"resident\": %.4f},\n",
+                    gStartupTimes.mWarmPipelineCache ? "warm" : "cold", gStartupTimes.mInit, gStartupTimes.mLoad,
+                    gStartupTimes.mFirstFrame, gStartupTimes.mResident);
+    fsPrintToStream(&json, "  \"phases\": {\n");
+    for (uint32_t phase = 0; phase < PHASE_COUNT; phase++)
+    {
+        const Summary &s = summaries[phase];
+        fsPrintToStream(&json,
+                        "    \"%s\": {\"samples\": %u, \"min\": %.4f, \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, "
+                        "\"p99\": %.4f, \"max\": %.4f}%s\n",
+                        GetPhaseName(static_cast<Phase>(phase)), s.mCount, s.mMin, s.mMean, s.mP50, s.mP95, s.mP99,
+                        s.mMax, phase + 1 < PHASE_COUNT ? "," : "");
+    }
+    fsPrintToStream(&json, "  },\n");
+    // Means per frame, only for the draws the device collected statistics for.
+    fsPrintToStream(&json, "  \"pipelineStatistics\": {");
+    const char *pSeparator = "\n";
+    for (uint32_t phase = 0; phase < PHASE_COUNT; phase++)
+    {
+        const StatisticsSum &sum = gStatistics[phase];
+        if (sum.mCount == 0)
+        {
+            continue;
+        }
+        fsPrintToStream(&json,
+                        "%s    \"%s\": {\"samples\": %u, \"vertexInvocations\": %.1f, \"primitives\": %.1f, "
+                        "\"fragmentInvocations\": %.1f}",
+                        pSeparator, GetPhaseName(static_cast<Phase>(phase)), sum.mCount,
+                        sum.mVertexInvocations / sum.mCount, sum.mPrimitives / sum.mCount,
+                        sum.mFragmentInvocations / sum.mCount);
+        pSeparator = ",\n";
+    }
+    fsPrintToStream(&json, "\n  }\n}\n");
+    fsCloseStream(&json);
+
+    snprintf(fileName, sizeof(fileName), "%s.csv", gSettings.pOutputPath);
+    FileStream csv = {};
+    if (!fsOpenStreamFromPath(RD_OTHER_FILES, fileName, FM_WRITE, &csv))
+    {
+        return false;
+    }
+    fsPrintToStream(&csv, "phase,samples,min_ms,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n");
+    for (uint32_t phase = 0; phase < PHASE_COUNT; phase++)
+    {
+        const Summary &s = summaries[phase];
+        fsPrintToStream(&csv, "%s,%u,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n", GetPhaseName(static_cast<Phase>(phase)),
+                        s.mCount, s.mMin, s.mMean, s.mP50, s.mP95, s.mP99, s.mMax);
+    }
+    fsCloseStream(&csv);
+
+    // One row per run, so cold and warm starts end up side by side.
+    const bool startupExists = fsFileExist(RD_OTHER_FILES, STARTUP_FILE_NAME);
+    FileStream startup = {};
+    if (!fsOpenStreamFromPath(RD_OTHER_FILES, STARTUP_FILE_NAME, FM_APPEND, &startup))
+    {
+        return false;
+    }
+    if (!startupExists)
+    {
+        fsPrintToStream(&startup, "run,pipeline_cache,init_ms,load_ms,first_frame_ms,resident_ms\n");
+    }
+    fsPrintToStream(&startup, "%s,%s,%.4f,%.4f,%.4f,%.4f\n", gSettings.pOutputPath,
+                    gStartupTimes.mWarmPipelineCache ? "warm" : "cold", gStartupTimes.mInit, gStartupTimes.mLoad,
+                    gStartupTimes.mFirstFrame, gStartupTimes.mResident);
+    fsCloseStream(&startup);
+
+    return true;
+}
+
+const char *Benchmark::GetPhaseName(Phase phase)
+{
+    switch (phase)
+    {
+    case PHASE_FRAME:
+        return "frame";
+    case PHASE_WAIT:
+        return "wait";
+    case PHASE_UPDATE:
+        return "update";
+    case PHASE_ACQUIRE:
+        return "acquire";
+    case PHASE_RECORD:
+        return "record";
+    case PHASE_SUBMIT:
+        return "submit";
+    case PHASE_GPU:
+        return "gpu";
+    case PHASE_INPUT_TO_GPU_DONE:
+        return "inputToGpuDone";
+    case PHASE_INPUT_TO_PRESENT:
+        return "inputToPresent";
+    case PHASE_GPU_SIMULATE:
+        return "gpuSimulate";
+    case PHASE_GPU_CULL:
+        return "gpuCull";
+    case PHASE_GPU_SHADOW:
+        return "gpuShadow";
+    case PHASE_GPU_SHADOW_SPHERES:
+        return "gpuShadowSpheres";
+    case PHASE_GPU_SHADOW_FLOOR:
+        return "gpuShadowFloor";
+    case PHASE_GPU_MAIN:
+        return "gpuMain";
+    case PHASE_GPU_MAIN_SPHERES:
+        return "gpuMainSpheres";
+    case PHASE_GPU_MAIN_FLOOR:
+        return "gpuMainFloor";
+    case PHASE_GPU_UI:
+        return "gpuUi";
+    default:
+        return "unknown";
+    }
+}
@@ -0,0 +1,99 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <cstdint>
+#include "Settings.h"
+
+namespace Benchmark
+{
+    enum Phase
+    {
+        // Whole frame, from the end of the previous Draw to the end of this one.
+        PHASE_FRAME,
+        // Waiting for the GPU to release the frame slot, and in low-latency pacing to finish the previous frame.
+        PHASE_WAIT,
+        PHASE_UPDATE,
+        PHASE_ACQUIRE,
+        PHASE_RECORD,
+        PHASE_SUBMIT,
+        // GPU time of the frame, as resolved by the GPU profiler.
+        PHASE_GPU,
+        // From sampling the input to the GPU finishing the frame that shows it. Presentation and scan-out come on top
+        // and are not measured.
+        PHASE_INPUT_TO_GPU_DONE,
+        // From sampling the input to the frame reaching the display, where the API reports it. See PresentTiming.
+        PHASE_INPUT_TO_PRESENT,
+        // GPU time of each pass and draw, from timestamp queries. See GpuTimers::Pass.
+        PHASE_GPU_SIMULATE,
+        PHASE_GPU_CULL,
+        PHASE_GPU_SHADOW,
+        PHASE_GPU_SHADOW_SPHERES,
+        PHASE_GPU_SHADOW_FLOOR,
+        PHASE_GPU_MAIN,
+        PHASE_GPU_MAIN_SPHERES,
+        PHASE_GPU_MAIN_FLOOR,
+        PHASE_GPU_UI,
+        PHASE_COUNT,
+    };
+
+    struct BenchmarkSettings
+    {
+        // Frames measured, 0 runs the app normally.
+        uint32_t mFrameCount = 0;
+        // Frames run before measuring, so shader compilation, caches and clocks have settled.
+        uint32_t mWarmupFrames = 60;
+        // Results are written to <pOutputPath>.json and <pOutputPath>.csv in the RD_OTHER_FILES directory, Benchmarks/.
+        const char *pOutputPath = "benchmark";
+    };
+
+    void Init(const BenchmarkSettings *pSettings);
+    void Exit();
+    bool IsEnabled();
+
+    // Records a time in milliseconds for the current frame. Ignored while warming up.
+    void AddTime(Phase phase, float milliseconds);
+    // Pipeline statistics of one draw in the current frame, reported as means over the measured frames. Ignored while
+    // warming up.
+    void AddPipelineStatistics(Phase phase, uint64_t vertexInvocations, uint64_t primitives,
+                               uint64_t fragmentInvocations);
+    // Returns true once the last measured frame has ended.
+    bool EndFrame();
+
+    // Milliseconds since MainApp::Init started, reported alongside the frame statistics.
+    struct StartupTimes
+    {
+        float mInit = 0.0f;
+        // Duration of the first MainApp::Load.
+        float mLoad = 0.0f;
+        // First frame presented.
+        float mFirstFrame = 0.0f;
+        // Every scene upload has completed.
+        float mResident = 0.0f;
+        bool mWarmPipelineCache = false;
+    };
+
+    void SetStartupTimes(const StartupTimes *pTimes);
+
+    // Where PHASE_INPUT_TO_PRESENT ends.
+    enum PresentTiming
+    {
+        // The GPU finishing the frame, a lower bound where nothing reports presents. Same samples as
+        // PHASE_INPUT_TO_GPU_DONE.
+        PRESENT_TIMING_GPU_DONE,
+        // The vertical blank the frame was first shown at, from DXGI's frame statistics. One sample per frame at
+        // most, the latest present shown when the frame starts.
+        PRESENT_TIMING_DISPLAY,
+    };
+
+    void SetPresentTiming(PresentTiming timing);
+
+    // Appended to by every benchmark run, in the RD_OTHER_FILES directory.
+    constexpr const char *STARTUP_FILE_NAME = "startup.csv";
+
+    // Writes min, mean, p50, p95, p99 and max of every phase, and appends the startup times to STARTUP_FILE_NAME.
+    bool WriteResults(const SceneSettings *pSceneSettings, const FrameSettings *pFrameSettings);
+
+    const char *GetPhaseName(Phase phase);
+} // namespace Benchmark
+
+#endif // BENCHMARK_H
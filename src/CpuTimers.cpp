@@ -0,0 +1,233 @@
+#include "CpuTimers.h"
+
+#include <IFileSystem.h>
+#include <IUI.h>
+#include <cmath>
+
+namespace CpuTimers
+{
+    namespace
+    {
+        typedef std::chrono::steady_clock Clock;
+
+        // Logarithmic buckets from 1 us, BUCKETS_PER_OCTAVE per doubling, so a percentile is off by at most 9%
+        // whatever the scale. The last bucket also takes anything slower than about 16 s.
+        constexpr uint32_t BUCKETS_PER_OCTAVE = 8;
+        constexpr uint32_t BUCKET_COUNT = 24 * BUCKETS_PER_OCTAVE;
+        constexpr float SMALLEST_BUCKET = 0.001f;
+        constexpr float UI_REFRESH_INTERVAL = 0.5f;
+
+        // Rolling over the last WINDOW_SIZE samples: a new sample takes the bucket count of the one it replaces.
+        struct Histogram
+        {
+            float mSamples[WINDOW_SIZE];
+            uint32_t mBuckets[BUCKET_COUNT];
+            uint32_t mCount;
+            uint32_t mNext;
+            double mSum;
+        };
+
+        TimerSettings gSettings = {};
+        Histogram gHistograms[SCOPE_COUNT] = {};
+        bstring gTexts[SCOPE_COUNT];
+        bool gWidgetsAdded = false;
+        Clock::time_point gStart = {};
+        Clock::time_point gLastRefresh = {};
+        Clock::time_point gLastDump = {};
+
+        uint32_t GetBucket(float milliseconds)
+        {
+            if (!(milliseconds > SMALLEST_BUCKET))
+            {
+                return 0;
+            }
+            const float bucket = std::log2(milliseconds / SMALLEST_BUCKET) * BUCKETS_PER_OCTAVE;
+            return bucket < BUCKET_COUNT - 1 ? static_cast<uint32_t>(bucket) : BUCKET_COUNT - 1;
+        }
+
+        // Upper edge of the bucket, so a percentile never reads faster than the samples behind it.
+        float GetBucketLimit(uint32_t bucket)
+        {
+            return SMALLEST_BUCKET * std::exp2(static_cast<float>(bucket + 1) / BUCKETS_PER_OCTAVE);
+        }
+
+        // Nearest-rank percentile, as in the benchmark results.
+        float Percentile(const Histogram &histogram, float percent)
+        {
+            if (histogram.mCount == 0)
+            {
+                return 0.0f;
+            }
+            uint32_t rank = static_cast<uint32_t>(percent / 100.0f * static_cast<float>(histogram.mCount) + 0.999999f);
+            rank = rank < 1 ? 1 : (rank > histogram.mCount ? histogram.mCount : rank);
+            uint32_t seen = 0;
+            for (uint32_t bucket = 0; bucket < BUCKET_COUNT; bucket++)
+            {
+                seen += histogram.mBuckets[bucket];
+                if (seen >= rank)
+                {
+                    return GetBucketLimit(bucket);
+                }
+            }
+            return GetBucketLimit(BUCKET_COUNT - 1);
+        }
+
+        float Seconds(Clock::time_point from, Clock::time_point to)
+        {
+            return std::chrono::duration<float>(to - from).count();
+        }
+
+        void Dump(Clock::time_point now)
+        {
+            FileStream file = {};
+            if (!fsOpenStreamFromPath(RD_OTHER_FILES, gSettings.pOutputPath, FM_APPEND, &file))
+            {
+                return;
+            }
+            const float time = Seconds(gStart, now);
+            for (uint32_t scope = 0; scope < SCOPE_COUNT; scope++)
+            {
+                const Histogram &histogram = gHistograms[scope];
+                const double mean = histogram.mCount ? histogram.mSum / histogram.mCount : 0.0;
+                fsPrintToStream(&file, "%.3f,%s,%u,%.4f,%.4f,%.4f,%.4f\n", time,
+                                GetScopeName(static_cast<Scope>(scope)), histogram.mCount, mean,
+                                Percentile(histogram, 50.0f), Percentile(histogram, 95.0f),
+                                Percentile(histogram, 99.0f));
+            }
+            fsCloseStream(&file);
+        }
+    } // namespace
+} // namespace CpuTimers
+
+void CpuTimers::Init(const TimerSettings *pSettings)
+{
+    gSettings = *pSettings;
+    for (uint32_t scope = 0; scope < SCOPE_COUNT; scope++)
+    {
+        gHistograms[scope] = {};
+    }
+    gStart = Clock::now();
+    gLastRefresh = gStart;
+    gLastDump = gStart;
+
+    if (gSettings.pOutputPath)
+    {
+        FileStream file = {};
+        if (fsOpenStreamFromPath(RD_OTHER_FILES, gSettings.pOutputPath, FM_WRITE, &file))
+        {
+            fsPrintToStream(&file, "time_s,scope,samples,mean_ms,p50_ms,p95_ms,p99_ms\n");
+            fsCloseStream(&file);
+        }
+        else
+        {
+            gSettings.pOutputPath = nullptr;
+        }
+    }
+}
+
+void CpuTimers::Exit()
+{
+    if (gSettings.pOutputPath)
+    {
+        Dump(Clock::now());
+    }
+    if (gWidgetsAdded)
+    {
+        for (uint32_t scope = 0; scope < SCOPE_COUNT; scope++)
+        {
+            bdestroy(&gTexts[scope]);
+        }
+        gWidgetsAdded = false;
+    }
+    gSettings = {};
+}
+
+void CpuTimers::AddWidgets(UIComponent *pWindow)
+{
+    static float4 textColor = {1.0f, 1.0f, 1.0f, 1.0f};
+    for (uint32_t scope = 0; scope < SCOPE_COUNT; scope++)
+    {
+        gTexts[scope] = bempty();
+        DynamicTextWidget text = {};
+        text.pText = &gTexts[scope];
+        text.pColor = &textColor;
+        uiCreateComponentWidget(pWindow, GetScopeName(static_cast<Scope>(scope)), &text, WIDGET_TYPE_DYNAMIC_TEXT);
+    }
+    gWidgetsAdded = true;
+}
+
+void CpuTimers::AddTime(Scope scope, float milliseconds)
+{
+    Histogram &histogram = gHistograms[scope];
+    if (histogram.mCount == WINDOW_SIZE)
+    {
+        const float oldest = histogram.mSamples[histogram.mNext];
+        histogram.mBuckets[GetBucket(oldest)]--;
+        histogram.mSum -= oldest;
+    }
+    else
+    {
+        histogram.mCount++;
+    }
+    histogram.mSamples[histogram.mNext] = milliseconds;
+    histogram.mBuckets[GetBucket(milliseconds)]++;
+    histogram.mSum += milliseconds;
+    histogram.mNext = (histogram.mNext + 1) % WINDOW_SIZE;
+}
+
+void CpuTimers::EndFrame()
+{
+    const Clock::time_point now = Clock::now();
+
+    if (gWidgetsAdded && Seconds(gLastRefresh, now) >= UI_REFRESH_INTERVAL)
+    {
+        gLastRefresh = now;
+        for (uint32_t scope = 0; scope < SCOPE_COUNT; scope++)
+        {
+            const Histogram &histogram = gHistograms[scope];
+            bassignformat(&gTexts[scope], "p50 %.3f  p95 %.3f  p99 %.3f ms", Percentile(histogram, 50.0f),
+                          Percentile(histogram, 95.0f), Percentile(histogram, 99.0f));
+        }
+    }
+
+    if (gSettings.pOutputPath && gSettings.mDumpInterval > 0.0f && Seconds(gLastDump, now) >= gSettings.mDumpInterval)
+    {
+        gLastDump = now;
+        Dump(now);
+    }
+}
+
+const char *CpuTimers::GetScopeName(Scope scope)
+{
+    switch (scope)
+    {
+    case SCOPE_FENCE_WAIT:
+        return "fence wait";
+    case SCOPE_INPUT:
+        return "input";
+    case SCOPE_SCENE_UPDATE:
+        return "scene update";
+    case SCOPE_MATRICES:
+        return "matrices";
+    case SCOPE_INTEGRATION:
+        return "integration";
+    case SCOPE_BVH:
+        return "bvh";
+    case SCOPE_CULL:
+        return "cull";
+    case SCOPE_UNIFORMS:
+        return "uniforms";
+    case SCOPE_ACQUIRE:
+        return "acquire";
+    case SCOPE_RECORD:
+        return "record";
+    case SCOPE_SCENE_DRAW:
+        return "scene draw";
+    case SCOPE_UI_DRAW:
+        return "ui draw";
+    case SCOPE_SUBMIT:
+        return "submit";
+    default:
+        return "unknown";
+    }
+}
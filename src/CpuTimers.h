@@ -0,0 +1,76 @@
+#ifndef CPU_TIMERS_H
+#define CPU_TIMERS_H
+
+#include <chrono>
+#include <cstdint>
+
+struct UIComponent;
+
+namespace CpuTimers
+{
+    // Timed spans of the render thread. Scopes nest, a sub-step is also counted in the scope around it.
+    enum Scope
+    {
+        // Waiting for the GPU to release the frame slot or, with low-latency pacing, to finish the previous frame.
+        SCOPE_FENCE_WAIT,
+        SCOPE_INPUT,
+        // DemoScene::Update and its sub-steps.
+        SCOPE_SCENE_UPDATE,
+        SCOPE_MATRICES,
+        // Blending the simulation thread's latest step, or setting up the GPU step.
+        SCOPE_INTEGRATION,
+        // Refitting or rebuilding the sphere BVH and casting the pick ray, on frames with a pick only.
+        SCOPE_BVH,
+        SCOPE_CULL,
+        SCOPE_UNIFORMS,
+        SCOPE_ACQUIRE,
+        // beginCmd to endCmd, and the scene and UI parts of it.
+        SCOPE_RECORD,
+        // The scene's compute passes and the render graph, which also runs the UI pass.
+        SCOPE_SCENE_DRAW,
+        SCOPE_UI_DRAW,
+        // Resource update flush, submit and present.
+        SCOPE_SUBMIT,
+        SCOPE_COUNT,
+    };
+
+    // Samples per scope the percentiles are taken over.
+    constexpr uint32_t WINDOW_SIZE = 1024;
+
+    struct TimerSettings
+    {
+        // Percentiles are appended to this CSV file in RD_OTHER_FILES, next to the benchmark results, every
+        // mDumpInterval seconds. nullptr only keeps them in the UI.
+        const char *pOutputPath = nullptr;
+        float mDumpInterval = 5.0f;
+    };
+
+    void Init(const TimerSettings *pSettings);
+    void Exit();
+
+    // Adds a line of p50/p95/p99 per scope to pWindow, refreshed twice a second.
+    void AddWidgets(UIComponent *pWindow);
+
+    // Render thread only. Every scope keeps a histogram of its last WINDOW_SIZE samples.
+    void AddTime(Scope scope, float milliseconds);
+    // Refreshes the UI text and writes the dump when they are due.
+    void EndFrame();
+
+    const char *GetScopeName(Scope scope);
+
+    // Two clock reads and a histogram update, cheap enough to leave in release builds.
+    struct ScopedTimer
+    {
+        explicit ScopedTimer(Scope scope) : mScope(scope), mStart(std::chrono::steady_clock::now()) {}
+        ~ScopedTimer()
+        {
+            const std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - mStart;
+            AddTime(mScope, std::chrono::duration<float, std::milli>(elapsed).count());
+        }
+
+        Scope mScope;
+        std::chrono::steady_clock::time_point mStart;
+    };
+} // namespace CpuTimers
+
+#endif // CPU_TIMERS_H
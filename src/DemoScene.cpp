@@ -3,31 +3,106 @@
 #include <ICameraController.h>
 #include <IGraphics.h>
 #include <IInput.h>
+#include <ILog.h>
 #include <IOperatingSystem.h>
 #include <IResourceLoader.h>
 #include <IUI.h>
 #include <Math/MathTypes.h>
 #include <array>
+#include <cstddef>
+#include <cstring>
+#include "CpuTimers.h"
+#include "EntityStorage.h"
+#include "GpuTimers.h"
+#include "JobSystem.h"
+#include "Mesh.h"
+#include "RenderGraph.h"
 #include "Settings.h"
+#include "SimulationThread.h"
+#include "SphereBvh.h"
+#include "SphereSimulation.h"
+#include "SphereSystems.h"
 
 namespace DemoScene
 {
-    int spherePoints = 0;
+    // One indexed sphere mesh per LOD, finest first, back to back in pBufferSphereVertex and pBufferSphereIndex.
+    // Indices are relative to the LOD's first vertex.
+    constexpr int SPHERE_LOD_DIVISIONS[SphereSimulation::MAX_LODS] = {12, 8, 6, 4};
+    uint32_t sphereLodFirstVertex[SphereSimulation::MAX_LODS] = {};
+    uint32_t sphereLodFirstIndex[SphereSimulation::MAX_LODS] = {};
+    uint32_t sphereLodIndexCount[SphereSimulation::MAX_LODS] = {};
+    // Two triangles (0, 1, 2, 2, 1, 3) after the LOD meshes in pBufferSphereIndex. The impostor shaders make the
+    // quad corners from SV_VertexID and read no vertex data.
+    constexpr uint32_t IMPOSTOR_INDEX_COUNT = 6;
+    uint32_t impostorFirstIndex = 0;
+    bool impostors = false;
+    // Smallest projected diameter in pixels drawn with LOD 0, 1 and 2.
+    constexpr float SPHERE_LOD_THRESHOLDS[SphereSimulation::MAX_LODS - 1] = {96.0f, 32.0f, 12.0f};
+    constexpr float SPHERE_LOD_HYSTERESIS = 0.1f;
     int quadPoints = 0;
 
-    constexpr size_t MAX_SPHERE = 768;
-    std::array<vec3, MAX_SPHERE> position{};
-    std::array<float, MAX_SPHERE> size{1.0f};
-    std::array<vec4, MAX_SPHERE> color{};
-    std::array<vec3, MAX_SPHERE> speed{};
+    // The spheres are entities of one archetype of sceneWorld, sized for the whole capacity so its columns never
+    // move. spheres views them for the simulation, culling and BVH functions. With the CPU simulation this is only the
+    // render side copy, interpolated from the simulation thread's snapshots every frame.
+    EntityStorage::World sceneWorld{};
+    SphereSystems::SphereComponents sphereComponents{};
+    uint32_t sphereArchetype = 0;
+    // The floor and the light are entities of sceneWorld too, in archetypes of their own. Update builds the floor's
+    // uniform and the shadow camera from their components.
+    struct Light
+    {
+        Point3 mPosition;
+        Point3 mTarget;
+    };
+    uint32_t transformComponent = 0;
+    uint32_t colorComponent = 0;
+    uint32_t lightComponent = 0;
+    EntityStorage::Entity floorEntity{};
+    EntityStorage::Entity lightEntity{};
+    SphereSimulation::SphereState spheres{};
+    uint32_t sphereCount = 0;
+    uint32_t chunkSize = SphereSimulation::DEFAULT_CHUNK_SIZE;
+    // See SceneSettings.
+    float fixedDeltaTime = 0.0f;
+    uint32_t stepLimit = 0;
+    bool stepLimitReached = false;
+    bool gpuSimulation = false;
+    bool gpuCulling = false;
+    bool collisions = true;
+    bstring collisionStats;
+
+    // Over the render side copy of the CPU simulation, refit on the frames that pick. The GPU simulation has none.
+    SphereBvh::Bvh sphereBvh{};
+    uint32_t bvhRebuilds = 0;
+    // A left click that moves the cursor less than this many pixels picks instead of rotating the camera.
+    constexpr float PICK_CLICK_DISTANCE = 4.0f;
+    bool pickPressed = false;
+    bool pickPending = false;
+    float2 pickPressPosition = {};
+    float2 pickPosition = {};
+    uint32_t pickedSphere = SphereBvh::INVALID_INDEX;
+    float pickedDistance = 0.0f;
+    bstring pickStats;
 
     struct SphereUniform
     {
         CameraMatrix projectView;
         CameraMatrix lightProjectView;
-        std::array<mat4, MAX_SPHERE> world;
-        std::array<vec4, MAX_SPHERE> color;
-    } sphereUniform = {};
+        vec4 cameraPosition;
+        vec4 lightDirection;
+    };
+
+
+    // Matches simulateConstants in sphere_simulate.comp.fsl.
+    struct SimulateConstants
+    {
+        float deltaTime;
+        uint32_t sphereCount;
+        uint32_t step;
+        uint32_t seed;
+    };
+
+    constexpr uint32_t SIMULATE_GROUP_SIZE = 64;
 
     struct QuadUniform
     {
@@ -35,16 +110,87 @@ namespace DemoScene
         CameraMatrix lightProjectView;
         mat4 world;
         vec4 color;
-    } quadUniform = {};
+    };
 
     Shader *pShaderInstancing = nullptr;
     Shader *pShaderInstancingShadow = nullptr;
     RootSignature *pRSInstancing = nullptr;
     DescriptorSet *pDSSphereUniform = nullptr;
-    Buffer *pBufferSphereUniform = nullptr;
+    Buffer *pBufferSphereUniform[MAX_DATA_BUFFER_COUNT] = {};
+    // Compact instance data read by sphere_resource.fsl: float4 position/scale and RGBA8 color per sphere.
+    Buffer *pBufferSpherePositionScale[MAX_DATA_BUFFER_COUNT] = {};
+    Buffer *pBufferSphereColor[MAX_DATA_BUFFER_COUNT] = {};
     Buffer *pBufferSphereVertex = nullptr;
+    Buffer *pBufferSphereIndex = nullptr;
     Pipeline *pPipelineSphere = nullptr;
     Pipeline *pPipelineSphereShadow = nullptr;
+    Shader *pShaderImpostor = nullptr;
+    Shader *pShaderImpostorShadow = nullptr;
+    Pipeline *pPipelineImpostor = nullptr;
+    Pipeline *pPipelineImpostorShadow = nullptr;
+
+    // Per pass culling, after the simulation. The order matches cameraVisible and lightVisible in
+    // sphere_resource.fsl.
+    enum CullView
+    {
+        CULL_VIEW_CAMERA,
+        CULL_VIEW_LIGHT,
+        CULL_VIEW_COUNT,
+    };
+    SphereSimulation::CullState cullState{};
+    // Compacted visible sphere indices, written by CullViews into the slot of the frame being recorded.
+    Buffer *pBufferSphereVisible[CULL_VIEW_COUNT][MAX_DATA_BUFFER_COUNT] = {};
+    SphereSimulation::VisibleCounts visibleCount{};
+    bstring cullStats[CULL_VIEW_COUNT];
+    // Added to the LOD picked from the camera distance. The shadow map gets away with coarser spheres.
+    uint32_t lodBias[CULL_VIEW_COUNT] = {0, 1};
+    uint32_t drawConstantsIndex = 0;
+
+    // Matches cullUniform in sphere_cull.comp.fsl.
+    struct CullUniform
+    {
+        SphereSimulation::Frustum frusta[CULL_VIEW_COUNT];
+        float4 lodCamera;
+        float4 lodThresholds;
+        uint32_t sphereCount;
+        uint32_t lodCount;
+        uint32_t bucketCapacity;
+        uint32_t lodBias[CULL_VIEW_COUNT];
+        float lodHysteresis;
+    };
+
+    constexpr uint32_t CULL_GROUP_SIZE = 64;
+
+    // GPU culling. The compute pass writes the visible index lists and the instance counts of one
+    // IndirectDrawIndexArguments per view and LOD, which the sphere passes then draw with cmdExecuteIndirect. Bucket
+    // lod of a view starts at lod * mCapacity in pBufferGpuVisible.
+    Shader *pShaderCull = nullptr;
+    RootSignature *pRSCull = nullptr;
+    DescriptorSet *pDSCull = nullptr;
+    Pipeline *pPipelineCull = nullptr;
+    CommandSignature *pCmdSignatureDraw = nullptr;
+    Buffer *pBufferCullUniform[MAX_DATA_BUFFER_COUNT] = {};
+    Buffer *pBufferGpuVisible[CULL_VIEW_COUNT] = {};
+    Buffer *pBufferCullArgs = nullptr;
+    Buffer *pBufferLodState = nullptr;
+    // Copied over pBufferCullArgs before every dispatch, instance counts zeroed. The impostor version draws the quad
+    // range for every LOD.
+    Buffer *pBufferCullArgsReset = nullptr;
+    Buffer *pBufferImpostorArgsReset = nullptr;
+    // Copy of pBufferCullArgs per frame in flight, read back for the UI once the frame's fence has passed.
+    Buffer *pBufferCullArgsReadback[MAX_DATA_BUFFER_COUNT] = {};
+
+    // GPU simulation. The compute pass owns a single copy of the sphere state and the sphere shaders read
+    // positionScale and color straight from it, instead of from the per-frame upload buffers.
+    Shader *pShaderSimulate = nullptr;
+    RootSignature *pRSSimulate = nullptr;
+    DescriptorSet *pDSSimulate = nullptr;
+    Pipeline *pPipelineSimulate = nullptr;
+    uint32_t simulateConstantsIndex = 0;
+    Buffer *pBufferSimulatePositionScale = nullptr;
+    Buffer *pBufferSimulateSpeed = nullptr;
+    Buffer *pBufferSimulateColor = nullptr;
+    SimulateConstants simulateConstants{};
 
     Shader *pShaderSingle = nullptr;
     Shader *pShaderSingleShadow = nullptr;
@@ -52,16 +198,20 @@ namespace DemoScene
     DescriptorSet *pDSQuadUniform = nullptr;
     Buffer *pBufferQuadVertex = nullptr;
     Buffer *pBufferQuadIndex = nullptr;
-    Buffer *pBufferQuadUniform = nullptr;
+    Buffer *pBufferQuadUniform[MAX_DATA_BUFFER_COUNT] = {};
     Pipeline *pPipelineQuad = nullptr;
     Pipeline *pPipelineQuadShadow = nullptr;
 
     ICameraController *pCameraController = nullptr;
 
-    RenderTarget *pRTDepth = nullptr;
+    UIComponent *pSceneWindow = nullptr;
+
+    // Render graph resources, declared by AddPasses. The graph creates the depth buffer and the shadow map.
+    uint32_t backBufferTarget = RenderGraph::INVALID_ID;
+    uint32_t depthTarget = RenderGraph::INVALID_ID;
+    uint32_t shadowMapTarget = RenderGraph::INVALID_ID;
 
     constexpr int SHADOW_MAP_SIZE = 2048;
-    RenderTarget *pRTShadowMap = nullptr;
     DescriptorSet *pDSShadowMap = nullptr;
 
     CameraMatrix lightViewProj{};
@@ -70,26 +220,151 @@ namespace DemoScene
 
     TinyImageFormat depthBufferFormat = TinyImageFormat_D32_SFLOAT;
 
+    // Owned by MainApp, passed to every addPipeline.
+    PipelineCache *pPipelineCache = nullptr;
+
+    // Load creates its shaders, then its pipelines, one after the other, or as batches of independent jobs on the job
+    // system with SceneSettings::mParallelLoad. Vulkan and D3D12 create shader modules and pipelines from any thread,
+    // sharing one pipeline cache.
+    constexpr uint32_t MAX_LOAD_JOBS = 16;
+    bool parallelLoad = false;
+
+    struct ShaderLoad
+    {
+        // Stage file names, the second one nullptr for compute shaders.
+        const char *pFileNames[2];
+        Shader **ppShader;
+    };
+
+    // mDesc points at state owned by the caller, which has to outlive AddPipelines.
+    struct PipelineLoad
+    {
+        PipelineDesc mDesc;
+        Pipeline **ppPipeline;
+    };
+
+    void AddShaders(Renderer *pRenderer, const ShaderLoad *pLoads, uint32_t count);
+    void AddPipelines(Renderer *pRenderer, const PipelineLoad *pLoads, uint32_t count);
+
+    // Init only queues the buffer uploads, the resource loader thread streams them in while the first frames are
+    // drawn. Draw skips everything whose group is not resident yet. The CPU copies an upload reads from are kept
+    // until its group's token has completed.
+    enum UploadGroup
+    {
+        UPLOAD_SPHERE_MESH,
+        UPLOAD_QUAD_MESH,
+        // Initial GPU simulation and culling state.
+        UPLOAD_SPHERE_STATE,
+        UPLOAD_GROUP_COUNT,
+    };
+    constexpr uint32_t MAX_UPLOAD_SOURCES = 8;
+    SyncToken uploadToken[UPLOAD_GROUP_COUNT] = {};
+    bool uploadResident[UPLOAD_GROUP_COUNT] = {};
+    void *pUploadSources[UPLOAD_GROUP_COUNT][MAX_UPLOAD_SOURCES] = {};
+    uint32_t uploadSourceCount[UPLOAD_GROUP_COUNT] = {};
+    // Latched by Update for the frame being recorded.
+    bool spheresResident = false;
+    bool quadResident = false;
+
+    // Takes ownership of pData, a tf_malloc'ed upload source.
+    void AddUploadSource(UploadGroup group, void *pData);
+    bool IsUploadResident(UploadGroup group);
+
     void AddSphereResources(Renderer *pRenderer);
     void RemoveSphereResources(Renderer *pRenderer);
 
     void AddQuadResources(Renderer *pRenderer);
     void RemoveQuadResources(Renderer *pRenderer);
+
+    void AddSimulateResources(Renderer *pRenderer);
+    void RemoveSimulateResources(Renderer *pRenderer);
+    void AddSimulateBuffers();
+
+    void AddCullResources(Renderer *pRenderer);
+    void RemoveCullResources(Renderer *pRenderer);
+    void AddCullBuffers();
+
+    // Creates or destroys spheres until count are alive and points spheres at them, keeping its seed and step.
+    void ResizeSpheres(uint32_t count);
+    // Registers the floor and light components and creates one entity of each.
+    void AddFloorAndLight();
+
+    template <typename T>
+    T *GetSceneComponent(EntityStorage::Entity entity, uint32_t component)
+    {
+        return static_cast<T *>(EntityStorage::GetComponent(&sceneWorld, entity, component));
+    }
+
+    SphereSimulation::Frustum ExtractFrustum(const mat4 &viewProj);
+    // Draws the visible spheres of one CullView with whatever pipeline is bound.
+    void DrawSpheres(Cmd *pCmd, uint32_t view);
+    // Render graph passes, run with their targets bound.
+    void DrawShadowPass(void *pUserData, Cmd *pCmd, uint32_t frameIndex);
+    void DrawMainPass(void *pUserData, Cmd *pCmd, uint32_t frameIndex);
 } // namespace DemoScene
 
-bool DemoScene::Init(Renderer *pRenderer)
+bool DemoScene::Init(Renderer *pRenderer, const SceneSettings *pSettings, PipelineCache *pCache)
 {
-    float *sphereVertices{};
-    generateSpherePoints(&sphereVertices, &spherePoints, 12, 1.0f);
+    pPipelineCache = pCache;
+
+    // generateSpherePoints writes a triangle soup. Weld, reorder and pack it so each shared vertex is fetched and
+    // transformed once.
+    Mesh::IndexedMesh sphereLodMeshes[SphereSimulation::MAX_LODS] = {};
+    uint32_t sphereVertexCount = 0;
+    uint32_t sphereIndexCount = 0;
+    for (uint32_t lod = 0; lod < SphereSimulation::MAX_LODS; lod++)
+    {
+        float *soup{};
+        int points = 0;
+        generateSpherePoints(&soup, &points, SPHERE_LOD_DIVISIONS[lod], 1.0f);
+
+        Mesh::MeshStats stats{};
+        Mesh::AddIndexedMesh(&sphereLodMeshes[lod], soup, static_cast<uint32_t>(points) / 6, &stats);
+        tf_free(soup);
+        LOGF(eINFO, "Sphere LOD %u: %u vertices unindexed (ACMR 3.00), %u indexed, ACMR %.2f welded, %.2f optimized",
+             lod, stats.mSoupVertexCount, stats.mVertexCount, stats.mAcmrWelded, stats.mAcmrOptimized);
+
+        // 16-bit indices relative to the LOD's first vertex.
+        ASSERT(sphereLodMeshes[lod].mVertexCount <= UINT16_MAX + 1);
+        sphereLodFirstVertex[lod] = sphereVertexCount;
+        sphereLodFirstIndex[lod] = sphereIndexCount;
+        sphereLodIndexCount[lod] = sphereLodMeshes[lod].mIndexCount;
+        sphereVertexCount += sphereLodMeshes[lod].mVertexCount;
+        sphereIndexCount += sphereLodMeshes[lod].mIndexCount;
+    }
+
+    Mesh::PackedVertex *sphereVertices =
+        static_cast<Mesh::PackedVertex *>(tf_malloc(sizeof(Mesh::PackedVertex) * sphereVertexCount));
+    impostorFirstIndex = sphereIndexCount;
+    sphereIndexCount += IMPOSTOR_INDEX_COUNT;
+    uint16_t *sphereIndices = static_cast<uint16_t *>(tf_malloc(sizeof(uint16_t) * sphereIndexCount));
+    const uint16_t impostorIndices[IMPOSTOR_INDEX_COUNT] = {0, 1, 2, 2, 1, 3};
+    memcpy(sphereIndices + impostorFirstIndex, impostorIndices, sizeof(impostorIndices));
+    for (uint32_t lod = 0; lod < SphereSimulation::MAX_LODS; lod++)
+    {
+        const Mesh::IndexedMesh &mesh = sphereLodMeshes[lod];
+        memcpy(sphereVertices + sphereLodFirstVertex[lod], mesh.pVertices,
+               sizeof(Mesh::PackedVertex) * mesh.mVertexCount);
+        for (uint32_t i = 0; i < mesh.mIndexCount; i++)
+        {
+            sphereIndices[sphereLodFirstIndex[lod] + i] = static_cast<uint16_t>(mesh.pIndices[i]);
+        }
+        Mesh::RemoveIndexedMesh(&sphereLodMeshes[lod]);
+    }
 
     float *quadVertices{};
     generateQuad(&quadVertices, &quadPoints);
 
-    uint16_t quadIndices[6] = {0, 1, 2, 1, 3, 2};
+    const uint16_t quadIndexData[6] = {0, 1, 2, 1, 3, 2};
+    uint16_t *quadIndices = static_cast<uint16_t *>(tf_malloc(sizeof(quadIndexData)));
+    memcpy(quadIndices, quadIndexData, sizeof(quadIndexData));
 
-    SyncToken token{};
+    AddUploadSource(UPLOAD_SPHERE_MESH, sphereVertices);
+    AddUploadSource(UPLOAD_SPHERE_MESH, sphereIndices);
+    AddUploadSource(UPLOAD_QUAD_MESH, quadVertices);
+    AddUploadSource(UPLOAD_QUAD_MESH, quadIndices);
 
-    uint64_t sphereDataSize = spherePoints * sizeof(float);
+    uint64_t sphereDataSize = sphereVertexCount * sizeof(Mesh::PackedVertex);
     BufferLoadDesc sphereVbDesc = {};
     sphereVbDesc.ppBuffer = &pBufferSphereVertex;
     sphereVbDesc.pData = sphereVertices;
@@ -98,7 +373,17 @@ bool DemoScene::Init(Renderer *pRenderer)
     sphereVbDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_ONLY;
     sphereVbDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_VERTEX_BUFFER;
 
-    addResource(&sphereVbDesc, &token);
+    addResource(&sphereVbDesc, &uploadToken[UPLOAD_SPHERE_MESH]);
+
+    BufferLoadDesc sphereIbDesc = {};
+    sphereIbDesc.ppBuffer = &pBufferSphereIndex;
+    sphereIbDesc.pData = sphereIndices;
+    sphereIbDesc.mDesc = {};
+    sphereIbDesc.mDesc.mSize = sizeof(uint16_t) * sphereIndexCount;
+    sphereIbDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_ONLY;
+    sphereIbDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_INDEX_BUFFER;
+
+    addResource(&sphereIbDesc, &uploadToken[UPLOAD_SPHERE_MESH]);
 
     uint64_t quadDataSize = quadPoints * sizeof(float);
     BufferLoadDesc quadVbDesc = {};
@@ -109,7 +394,7 @@ bool DemoScene::Init(Renderer *pRenderer)
     quadVbDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_ONLY;
     quadVbDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_VERTEX_BUFFER;
 
-    addResource(&quadVbDesc, &token);
+    addResource(&quadVbDesc, &uploadToken[UPLOAD_QUAD_MESH]);
 
     BufferLoadDesc quadIdDesc = {};
     quadIdDesc.ppBuffer = &pBufferQuadIndex;
@@ -119,33 +404,113 @@ bool DemoScene::Init(Renderer *pRenderer)
     quadIdDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_ONLY;
     quadIdDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_INDEX_BUFFER;
 
-    addResource(&quadIdDesc, &token);
+    addResource(&quadIdDesc, &uploadToken[UPLOAD_QUAD_MESH]);
 
-    BufferLoadDesc ubDesc = {};
-    ubDesc.ppBuffer = &pBufferSphereUniform;
-    ubDesc.mDesc = {};
-    ubDesc.mDesc.mSize = sizeof(SphereUniform);
-    ubDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_CPU_TO_GPU;
-    ubDesc.mDesc.mFlags = BUFFER_CREATION_FLAG_PERSISTENT_MAP_BIT;
-    ubDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    addResource(&ubDesc, &token);
+    // One uniform buffer per frame in flight. Update writes straight into the persistently mapped slot of the frame
+    // being recorded, the GPU may still be reading the other ones. Mapped buffers have nothing to upload, so they are
+    // usable right away.
+    for (uint32_t i = 0; i < gDataBufferCount; i++)
+    {
+        BufferLoadDesc ubDesc = {};
+        ubDesc.ppBuffer = &pBufferSphereUniform[i];
+        ubDesc.mDesc = {};
+        ubDesc.mDesc.mSize = sizeof(SphereUniform);
+        ubDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_CPU_TO_GPU;
+        ubDesc.mDesc.mFlags = BUFFER_CREATION_FLAG_PERSISTENT_MAP_BIT;
+        ubDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        addResource(&ubDesc, nullptr);
+
+        BufferLoadDesc quadUniformDesc = {};
+        quadUniformDesc.ppBuffer = &pBufferQuadUniform[i];
+        quadUniformDesc.mDesc = {};
+        quadUniformDesc.mDesc.mSize = sizeof(QuadUniform);
+        quadUniformDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_CPU_TO_GPU;
+        quadUniformDesc.mDesc.mFlags = BUFFER_CREATION_FLAG_PERSISTENT_MAP_BIT;
+        quadUniformDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+
+        addResource(&quadUniformDesc, nullptr);
+
+        if (pSettings->mGpuSimulation)
+        {
+            continue;
+        }
 
-    BufferLoadDesc quadUniformDesc = {};
-    quadUniformDesc.ppBuffer = &pBufferQuadUniform;
-    quadUniformDesc.mDesc = {};
-    quadUniformDesc.mDesc.mSize = sizeof(QuadUniform);
-    quadUniformDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_CPU_TO_GPU;
-    quadUniformDesc.mDesc.mFlags = BUFFER_CREATION_FLAG_PERSISTENT_MAP_BIT;
-    quadUniformDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        BufferLoadDesc instanceDesc = {};
+        instanceDesc.ppBuffer = &pBufferSpherePositionScale[i];
+        instanceDesc.mDesc = {};
+        instanceDesc.mDesc.mSize = sizeof(float4) * pSettings->mSphereCapacity;
+        instanceDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_CPU_TO_GPU;
+        instanceDesc.mDesc.mFlags = BUFFER_CREATION_FLAG_PERSISTENT_MAP_BIT;
+        instanceDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_BUFFER;
+        instanceDesc.mDesc.mStructStride = sizeof(float4);
+        instanceDesc.mDesc.mElementCount = pSettings->mSphereCapacity;
+        instanceDesc.mDesc.mFirstElement = 0;
+        addResource(&instanceDesc, nullptr);
+
+        instanceDesc.ppBuffer = &pBufferSphereColor[i];
+        instanceDesc.mDesc.mSize = sizeof(uint32_t) * pSettings->mSphereCapacity;
+        instanceDesc.mDesc.mStructStride = sizeof(uint32_t);
+        addResource(&instanceDesc, nullptr);
+
+        if (pSettings->mGpuCulling)
+        {
+            continue;
+        }
 
-    addResource(&quadUniformDesc, &token);
+        for (uint32_t view = 0; view < CULL_VIEW_COUNT; view++)
+        {
+            instanceDesc.ppBuffer = &pBufferSphereVisible[view][i];
+            addResource(&instanceDesc, nullptr);
+        }
+    }
 
-    for (size_t i = 0; i < MAX_SPHERE; i++)
+    // Spawn the whole capacity up front, the GPU simulation seeds its state from it. Update then keeps sphereCount of
+    // them alive.
+    EntityStorage::AddWorld(&sceneWorld);
+    SphereSystems::AddSphereComponents(&sceneWorld, &sphereComponents);
+    sphereArchetype = EntityStorage::AddArchetype(&sceneWorld, sphereComponents.mMask, pSettings->mSphereCapacity);
+    AddFloorAndLight();
+    spheres = {};
+    spheres.mSeed = pSettings->mSeed;
+    ResizeSpheres(pSettings->mSphereCapacity);
+    sphereCount = pSettings->mSphereCount;
+    chunkSize = pSettings->mChunkSize;
+    gpuSimulation = pSettings->mGpuSimulation;
+    gpuCulling = pSettings->mGpuCulling || gpuSimulation;
+    impostors = pSettings->mImpostors;
+    parallelLoad = pSettings->mParallelLoad;
+    fixedDeltaTime = pSettings->mFixedDeltaTime;
+    stepLimit = pSettings->mStepLimit;
+    collisions = pSettings->mCollisions;
+    LOGF(eINFO, "Sphere simulation seed: %llu", static_cast<unsigned long long>(pSettings->mSeed));
+    if (gpuSimulation)
+    {
+        AddSimulateBuffers();
+        LOGF(eINFO, "Sphere simulation: GPU compute");
+    }
+    else
     {
-        position[i] = {randomFloat(-200, 200), randomFloat(-200, 200), randomFloat(-200, 200)};
-        color[i] = {randomFloat01(), randomFloat01(), randomFloat01(), 1.0f};
-        size[i] = randomFloat(0, 10);
-        speed[i] = {randomFloat(-10.0f, 10.0f), randomFloat(-10.0f, 10.0f), randomFloat(-10.0f, 10.0f)};
+        SimulationThread::ThreadDesc threadDesc{};
+        threadDesc.mCapacity = spheres.mCapacity;
+        threadDesc.mCount = sphereCount;
+        threadDesc.mSeed = pSettings->mSeed;
+        threadDesc.mTickTime = fixedDeltaTime > 0.0f ? fixedDeltaTime : SimulationThread::DEFAULT_TICK_TIME;
+        threadDesc.mChunkSize = chunkSize;
+        threadDesc.mStepLimit = stepLimit;
+        threadDesc.mCollisions = collisions;
+        SimulationThread::Start(&threadDesc);
+        SphereBvh::AddBvh(&sphereBvh, spheres.mCapacity);
+        LOGF(eINFO, "Sphere simulation kernel: %s, %u threads, %.1f steps per second",
+             SphereSimulation::GetKernelName(SphereSimulation::GetKernel()), JobSystem::GetThreadCount(),
+             1.0f / threadDesc.mTickTime);
+    }
+    if (gpuCulling)
+    {
+        AddCullBuffers();
+    }
+    else
+    {
+        SphereSimulation::AddCullState(&cullState, spheres.mCapacity);
     }
 
     CameraMotionParameters cmp = {};
@@ -163,6 +528,70 @@ bool DemoScene::Init(Renderer *pRenderer)
 
     addSampler(pRenderer, &samplerDesc, &pSampler);
 
+    UIComponentDesc uiDesc = {};
+    uiDesc.mStartPosition = vec2(1080.0f, 100.0f);
+    uiCreateComponent("Scene", &uiDesc, &pSceneWindow);
+
+    SliderUintWidget sphereCountSlider = {};
+    sphereCountSlider.pData = &sphereCount;
+    sphereCountSlider.mMin = 1;
+    sphereCountSlider.mMax = spheres.mCapacity;
+    sphereCountSlider.mStep = 1;
+    uiCreateComponentWidget(pSceneWindow, "Spheres", &sphereCountSlider, WIDGET_TYPE_SLIDER_UINT);
+
+    if (!gpuSimulation)
+    {
+        SliderUintWidget chunkSizeSlider = {};
+        chunkSizeSlider.pData = &chunkSize;
+        chunkSizeSlider.mMin = SphereSimulation::CHUNK_ALIGNMENT;
+        chunkSizeSlider.mMax = 65536;
+        chunkSizeSlider.mStep = SphereSimulation::CHUNK_ALIGNMENT;
+        uiCreateComponentWidget(pSceneWindow, "Simulation chunk size", &chunkSizeSlider, WIDGET_TYPE_SLIDER_UINT);
+
+        CheckboxWidget collisionCheckbox = {};
+        collisionCheckbox.pData = &collisions;
+        uiCreateComponentWidget(pSceneWindow, "Collisions", &collisionCheckbox, WIDGET_TYPE_CHECKBOX);
+
+        static float4 collisionStatsColor = {1.0f, 1.0f, 1.0f, 1.0f};
+        collisionStats = bempty();
+        DynamicTextWidget collisionStatsText = {};
+        collisionStatsText.pText = &collisionStats;
+        collisionStatsText.pColor = &collisionStatsColor;
+        uiCreateComponentWidget(pSceneWindow, "Collision step", &collisionStatsText, WIDGET_TYPE_DYNAMIC_TEXT);
+
+        pickStats = bempty();
+        DynamicTextWidget pickStatsText = {};
+        pickStatsText.pText = &pickStats;
+        pickStatsText.pColor = &collisionStatsColor;
+        uiCreateComponentWidget(pSceneWindow, "Picking", &pickStatsText, WIDGET_TYPE_DYNAMIC_TEXT);
+    }
+
+    CheckboxWidget impostorCheckbox = {};
+    impostorCheckbox.pData = &impostors;
+    uiCreateComponentWidget(pSceneWindow, "Ray-cast impostors", &impostorCheckbox, WIDGET_TYPE_CHECKBOX);
+
+    const char *lodBiasNames[CULL_VIEW_COUNT] = {"Camera LOD bias", "Shadow LOD bias"};
+    for (uint32_t view = 0; view < CULL_VIEW_COUNT; view++)
+    {
+        SliderUintWidget lodBiasSlider = {};
+        lodBiasSlider.pData = &lodBias[view];
+        lodBiasSlider.mMin = 0;
+        lodBiasSlider.mMax = SphereSimulation::MAX_LODS - 1;
+        lodBiasSlider.mStep = 1;
+        uiCreateComponentWidget(pSceneWindow, lodBiasNames[view], &lodBiasSlider, WIDGET_TYPE_SLIDER_UINT);
+    }
+
+    static float4 cullStatsColor = {1.0f, 1.0f, 1.0f, 1.0f};
+    const char *cullViewNames[CULL_VIEW_COUNT] = {"Camera culling", "Light culling"};
+    for (uint32_t view = 0; view < CULL_VIEW_COUNT; view++)
+    {
+        cullStats[view] = bempty();
+        DynamicTextWidget cullStatsText = {};
+        cullStatsText.pText = &cullStats[view];
+        cullStatsText.pColor = &cullStatsColor;
+        uiCreateComponentWidget(pSceneWindow, cullViewNames[view], &cullStatsText, WIDGET_TYPE_DYNAMIC_TEXT);
+    }
+
     typedef bool (*CameraInputHandler)(InputActionContext *ctx, DefaultInputActions::DefaultInputAction action);
     static CameraInputHandler onCameraInput =
         [](InputActionContext *ctx, DefaultInputActions::DefaultInputAction action)
@@ -195,6 +624,30 @@ bool DemoScene::Init(Renderer *pRenderer)
     actionDesc.pFunction = [](InputActionContext *ctx)
     {
         setEnableCaptureInput(!uiIsFocused() && INPUT_ACTION_PHASE_CANCELED != ctx->mPhase);
+
+        // Picked by Update, which has the camera of the frame.
+        if (ctx->pPosition && !gpuSimulation)
+        {
+            if (INPUT_ACTION_PHASE_CANCELED != ctx->mPhase)
+            {
+                if (!pickPressed && !uiIsFocused())
+                {
+                    pickPressed = true;
+                    pickPressPosition = *ctx->pPosition;
+                }
+            }
+            else if (pickPressed)
+            {
+                pickPressed = false;
+                const float dx = ctx->pPosition->x - pickPressPosition.x;
+                const float dy = ctx->pPosition->y - pickPressPosition.y;
+                if (dx * dx + dy * dy <= PICK_CLICK_DISTANCE * PICK_CLICK_DISTANCE)
+                {
+                    pickPosition = *ctx->pPosition;
+                    pickPending = true;
+                }
+            }
+        }
         return true;
     };
     addInputAction(&actionDesc);
@@ -227,76 +680,161 @@ bool DemoScene::Init(Renderer *pRenderer)
     };
     addInputAction(&actionDesc);
 
-    waitForToken(&token);
-
-    tf_free(sphereVertices);
-    tf_free(quadVertices);
-
     return true;
 }
 
 void DemoScene::Exit(Renderer *pRenderer)
 {
-    removeResource(pBufferSphereUniform);
+    if (!gpuSimulation)
+    {
+        SimulationThread::Exit();
+        SphereBvh::RemoveBvh(&sphereBvh);
+        bdestroy(&collisionStats);
+        bdestroy(&pickStats);
+    }
+    stepLimitReached = false;
+    bvhRebuilds = 0;
+    pickPressed = false;
+    pickPending = false;
+    pickedSphere = SphereBvh::INVALID_INDEX;
+
+    // Quitting before the scene became resident leaves uploads in flight that still read their sources.
+    for (uint32_t group = 0; group < UPLOAD_GROUP_COUNT; group++)
+    {
+        waitForToken(&uploadToken[group]);
+        IsUploadResident(static_cast<UploadGroup>(group));
+        uploadToken[group] = {};
+        uploadResident[group] = false;
+    }
+    spheresResident = false;
+    quadResident = false;
+
+    for (uint32_t i = 0; i < gDataBufferCount; i++)
+    {
+        removeResource(pBufferSphereUniform[i]);
+        removeResource(pBufferQuadUniform[i]);
+        if (!gpuSimulation)
+        {
+            removeResource(pBufferSpherePositionScale[i]);
+            removeResource(pBufferSphereColor[i]);
+        }
+        if (gpuCulling)
+        {
+            removeResource(pBufferCullUniform[i]);
+            removeResource(pBufferCullArgsReadback[i]);
+        }
+        else
+        {
+            for (uint32_t view = 0; view < CULL_VIEW_COUNT; view++)
+            {
+                removeResource(pBufferSphereVisible[view][i]);
+            }
+        }
+    }
+    if (gpuSimulation)
+    {
+        removeResource(pBufferSimulatePositionScale);
+        removeResource(pBufferSimulateSpeed);
+        removeResource(pBufferSimulateColor);
+    }
+    if (gpuCulling)
+    {
+        for (uint32_t view = 0; view < CULL_VIEW_COUNT; view++)
+        {
+            removeResource(pBufferGpuVisible[view]);
+        }
+        removeResource(pBufferCullArgs);
+        removeResource(pBufferLodState);
+        removeResource(pBufferCullArgsReset);
+        removeResource(pBufferImpostorArgsReset);
+    }
+    else
+    {
+        SphereSimulation::RemoveCullState(&cullState);
+    }
+    for (uint32_t view = 0; view < CULL_VIEW_COUNT; view++)
+    {
+        bdestroy(&cullStats[view]);
+    }
     removeResource(pBufferSphereVertex);
+    removeResource(pBufferSphereIndex);
 
-    removeResource(pBufferQuadUniform);
     removeResource(pBufferQuadVertex);
     removeResource(pBufferQuadIndex);
 
     removeSampler(pRenderer, pSampler);
 
+    uiDestroyComponent(pSceneWindow);
+
+    EntityStorage::RemoveWorld(&sceneWorld);
+    spheres = {};
+    floorEntity = {};
+    lightEntity = {};
+
     exitCameraController(pCameraController);
+    pPipelineCache = nullptr;
 }
 
 bool DemoScene::Load(ReloadDesc *pReloadDesc, Renderer *pRenderer, RenderTarget *pRenderTarget)
 {
     if (pReloadDesc->mType & RELOAD_TYPE_SHADER)
     {
+        ShaderLoad shaders[MAX_LOAD_JOBS] = {};
+        uint32_t shaderCount = 0;
+        shaders[shaderCount++] = {{"sphere.vert", "basic.frag"}, &pShaderInstancing};
+        shaders[shaderCount++] = {{"sphere_shadow.vert", "shadow.frag"}, &pShaderInstancingShadow};
+        shaders[shaderCount++] = {{"sphere_impostor.vert", "sphere_impostor.frag"}, &pShaderImpostor};
+        shaders[shaderCount++] = {{"sphere_impostor_shadow.vert", "sphere_impostor_shadow.frag"},
+                                  &pShaderImpostorShadow};
+        shaders[shaderCount++] = {{"quad.vert", "basic.frag"}, &pShaderSingle};
+        shaders[shaderCount++] = {{"quad_shadow.vert", "shadow.frag"}, &pShaderSingleShadow};
+        if (gpuSimulation)
+        {
+            shaders[shaderCount++] = {{"sphere_simulate.comp", nullptr}, &pShaderSimulate};
+        }
+        if (gpuCulling)
+        {
+            shaders[shaderCount++] = {{"sphere_cull.comp", nullptr}, &pShaderCull};
+        }
+        ASSERT(shaderCount <= MAX_LOAD_JOBS);
+        AddShaders(pRenderer, shaders, shaderCount);
+
+        // Root signatures need the reflection of all their shaders and are cheap, they are made on this thread.
         AddSphereResources(pRenderer);
         AddQuadResources(pRenderer);
+        if (gpuSimulation)
+        {
+            AddSimulateResources(pRenderer);
+        }
+        if (gpuCulling)
+        {
+            AddCullResources(pRenderer);
+        }
 
         DescriptorSetDesc dsDesc = {pRSInstancing, DESCRIPTOR_UPDATE_FREQ_NONE, 1};
         addDescriptorSet(pRenderer, &dsDesc, &pDSShadowMap);
     }
 
-    if (pReloadDesc->mType & (RELOAD_TYPE_RESIZE | RELOAD_TYPE_RENDERTARGET))
-    {
-        RenderTargetDesc desc{};
-        desc.mFlags = TEXTURE_CREATION_FLAG_ON_TILE | TEXTURE_CREATION_FLAG_VR_MULTIVIEW;
-        desc.mWidth = pRenderTarget->mWidth;
-        desc.mHeight = pRenderTarget->mHeight;
-        desc.mDepth = 1;
-        desc.mArraySize = 1;
-        desc.mSampleCount = SAMPLE_COUNT_1;
-        desc.mFormat = depthBufferFormat;
-        desc.mStartState = RESOURCE_STATE_DEPTH_WRITE;
-        desc.mClearValue = {};
-        desc.mSampleQuality = 0;
-
-        addRenderTarget(pRenderer, &desc, &pRTDepth);
-        ASSERT(pRTDepth);
-
-        desc = {};
-        desc.mFlags = TEXTURE_CREATION_FLAG_OWN_MEMORY_BIT;
-        desc.mWidth = SHADOW_MAP_SIZE;
-        desc.mHeight = SHADOW_MAP_SIZE;
-        desc.mDepth = 1;
-        desc.mArraySize = 1;
-        desc.mSampleCount = SAMPLE_COUNT_1;
-        desc.mFormat = depthBufferFormat;
-        desc.mStartState = RESOURCE_STATE_SHADER_RESOURCE;
-        desc.mClearValue = {};
-        desc.mSampleQuality = 0;
-        desc.mDescriptors = DESCRIPTOR_TYPE_TEXTURE;
-
-        addRenderTarget(pRenderer, &desc, &pRTShadowMap);
-        ASSERT(pRTShadowMap);
-    }
-
     if (pReloadDesc->mType & (RELOAD_TYPE_SHADER | RELOAD_TYPE_RENDERTARGET))
     {
         // layout and pipeline for sphere draw
+        VertexLayout sphereVertexLayout = {};
+        sphereVertexLayout.mBindingCount = 1;
+        sphereVertexLayout.mBindings[0].mStride = sizeof(Mesh::PackedVertex);
+
+        sphereVertexLayout.mAttribCount = 2;
+        sphereVertexLayout.mAttribs[0].mSemantic = SEMANTIC_POSITION;
+        sphereVertexLayout.mAttribs[0].mFormat = TinyImageFormat_R16G16B16A16_SFLOAT;
+        sphereVertexLayout.mAttribs[0].mBinding = 0;
+        sphereVertexLayout.mAttribs[0].mLocation = 0;
+        sphereVertexLayout.mAttribs[0].mOffset = offsetof(Mesh::PackedVertex, mPosition);
+
+        sphereVertexLayout.mAttribs[1].mSemantic = SEMANTIC_NORMAL;
+        sphereVertexLayout.mAttribs[1].mFormat = TinyImageFormat_R16G16_SNORM;
+        sphereVertexLayout.mAttribs[1].mBinding = 0;
+        sphereVertexLayout.mAttribs[1].mLocation = 1;
+        sphereVertexLayout.mAttribs[1].mOffset = offsetof(Mesh::PackedVertex, mNormal);
+
         VertexLayout vertexLayout = {};
         vertexLayout.mBindingCount = 1;
         vertexLayout.mBindings[0].mStride = sizeof(float) * 6;
@@ -323,13 +861,17 @@ bool DemoScene::Load(ReloadDesc *pReloadDesc, Renderer *pRenderer, RenderTarget
         depthStateDesc.mDepthWrite = true;
         depthStateDesc.mDepthFunc = CMP_GEQUAL;
 
+        PipelineLoad pipelines[MAX_LOAD_JOBS] = {};
+        uint32_t pipelineCount = 0;
+
         PipelineDesc desc = {};
         desc.mType = PIPELINE_TYPE_GRAPHICS;
+        desc.pCache = pPipelineCache;
 
         desc.mGraphicsDesc = {};
         desc.mGraphicsDesc.pShaderProgram = pShaderInstancing;
         desc.mGraphicsDesc.pRootSignature = pRSInstancing;
-        desc.mGraphicsDesc.pVertexLayout = &vertexLayout;
+        desc.mGraphicsDesc.pVertexLayout = &sphereVertexLayout;
         desc.mGraphicsDesc.pDepthState = &depthStateDesc;
         desc.mGraphicsDesc.pRasterizerState = &sphereRasterizerStateDesc;
         desc.mGraphicsDesc.pColorFormats = &pRenderTarget->mFormat;
@@ -341,28 +883,52 @@ bool DemoScene::Load(ReloadDesc *pReloadDesc, Renderer *pRenderer, RenderTarget
         desc.mGraphicsDesc.mVRFoveatedRendering = true;
 
 
-        addPipeline(pRenderer, &desc, &pPipelineSphere);
-        ASSERT(pPipelineSphere);
+        pipelines[pipelineCount++] = {desc, &pPipelineSphere};
 
         desc = {};
         desc.mType = PIPELINE_TYPE_GRAPHICS;
+        desc.pCache = pPipelineCache;
         desc.mGraphicsDesc = {};
         desc.mGraphicsDesc.pShaderProgram = pShaderInstancingShadow;
         desc.mGraphicsDesc.pRootSignature = pRSInstancing;
-        desc.mGraphicsDesc.pVertexLayout = &vertexLayout;
+        desc.mGraphicsDesc.pVertexLayout = &sphereVertexLayout;
+        desc.mGraphicsDesc.pDepthState = &depthStateDesc;
+        desc.mGraphicsDesc.pRasterizerState = &sphereRasterizerStateDesc;
+        desc.mGraphicsDesc.mSampleCount = pRenderTarget->mSampleCount;
+        desc.mGraphicsDesc.mSampleQuality = pRenderTarget->mSampleQuality;
+        desc.mGraphicsDesc.mDepthStencilFormat = depthBufferFormat;
+        desc.mGraphicsDesc.mPrimitiveTopo = PRIMITIVE_TOPO_TRI_LIST;
+        desc.mGraphicsDesc.mVRFoveatedRendering = true;
+
+        pipelines[pipelineCount++] = {desc, &pPipelineSphereShadow};
+
+        // Impostors read no vertex buffer.
+        desc.mGraphicsDesc.pShaderProgram = pShaderImpostorShadow;
+        desc.mGraphicsDesc.pVertexLayout = nullptr;
+        pipelines[pipelineCount++] = {desc, &pPipelineImpostorShadow};
+
+        desc = {};
+        desc.mType = PIPELINE_TYPE_GRAPHICS;
+        desc.pCache = pPipelineCache;
+        desc.mGraphicsDesc = {};
+        desc.mGraphicsDesc.pShaderProgram = pShaderImpostor;
+        desc.mGraphicsDesc.pRootSignature = pRSInstancing;
+        desc.mGraphicsDesc.pVertexLayout = nullptr;
         desc.mGraphicsDesc.pDepthState = &depthStateDesc;
         desc.mGraphicsDesc.pRasterizerState = &sphereRasterizerStateDesc;
+        desc.mGraphicsDesc.pColorFormats = &pRenderTarget->mFormat;
+        desc.mGraphicsDesc.mRenderTargetCount = 1;
         desc.mGraphicsDesc.mSampleCount = pRenderTarget->mSampleCount;
         desc.mGraphicsDesc.mSampleQuality = pRenderTarget->mSampleQuality;
         desc.mGraphicsDesc.mDepthStencilFormat = depthBufferFormat;
         desc.mGraphicsDesc.mPrimitiveTopo = PRIMITIVE_TOPO_TRI_LIST;
         desc.mGraphicsDesc.mVRFoveatedRendering = true;
 
-        addPipeline(pRenderer, &desc, &pPipelineSphereShadow);
-        ASSERT(pPipelineSphereShadow);
+        pipelines[pipelineCount++] = {desc, &pPipelineImpostor};
 
         desc = {};
         desc.mType = PIPELINE_TYPE_GRAPHICS;
+        desc.pCache = pPipelineCache;
         desc.mGraphicsDesc = {};
         desc.mGraphicsDesc.pShaderProgram = pShaderSingle;
         desc.mGraphicsDesc.pRootSignature = pRSSingle;
@@ -377,11 +943,11 @@ bool DemoScene::Load(ReloadDesc *pReloadDesc, Renderer *pRenderer, RenderTarget
         desc.mGraphicsDesc.mPrimitiveTopo = PRIMITIVE_TOPO_TRI_LIST;
         desc.mGraphicsDesc.mVRFoveatedRendering = true;
 
-        addPipeline(pRenderer, &desc, &pPipelineQuad);
-        ASSERT(pPipelineQuad);
+        pipelines[pipelineCount++] = {desc, &pPipelineQuad};
 
         desc = {};
         desc.mType = PIPELINE_TYPE_GRAPHICS;
+        desc.pCache = pPipelineCache;
         desc.mGraphicsDesc = {};
         desc.mGraphicsDesc.pShaderProgram = pShaderSingleShadow;
         desc.mGraphicsDesc.pRootSignature = pRSSingle;
@@ -394,51 +960,210 @@ bool DemoScene::Load(ReloadDesc *pReloadDesc, Renderer *pRenderer, RenderTarget
         desc.mGraphicsDesc.mPrimitiveTopo = PRIMITIVE_TOPO_TRI_LIST;
         desc.mGraphicsDesc.mVRFoveatedRendering = true;
 
-        addPipeline(pRenderer, &desc, &pPipelineQuadShadow);
-        ASSERT(pPipelineQuadShadow);
+        pipelines[pipelineCount++] = {desc, &pPipelineQuadShadow};
+
+        // Compute pipelines do not depend on the render targets, so they only follow shader reloads.
+        if ((pReloadDesc->mType & RELOAD_TYPE_SHADER) && gpuSimulation)
+        {
+            desc = {};
+            desc.mType = PIPELINE_TYPE_COMPUTE;
+            desc.pCache = pPipelineCache;
+            desc.mComputeDesc = {};
+            desc.mComputeDesc.pShaderProgram = pShaderSimulate;
+            desc.mComputeDesc.pRootSignature = pRSSimulate;
+            pipelines[pipelineCount++] = {desc, &pPipelineSimulate};
+        }
+        if ((pReloadDesc->mType & RELOAD_TYPE_SHADER) && gpuCulling)
+        {
+            desc = {};
+            desc.mType = PIPELINE_TYPE_COMPUTE;
+            desc.pCache = pPipelineCache;
+            desc.mComputeDesc = {};
+            desc.mComputeDesc.pShaderProgram = pShaderCull;
+            desc.mComputeDesc.pRootSignature = pRSCull;
+            pipelines[pipelineCount++] = {desc, &pPipelineCull};
+        }
+
+        ASSERT(pipelineCount <= MAX_LOAD_JOBS);
+        AddPipelines(pRenderer, pipelines, pipelineCount);
     }
 
     DescriptorData params = {};
-    params.pName = "uniformBlock";
-    params.ppBuffers = &pBufferSphereUniform;
-    updateDescriptorSet(pRenderer, 0, pDSSphereUniform, 1, &params);
-
-    params = {};
-    params.pName = "uniformBlock";
-    params.ppBuffers = &pBufferQuadUniform;
-    updateDescriptorSet(pRenderer, 0, pDSQuadUniform, 1, &params);
+    for (uint32_t i = 0; i < gDataBufferCount; i++)
+    {
+        params = {};
+        params.pName = "uniformBlock";
+        params.ppBuffers = &pBufferSphereUniform[i];
+        updateDescriptorSet(pRenderer, i, pDSSphereUniform, 1, &params);
+
+        params = {};
+        params.pName = "instancePositionScale";
+        params.ppBuffers = gpuSimulation ? &pBufferSimulatePositionScale : &pBufferSpherePositionScale[i];
+        updateDescriptorSet(pRenderer, i, pDSSphereUniform, 1, &params);
+
+        params = {};
+        params.pName = "instanceColor";
+        params.ppBuffers = gpuSimulation ? &pBufferSimulateColor : &pBufferSphereColor[i];
+        updateDescriptorSet(pRenderer, i, pDSSphereUniform, 1, &params);
+
+        params = {};
+        params.pName = "cameraVisible";
+        params.ppBuffers =
+            gpuCulling ? &pBufferGpuVisible[CULL_VIEW_CAMERA] : &pBufferSphereVisible[CULL_VIEW_CAMERA][i];
+        updateDescriptorSet(pRenderer, i, pDSSphereUniform, 1, &params);
+
+        params = {};
+        params.pName = "lightVisible";
+        params.ppBuffers =
+            gpuCulling ? &pBufferGpuVisible[CULL_VIEW_LIGHT] : &pBufferSphereVisible[CULL_VIEW_LIGHT][i];
+        updateDescriptorSet(pRenderer, i, pDSSphereUniform, 1, &params);
+
+        params = {};
+        params.pName = "uniformBlock";
+        params.ppBuffers = &pBufferQuadUniform[i];
+        updateDescriptorSet(pRenderer, i, pDSQuadUniform, 1, &params);
+    }
 
     params = {};
     params.pName = "lightMap";
-    params.ppTextures = &pRTShadowMap->pTexture;
+    RenderTarget *pShadowMap = RenderGraph::GetRenderTarget(shadowMapTarget);
+    params.ppTextures = &pShadowMap->pTexture;
     updateDescriptorSet(pRenderer, 0, pDSShadowMap, 1, &params);
 
+    if (gpuSimulation && (pReloadDesc->mType & RELOAD_TYPE_SHADER))
+    {
+        DescriptorData simulateParams[3] = {};
+        simulateParams[0].pName = "positionScale";
+        simulateParams[0].ppBuffers = &pBufferSimulatePositionScale;
+        simulateParams[1].pName = "speed";
+        simulateParams[1].ppBuffers = &pBufferSimulateSpeed;
+        simulateParams[2].pName = "color";
+        simulateParams[2].ppBuffers = &pBufferSimulateColor;
+        updateDescriptorSet(pRenderer, 0, pDSSimulate, 3, simulateParams);
+    }
+
+    if (gpuCulling && (pReloadDesc->mType & RELOAD_TYPE_SHADER))
+    {
+        for (uint32_t i = 0; i < gDataBufferCount; i++)
+        {
+            DescriptorData cullParams[6] = {};
+            cullParams[0].pName = "cullUniform";
+            cullParams[0].ppBuffers = &pBufferCullUniform[i];
+            cullParams[1].pName = "positionScale";
+            cullParams[1].ppBuffers = gpuSimulation ? &pBufferSimulatePositionScale : &pBufferSpherePositionScale[i];
+            cullParams[2].pName = "cameraVisibleOut";
+            cullParams[2].ppBuffers = &pBufferGpuVisible[CULL_VIEW_CAMERA];
+            cullParams[3].pName = "lightVisibleOut";
+            cullParams[3].ppBuffers = &pBufferGpuVisible[CULL_VIEW_LIGHT];
+            cullParams[4].pName = "drawArgs";
+            cullParams[4].ppBuffers = &pBufferCullArgs;
+            cullParams[5].pName = "lodState";
+            cullParams[5].ppBuffers = &pBufferLodState;
+            updateDescriptorSet(pRenderer, i, pDSCull, 6, cullParams);
+        }
+    }
+
     return true;
 }
 
-void DemoScene::AddSphereResources(Renderer *pRenderer)
+bool DemoScene::IsResident()
 {
-    ShaderLoadDesc shaderDesc{};
+    return IsUploadResident(UPLOAD_SPHERE_MESH) && IsUploadResident(UPLOAD_QUAD_MESH) &&
+           IsUploadResident(UPLOAD_SPHERE_STATE);
+}
 
-    shaderDesc.mStages[0].pFileName = "sphere.vert";
-    shaderDesc.mStages[1].pFileName = "basic.frag";
-    addShader(pRenderer, &shaderDesc, &pShaderInstancing);
-    ASSERT(pShaderInstancing);
+void DemoScene::AddUploadSource(UploadGroup group, void *pData)
+{
+    ASSERT(uploadSourceCount[group] < MAX_UPLOAD_SOURCES);
+    pUploadSources[group][uploadSourceCount[group]++] = pData;
+}
 
-    shaderDesc = {};
-    shaderDesc.mStages[0].pFileName = "sphere_shadow.vert";
-    shaderDesc.mStages[1].pFileName = "shadow.frag";
-    addShader(pRenderer, &shaderDesc, &pShaderInstancingShadow);
-    ASSERT(pShaderInstancingShadow);
+bool DemoScene::IsUploadResident(UploadGroup group)
+{
+    if (!uploadResident[group] && isTokenCompleted(&uploadToken[group]))
+    {
+        for (uint32_t i = 0; i < uploadSourceCount[group]; i++)
+        {
+            tf_free(pUploadSources[group][i]);
+            pUploadSources[group][i] = nullptr;
+        }
+        uploadSourceCount[group] = 0;
+        uploadResident[group] = true;
+    }
+    return uploadResident[group];
+}
 
-    std::array<Shader *, 2> shaders = {pShaderInstancing, pShaderInstancingShadow};
+void DemoScene::AddShaders(Renderer *pRenderer, const ShaderLoad *pLoads, uint32_t count)
+{
+    struct ShaderJob
+    {
+        Renderer *pRenderer;
+        const ShaderLoad *pLoads;
+    } job = {pRenderer, pLoads};
+
+    // A single chunk runs on this thread.
+    JobSystem::ParallelFor(
+        count, parallelLoad ? 1 : count,
+        [](void *pUserData, uint32_t begin, uint32_t end)
+        {
+            const ShaderJob *pJob = static_cast<const ShaderJob *>(pUserData);
+            for (uint32_t i = begin; i < end; i++)
+            {
+                const ShaderLoad &load = pJob->pLoads[i];
+                ShaderLoadDesc shaderDesc{};
+                shaderDesc.mStages[0].pFileName = load.pFileNames[0];
+                shaderDesc.mStages[1].pFileName = load.pFileNames[1];
+                addShader(pJob->pRenderer, &shaderDesc, load.ppShader);
+            }
+        },
+        &job);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        ASSERT(*pLoads[i].ppShader);
+    }
+}
+
+void DemoScene::AddPipelines(Renderer *pRenderer, const PipelineLoad *pLoads, uint32_t count)
+{
+    struct PipelineJob
+    {
+        Renderer *pRenderer;
+        const PipelineLoad *pLoads;
+    } job = {pRenderer, pLoads};
+
+    JobSystem::ParallelFor(
+        count, parallelLoad ? 1 : count,
+        [](void *pUserData, uint32_t begin, uint32_t end)
+        {
+            const PipelineJob *pJob = static_cast<const PipelineJob *>(pUserData);
+            for (uint32_t i = begin; i < end; i++)
+            {
+                PipelineDesc desc = pJob->pLoads[i].mDesc;
+                addPipeline(pJob->pRenderer, &desc, pJob->pLoads[i].ppPipeline);
+            }
+        },
+        &job);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        ASSERT(*pLoads[i].ppPipeline);
+    }
+}
+
+void DemoScene::AddSphereResources(Renderer *pRenderer)
+{
+    // Mesh and impostor shaders share the uniforms, instance data and shadow map, so they share the descriptor sets.
+    std::array<Shader *, 4> shaders = {pShaderInstancing, pShaderInstancingShadow, pShaderImpostor,
+                                       pShaderImpostorShadow};
     RootSignatureDesc rootDesc = {};
     rootDesc.ppShaders = shaders.data();
     rootDesc.mShaderCount = shaders.size();
     addRootSignature(pRenderer, &rootDesc, &pRSInstancing);
     ASSERT(pRSInstancing);
+    drawConstantsIndex = getDescriptorIndexFromName(pRSInstancing, "drawConstants");
 
-    DescriptorSetDesc dsDesc = {pRSInstancing, DESCRIPTOR_UPDATE_FREQ_PER_FRAME, 1};
+    DescriptorSetDesc dsDesc = {pRSInstancing, DESCRIPTOR_UPDATE_FREQ_PER_FRAME, gDataBufferCount};
     addDescriptorSet(pRenderer, &dsDesc, &pDSSphereUniform);
 
     ASSERT(pDSSphereUniform);
@@ -446,18 +1171,6 @@ void DemoScene::AddSphereResources(Renderer *pRenderer)
 
 void DemoScene::AddQuadResources(Renderer *pRenderer)
 {
-    ShaderLoadDesc shaderDesc{};
-    shaderDesc.mStages[0].pFileName = "quad.vert";
-    shaderDesc.mStages[1].pFileName = "basic.frag";
-    addShader(pRenderer, &shaderDesc, &pShaderSingle);
-    ASSERT(pShaderSingle);
-
-    shaderDesc = {};
-    shaderDesc.mStages[0].pFileName = "quad_shadow.vert";
-    shaderDesc.mStages[1].pFileName = "shadow.frag";
-    addShader(pRenderer, &shaderDesc, &pShaderSingleShadow);
-    ASSERT(pShaderSingleShadow);
-
     std::array<Shader *, 2> shaders = {pShaderSingle, pShaderSingleShadow};
     RootSignatureDesc rootDesc{};
     rootDesc.ppShaders = shaders.data();
@@ -466,18 +1179,272 @@ void DemoScene::AddQuadResources(Renderer *pRenderer)
     addRootSignature(pRenderer, &rootDesc, &pRSSingle);
     ASSERT(pRSSingle);
 
-    DescriptorSetDesc dsDesc = {pRSSingle, DESCRIPTOR_UPDATE_FREQ_PER_FRAME, 1};
+    DescriptorSetDesc dsDesc = {pRSSingle, DESCRIPTOR_UPDATE_FREQ_PER_FRAME, gDataBufferCount};
     addDescriptorSet(pRenderer, &dsDesc, &pDSQuadUniform);
 
     ASSERT(pDSQuadUniform);
 }
 
+void DemoScene::AddSimulateResources(Renderer *pRenderer)
+{
+    RootSignatureDesc rootDesc{};
+    rootDesc.ppShaders = &pShaderSimulate;
+    rootDesc.mShaderCount = 1;
+    addRootSignature(pRenderer, &rootDesc, &pRSSimulate);
+    ASSERT(pRSSimulate);
+    simulateConstantsIndex = getDescriptorIndexFromName(pRSSimulate, "simulateConstants");
+
+    DescriptorSetDesc dsDesc = {pRSSimulate, DESCRIPTOR_UPDATE_FREQ_NONE, 1};
+    addDescriptorSet(pRenderer, &dsDesc, &pDSSimulate);
+    ASSERT(pDSSimulate);
+}
+
+void DemoScene::AddSimulateBuffers()
+{
+    SyncToken *pToken = &uploadToken[UPLOAD_SPHERE_STATE];
+    // Seed the GPU state from the CPU spawn, so both modes start from the same spheres. Update resizes spheres while
+    // the upload is in flight, so the loader thread only reads copies owned by the upload.
+    const uint32_t capacity = spheres.mCapacity;
+    float *pPositionScale = static_cast<float *>(tf_malloc(sizeof(float4) * capacity));
+    float *pSpeed = static_cast<float *>(tf_malloc(sizeof(float4) * capacity));
+    uint32_t *pColor = static_cast<uint32_t *>(tf_malloc(sizeof(uint32_t) * capacity));
+    memcpy(pColor, spheres.pColor, sizeof(uint32_t) * capacity);
+    for (uint32_t i = 0; i < capacity; i++)
+    {
+        pPositionScale[i * 4 + 0] = spheres.pPositionX[i];
+        pPositionScale[i * 4 + 1] = spheres.pPositionY[i];
+        pPositionScale[i * 4 + 2] = spheres.pPositionZ[i];
+        pPositionScale[i * 4 + 3] = spheres.pSize[i];
+        pSpeed[i * 4 + 0] = spheres.pSpeedX[i];
+        pSpeed[i * 4 + 1] = spheres.pSpeedY[i];
+        pSpeed[i * 4 + 2] = spheres.pSpeedZ[i];
+        pSpeed[i * 4 + 3] = 0.0f;
+    }
+
+    BufferLoadDesc desc = {};
+    desc.ppBuffer = &pBufferSimulatePositionScale;
+    desc.pData = pPositionScale;
+    desc.mDesc = {};
+    desc.mDesc.mSize = sizeof(float4) * capacity;
+    desc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_ONLY;
+    desc.mDesc.mDescriptors = DESCRIPTOR_TYPE_BUFFER | DESCRIPTOR_TYPE_RW_BUFFER;
+    desc.mDesc.mStructStride = sizeof(float4);
+    desc.mDesc.mElementCount = capacity;
+    desc.mDesc.mFirstElement = 0;
+    // positionScale and color sit in SHADER_RESOURCE between frames and are only UAVs during the dispatch.
+    desc.mDesc.mStartState = RESOURCE_STATE_SHADER_RESOURCE;
+    addResource(&desc, pToken);
+
+    desc.ppBuffer = &pBufferSimulateColor;
+    desc.pData = pColor;
+    desc.mDesc.mSize = sizeof(uint32_t) * capacity;
+    desc.mDesc.mStructStride = sizeof(uint32_t);
+    addResource(&desc, pToken);
+
+    desc.ppBuffer = &pBufferSimulateSpeed;
+    desc.pData = pSpeed;
+    desc.mDesc.mSize = sizeof(float4) * capacity;
+    desc.mDesc.mDescriptors = DESCRIPTOR_TYPE_RW_BUFFER;
+    desc.mDesc.mStructStride = sizeof(float4);
+    desc.mDesc.mStartState = RESOURCE_STATE_UNORDERED_ACCESS;
+    addResource(&desc, pToken);
+
+    AddUploadSource(UPLOAD_SPHERE_STATE, pPositionScale);
+    AddUploadSource(UPLOAD_SPHERE_STATE, pSpeed);
+    AddUploadSource(UPLOAD_SPHERE_STATE, pColor);
+}
+
+void DemoScene::AddCullResources(Renderer *pRenderer)
+{
+    RootSignatureDesc rootDesc{};
+    rootDesc.ppShaders = &pShaderCull;
+    rootDesc.mShaderCount = 1;
+    addRootSignature(pRenderer, &rootDesc, &pRSCull);
+    ASSERT(pRSCull);
+
+    DescriptorSetDesc dsDesc = {pRSCull, DESCRIPTOR_UPDATE_FREQ_PER_FRAME, gDataBufferCount};
+    addDescriptorSet(pRenderer, &dsDesc, &pDSCull);
+    ASSERT(pDSCull);
+
+    IndirectArgumentDescriptor indirectArg = {};
+    indirectArg.mType = INDIRECT_DRAW_INDEX;
+
+    CommandSignatureDesc signatureDesc = {};
+    signatureDesc.pRootSignature = pRSInstancing;
+    signatureDesc.pArgDescs = &indirectArg;
+    signatureDesc.mIndirectArgCount = 1;
+    signatureDesc.mPacked = true;
+    addIndirectCommandSignature(pRenderer, &signatureDesc, &pCmdSignatureDraw);
+    ASSERT(pCmdSignatureDraw);
+}
+
+void DemoScene::AddCullBuffers()
+{
+    SyncToken *pToken = &uploadToken[UPLOAD_SPHERE_STATE];
+    BufferLoadDesc desc = {};
+    for (uint32_t view = 0; view < CULL_VIEW_COUNT; view++)
+    {
+        desc = {};
+        desc.ppBuffer = &pBufferGpuVisible[view];
+        desc.mDesc = {};
+        desc.mDesc.mSize = sizeof(uint32_t) * spheres.mCapacity * SphereSimulation::MAX_LODS;
+        desc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_ONLY;
+        desc.mDesc.mDescriptors = DESCRIPTOR_TYPE_BUFFER | DESCRIPTOR_TYPE_RW_BUFFER;
+        desc.mDesc.mStructStride = sizeof(uint32_t);
+        desc.mDesc.mElementCount = spheres.mCapacity * SphereSimulation::MAX_LODS;
+        desc.mDesc.mFirstElement = 0;
+        desc.mDesc.mStartState = RESOURCE_STATE_SHADER_RESOURCE;
+        addResource(&desc, pToken);
+    }
+
+    constexpr uint32_t argsCount = CULL_VIEW_COUNT * SphereSimulation::MAX_LODS;
+    constexpr uint32_t argsSize = sizeof(IndirectDrawIndexArguments) * argsCount;
+    IndirectDrawIndexArguments *args =
+        static_cast<IndirectDrawIndexArguments *>(tf_calloc(argsCount, sizeof(IndirectDrawIndexArguments)));
+    for (uint32_t view = 0; view < CULL_VIEW_COUNT; view++)
+    {
+        for (uint32_t lod = 0; lod < SphereSimulation::MAX_LODS; lod++)
+        {
+            args[view * SphereSimulation::MAX_LODS + lod].mIndexCount = sphereLodIndexCount[lod];
+            args[view * SphereSimulation::MAX_LODS + lod].mStartIndex = sphereLodFirstIndex[lod];
+            args[view * SphereSimulation::MAX_LODS + lod].mVertexOffset = sphereLodFirstVertex[lod];
+        }
+    }
+
+    // Every sphere starts at LOD 0 and the compute pass keeps its LOD from frame to frame.
+    uint32_t *lodState = static_cast<uint32_t *>(tf_calloc(spheres.mCapacity, sizeof(uint32_t)));
+    desc = {};
+    desc.ppBuffer = &pBufferLodState;
+    desc.pData = lodState;
+    desc.mDesc = {};
+    desc.mDesc.mSize = sizeof(uint32_t) * spheres.mCapacity;
+    desc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_ONLY;
+    desc.mDesc.mDescriptors = DESCRIPTOR_TYPE_RW_BUFFER;
+    desc.mDesc.mStructStride = sizeof(uint32_t);
+    desc.mDesc.mElementCount = spheres.mCapacity;
+    desc.mDesc.mFirstElement = 0;
+    desc.mDesc.mStartState = RESOURCE_STATE_UNORDERED_ACCESS;
+    addResource(&desc, pToken);
+
+    desc = {};
+    desc.ppBuffer = &pBufferCullArgsReset;
+    desc.pData = args;
+    desc.mDesc = {};
+    desc.mDesc.mSize = argsSize;
+    desc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_ONLY;
+    desc.mDesc.mDescriptors = DESCRIPTOR_TYPE_BUFFER;
+    desc.mDesc.mStartState = RESOURCE_STATE_COPY_SOURCE;
+    addResource(&desc, pToken);
+
+    IndirectDrawIndexArguments *impostorArgs =
+        static_cast<IndirectDrawIndexArguments *>(tf_calloc(argsCount, sizeof(IndirectDrawIndexArguments)));
+    for (uint32_t i = 0; i < argsCount; i++)
+    {
+        impostorArgs[i].mIndexCount = IMPOSTOR_INDEX_COUNT;
+        impostorArgs[i].mStartIndex = impostorFirstIndex;
+    }
+    desc.ppBuffer = &pBufferImpostorArgsReset;
+    desc.pData = impostorArgs;
+    addResource(&desc, pToken);
+
+    desc.ppBuffer = &pBufferCullArgs;
+    desc.mDesc.mDescriptors = DESCRIPTOR_TYPE_RW_BUFFER | DESCRIPTOR_TYPE_INDIRECT_BUFFER;
+    desc.mDesc.mStructStride = sizeof(uint32_t);
+    desc.mDesc.mElementCount = argsSize / sizeof(uint32_t);
+    desc.mDesc.mFirstElement = 0;
+    desc.mDesc.mStartState = RESOURCE_STATE_INDIRECT_ARGUMENT;
+    addResource(&desc, pToken);
+
+    for (uint32_t i = 0; i < gDataBufferCount; i++)
+    {
+        desc = {};
+        desc.ppBuffer = &pBufferCullUniform[i];
+        desc.mDesc = {};
+        desc.mDesc.mSize = sizeof(CullUniform);
+        desc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_CPU_TO_GPU;
+        desc.mDesc.mFlags = BUFFER_CREATION_FLAG_PERSISTENT_MAP_BIT;
+        desc.mDesc.mDescriptors = DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        addResource(&desc, pToken);
+
+        desc = {};
+        desc.ppBuffer = &pBufferCullArgsReadback[i];
+        desc.mDesc = {};
+        desc.mDesc.mSize = argsSize;
+        desc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_TO_CPU;
+        desc.mDesc.mFlags = BUFFER_CREATION_FLAG_PERSISTENT_MAP_BIT;
+        desc.mDesc.mStartState = RESOURCE_STATE_COPY_DEST;
+        addResource(&desc, pToken);
+    }
+
+    AddUploadSource(UPLOAD_SPHERE_STATE, lodState);
+    AddUploadSource(UPLOAD_SPHERE_STATE, args);
+    AddUploadSource(UPLOAD_SPHERE_STATE, impostorArgs);
+
+    // The UI shows zeros until the first frames come back.
+    for (uint32_t i = 0; i < gDataBufferCount; i++)
+    {
+        memset(pBufferCullArgsReadback[i]->pCpuMappedAddress, 0, argsSize);
+    }
+}
+
+void DemoScene::AddFloorAndLight()
+{
+    transformComponent = EntityStorage::AddComponentType(&sceneWorld, sizeof(mat4));
+    colorComponent = EntityStorage::AddComponentType(&sceneWorld, sizeof(vec4));
+    lightComponent = EntityStorage::AddComponentType(&sceneWorld, sizeof(Light));
+
+    const uint32_t floorArchetype =
+        EntityStorage::AddArchetype(&sceneWorld, (1u << transformComponent) | (1u << colorComponent), 1);
+    EntityStorage::CreateEntities(&sceneWorld, floorArchetype, 1, &floorEntity);
+    *GetSceneComponent<mat4>(floorEntity, transformComponent) =
+        mat4::translation({0, -200, 0}) * mat4::rotationX(degToRad(-90)) * mat4::scale({200, 200, 200});
+    *GetSceneComponent<vec4>(floorEntity, colorComponent) = {1.0f, 1.0f, 1.0f, 1.0f};
+
+    const uint32_t lightArchetype = EntityStorage::AddArchetype(&sceneWorld, 1u << lightComponent, 1);
+    EntityStorage::CreateEntities(&sceneWorld, lightArchetype, 1, &lightEntity);
+    Light *pLight = GetSceneComponent<Light>(lightEntity, lightComponent);
+    pLight->mPosition = {0, 300, 500};
+    pLight->mTarget = {0, -200, 0};
+}
+
+void DemoScene::ResizeSpheres(uint32_t count)
+{
+    // Culling, picking and the instance buffers index spheres through the one SphereState of spheres.
+    ASSERT(SphereSystems::GetSphereArchetype(&sceneWorld, &sphereComponents) == sphereArchetype);
+    SphereSystems::Resize(&sceneWorld, &sphereComponents, sphereArchetype, count, spheres.mSeed);
+    SphereSystems::GetSphereState(&sceneWorld, &sphereComponents, sphereArchetype, &spheres);
+}
+
+SphereSimulation::Frustum DemoScene::ExtractFrustum(const mat4 &viewProj)
+{
+    // Gribb/Hartmann: clip space is -w <= x, y <= w and 0 <= z <= w, which also holds for the reversed Z
+    // projections used here.
+    const vec4 row0 = viewProj.getRow(0);
+    const vec4 row1 = viewProj.getRow(1);
+    const vec4 row2 = viewProj.getRow(2);
+    const vec4 row3 = viewProj.getRow(3);
+    const vec4 planes[6] = {row3 + row0, row3 - row0, row3 + row1, row3 - row1, row2, row3 - row2};
+
+    SphereSimulation::Frustum frustum{};
+    for (uint32_t i = 0; i < 6; i++)
+    {
+        const float inverseLength = 1.0f / length(planes[i].getXYZ());
+        frustum.mPlanes[i][0] = planes[i].getX() * inverseLength;
+        frustum.mPlanes[i][1] = planes[i].getY() * inverseLength;
+        frustum.mPlanes[i][2] = planes[i].getZ() * inverseLength;
+        frustum.mPlanes[i][3] = planes[i].getW() * inverseLength;
+    }
+    return frustum;
+}
+
 void DemoScene::Unload(ReloadDesc *pReloadDesc, Renderer *pRenderer)
 {
     if (pReloadDesc->mType & (RELOAD_TYPE_SHADER | RELOAD_TYPE_RENDERTARGET))
     {
         removePipeline(pRenderer, pPipelineSphere);
         removePipeline(pRenderer, pPipelineSphereShadow);
+        removePipeline(pRenderer, pPipelineImpostor);
+        removePipeline(pRenderer, pPipelineImpostorShadow);
         removePipeline(pRenderer, pPipelineQuad);
         removePipeline(pRenderer, pPipelineQuadShadow);
     }
@@ -486,15 +1453,17 @@ void DemoScene::Unload(ReloadDesc *pReloadDesc, Renderer *pRenderer)
     {
         RemoveSphereResources(pRenderer);
         RemoveQuadResources(pRenderer);
+        if (gpuSimulation)
+        {
+            RemoveSimulateResources(pRenderer);
+        }
+        if (gpuCulling)
+        {
+            RemoveCullResources(pRenderer);
+        }
 
         removeDescriptorSet(pRenderer, pDSShadowMap);
     }
-
-    if (pReloadDesc->mType & (RELOAD_TYPE_RESIZE | RELOAD_TYPE_RENDERTARGET))
-    {
-        removeRenderTarget(pRenderer, pRTDepth);
-        removeRenderTarget(pRenderer, pRTShadowMap);
-    }
 }
 
 void DemoScene::RemoveSphereResources(Renderer *pRenderer)
@@ -503,6 +1472,8 @@ void DemoScene::RemoveSphereResources(Renderer *pRenderer)
     removeRootSignature(pRenderer, pRSInstancing);
     removeShader(pRenderer, pShaderInstancing);
     removeShader(pRenderer, pShaderInstancingShadow);
+    removeShader(pRenderer, pShaderImpostor);
+    removeShader(pRenderer, pShaderImpostorShadow);
 }
 
 void DemoScene::RemoveQuadResources(Renderer *pRenderer)
@@ -513,115 +1484,444 @@ void DemoScene::RemoveQuadResources(Renderer *pRenderer)
     removeShader(pRenderer, pShaderSingleShadow);
 }
 
-void DemoScene::Update(float deltaTime, uint32_t width, uint32_t height)
+void DemoScene::RemoveSimulateResources(Renderer *pRenderer)
 {
+    removePipeline(pRenderer, pPipelineSimulate);
+    removeDescriptorSet(pRenderer, pDSSimulate);
+    removeRootSignature(pRenderer, pRSSimulate);
+    removeShader(pRenderer, pShaderSimulate);
+}
+
+void DemoScene::RemoveCullResources(Renderer *pRenderer)
+{
+    removeIndirectCommandSignature(pRenderer, pCmdSignatureDraw);
+    removePipeline(pRenderer, pPipelineCull);
+    removeDescriptorSet(pRenderer, pDSCull);
+    removeRootSignature(pRenderer, pRSCull);
+    removeShader(pRenderer, pShaderCull);
+}
+
+void DemoScene::Update(float deltaTime, uint32_t width, uint32_t height, uint32_t frameIndex)
+{
+    CpuTimers::ScopedTimer updateTimer(CpuTimers::SCOPE_SCENE_UPDATE);
+
     const float aspectInverse = (float)height / (float)width;
     const float horizontal_fov = PI / 2.0f;
 
-    Point3 lightPos{0, 300, 500};
-    Point3 lightLookAt{0, -200, 0};
-    mat4 lightView = mat4::lookAtLH(lightPos, lightLookAt, {0, 1, 0});
-    lightViewProj = CameraMatrix::orthographic(-200, 200, -200, 200, 1000, 0.1) * lightView;
+    const Light *pLight = GetSceneComponent<Light>(lightEntity, lightComponent);
+    const Point3 lightPos = pLight->mPosition;
+    const Point3 lightLookAt = pLight->mTarget;
+    CameraMatrix mProjectView{};
+    vec3 cameraPosition{};
+    {
+        CpuTimers::ScopedTimer timer(CpuTimers::SCOPE_MATRICES);
+        mat4 lightView = mat4::lookAtLH(lightPos, lightLookAt, {0, 1, 0});
+        lightViewProj = CameraMatrix::orthographic(-200, 200, -200, 200, 1000, 0.1) * lightView;
+
+        pCameraController->update(deltaTime);
+        CameraMatrix projMat = CameraMatrix::perspective(horizontal_fov, aspectInverse, 1000.0f, 0.1f);
+        mProjectView = projMat * pCameraController->getViewMatrix();
+        cameraPosition = pCameraController->getViewPosition();
+    }
 
-    sphereUniform.lightProjectView = lightViewProj;
-    quadUniform.lightProjectView = lightViewProj;
+    spheresResident = IsUploadResident(UPLOAD_SPHERE_MESH) && IsUploadResident(UPLOAD_SPHERE_STATE);
+    quadResident = IsUploadResident(UPLOAD_QUAD_MESH);
 
-    pCameraController->update(deltaTime);
-    CameraMatrix projMat = CameraMatrix::perspective(horizontal_fov, aspectInverse, 1000.0f, 0.1f);
-    CameraMatrix mProjectView = projMat * pCameraController->getViewMatrix();
+    {
+        CpuTimers::ScopedTimer timer(CpuTimers::SCOPE_INTEGRATION);
+        if (gpuSimulation)
+        {
+            ResizeSpheres(sphereCount < spheres.mCapacity ? sphereCount : spheres.mCapacity);
+            // Recorded into the command buffer by Draw, one step per frame. The simulation starts once its initial
+            // state is resident. The camera keeps moving with the frame time, only the simulation steps are fixed.
+            if (spheresResident)
+            {
+                simulateConstants.deltaTime = fixedDeltaTime > 0.0f ? fixedDeltaTime : deltaTime;
+                simulateConstants.sphereCount = spheres.mCount;
+                simulateConstants.step = spheres.mStep++;
+                simulateConstants.seed = static_cast<uint32_t>(spheres.mSeed ^ (spheres.mSeed >> 32));
+            }
+        }
+        else
+        {
+            SphereSimulation::InstanceOutput output{};
+            output.pPositionScale = static_cast<float *>(pBufferSpherePositionScale[frameIndex]->pCpuMappedAddress);
+            output.pColor = static_cast<uint32_t *>(pBufferSphereColor[frameIndex]->pCpuMappedAddress);
+            // The simulation steps on its own thread at a fixed rate and never waits for a frame, nor a frame for
+            // it. Each frame shows its latest published step blended with the one before.
+            SimulationThread::SetSphereCount(sphereCount);
+            SimulationThread::SetChunkSize(chunkSize);
+            SimulationThread::SetCollisions(collisions);
+            float alpha = 0.0f;
+            const SphereSimulation::Snapshot *pSnapshot = SimulationThread::AcquireSnapshot(&alpha);
+            // The render copy holds as many spheres as the step it shows, which may lag the slider.
+            ResizeSpheres(pSnapshot->mCount);
+            SphereSimulation::Interpolate(pSnapshot, alpha, &spheres, &output, chunkSize);
+            spheres.mStep = pSnapshot->mStep;
+
+            const SphereSimulation::CollisionStats &stats = pSnapshot->mCollisions;
+            bassignformat(&collisionStats, "%llu pair tests, %llu contacts, grid %u^3 %.3f ms, narrowphase %.3f ms",
+                          static_cast<unsigned long long>(stats.mPairTests),
+                          static_cast<unsigned long long>(stats.mContacts), stats.mGridResolution,
+                          stats.mBroadphaseTime, stats.mNarrowphaseTime);
+        }
+    }
+
+    if (!gpuSimulation)
+    {
+        CpuTimers::ScopedTimer timer(CpuTimers::SCOPE_BVH);
+        // Nothing else queries the tree, so frames without a pick leave it alone. A refit picks up however far the
+        // spheres have moved since the last one, and respawns and drift that have stretched its boxes too far make
+        // it rebuild.
+        if (pickPending)
+        {
+            pickPending = false;
+            bvhRebuilds +=
+                SphereBvh::Update(&sphereBvh, &spheres, SphereBvh::DEFAULT_REBUILD_THRESHOLD, chunkSize) ? 1 : 0;
+
+            // Any depth between the clip planes gives a point on the line through the cursor.
+            const vec4 clipPoint(2.0f * pickPosition.x / static_cast<float>(width) - 1.0f,
+                                 1.0f - 2.0f * pickPosition.y / static_cast<float>(height), 0.5f, 1.0f);
+            const vec4 worldPoint = inverse(mProjectView.getPrimaryMatrix()) * clipPoint;
+            const vec3 direction = normalize(worldPoint.getXYZ() / worldPoint.getW() - cameraPosition);
+
+            SphereBvh::Ray ray{};
+            ray.mOrigin[0] = cameraPosition.getX();
+            ray.mOrigin[1] = cameraPosition.getY();
+            ray.mOrigin[2] = cameraPosition.getZ();
+            ray.mDirection[0] = direction.getX();
+            ray.mDirection[1] = direction.getY();
+            ray.mDirection[2] = direction.getZ();
+            ray.mMaxDistance = 1000.0f;
+            SphereBvh::RayHit hit{};
+            SphereBvh::Intersect(&sphereBvh, &ray, 1, &hit, 1);
+            pickedSphere = hit.mSphere;
+            pickedDistance = hit.mDistance;
+        }
+
+        // Interpolate rewrites every color each frame, so the highlight goes away with the pick.
+        if (pickedSphere < spheres.mCount)
+        {
+            uint32_t *pColor = static_cast<uint32_t *>(pBufferSphereColor[frameIndex]->pCpuMappedAddress);
+            pColor[pickedSphere] = SphereSimulation::PackColor(1.0f, 1.0f, 1.0f, 1.0f);
+            bassignformat(&pickStats, "sphere %u, %.1f away, BVH at %.2fx its build area, %u rebuilds", pickedSphere,
+                          pickedDistance, SphereBvh::GetQuality(&sphereBvh), bvhRebuilds);
+        }
+        else
+        {
+            bassignformat(&pickStats, "click a sphere, BVH at %.2fx its build area, %u rebuilds",
+                          SphereBvh::GetQuality(&sphereBvh), bvhRebuilds);
+        }
+    }
 
-    sphereUniform.projectView = mProjectView;
+    if (stepLimit != 0 && spheres.mStep == stepLimit && !stepLimitReached)
+    {
+        stepLimitReached = true;
+        // The GPU simulation keeps its state in GPU buffers, so only the CPU one can be hashed.
+        if (gpuSimulation)
+        {
+            LOGF(eINFO, "Sphere simulation: stopped after %u steps", spheres.mStep);
+        }
+        else
+        {
+            SimulationThread::Stop();
+            LOGF(eINFO, "Sphere simulation: stopped after %u steps, state hash %016llx", spheres.mStep,
+                 static_cast<unsigned long long>(SphereSimulation::HashState(SimulationThread::GetState())));
+        }
+        requestShutdown();
+    }
 
-    for (int i = 0; i < MAX_SPHERE; i++)
     {
-        position[i] = position[i] + (deltaTime * speed[i]);
-        if (fabs(position[i].getX()) > 200 || fabs(position[i].getY()) > 200 || fabs(position[i].getZ()) > 200)
+        CpuTimers::ScopedTimer timer(CpuTimers::SCOPE_CULL);
+        SphereSimulation::CullDesc cullDesc{};
+        cullDesc.mFrusta[CULL_VIEW_CAMERA] = ExtractFrustum(mProjectView.getPrimaryMatrix());
+        cullDesc.mFrusta[CULL_VIEW_LIGHT] = ExtractFrustum(lightViewProj.getPrimaryMatrix());
+        cullDesc.mViewCount = CULL_VIEW_COUNT;
+
+        // LODs are picked by the size on the main camera's screen, the shadow pass only biases them.
+        cullDesc.mLod.mCameraPosition[0] = cameraPosition.getX();
+        cullDesc.mLod.mCameraPosition[1] = cameraPosition.getY();
+        cullDesc.mLod.mCameraPosition[2] = cameraPosition.getZ();
+        cullDesc.mLod.mPixelScale = static_cast<float>(width) / tanf(horizontal_fov * 0.5f);
+        for (uint32_t lod = 0; lod < SphereSimulation::MAX_LODS - 1; lod++)
+        {
+            cullDesc.mLod.mThresholds[lod] = SPHERE_LOD_THRESHOLDS[lod];
+        }
+        cullDesc.mLod.mLodCount = SphereSimulation::MAX_LODS;
+        cullDesc.mLod.mHysteresis = SPHERE_LOD_HYSTERESIS;
+        for (uint32_t view = 0; view < CULL_VIEW_COUNT; view++)
         {
-            position[i].setX(randomFloat(-200, 200));
-            position[i].setY(randomFloat(-200, 200));
-            position[i].setZ(randomFloat(-200, 200));
+            cullDesc.mLod.mBias[view] = lodBias[view];
+        }
 
-            color[i] = {randomFloat01(), randomFloat01(), randomFloat01(), 1.0};
-            size[i] = randomFloat(1.0f, 10.0f);
+        if (gpuCulling)
+        {
+            CullUniform *pCullUniform = static_cast<CullUniform *>(pBufferCullUniform[frameIndex]->pCpuMappedAddress);
+            for (uint32_t view = 0; view < CULL_VIEW_COUNT; view++)
+            {
+                pCullUniform->frusta[view] = cullDesc.mFrusta[view];
+                pCullUniform->lodBias[view] = cullDesc.mLod.mBias[view];
+            }
+            pCullUniform->lodCamera = {cullDesc.mLod.mCameraPosition[0], cullDesc.mLod.mCameraPosition[1],
+                                       cullDesc.mLod.mCameraPosition[2], cullDesc.mLod.mPixelScale};
+            pCullUniform->lodThresholds = {cullDesc.mLod.mThresholds[0], cullDesc.mLod.mThresholds[1],
+                                           cullDesc.mLod.mThresholds[2], 0.0f};
+            pCullUniform->sphereCount = spheres.mCount;
+            pCullUniform->lodCount = cullDesc.mLod.mLodCount;
+            pCullUniform->bucketCapacity = spheres.mCapacity;
+            pCullUniform->lodHysteresis = cullDesc.mLod.mHysteresis;
+
+            // This slot's fence has passed, so the readback holds the counts of the last frame recorded into it.
+            const IndirectDrawIndexArguments *pArgs =
+                static_cast<const IndirectDrawIndexArguments *>(pBufferCullArgsReadback[frameIndex]->pCpuMappedAddress);
+            for (uint32_t view = 0; view < CULL_VIEW_COUNT; view++)
+            {
+                for (uint32_t lod = 0; lod < SphereSimulation::MAX_LODS; lod++)
+                {
+                    visibleCount.mCount[view][lod] = pArgs[view * SphereSimulation::MAX_LODS + lod].mInstanceCount;
+                }
+            }
+        }
+        else
+        {
+            uint32_t *ppVisible[CULL_VIEW_COUNT] = {};
+            for (uint32_t view = 0; view < CULL_VIEW_COUNT; view++)
+            {
+                ppVisible[view] = static_cast<uint32_t *>(pBufferSphereVisible[view][frameIndex]->pCpuMappedAddress);
+            }
+            SphereSimulation::CullViews(&spheres, &cullState, &cullDesc, ppVisible, &visibleCount, chunkSize);
+        }
+
+        for (uint32_t view = 0; view < CULL_VIEW_COUNT; view++)
+        {
+            const uint32_t *pLodCount = visibleCount.mCount[view];
+            uint32_t visible = 0;
+            for (uint32_t lod = 0; lod < SphereSimulation::MAX_LODS; lod++)
+            {
+                visible += pLodCount[lod];
+            }
+            visible = visible < spheres.mCount ? visible : spheres.mCount;
+            const uint32_t culled = spheres.mCount - visible;
+            bassignformat(&cullStats[view], "%u visible, %u culled (%.1f%%), LOD %u/%u/%u/%u", visible, culled,
+                          100.0f * static_cast<float>(culled) / static_cast<float>(spheres.mCount), pLodCount[0],
+                          pLodCount[1], pLodCount[2], pLodCount[3]);
         }
-        sphereUniform.color[i] = color[i];
-        sphereUniform.world[i] = mat4::translation(position[i]) * mat4::scale({size[i], size[i], size[i]});
     }
 
-    quadUniform.projectView = mProjectView;
-    quadUniform.color = {1.0f, 1.0f, 1.0f, 1.0f};
-    quadUniform.world = mat4::translation({0, -200, 0}) * mat4::rotationX(degToRad(-90)) * mat4::scale({200, 200, 200});
+    CpuTimers::ScopedTimer timer(CpuTimers::SCOPE_UNIFORMS);
+    SphereUniform *pSphereUniform = static_cast<SphereUniform *>(pBufferSphereUniform[frameIndex]->pCpuMappedAddress);
+    pSphereUniform->projectView = mProjectView;
+    pSphereUniform->lightProjectView = lightViewProj;
+    pSphereUniform->cameraPosition = vec4(cameraPosition, 1.0f);
+    pSphereUniform->lightDirection = vec4(normalize(lightLookAt - lightPos), 0.0f);
+
+    QuadUniform *pQuadUniform = static_cast<QuadUniform *>(pBufferQuadUniform[frameIndex]->pCpuMappedAddress);
+    pQuadUniform->projectView = mProjectView;
+    pQuadUniform->lightProjectView = lightViewProj;
+    pQuadUniform->color = *GetSceneComponent<vec4>(floorEntity, colorComponent);
+    pQuadUniform->world = *GetSceneComponent<mat4>(floorEntity, transformComponent);
 }
 
-void DemoScene::Draw(Cmd *pCmd, Renderer *pRenderer, RenderTarget *pRenderTarget)
+void DemoScene::DrawSpheres(Cmd *pCmd, uint32_t view)
 {
-    constexpr uint32_t stride = sizeof(float) * 6;
+    // One draw per LOD bucket. instanceOffset tells the vertex shader where the bucket starts in the index list.
+    uint32_t instanceOffset = 0;
+    for (uint32_t lod = 0; lod < SphereSimulation::MAX_LODS; lod++)
     {
-        RenderTargetBarrier barriers[]{
-            {pRTShadowMap, RESOURCE_STATE_SHADER_RESOURCE, RESOURCE_STATE_DEPTH_WRITE},
+        if (gpuCulling)
+        {
+            instanceOffset = lod * spheres.mCapacity;
+            cmdBindPushConstants(pCmd, pRSInstancing, drawConstantsIndex, &instanceOffset);
+            const uint32_t argsOffset =
+                sizeof(IndirectDrawIndexArguments) * (view * SphereSimulation::MAX_LODS + lod);
+            cmdExecuteIndirect(pCmd, pCmdSignatureDraw, 1, pBufferCullArgs, argsOffset, nullptr, 0);
+        }
+        else
+        {
+            const uint32_t count = visibleCount.mCount[view][lod];
+            if (count == 0)
+            {
+                continue;
+            }
+            cmdBindPushConstants(pCmd, pRSInstancing, drawConstantsIndex, &instanceOffset);
+            if (impostors)
+            {
+                cmdDrawIndexedInstanced(pCmd, IMPOSTOR_INDEX_COUNT, impostorFirstIndex, count, 0, 0);
+            }
+            else
+            {
+                cmdDrawIndexedInstanced(pCmd, sphereLodIndexCount[lod], sphereLodFirstIndex[lod], count,
+                                        sphereLodFirstVertex[lod], 0);
+            }
+            instanceOffset += count;
+        }
+    }
+}
+
+void DemoScene::Draw(Cmd *pCmd, Renderer *pRenderer, uint32_t frameIndex)
+{
+    if (gpuSimulation && spheresResident)
+    {
+        GpuTimers::BeginPass(pCmd, GpuTimers::PASS_SIMULATE);
+        BufferBarrier bufferBarriers[]{
+            {pBufferSimulatePositionScale, RESOURCE_STATE_SHADER_RESOURCE, RESOURCE_STATE_UNORDERED_ACCESS},
+            {pBufferSimulateColor, RESOURCE_STATE_SHADER_RESOURCE, RESOURCE_STATE_UNORDERED_ACCESS},
         };
-        cmdResourceBarrier(pCmd, 0, nullptr, 0, nullptr, 1, barriers);
+        cmdResourceBarrier(pCmd, 2, bufferBarriers, 0, nullptr, 0, nullptr);
+
+        cmdBindPipeline(pCmd, pPipelineSimulate);
+        cmdBindDescriptorSet(pCmd, 0, pDSSimulate);
+        cmdBindPushConstants(pCmd, pRSSimulate, simulateConstantsIndex, &simulateConstants);
+        cmdDispatch(pCmd, (simulateConstants.sphereCount + SIMULATE_GROUP_SIZE - 1) / SIMULATE_GROUP_SIZE, 1, 1);
+
+        bufferBarriers[0] = {pBufferSimulatePositionScale, RESOURCE_STATE_UNORDERED_ACCESS,
+                             RESOURCE_STATE_SHADER_RESOURCE};
+        bufferBarriers[1] = {pBufferSimulateColor, RESOURCE_STATE_UNORDERED_ACCESS, RESOURCE_STATE_SHADER_RESOURCE};
+        cmdResourceBarrier(pCmd, 2, bufferBarriers, 0, nullptr, 0, nullptr);
+        GpuTimers::EndPass(pCmd, GpuTimers::PASS_SIMULATE);
     }
 
+    if (gpuCulling && spheresResident)
     {
-        BindRenderTargetsDesc bindRenderTargets = {};
-        bindRenderTargets.mDepthStencil = {pRTShadowMap, LOAD_ACTION_CLEAR};
-        cmdBindRenderTargets(pCmd, &bindRenderTargets);
+        GpuTimers::BeginPass(pCmd, GpuTimers::PASS_CULL);
+        constexpr uint32_t argsSize = sizeof(IndirectDrawIndexArguments) * CULL_VIEW_COUNT * SphereSimulation::MAX_LODS;
+
+        BufferBarrier bufferBarriers[]{
+            {pBufferCullArgs, RESOURCE_STATE_INDIRECT_ARGUMENT, RESOURCE_STATE_COPY_DEST},
+            {pBufferGpuVisible[CULL_VIEW_CAMERA], RESOURCE_STATE_SHADER_RESOURCE, RESOURCE_STATE_UNORDERED_ACCESS},
+            {pBufferGpuVisible[CULL_VIEW_LIGHT], RESOURCE_STATE_SHADER_RESOURCE, RESOURCE_STATE_UNORDERED_ACCESS},
+            // The LOD history is read and written by every frame's dispatch.
+            {pBufferLodState, RESOURCE_STATE_UNORDERED_ACCESS, RESOURCE_STATE_UNORDERED_ACCESS},
+        };
+        cmdResourceBarrier(pCmd, 4, bufferBarriers, 0, nullptr, 0, nullptr);
+
+        cmdUpdateBuffer(pCmd, pBufferCullArgs, 0, impostors ? pBufferImpostorArgsReset : pBufferCullArgsReset, 0,
+                        argsSize);
+        bufferBarriers[0] = {pBufferCullArgs, RESOURCE_STATE_COPY_DEST, RESOURCE_STATE_UNORDERED_ACCESS};
+        cmdResourceBarrier(pCmd, 1, bufferBarriers, 0, nullptr, 0, nullptr);
+
+        cmdBindPipeline(pCmd, pPipelineCull);
+        cmdBindDescriptorSet(pCmd, frameIndex, pDSCull);
+        cmdDispatch(pCmd, (spheres.mCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+        bufferBarriers[0] = {pBufferCullArgs, RESOURCE_STATE_UNORDERED_ACCESS, RESOURCE_STATE_COPY_SOURCE};
+        bufferBarriers[1] = {pBufferGpuVisible[CULL_VIEW_CAMERA], RESOURCE_STATE_UNORDERED_ACCESS,
+                             RESOURCE_STATE_SHADER_RESOURCE};
+        bufferBarriers[2] = {pBufferGpuVisible[CULL_VIEW_LIGHT], RESOURCE_STATE_UNORDERED_ACCESS,
+                             RESOURCE_STATE_SHADER_RESOURCE};
+        cmdResourceBarrier(pCmd, 3, bufferBarriers, 0, nullptr, 0, nullptr);
+
+        cmdUpdateBuffer(pCmd, pBufferCullArgsReadback[frameIndex], 0, pBufferCullArgs, 0, argsSize);
+        bufferBarriers[0] = {pBufferCullArgs, RESOURCE_STATE_COPY_SOURCE, RESOURCE_STATE_INDIRECT_ARGUMENT};
+        cmdResourceBarrier(pCmd, 1, bufferBarriers, 0, nullptr, 0, nullptr);
+        GpuTimers::EndPass(pCmd, GpuTimers::PASS_CULL);
     }
+}
+
+void DemoScene::AddPasses(uint32_t backBuffer, uint32_t width, uint32_t height)
+{
+    backBufferTarget = backBuffer;
+
+    RenderTargetDesc desc{};
+    desc.mFlags = TEXTURE_CREATION_FLAG_ON_TILE | TEXTURE_CREATION_FLAG_VR_MULTIVIEW;
+    desc.mWidth = width;
+    desc.mHeight = height;
+    desc.mDepth = 1;
+    desc.mArraySize = 1;
+    desc.mSampleCount = SAMPLE_COUNT_1;
+    desc.mFormat = depthBufferFormat;
+    desc.mClearValue = {};
+    desc.mSampleQuality = 0;
+    depthTarget = RenderGraph::AddRenderTarget("Depth", &desc);
+
+    desc = {};
+    desc.mFlags = TEXTURE_CREATION_FLAG_OWN_MEMORY_BIT;
+    desc.mWidth = SHADOW_MAP_SIZE;
+    desc.mHeight = SHADOW_MAP_SIZE;
+    desc.mDepth = 1;
+    desc.mArraySize = 1;
+    desc.mSampleCount = SAMPLE_COUNT_1;
+    desc.mFormat = depthBufferFormat;
+    desc.mClearValue = {};
+    desc.mSampleQuality = 0;
+    desc.mDescriptors = DESCRIPTOR_TYPE_TEXTURE;
+    shadowMapTarget = RenderGraph::AddRenderTarget("Shadow map", &desc);
+
+    const uint32_t shadowPass = RenderGraph::AddPass("Shadow", DrawShadowPass, nullptr);
+    RenderGraph::WriteDepth(shadowPass, shadowMapTarget, LOAD_ACTION_CLEAR);
+
+    const uint32_t mainPass = RenderGraph::AddPass("Main", DrawMainPass, nullptr);
+    RenderGraph::WriteColor(mainPass, backBufferTarget, LOAD_ACTION_CLEAR);
+    RenderGraph::WriteDepth(mainPass, depthTarget, LOAD_ACTION_CLEAR);
+    RenderGraph::ReadTexture(mainPass, shadowMapTarget);
+}
+
+void DemoScene::DrawShadowPass(void *, Cmd *pCmd, uint32_t frameIndex)
+{
+    constexpr uint32_t stride = sizeof(float) * 6;
+    constexpr uint32_t sphereStride = sizeof(Mesh::PackedVertex);
+
+    GpuTimers::BeginPass(pCmd, GpuTimers::PASS_SHADOW);
     cmdSetViewport(pCmd, 0.0f, 0.0f, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 0.0f, 1.0f);
     cmdSetScissor(pCmd, 0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
 
-    cmdBindPipeline(pCmd, pPipelineSphereShadow);
-    cmdBindDescriptorSet(pCmd, 0, pDSSphereUniform);
-    cmdBindVertexBuffer(pCmd, 1, &pBufferSphereVertex, &stride, nullptr);
-    cmdDrawInstanced(pCmd, spherePoints / 6, 0, MAX_SPHERE, 0);
-
-    cmdBindPipeline(pCmd, pPipelineQuadShadow);
-    cmdBindDescriptorSet(pCmd, 0, pDSQuadUniform);
-    cmdBindVertexBuffer(pCmd, 1, &pBufferQuadVertex, &stride, nullptr);
-    cmdBindIndexBuffer(pCmd, pBufferQuadIndex, INDEX_TYPE_UINT16, 0);
-    cmdDrawIndexed(pCmd, 6, 0, 0);
+    // Whatever is still streaming in is left out, the passes still clear their targets.
+    if (spheresResident)
+    {
+        GpuTimers::BeginPass(pCmd, GpuTimers::PASS_SHADOW_SPHERES);
+        cmdBindPipeline(pCmd, impostors ? pPipelineImpostorShadow : pPipelineSphereShadow);
+        cmdBindDescriptorSet(pCmd, frameIndex, pDSSphereUniform);
+        cmdBindVertexBuffer(pCmd, 1, &pBufferSphereVertex, &sphereStride, nullptr);
+        cmdBindIndexBuffer(pCmd, pBufferSphereIndex, INDEX_TYPE_UINT16, 0);
+        DrawSpheres(pCmd, CULL_VIEW_LIGHT);
+        GpuTimers::EndPass(pCmd, GpuTimers::PASS_SHADOW_SPHERES);
+    }
 
-    cmdBindRenderTargets(pCmd, nullptr);
+    if (quadResident)
     {
-        RenderTargetBarrier barriers[]{
-            {pRTShadowMap, RESOURCE_STATE_DEPTH_WRITE, RESOURCE_STATE_SHADER_RESOURCE},
-        };
-        cmdResourceBarrier(pCmd, 0, nullptr, 0, nullptr, 1, barriers);
+        GpuTimers::BeginPass(pCmd, GpuTimers::PASS_SHADOW_FLOOR);
+        cmdBindPipeline(pCmd, pPipelineQuadShadow);
+        cmdBindDescriptorSet(pCmd, frameIndex, pDSQuadUniform);
+        cmdBindVertexBuffer(pCmd, 1, &pBufferQuadVertex, &stride, nullptr);
+        cmdBindIndexBuffer(pCmd, pBufferQuadIndex, INDEX_TYPE_UINT16, 0);
+        cmdDrawIndexed(pCmd, 6, 0, 0);
+        GpuTimers::EndPass(pCmd, GpuTimers::PASS_SHADOW_FLOOR);
     }
+    GpuTimers::EndPass(pCmd, GpuTimers::PASS_SHADOW);
+}
 
-    BindRenderTargetsDesc bindRenderTargets = {};
-    bindRenderTargets.mRenderTargetCount = 1;
-    bindRenderTargets.mRenderTargets[0] = {pRenderTarget, LOAD_ACTION_CLEAR};
-    bindRenderTargets.mDepthStencil = {pRTDepth, LOAD_ACTION_CLEAR},
+void DemoScene::DrawMainPass(void *, Cmd *pCmd, uint32_t frameIndex)
+{
+    constexpr uint32_t stride = sizeof(float) * 6;
+    constexpr uint32_t sphereStride = sizeof(Mesh::PackedVertex);
+    RenderTarget *pRenderTarget = RenderGraph::GetRenderTarget(backBufferTarget);
 
-    cmdBindRenderTargets(pCmd, &bindRenderTargets);
+    GpuTimers::BeginPass(pCmd, GpuTimers::PASS_MAIN);
     cmdSetViewport(pCmd, 0.0f, 0.0f, (float)pRenderTarget->mWidth, (float)pRenderTarget->mHeight, 0.0f, 1.0f);
     cmdSetScissor(pCmd, 0, 0, pRenderTarget->mWidth, pRenderTarget->mHeight);
 
-    cmdBindPipeline(pCmd, pPipelineSphere);
-    cmdBindDescriptorSet(pCmd, 0, pDSSphereUniform);
-    cmdBindDescriptorSet(pCmd, 0, pDSShadowMap);
-    cmdBindVertexBuffer(pCmd, 1, &pBufferSphereVertex, &stride, nullptr);
-    cmdDrawInstanced(pCmd, spherePoints / 6, 0, MAX_SPHERE, 0);
-
-    cmdBindPipeline(pCmd, pPipelineQuad);
-    cmdBindDescriptorSet(pCmd, 0, pDSQuadUniform);
-    cmdBindDescriptorSet(pCmd, 0, pDSShadowMap);
-    cmdBindVertexBuffer(pCmd, 1, &pBufferQuadVertex, &stride, nullptr);
-    cmdBindIndexBuffer(pCmd, pBufferQuadIndex, INDEX_TYPE_UINT16, 0);
-    cmdDrawIndexed(pCmd, 6, 0, 0);
-}
+    if (spheresResident)
+    {
+        GpuTimers::BeginPass(pCmd, GpuTimers::PASS_MAIN_SPHERES);
+        cmdBindPipeline(pCmd, impostors ? pPipelineImpostor : pPipelineSphere);
+        cmdBindDescriptorSet(pCmd, frameIndex, pDSSphereUniform);
+        cmdBindDescriptorSet(pCmd, 0, pDSShadowMap);
+        cmdBindVertexBuffer(pCmd, 1, &pBufferSphereVertex, &sphereStride, nullptr);
+        cmdBindIndexBuffer(pCmd, pBufferSphereIndex, INDEX_TYPE_UINT16, 0);
+        DrawSpheres(pCmd, CULL_VIEW_CAMERA);
+        GpuTimers::EndPass(pCmd, GpuTimers::PASS_MAIN_SPHERES);
+    }
 
-void DemoScene::PreDraw()
-{
-    BufferUpdateDesc sphereUniformUpdateDesc = {pBufferSphereUniform};
-    beginUpdateResource(&sphereUniformUpdateDesc);
-    *(SphereUniform *)sphereUniformUpdateDesc.pMappedData = sphereUniform;
-    endUpdateResource(&sphereUniformUpdateDesc);
-
-    BufferUpdateDesc quadUniformUpdateDesc = {pBufferQuadUniform};
-    beginUpdateResource(&quadUniformUpdateDesc);
-    *(QuadUniform *)quadUniformUpdateDesc.pMappedData = quadUniform;
-    endUpdateResource(&quadUniformUpdateDesc);
+    if (quadResident)
+    {
+        GpuTimers::BeginPass(pCmd, GpuTimers::PASS_MAIN_FLOOR);
+        cmdBindPipeline(pCmd, pPipelineQuad);
+        cmdBindDescriptorSet(pCmd, frameIndex, pDSQuadUniform);
+        cmdBindDescriptorSet(pCmd, 0, pDSShadowMap);
+        cmdBindVertexBuffer(pCmd, 1, &pBufferQuadVertex, &stride, nullptr);
+        cmdBindIndexBuffer(pCmd, pBufferQuadIndex, INDEX_TYPE_UINT16, 0);
+        cmdDrawIndexed(pCmd, 6, 0, 0);
+        GpuTimers::EndPass(pCmd, GpuTimers::PASS_MAIN_FLOOR);
+    }
+    GpuTimers::EndPass(pCmd, GpuTimers::PASS_MAIN);
 }
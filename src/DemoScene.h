@@ -2,16 +2,23 @@
 #define DEMO_SCENE_H
 
 #include <IGraphics.h>
+#include "Settings.h"
 
 namespace DemoScene
 {
-    bool Init(Renderer *pRenderer);
+    bool Init(Renderer *pRenderer, const SceneSettings *pSettings, PipelineCache *pCache);
     void Exit(Renderer *pRenderer);
+    // Declares the depth buffer, the shadow map and the shadow and main passes on the render graph, the main pass
+    // drawing into the graph resource backBuffer. Called on a resize or render target reload, before the graph is
+    // compiled and before Load, which binds the shadow map the graph created.
+    void AddPasses(uint32_t backBuffer, uint32_t width, uint32_t height);
     bool Load(ReloadDesc *pReloadDesc, Renderer *pRenderer, RenderTarget *pRenderTarget);
     void Unload(ReloadDesc *pReloadDesc, Renderer *pRenderer);
-    void Update(float deltaTime, uint32_t width, uint32_t height);
-    void PreDraw();
-    void Draw(Cmd *pCmd, Renderer *pRenderer, RenderTarget *pRenderTarget);
+    void Update(float deltaTime, uint32_t width, uint32_t height, uint32_t frameIndex);
+    // Records the compute passes, which keep their own barriers. The shadow and main passes run from the graph.
+    void Draw(Cmd *pCmd, Renderer *pRenderer, uint32_t frameIndex);
+    // True once every upload queued by Init has completed. Until then Draw leaves out what is still streaming in.
+    bool IsResident();
 }; // namespace DemoScene
 
 
@@ -0,0 +1,253 @@
+#include "GpuTimers.h"
+
+#include <chrono>
+#include "Benchmark.h"
+#include "Settings.h"
+
+namespace GpuTimers
+{
+    namespace
+    {
+        typedef std::chrono::steady_clock Clock;
+
+        constexpr float UI_REFRESH_INTERVAL = 0.5f;
+
+        struct PassInfo
+        {
+            const char *pName;
+            Benchmark::Phase mPhase;
+            // Draws only. Vulkan allows one active statistics query at a time, so the passes around them have none.
+            bool mStatistics;
+        };
+
+        const PassInfo PASS_INFOS[PASS_COUNT] = {
+            {"Simulate", Benchmark::PHASE_GPU_SIMULATE, false},
+            {"Cull", Benchmark::PHASE_GPU_CULL, false},
+            {"Shadow Pass", Benchmark::PHASE_GPU_SHADOW, false},
+            {"Shadow Spheres", Benchmark::PHASE_GPU_SHADOW_SPHERES, true},
+            {"Shadow Floor", Benchmark::PHASE_GPU_SHADOW_FLOOR, true},
+            {"Main Pass", Benchmark::PHASE_GPU_MAIN, false},
+            {"Spheres", Benchmark::PHASE_GPU_MAIN_SPHERES, true},
+            {"Floor", Benchmark::PHASE_GPU_MAIN_FLOOR, true},
+            {"UI", Benchmark::PHASE_GPU_UI, true},
+        };
+
+        ProfileToken gProfileToken = PROFILE_INVALID_TOKEN;
+        // One query per pass and frame slot, the slot's passes back to back. Either pool is nullptr when the device
+        // lacks the query type.
+        QueryPool *pTimestampPool = nullptr;
+        QueryPool *pStatisticsPool = nullptr;
+        double gTimestampFrequency = 0.0;
+
+        uint32_t gFrameIndex = 0;
+        // Passes recorded into each slot's last frame. Whatever a frame skipped is not read back.
+        bool gRecorded[MAX_DATA_BUFFER_COUNT][PASS_COUNT] = {};
+
+        float gTimes[PASS_COUNT] = {};
+        PipelineStatistics gStatistics[PASS_COUNT] = {};
+
+        bstring gTexts[PASS_COUNT];
+        bool gWidgetsAdded = false;
+        Clock::time_point gLastRefresh = {};
+    } // namespace
+} // namespace GpuTimers
+
+void GpuTimers::Init(Renderer *pRenderer, Queue *pQueue, ProfileToken profileToken)
+{
+    gProfileToken = profileToken;
+
+    QueryPoolDesc poolDesc = {};
+    poolDesc.mQueryCount = MAX_DATA_BUFFER_COUNT * PASS_COUNT;
+    if (pRenderer->pGpu->mSettings.mTimestampQueries)
+    {
+        poolDesc.mType = QUERY_TYPE_TIMESTAMP;
+        addQueryPool(pRenderer, &poolDesc, &pTimestampPool);
+        getTimestampFrequency(pQueue, &gTimestampFrequency);
+    }
+    if (pRenderer->pGpu->mSettings.mPipelineStatsQueries)
+    {
+        poolDesc.mType = QUERY_TYPE_PIPELINE_STATISTICS;
+        addQueryPool(pRenderer, &poolDesc, &pStatisticsPool);
+    }
+
+    for (uint32_t i = 0; i < MAX_DATA_BUFFER_COUNT; i++)
+    {
+        for (uint32_t pass = 0; pass < PASS_COUNT; pass++)
+        {
+            gRecorded[i][pass] = false;
+        }
+    }
+    gLastRefresh = Clock::now();
+}
+
+void GpuTimers::Exit(Renderer *pRenderer)
+{
+    if (pTimestampPool)
+    {
+        removeQueryPool(pRenderer, pTimestampPool);
+        pTimestampPool = nullptr;
+    }
+    if (pStatisticsPool)
+    {
+        removeQueryPool(pRenderer, pStatisticsPool);
+        pStatisticsPool = nullptr;
+    }
+    if (gWidgetsAdded)
+    {
+        for (uint32_t pass = 0; pass < PASS_COUNT; pass++)
+        {
+            if (PASS_INFOS[pass].mStatistics)
+            {
+                bdestroy(&gTexts[pass]);
+            }
+        }
+        gWidgetsAdded = false;
+    }
+    gProfileToken = PROFILE_INVALID_TOKEN;
+}
+
+void GpuTimers::AddWidgets(UIComponent *pWindow)
+{
+    if (!pStatisticsPool)
+    {
+        return;
+    }
+
+    static float4 textColor = {1.0f, 1.0f, 1.0f, 1.0f};
+    for (uint32_t pass = 0; pass < PASS_COUNT; pass++)
+    {
+        if (!PASS_INFOS[pass].mStatistics)
+        {
+            continue;
+        }
+        gTexts[pass] = bempty();
+        DynamicTextWidget text = {};
+        text.pText = &gTexts[pass];
+        text.pColor = &textColor;
+        uiCreateComponentWidget(pWindow, PASS_INFOS[pass].pName, &text, WIDGET_TYPE_DYNAMIC_TEXT);
+    }
+    gWidgetsAdded = true;
+}
+
+void GpuTimers::BeginFrame(Cmd *pCmd, uint32_t frameIndex)
+{
+    gFrameIndex = frameIndex;
+    for (uint32_t pass = 0; pass < PASS_COUNT; pass++)
+    {
+        gRecorded[frameIndex][pass] = false;
+    }
+    if (pTimestampPool)
+    {
+        cmdResetQuery(pCmd, pTimestampPool, frameIndex * PASS_COUNT, PASS_COUNT);
+    }
+    if (pStatisticsPool)
+    {
+        cmdResetQuery(pCmd, pStatisticsPool, frameIndex * PASS_COUNT, PASS_COUNT);
+    }
+}
+
+void GpuTimers::BeginPass(Cmd *pCmd, Pass pass)
+{
+    cmdBeginGpuTimestampQuery(pCmd, gProfileToken, PASS_INFOS[pass].pName);
+
+    QueryDesc queryDesc = {};
+    queryDesc.mIndex = gFrameIndex * PASS_COUNT + pass;
+    if (pTimestampPool)
+    {
+        cmdBeginQuery(pCmd, pTimestampPool, &queryDesc);
+    }
+    if (pStatisticsPool && PASS_INFOS[pass].mStatistics)
+    {
+        cmdBeginQuery(pCmd, pStatisticsPool, &queryDesc);
+    }
+}
+
+void GpuTimers::EndPass(Cmd *pCmd, Pass pass)
+{
+    QueryDesc queryDesc = {};
+    queryDesc.mIndex = gFrameIndex * PASS_COUNT + pass;
+    if (pStatisticsPool && PASS_INFOS[pass].mStatistics)
+    {
+        cmdEndQuery(pCmd, pStatisticsPool, &queryDesc);
+    }
+    if (pTimestampPool)
+    {
+        cmdEndQuery(pCmd, pTimestampPool, &queryDesc);
+    }
+
+    cmdEndGpuTimestampQuery(pCmd, gProfileToken);
+    gRecorded[gFrameIndex][pass] = true;
+}
+
+void GpuTimers::EndFrame(Cmd *pCmd)
+{
+    if (pTimestampPool)
+    {
+        cmdResolveQuery(pCmd, pTimestampPool, gFrameIndex * PASS_COUNT, PASS_COUNT);
+    }
+    if (pStatisticsPool)
+    {
+        cmdResolveQuery(pCmd, pStatisticsPool, gFrameIndex * PASS_COUNT, PASS_COUNT);
+    }
+}
+
+void GpuTimers::ReadFrame(Renderer *pRenderer, uint32_t frameIndex)
+{
+    for (uint32_t pass = 0; pass < PASS_COUNT; pass++)
+    {
+        if (!gRecorded[frameIndex][pass])
+        {
+            continue;
+        }
+        gRecorded[frameIndex][pass] = false;
+
+        const uint32_t queryIndex = frameIndex * PASS_COUNT + pass;
+        QueryData data = {};
+        if (pTimestampPool)
+        {
+            getQueryData(pRenderer, pTimestampPool, queryIndex, &data);
+            if (data.mValid)
+            {
+                gTimes[pass] = static_cast<float>((data.mEndTimestamp - data.mBeginTimestamp) * 1000.0 /
+                                                  gTimestampFrequency);
+                Benchmark::AddTime(PASS_INFOS[pass].mPhase, gTimes[pass]);
+            }
+        }
+        if (pStatisticsPool && PASS_INFOS[pass].mStatistics)
+        {
+            getQueryData(pRenderer, pStatisticsPool, queryIndex, &data);
+            if (data.mValid)
+            {
+                PipelineStatistics &statistics = gStatistics[pass];
+                statistics.mVertexInvocations = data.mPipelineStats.mVSInvocations;
+                statistics.mPrimitives = data.mPipelineStats.mIAPrimitives;
+                statistics.mFragmentInvocations = data.mPipelineStats.mPSInvocations;
+                Benchmark::AddPipelineStatistics(PASS_INFOS[pass].mPhase, statistics.mVertexInvocations,
+                                                 statistics.mPrimitives, statistics.mFragmentInvocations);
+            }
+        }
+    }
+
+    const Clock::time_point now = Clock::now();
+    if (gWidgetsAdded && std::chrono::duration<float>(now - gLastRefresh).count() >= UI_REFRESH_INTERVAL)
+    {
+        gLastRefresh = now;
+        for (uint32_t pass = 0; pass < PASS_COUNT; pass++)
+        {
+            if (PASS_INFOS[pass].mStatistics)
+            {
+                const PipelineStatistics &statistics = gStatistics[pass];
+                bassignformat(&gTexts[pass], "%llu vertices, %llu primitives, %llu fragments",
+                              static_cast<unsigned long long>(statistics.mVertexInvocations),
+                              static_cast<unsigned long long>(statistics.mPrimitives),
+                              static_cast<unsigned long long>(statistics.mFragmentInvocations));
+            }
+        }
+    }
+}
+
+float GpuTimers::GetTime(Pass pass) { return gTimes[pass]; }
+
+const GpuTimers::PipelineStatistics *GpuTimers::GetPipelineStatistics(Pass pass) { return &gStatistics[pass]; }
+
+const char *GpuTimers::GetPassName(Pass pass) { return PASS_INFOS[pass].pName; }
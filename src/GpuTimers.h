@@ -0,0 +1,58 @@
+#ifndef GPU_TIMERS_H
+#define GPU_TIMERS_H
+
+#include <IGraphics.h>
+#include <IProfiler.h>
+#include <IUI.h>
+
+namespace GpuTimers
+{
+    // Passes and draws of a frame. Every one is a scope in the GPU profiler overlay and a gpu* phase of the
+    // benchmark; the draws also collect pipeline statistics where the device supports them.
+    enum Pass
+    {
+        PASS_SIMULATE,
+        PASS_CULL,
+        // The shadow map pass, holding the two draws after it.
+        PASS_SHADOW,
+        PASS_SHADOW_SPHERES,
+        PASS_SHADOW_FLOOR,
+        // The main pass, holding the two draws after it.
+        PASS_MAIN,
+        PASS_MAIN_SPHERES,
+        PASS_MAIN_FLOOR,
+        PASS_UI,
+        PASS_COUNT,
+    };
+
+    struct PipelineStatistics
+    {
+        uint64_t mVertexInvocations = 0;
+        uint64_t mPrimitives = 0;
+        uint64_t mFragmentInvocations = 0;
+    };
+
+    void Init(Renderer *pRenderer, Queue *pQueue, ProfileToken profileToken);
+    void Exit(Renderer *pRenderer);
+
+    // Adds a line of pipeline statistics per draw to pWindow, refreshed twice a second.
+    void AddWidgets(UIComponent *pWindow);
+
+    // Resets the queries of frameIndex's slot. Its fence must have passed.
+    void BeginFrame(Cmd *pCmd, uint32_t frameIndex);
+    void BeginPass(Cmd *pCmd, Pass pass);
+    void EndPass(Cmd *pCmd, Pass pass);
+    void EndFrame(Cmd *pCmd);
+
+    // Reads back the last frame recorded into frameIndex's slot once its fence has passed, and hands the pass times
+    // and statistics to the benchmark.
+    void ReadFrame(Renderer *pRenderer, uint32_t frameIndex);
+
+    // Of the last frame read back, in milliseconds.
+    float GetTime(Pass pass);
+    const PipelineStatistics *GetPipelineStatistics(Pass pass);
+
+    const char *GetPassName(Pass pass);
+} // namespace GpuTimers
+
+#endif // GPU_TIMERS_H
@@ -4,17 +4,28 @@
 #include <IFont.h>
 #include <IGraphics.h>
 #include <IInput.h>
+#include <ILog.h>
 #include <IProfiler.h>
 #include <IResourceLoader.h>
 #include <IScreenshot.h>
 #include <IUI.h>
 #include <RingBuffer.h>
+#include <chrono>
+#include <cstdio>
 #include <cstdlib>
+#include <ctime>
 #include <string>
+#include "Benchmark.h"
+#include "CpuTimers.h"
 #include "DemoScene.h"
+#include "GpuTimers.h"
+#include "JobSystem.h"
+#include "RenderGraph.h"
+#include "Scene.h"
 #include "Settings.h"
+#include "SphereSimulation.h"
 
-namespace Scene = DemoScene;
+uint32_t gDataBufferCount = 2;
 
 namespace
 {
@@ -25,19 +36,261 @@ namespace
     Queue *pGraphicsQueue = nullptr;
     uint32_t gFontID = 0;
     GpuCmdRing gGraphicsCmdRing = {};
+    GpuCmdRingElement gCmdRingElement = {};
+    uint32_t gFrameIndex = 0;
 
     Semaphore *pImageAcquiredSemaphore = nullptr;
 
     ProfileToken gGpuProfileToken = PROFILE_INVALID_TOKEN;
+
+    // Scenes --scene picks from by name, the first one by default.
+    const SceneInterface gScenes[] = {
+        {"demo", DemoScene::Init, DemoScene::Exit, DemoScene::AddPasses, DemoScene::Load, DemoScene::Unload,
+         DemoScene::Update, DemoScene::Draw, DemoScene::IsResident},
+    };
+    const SceneInterface *pScene = &gScenes[0];
+
+    SceneSettings gSceneSettings = {};
+    FrameSettings gFrameSettings = {};
+    uint32_t gThreadCount = 0;
+
+    typedef std::chrono::steady_clock Clock;
+    Benchmark::BenchmarkSettings gBenchmarkSettings = {};
+    CpuTimers::TimerSettings gTimerSettings = {};
+    Clock::time_point gLastFrameEnd = {};
+
+    float MillisecondsBetween(Clock::time_point from, Clock::time_point to)
+    {
+        return std::chrono::duration<float, std::milli>(to - from).count();
+    }
+
+    // Shared by every pipeline, loaded from RD_PIPELINE_CACHE at startup and written back at exit.
+    PipelineCache *pPipelineCache = nullptr;
+    // Named after the renderer API, GPU and driver, so another device or a driver update starts from an empty cache
+    // instead of handing the driver data it did not write.
+    char gPipelineCacheName[64] = {};
+    // Bytes of cache data found at startup, 0 for a cold start.
+    size_t gPipelineCacheLoadedSize = 0;
+    bool gResetPipelineCache = false;
+
+    // Input sample time of the frame last recorded into each slot, until the GPU finishes it.
+    Clock::time_point gInputTime[MAX_DATA_BUFFER_COUNT] = {};
+    Fence *pSlotFence[MAX_DATA_BUFFER_COUNT] = {};
+    bool gGpuDonePending[MAX_DATA_BUFFER_COUNT] = {};
+    Fence *pLastSubmittedFence = nullptr;
+
+    // Input-to-present samples come from DXGI's frame statistics on D3D12. Forge presents through Vulkan without
+    // present ids, so VK_KHR_present_wait and VK_GOOGLE_display_timing are out of reach, and elsewhere the GPU
+    // finishing the frame stands in for its present.
+    bool gDisplayTiming = false;
+
+    // Records the input-to-GPU-done time of every submitted frame the GPU has finished since the last call. The fence
+    // signals before the frame is presented, so this leaves out presentation.
+    void ResolveInputToGpuDone(Clock::time_point now)
+    {
+        for (uint32_t i = 0; i < gDataBufferCount; i++)
+        {
+            if (!gGpuDonePending[i])
+            {
+                continue;
+            }
+            FenceStatus fenceStatus;
+            getFenceStatus(pRenderer, pSlotFence[i], &fenceStatus);
+            if (fenceStatus != FENCE_STATUS_INCOMPLETE)
+            {
+                gGpuDonePending[i] = false;
+                Benchmark::AddTime(Benchmark::PHASE_INPUT_TO_GPU_DONE, MillisecondsBetween(gInputTime[i], now));
+                if (!gDisplayTiming)
+                {
+                    Benchmark::AddTime(Benchmark::PHASE_INPUT_TO_PRESENT, MillisecondsBetween(gInputTime[i], now));
+                }
+            }
+        }
+    }
+
+#ifdef DIRECT3D12
+    // Input sample times of the latest presents, by the swapchain's count of Present calls, until the frame
+    // statistics show one of them on screen. Those only report the latest present shown, the others are dropped.
+    struct PendingPresent
+    {
+        UINT mPresentCount;
+        Clock::time_point mInputTime;
+    };
+    constexpr uint32_t MAX_PENDING_PRESENTS = 8;
+    PendingPresent gPendingPresents[MAX_PENDING_PRESENTS] = {};
+    uint32_t gNextPendingPresent = 0;
+
+    void AddPendingPresent(Clock::time_point inputTime)
+    {
+        UINT presentCount = 0;
+        if (SUCCEEDED(pSwapChain->mDx.pSwapChain->GetLastPresentCount(&presentCount)))
+        {
+            gPendingPresents[gNextPendingPresent] = {presentCount, inputTime};
+            gNextPendingPresent = (gNextPendingPresent + 1) % MAX_PENDING_PRESENTS;
+        }
+    }
+
+    // Records the input-to-present time of the latest present shown, if it is still pending. SyncQPCTime is the
+    // vertical blank it was shown at on the QueryPerformanceCounter clock, carried over to Clock through the time
+    // elapsed since.
+    void ResolveInputToPresent()
+    {
+        DXGI_FRAME_STATISTICS statistics = {};
+        if (FAILED(pSwapChain->mDx.pSwapChain->GetFrameStatistics(&statistics)))
+        {
+            return;
+        }
+        LARGE_INTEGER counter;
+        LARGE_INTEGER frequency;
+        QueryPerformanceCounter(&counter);
+        QueryPerformanceFrequency(&frequency);
+        const Clock::time_point now = Clock::now();
+        for (PendingPresent &present : gPendingPresents)
+        {
+            if (present.mPresentCount == 0 || present.mPresentCount != statistics.PresentCount)
+            {
+                continue;
+            }
+            const std::chrono::duration<double> sinceShown(
+                static_cast<double>(counter.QuadPart - statistics.SyncQPCTime.QuadPart) /
+                static_cast<double>(frequency.QuadPart));
+            const Clock::time_point shown = now - std::chrono::duration_cast<Clock::duration>(sinceShown);
+            Benchmark::AddTime(Benchmark::PHASE_INPUT_TO_PRESENT, MillisecondsBetween(present.mInputTime, shown));
+            present.mPresentCount = 0;
+        }
+    }
+#endif
+
+    // The swapchain image drawn this frame, as a render graph resource.
+    uint32_t gBackBufferTarget = RenderGraph::INVALID_ID;
+
+    // Render graph pass drawing the profiler text and the UI over the scene.
+    void DrawUserInterfacePass(void *, Cmd *pCmd, uint32_t)
+    {
+        RenderTarget *pRenderTarget = RenderGraph::GetRenderTarget(gBackBufferTarget);
+        cmdSetViewport(pCmd, 0, 0, (float)pRenderTarget->mWidth, (float)pRenderTarget->mHeight, 0.0f, 1.0f);
+        cmdSetScissor(pCmd, 0, 0, pRenderTarget->mWidth, pRenderTarget->mHeight);
+
+        GpuTimers::BeginPass(pCmd, GpuTimers::PASS_UI);
+
+        // Nobody watches a benchmark, keep the text rendering out of the numbers.
+        if (!Benchmark::IsEnabled())
+        {
+            CpuTimers::ScopedTimer timer(CpuTimers::SCOPE_UI_DRAW);
+            FontDrawDesc gFrameTimeDraw = {};
+            gFrameTimeDraw.mFontID = gFontID;
+            gFrameTimeDraw.mFontColor = 0xff00ffff;
+            gFrameTimeDraw.mFontSize = 18.0f;
+
+            float2 txtSizePx = cmdDrawCpuProfile(pCmd, float2(8.f, 15.f), &gFrameTimeDraw);
+            cmdDrawGpuProfile(pCmd, float2(8.f, txtSizePx.y + 75.f), gGpuProfileToken, &gFrameTimeDraw);
+
+            cmdDrawUserInterface(pCmd);
+        }
+
+        GpuTimers::EndPass(pCmd, GpuTimers::PASS_UI);
+    }
+
+    Clock::time_point gInitStart = {};
+    Benchmark::StartupTimes gStartupTimes = {};
+    bool gStartupLoad = true;
+    bool gFirstFramePresented = false;
+    bool gSceneResident = false;
+
+    // FNV-1a. The GPU preset fields are numbers or strings depending on the platform, hash either.
+    uint64_t HashKey(uint64_t hash, const char *pString)
+    {
+        for (const char *p = pString; *p; p++)
+        {
+            hash = (hash ^ static_cast<uint8_t>(*p)) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    uint64_t HashKey(uint64_t hash, uint32_t value)
+    {
+        for (uint32_t i = 0; i < 4; i++)
+        {
+            hash = (hash ^ ((value >> (i * 8)) & 0xff)) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    void LoadPipelineCache(uint32_t rendererApi)
+    {
+        const GPUVendorPreset &gpu = pRenderer->pGpu->mSettings.mGpuVendorPreset;
+        uint64_t key = 14695981039346656037ull;
+        key = HashKey(key, rendererApi);
+        key = HashKey(key, gpu.mVendorId);
+        key = HashKey(key, gpu.mModelId);
+        key = HashKey(key, gpu.mRevisionId);
+        key = HashKey(key, gpu.mGpuName);
+        key = HashKey(key, gpu.mGpuDriverVersion);
+        snprintf(gPipelineCacheName, sizeof(gPipelineCacheName), "Pipelines_%016llx.cache",
+                 static_cast<unsigned long long>(key));
+
+        void *pData = nullptr;
+        size_t size = 0;
+        FileStream stream = {};
+        if (!gResetPipelineCache && fsOpenStreamFromPath(RD_PIPELINE_CACHE, gPipelineCacheName, FM_READ, &stream))
+        {
+            const ssize_t fileSize = fsGetStreamFileSize(&stream);
+            if (fileSize > 0)
+            {
+                pData = tf_malloc(static_cast<size_t>(fileSize));
+                size = fsReadFromStream(&stream, pData, static_cast<size_t>(fileSize));
+            }
+            fsCloseStream(&stream);
+        }
+
+        PipelineCacheDesc desc = {};
+        desc.pData = pData;
+        desc.mSize = size;
+        addPipelineCache(pRenderer, &desc, &pPipelineCache);
+        tf_free(pData);
+
+        gPipelineCacheLoadedSize = size;
+        LOGF(eINFO, "Pipeline cache %s for %s (driver %s): %s", gPipelineCacheName, gpu.mGpuName,
+             gpu.mGpuDriverVersion, size ? "warm" : "cold");
+    }
+
+    void SavePipelineCache()
+    {
+        size_t size = 0;
+        getPipelineCacheData(pRenderer, pPipelineCache, &size, nullptr);
+        if (size == 0)
+        {
+            return;
+        }
+
+        void *pData = tf_malloc(size);
+        getPipelineCacheData(pRenderer, pPipelineCache, &size, pData);
+
+        FileStream stream = {};
+        if (fsOpenStreamFromPath(RD_PIPELINE_CACHE, gPipelineCacheName, FM_WRITE, &stream))
+        {
+            fsWriteToStream(&stream, pData, size);
+            fsCloseStream(&stream);
+            LOGF(eINFO, "Pipeline cache %s: %zu bytes written", gPipelineCacheName, size);
+        }
+        else
+        {
+            LOGF(eWARNING, "Pipeline cache %s could not be written", gPipelineCacheName);
+        }
+        tf_free(pData);
+    }
 } // namespace
 
 const char *MainApp::GetName() { return "The Forge Template"; }
 
 bool MainApp::Init()
 {
-    srand(time(NULL));
     extern PlatformParameters gPlatformParameters;
 
+    gInitStart = Clock::now();
+    bool seedGiven = false;
+    bool collisionsGiven = false;
+
     for (int i = 0; i < IApp::argc; i++)
     {
         std::string arg(IApp::argv[i]);
@@ -55,8 +308,169 @@ bool MainApp::Init()
             gPlatformParameters.mSelectedRendererApi = RendererApi::RENDERER_API_D3D12;
         }
 #endif
+
+        if (arg == "--scene" && i + 1 < IApp::argc)
+        {
+            const std::string name(IApp::argv[++i]);
+            const SceneInterface *pNamed = nullptr;
+            for (const SceneInterface &scene : gScenes)
+            {
+                if (name == scene.pName)
+                {
+                    pNamed = &scene;
+                }
+            }
+            if (pNamed)
+            {
+                pScene = pNamed;
+            }
+            else
+            {
+                LOGF(eWARNING, "Unknown scene %s, running %s", name.c_str(), pScene->pName);
+            }
+        }
+
+        if (arg == "--spheres" && i + 1 < IApp::argc)
+        {
+            gSceneSettings.mSphereCount = static_cast<uint32_t>(strtoul(IApp::argv[++i], nullptr, 10));
+        }
+
+        if (arg == "--sphere-capacity" && i + 1 < IApp::argc)
+        {
+            gSceneSettings.mSphereCapacity = static_cast<uint32_t>(strtoul(IApp::argv[++i], nullptr, 10));
+        }
+
+        if (arg == "--seed" && i + 1 < IApp::argc)
+        {
+            gSceneSettings.mSeed = strtoull(IApp::argv[++i], nullptr, 10);
+            seedGiven = true;
+        }
+
+        if (arg == "--fixed-timestep" && i + 1 < IApp::argc)
+        {
+            gSceneSettings.mFixedDeltaTime = strtof(IApp::argv[++i], nullptr);
+        }
+
+        if (arg == "--steps" && i + 1 < IApp::argc)
+        {
+            gSceneSettings.mStepLimit = static_cast<uint32_t>(strtoul(IApp::argv[++i], nullptr, 10));
+        }
+
+        if (arg == "--benchmark" && i + 1 < IApp::argc)
+        {
+            gBenchmarkSettings.mFrameCount = static_cast<uint32_t>(strtoul(IApp::argv[++i], nullptr, 10));
+        }
+
+        if (arg == "--warmup" && i + 1 < IApp::argc)
+        {
+            gBenchmarkSettings.mWarmupFrames = static_cast<uint32_t>(strtoul(IApp::argv[++i], nullptr, 10));
+        }
+
+        if (arg == "--benchmark-output" && i + 1 < IApp::argc)
+        {
+            gBenchmarkSettings.pOutputPath = IApp::argv[++i];
+        }
+
+        if (arg == "--cpu-timers" && i + 1 < IApp::argc)
+        {
+            gTimerSettings.pOutputPath = IApp::argv[++i];
+        }
+
+        if (arg == "--cpu-timers-interval" && i + 1 < IApp::argc)
+        {
+            gTimerSettings.mDumpInterval = strtof(IApp::argv[++i], nullptr);
+        }
+
+        if (arg == "--threads" && i + 1 < IApp::argc)
+        {
+            gThreadCount = static_cast<uint32_t>(strtoul(IApp::argv[++i], nullptr, 10));
+        }
+
+        if (arg == "--chunk-size" && i + 1 < IApp::argc)
+        {
+            gSceneSettings.mChunkSize = static_cast<uint32_t>(strtoul(IApp::argv[++i], nullptr, 10));
+        }
+
+        if (arg == "--gpu-simulation")
+        {
+            gSceneSettings.mGpuSimulation = true;
+        }
+
+        if (arg == "--gpu-culling")
+        {
+            gSceneSettings.mGpuCulling = true;
+        }
+
+        if (arg == "--impostors")
+        {
+            gSceneSettings.mImpostors = true;
+        }
+
+        if (arg == "--collisions")
+        {
+            gSceneSettings.mCollisions = true;
+            collisionsGiven = true;
+        }
+
+        if (arg == "--no-collisions")
+        {
+            gSceneSettings.mCollisions = false;
+            collisionsGiven = true;
+        }
+
+        if (arg == "--parallel-load")
+        {
+            gSceneSettings.mParallelLoad = true;
+        }
+
+        if (arg == "--frames-in-flight" && i + 1 < IApp::argc)
+        {
+            gFrameSettings.mFramesInFlight = static_cast<uint32_t>(strtoul(IApp::argv[++i], nullptr, 10));
+        }
+
+        if (arg == "--frame-pacing" && i + 1 < IApp::argc)
+        {
+            std::string pacing(IApp::argv[++i]);
+            if (pacing == "low-latency")
+            {
+                gFrameSettings.mPacing = FramePacing::LowLatency;
+            }
+            else if (pacing == "throughput")
+            {
+                gFrameSettings.mPacing = FramePacing::Throughput;
+            }
+        }
+
+        if (arg == "--reset-pipeline-cache")
+        {
+            gResetPipelineCache = true;
+        }
+
+        if (arg == "--kernel" && i + 1 < IApp::argc)
+        {
+            std::string kernel(IApp::argv[++i]);
+            if (kernel == "scalar")
+            {
+                SphereSimulation::SetKernel(SphereSimulation::KernelType::Scalar);
+            }
+            else if (kernel == "sse")
+            {
+                SphereSimulation::SetKernel(SphereSimulation::KernelType::SSE);
+            }
+            else if (kernel == "avx2")
+            {
+                SphereSimulation::SetKernel(SphereSimulation::KernelType::AVX2);
+            }
+        }
     }
 
+    // Every per-frame buffer, descriptor set and command pool is sized from this, so it only changes at startup.
+    gFrameSettings.mFramesInFlight = gFrameSettings.mFramesInFlight < 1 ? 1 : gFrameSettings.mFramesInFlight;
+    gFrameSettings.mFramesInFlight = gFrameSettings.mFramesInFlight > MAX_DATA_BUFFER_COUNT
+                                         ? MAX_DATA_BUFFER_COUNT
+                                         : gFrameSettings.mFramesInFlight;
+    gDataBufferCount = gFrameSettings.mFramesInFlight;
+
     // FILE PATHS
     fsSetPathForResourceDir(pSystemFileIO, RM_CONTENT, RD_FONTS, "Fonts");
     fsSetPathForResourceDir(pSystemFileIO, RM_CONTENT, RD_GPU_CONFIG, "GPUCfg");
@@ -64,6 +478,9 @@ bool MainApp::Init()
     fsSetPathForResourceDir(pSystemFileIO, RM_CONTENT, RD_SHADER_BINARIES, "CompiledShaders");
     fsSetPathForResourceDir(pSystemFileIO, RM_CONTENT, RD_TEXTURES, "Textures");
     fsSetPathForResourceDir(pSystemFileIO, RM_DEBUG, RD_SCREENSHOTS, "Screenshots");
+    fsSetPathForResourceDir(pSystemFileIO, RM_DEBUG, RD_PIPELINE_CACHE, "PipelineCaches");
+    // Benchmark results and CPU timer dumps.
+    fsSetPathForResourceDir(pSystemFileIO, RM_DEBUG, RD_OTHER_FILES, "Benchmarks");
 
     // window and renderer setup
     RendererDesc settings{};
@@ -93,6 +510,8 @@ bool MainApp::Init()
 
     initResourceLoaderInterface(pRenderer);
 
+    LoadPipelineCache(static_cast<uint32_t>(gPlatformParameters.mSelectedRendererApi));
+
     // Initialize micro profiler and its UI.
     ProfilerDesc profiler = {};
     profiler.pRenderer = pRenderer;
@@ -103,6 +522,7 @@ bool MainApp::Init()
 
     // Gpu profiler can only be added after initProfile.
     gGpuProfileToken = addGpuProfiler(pRenderer, pGraphicsQueue, "Graphics");
+    GpuTimers::Init(pRenderer, pGraphicsQueue, gGpuProfileToken);
 
     // Load fonts
     FontDesc font = {};
@@ -129,6 +549,11 @@ bool MainApp::Init()
     ButtonWidget screenshot{};
     UIWidget *pScreenshot = uiCreateComponentWidget(pGuiWindow, "Screenshot", &screenshot, WIDGET_TYPE_BUTTON);
 
+    CpuTimers::Init(&gTimerSettings);
+    CpuTimers::AddWidgets(pGuiWindow);
+    GpuTimers::AddWidgets(pGuiWindow);
+
+    // Only the font and UI resources are queued so far. The scene streams its buffers in behind the first frames.
     waitForAllResourceLoads();
 
     InputSystemDesc inputDesc = {};
@@ -153,25 +578,90 @@ bool MainApp::Init()
 
     setGlobalInputAction(&globalInputActionDesc);
 
-    if (!Scene::Init(pRenderer))
+    // --sphere-capacity only reserves extra room for the UI slider, it never shrinks below --spheres.
+    if (gSceneSettings.mSphereCount == 0)
+    {
+        gSceneSettings.mSphereCount = 1;
+    }
+    if (gSceneSettings.mSphereCapacity < gSceneSettings.mSphereCount)
+    {
+        gSceneSettings.mSphereCapacity = gSceneSettings.mSphereCount;
+    }
+    if (gSceneSettings.mGpuSimulation)
+    {
+        gSceneSettings.mGpuCulling = true;
+    }
+    if (!collisionsGiven && gSceneSettings.mSphereCount > DEFAULT_COLLISION_SPHERE_LIMIT)
+    {
+        gSceneSettings.mCollisions = false;
+        LOGF(eINFO, "Collisions start off for more than %u spheres, --collisions turns them on",
+             DEFAULT_COLLISION_SPHERE_LIMIT);
+    }
+    if (!seedGiven)
+    {
+        gSceneSettings.mSeed = static_cast<uint64_t>(time(nullptr));
+    }
+    if (gSceneSettings.mFixedDeltaTime < 0.0f)
+    {
+        gSceneSettings.mFixedDeltaTime = 0.0f;
+    }
+
+    // A benchmark always simulates the same workload and runs as fast as the device allows.
+    if (gBenchmarkSettings.mFrameCount != 0)
+    {
+        if (gSceneSettings.mFixedDeltaTime == 0.0f)
+        {
+            gSceneSettings.mFixedDeltaTime = 1.0f / 60.0f;
+        }
+        mSettings.mVSyncEnabled = false;
+        LOGF(eINFO, "Benchmark: %u frames after %u warm-up frames", gBenchmarkSettings.mFrameCount,
+             gBenchmarkSettings.mWarmupFrames);
+    }
+    Benchmark::Init(&gBenchmarkSettings);
+#ifdef DIRECT3D12
+    gDisplayTiming = gPlatformParameters.mSelectedRendererApi == RendererApi::RENDERER_API_D3D12;
+#endif
+    Benchmark::SetPresentTiming(gDisplayTiming ? Benchmark::PRESENT_TIMING_DISPLAY
+                                               : Benchmark::PRESENT_TIMING_GPU_DONE);
+
+    JobSystem::Init(gThreadCount);
+
+    if (!pScene->pInit(pRenderer, &gSceneSettings, pPipelineCache))
     {
         return false;
     };
 
+    gLastFrameEnd = Clock::now();
+    gStartupTimes.mInit = MillisecondsBetween(gInitStart, gLastFrameEnd);
+
     return true;
 }
 
 void MainApp::Exit()
 {
-    Scene::Exit(pRenderer);
+    pScene->pExit(pRenderer);
+    JobSystem::Exit();
+    Benchmark::Exit();
+    CpuTimers::Exit();
     exitInputSystem();
     exitUserInterface();
     exitFontSystem();
 
+    GpuTimers::Exit(pRenderer);
     exitProfiler();
 
     removeSemaphore(pRenderer, pImageAcquiredSemaphore);
     removeGpuCmdRing(pRenderer, &gGraphicsCmdRing);
+    pLastSubmittedFence = nullptr;
+    for (uint32_t i = 0; i < MAX_DATA_BUFFER_COUNT; i++)
+    {
+        pSlotFence[i] = nullptr;
+        gGpuDonePending[i] = false;
+    }
+
+    SavePipelineCache();
+    removePipelineCache(pRenderer, pPipelineCache);
+    pPipelineCache = nullptr;
 
     exitResourceLoaderInterface(pRenderer);
     removeQueue(pRenderer, pGraphicsQueue);
@@ -181,13 +671,20 @@ void MainApp::Exit()
 
 bool MainApp::Load(ReloadDesc *pReloadDesc)
 {
+    const Clock::time_point loadStart = Clock::now();
+
     if (pReloadDesc->mType & (RELOAD_TYPE_RESIZE | RELOAD_TYPE_RENDERTARGET))
     {
         SwapChainDesc swapChainDesc = {};
         swapChainDesc.mWindowHandle = pWindow->handle;
         swapChainDesc.ppPresentQueues = &pGraphicsQueue;
         swapChainDesc.mPresentQueueCount = 1;
+        // Enough images that acquiring one never waits on a frame the CPU is still allowed to have in flight.
         swapChainDesc.mImageCount = getRecommendedSwapchainImageCount(pRenderer, &pWindow->handle);
+        if (swapChainDesc.mImageCount < gDataBufferCount)
+        {
+            swapChainDesc.mImageCount = gDataBufferCount;
+        }
         swapChainDesc.mWidth = static_cast<uint32_t>(mSettings.mWidth);
         swapChainDesc.mHeight = static_cast<uint32_t>(mSettings.mHeight);
         swapChainDesc.mColorFormat = getSupportedSwapchainFormat(pRenderer, &swapChainDesc, COLOR_SPACE_SDR_SRGB);
@@ -201,9 +698,19 @@ bool MainApp::Load(ReloadDesc *pReloadDesc)
         {
             return false;
         }
+
+        RenderTarget *pRenderTarget = pSwapChain->ppRenderTargets[0];
+        RenderGraph::Reset();
+        gBackBufferTarget =
+            RenderGraph::ImportRenderTarget("Back buffer", RESOURCE_STATE_PRESENT, RESOURCE_STATE_PRESENT);
+        pScene->pAddPasses(gBackBufferTarget, pRenderTarget->mWidth, pRenderTarget->mHeight);
+        const uint32_t uiPass = RenderGraph::AddPass("UI", DrawUserInterfacePass, nullptr);
+        RenderGraph::WriteColor(uiPass, gBackBufferTarget, LOAD_ACTION_LOAD);
+        RenderGraph::Compile(pRenderer);
     }
 
     FontSystemLoadDesc fontLoad = {};
+    fontLoad.pCache = pPipelineCache;
     fontLoad.mLoadType = pReloadDesc->mType;
     fontLoad.mColorFormat = static_cast<uint32_t>(pSwapChain->ppRenderTargets[0]->mFormat);
     fontLoad.mWidth = static_cast<uint32_t>(mSettings.mWidth);
@@ -211,6 +718,7 @@ bool MainApp::Load(ReloadDesc *pReloadDesc)
     loadFontSystem(&fontLoad);
 
     UserInterfaceLoadDesc uiLoad = {};
+    uiLoad.pCache = pPipelineCache;
     uiLoad.mLoadType = static_cast<uint32_t>(pReloadDesc->mType);
     uiLoad.mColorFormat = static_cast<uint32_t>(pSwapChain->ppRenderTargets[0]->mFormat);
     uiLoad.mWidth = static_cast<uint32_t>(mSettings.mWidth);
@@ -219,12 +727,30 @@ bool MainApp::Load(ReloadDesc *pReloadDesc)
 
     initScreenshotInterface(pRenderer, pGraphicsQueue);
 
-    if (!Scene::Load(pReloadDesc, pRenderer, pSwapChain->ppRenderTargets[0]))
+    if (!pScene->pLoad(pReloadDesc, pRenderer, pSwapChain->ppRenderTargets[0]))
     {
         return false;
     };
 
-    waitForAllResourceLoads();
+    // No wait for the resource loader here, the scene buffers queued by Init stream in behind the first frames.
+
+    // Most of a load is pipeline creation, which is what the pipeline cache shortens.
+    const Clock::time_point loadEnd = Clock::now();
+    const float loadTime = MillisecondsBetween(loadStart, loadEnd);
+    if (gStartupLoad)
+    {
+        gStartupTimes.mLoad = loadTime;
+        gStartupTimes.mWarmPipelineCache = gPipelineCacheLoadedSize != 0;
+        LOGF(eINFO, "Startup with a %s pipeline cache: init %.1f ms, load %.1f ms, %.1f ms in total",
+             gStartupTimes.mWarmPipelineCache ? "warm" : "cold", gStartupTimes.mInit, loadTime,
+             MillisecondsBetween(gInitStart, loadEnd));
+        Benchmark::SetStartupTimes(&gStartupTimes);
+        gStartupLoad = false;
+    }
+    else
+    {
+        LOGF(eINFO, "Reload took %.1f ms", loadTime);
+    }
 
     return true;
 }
@@ -233,14 +759,22 @@ void MainApp::Unload(ReloadDesc *pReloadDesc)
 {
     waitQueueIdle(pGraphicsQueue);
 
-    Scene::Unload(pReloadDesc, pRenderer);
+    pScene->pUnload(pReloadDesc, pRenderer);
 
     unloadFontSystem(pReloadDesc->mType);
     unloadUserInterface(pReloadDesc->mType);
 
     if (pReloadDesc->mType & (RELOAD_TYPE_RESIZE | RELOAD_TYPE_RENDERTARGET))
     {
+        RenderGraph::Release(pRenderer);
         removeSwapChain(pRenderer, pSwapChain);
+#ifdef DIRECT3D12
+        // The new swapchain counts its presents from 0 again.
+        for (PendingPresent &present : gPendingPresents)
+        {
+            present.mPresentCount = 0;
+        }
+#endif
     }
 
     exitScreenshotInterface();
@@ -248,8 +782,63 @@ void MainApp::Unload(ReloadDesc *pReloadDesc)
 
 void MainApp::Update(float deltaTime)
 {
+    const Clock::time_point waitStart = Clock::now();
+    if (gFrameSettings.mPacing == FramePacing::LowLatency && pLastSubmittedFence)
+    {
+        // Let the GPU drain before sampling the input, the frame recorded next is then the next one shown.
+        FenceStatus lastStatus;
+        getFenceStatus(pRenderer, pLastSubmittedFence, &lastStatus);
+        if (lastStatus == FENCE_STATUS_INCOMPLETE)
+        {
+            waitForFences(pRenderer, 1, &pLastSubmittedFence);
+        }
+    }
+
+    const Clock::time_point inputStart = Clock::now();
     updateInputSystem(deltaTime, mSettings.mWidth, mSettings.mHeight);
-    Scene::Update(deltaTime, mSettings.mWidth, mSettings.mHeight);
+    const Clock::time_point inputTime = Clock::now();
+    CpuTimers::AddTime(CpuTimers::SCOPE_INPUT, MillisecondsBetween(inputStart, inputTime));
+
+    // Claim this frame's slot before the scene writes into its buffers.
+    gCmdRingElement = getNextGpuCmdRingElement(&gGraphicsCmdRing, true, 1);
+
+    // Stall if CPU is running "Swap Chain Buffer Count" frames ahead of GPU
+    FenceStatus fenceStatus;
+    getFenceStatus(pRenderer, gCmdRingElement.pFence, &fenceStatus);
+    if (fenceStatus == FENCE_STATUS_INCOMPLETE)
+    {
+        waitForFences(pRenderer, 1, &gCmdRingElement.pFence);
+    }
+    const Clock::time_point updateStart = Clock::now();
+    // Input sampling is counted as waiting, it is negligible next to the fence waits.
+    Benchmark::AddTime(Benchmark::PHASE_WAIT, MillisecondsBetween(waitStart, updateStart));
+    CpuTimers::AddTime(CpuTimers::SCOPE_FENCE_WAIT,
+                       MillisecondsBetween(waitStart, inputStart) + MillisecondsBetween(inputTime, updateStart));
+    // Resolve before this slot's sample time is overwritten. Without a wait on it, a frame is only noticed as done at
+    // the next Update, so in throughput pacing the times are rounded up to the frame they are polled in.
+    ResolveInputToGpuDone(updateStart);
+#ifdef DIRECT3D12
+    if (gDisplayTiming)
+    {
+        ResolveInputToPresent();
+    }
+#endif
+    gInputTime[gFrameIndex] = inputTime;
+    // Latest frame the GPU profiler has resolved, a few frames behind.
+    Benchmark::AddTime(Benchmark::PHASE_GPU, getGpuProfileTime(gGpuProfileToken));
+    GpuTimers::ReadFrame(pRenderer, gFrameIndex);
+
+    pScene->pUpdate(deltaTime, mSettings.mWidth, mSettings.mHeight, gFrameIndex);
+    const Clock::time_point updateEnd = Clock::now();
+    Benchmark::AddTime(Benchmark::PHASE_UPDATE, MillisecondsBetween(updateStart, updateEnd));
+
+    if (!gSceneResident && pScene->pIsResident())
+    {
+        gSceneResident = true;
+        gStartupTimes.mResident = MillisecondsBetween(gInitStart, updateEnd);
+        LOGF(eINFO, "Startup: scene resident after %.1f ms", gStartupTimes.mResident);
+        Benchmark::SetStartupTimes(&gStartupTimes);
+    }
 }
 
 void MainApp::Draw()
@@ -260,21 +849,15 @@ void MainApp::Draw()
         ::toggleVSync(pRenderer, &pSwapChain);
     }
 
+    const Clock::time_point acquireStart = Clock::now();
     uint32_t swapchainImageIndex;
     acquireNextImage(pRenderer, pSwapChain, pImageAcquiredSemaphore, nullptr, &swapchainImageIndex);
+    const Clock::time_point recordStart = Clock::now();
+    Benchmark::AddTime(Benchmark::PHASE_ACQUIRE, MillisecondsBetween(acquireStart, recordStart));
+    CpuTimers::AddTime(CpuTimers::SCOPE_ACQUIRE, MillisecondsBetween(acquireStart, recordStart));
 
     RenderTarget *pRenderTarget = pSwapChain->ppRenderTargets[swapchainImageIndex];
-    GpuCmdRingElement elem = getNextGpuCmdRingElement(&gGraphicsCmdRing, true, 1);
-
-    // Stall if CPU is running "Swap Chain Buffer Count" frames ahead of GPU
-    FenceStatus fenceStatus;
-    getFenceStatus(pRenderer, elem.pFence, &fenceStatus);
-    if (fenceStatus == FENCE_STATUS_INCOMPLETE)
-    {
-        waitForFences(pRenderer, 1, &elem.pFence);
-    }
-
-    Scene::PreDraw();
+    GpuCmdRingElement &elem = gCmdRingElement;
 
     // Reset cmd pool for this frame
     resetCmdPool(pRenderer, elem.pCmdPool);
@@ -283,49 +866,25 @@ void MainApp::Draw()
     beginCmd(cmd);
 
     cmdBeginGpuFrameProfile(cmd, gGpuProfileToken);
+    GpuTimers::BeginFrame(cmd, gFrameIndex);
 
-    RenderTargetBarrier barriers[]{
-        {pRenderTarget, RESOURCE_STATE_PRESENT, RESOURCE_STATE_RENDER_TARGET},
-    };
-    cmdResourceBarrier(cmd, 0, nullptr, 0, nullptr, 1, barriers);
-
-    cmdBeginGpuTimestampQuery(cmd, gGpuProfileToken, "Draw Scene");
-    Scene::Draw(cmd, pRenderer, pRenderTarget);
-    cmdEndGpuTimestampQuery(cmd, gGpuProfileToken);
-
-    cmdSetViewport(cmd, 0, 0, (float)pRenderTarget->mWidth, (float)pRenderTarget->mHeight, 0.0f, 1.0f);
-    cmdSetScissor(cmd, 0, 0, pRenderTarget->mWidth, pRenderTarget->mHeight);
-
-    BindRenderTargetsDesc bindRenderTargets = {};
-    bindRenderTargets.mRenderTargetCount = 1;
-    bindRenderTargets.mRenderTargets[0] = {pRenderTarget, LOAD_ACTION_LOAD};
-
-    cmdBindRenderTargets(cmd, &bindRenderTargets);
-
-    cmdBeginGpuTimestampQuery(cmd, gGpuProfileToken, "Draw UI");
-
-    FontDrawDesc gFrameTimeDraw = {};
-    gFrameTimeDraw.mFontID = gFontID;
-    gFrameTimeDraw.mFontColor = 0xff00ffff;
-    gFrameTimeDraw.mFontSize = 18.0f;
-
-    float2 txtSizePx = cmdDrawCpuProfile(cmd, float2(8.f, 15.f), &gFrameTimeDraw);
-    cmdDrawGpuProfile(cmd, float2(8.f, txtSizePx.y + 75.f), gGpuProfileToken, &gFrameTimeDraw);
-
-    cmdDrawUserInterface(cmd);
+    RenderGraph::SetRenderTarget(gBackBufferTarget, pRenderTarget);
 
+    // The UI pass runs from the graph too, so the scene draw scope holds the UI draw.
+    cmdBeginGpuTimestampQuery(cmd, gGpuProfileToken, "Draw Frame");
+    {
+        CpuTimers::ScopedTimer timer(CpuTimers::SCOPE_SCENE_DRAW);
+        pScene->pDraw(cmd, pRenderer, gFrameIndex);
+        RenderGraph::Execute(cmd, gFrameIndex);
+    }
     cmdEndGpuTimestampQuery(cmd, gGpuProfileToken);
 
-    cmdBindRenderTargets(cmd, nullptr);
-    barriers[0] = {
-        pRenderTarget,
-        RESOURCE_STATE_RENDER_TARGET,
-        RESOURCE_STATE_PRESENT,
-    };
-    cmdResourceBarrier(cmd, 0, nullptr, 0, nullptr, 1, barriers);
-
+    GpuTimers::EndFrame(cmd);
     cmdEndGpuFrameProfile(cmd, gGpuProfileToken);
     endCmd(cmd);
+    const Clock::time_point submitStart = Clock::now();
+    Benchmark::AddTime(Benchmark::PHASE_RECORD, MillisecondsBetween(recordStart, submitStart));
+    CpuTimers::AddTime(CpuTimers::SCOPE_RECORD, MillisecondsBetween(recordStart, submitStart));
 
     FlushResourceUpdateDesc flushUpdateDesc = {};
     flushUpdateDesc.mNodeIndex = 0;
@@ -345,6 +904,9 @@ void MainApp::Draw()
     submitDesc.mWaitSemaphoreCount = 2;
     submitDesc.mSignalSemaphoreCount = 1;
     queueSubmit(pGraphicsQueue, &submitDesc);
+    pSlotFence[gFrameIndex] = elem.pFence;
+    gGpuDonePending[gFrameIndex] = true;
+    pLastSubmittedFence = elem.pFence;
 
     QueuePresentDesc presentDesc = {};
     presentDesc.pSwapChain = pSwapChain;
@@ -353,8 +915,45 @@ void MainApp::Draw()
     presentDesc.mIndex = static_cast<uint8_t>(swapchainImageIndex);
     presentDesc.mSubmitDone = true;
     queuePresent(pGraphicsQueue, &presentDesc);
+#ifdef DIRECT3D12
+    if (gDisplayTiming)
+    {
+        AddPendingPresent(gInputTime[gFrameIndex]);
+    }
+#endif
+
+    const Clock::time_point frameEnd = Clock::now();
+    Benchmark::AddTime(Benchmark::PHASE_SUBMIT, MillisecondsBetween(submitStart, frameEnd));
+    CpuTimers::AddTime(CpuTimers::SCOPE_SUBMIT, MillisecondsBetween(submitStart, frameEnd));
+    CpuTimers::EndFrame();
+    Benchmark::AddTime(Benchmark::PHASE_FRAME, MillisecondsBetween(gLastFrameEnd, frameEnd));
+    gLastFrameEnd = frameEnd;
+
+    if (!gFirstFramePresented)
+    {
+        gFirstFramePresented = true;
+        gStartupTimes.mFirstFrame = MillisecondsBetween(gInitStart, frameEnd);
+        LOGF(eINFO, "Startup: first frame presented after %.1f ms", gStartupTimes.mFirstFrame);
+        Benchmark::SetStartupTimes(&gStartupTimes);
+    }
 
     flipProfiler();
+
+    gFrameIndex = (gFrameIndex + 1) % gDataBufferCount;
+
+    if (Benchmark::EndFrame())
+    {
+        if (Benchmark::WriteResults(&gSceneSettings, &gFrameSettings))
+        {
+            LOGF(eINFO, "Benchmark: results written to Benchmarks/%s.json and Benchmarks/%s.csv",
+                 gBenchmarkSettings.pOutputPath, gBenchmarkSettings.pOutputPath);
+        }
+        else
+        {
+            LOGF(eERROR, "Benchmark: could not write %s.json/.csv", gBenchmarkSettings.pOutputPath);
+        }
+        requestShutdown();
+    }
 }
 
 DEFINE_APPLICATION_MAIN(MainApp);
\ No newline at end of file
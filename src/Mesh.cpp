@@ -0,0 +1,375 @@
+#include "Mesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Forge allocators, as in the rest of src. Last, it redefines the allocation functions.
+#include <IMemory.h>
+
+namespace Mesh
+{
+    namespace
+    {
+        template <typename T>
+        T *AllocateArray(uint32_t count)
+        {
+            return static_cast<T *>(tf_malloc(sizeof(T) * (count > 0 ? count : 1)));
+        }
+
+        // Vertex scoring from Forsyth, "Linear-Speed Vertex Cache Optimisation".
+        constexpr float CACHE_DECAY_POWER = 1.5f;
+        constexpr float LAST_TRIANGLE_SCORE = 0.75f;
+        constexpr float VALENCE_BOOST_SCALE = 2.0f;
+        constexpr float VALENCE_BOOST_POWER = 0.5f;
+
+        float VertexScore(int32_t cachePosition, uint32_t remainingTriangles)
+        {
+            if (remainingTriangles == 0)
+            {
+                return -1.0f;
+            }
+
+            float score = 0.0f;
+            if (cachePosition >= 0)
+            {
+                if (cachePosition < 3)
+                {
+                    // The triangle just emitted. Fixed score so its own edges are not favoured too much.
+                    score = LAST_TRIANGLE_SCORE;
+                }
+                else
+                {
+                    const float scale = 1.0f / static_cast<float>(VERTEX_CACHE_SIZE - 3);
+                    score = powf(1.0f - static_cast<float>(cachePosition - 3) * scale, CACHE_DECAY_POWER);
+                }
+            }
+
+            // Prefer vertices with few triangles left, so lone triangles are not left behind.
+            return score +
+                   VALENCE_BOOST_SCALE * powf(static_cast<float>(remainingTriangles), -VALENCE_BOOST_POWER);
+        }
+    } // namespace
+} // namespace Mesh
+
+void Mesh::AddIndexedMesh(IndexedMesh *pMesh, const float *pSoup, uint32_t soupVertexCount, MeshStats *pStats)
+{
+    *pMesh = {};
+
+    PackedVertex *pPacked = AllocateArray<PackedVertex>(soupVertexCount);
+    for (uint32_t i = 0; i < soupVertexCount; i++)
+    {
+        const float *pSource = pSoup + i * 6;
+        pPacked[i].mPosition[0] = PackHalf(pSource[0]);
+        pPacked[i].mPosition[1] = PackHalf(pSource[1]);
+        pPacked[i].mPosition[2] = PackHalf(pSource[2]);
+        pPacked[i].mPosition[3] = PackHalf(1.0f);
+        PackOctahedral(pSource + 3, pPacked[i].mNormal);
+    }
+
+    // Weld on the packed bits: sort the soup and give every run of equal vertices one index. Working on the packed
+    // form also merges vertices the generator computed along different paths with slightly different rounding.
+    uint32_t *pOrder = AllocateArray<uint32_t>(soupVertexCount);
+    for (uint32_t i = 0; i < soupVertexCount; i++)
+    {
+        pOrder[i] = i;
+    }
+    std::sort(pOrder, pOrder + soupVertexCount,
+              [pPacked](uint32_t a, uint32_t b) { return memcmp(&pPacked[a], &pPacked[b], sizeof(PackedVertex)) < 0; });
+
+    PackedVertex *pWelded = AllocateArray<PackedVertex>(soupVertexCount);
+    uint32_t *pRemap = AllocateArray<uint32_t>(soupVertexCount);
+    uint32_t weldedCount = 0;
+    for (uint32_t i = 0; i < soupVertexCount; i++)
+    {
+        const uint32_t vertex = pOrder[i];
+        if (i == 0 || memcmp(&pPacked[vertex], &pWelded[weldedCount - 1], sizeof(PackedVertex)) != 0)
+        {
+            pWelded[weldedCount++] = pPacked[vertex];
+        }
+        pRemap[vertex] = weldedCount - 1;
+    }
+
+    uint32_t *pIndices = AllocateArray<uint32_t>(soupVertexCount);
+    uint32_t indexCount = 0;
+    for (uint32_t i = 0; i + 2 < soupVertexCount; i += 3)
+    {
+        const uint32_t a = pRemap[i];
+        const uint32_t b = pRemap[i + 1];
+        const uint32_t c = pRemap[i + 2];
+        // The poles of a latitude/longitude sphere collapse to points.
+        if (a == b || b == c || c == a)
+        {
+            continue;
+        }
+        pIndices[indexCount++] = a;
+        pIndices[indexCount++] = b;
+        pIndices[indexCount++] = c;
+    }
+
+    const float acmrWelded = ComputeAcmr(pIndices, indexCount, weldedCount, ACMR_CACHE_SIZE);
+
+    OptimizeVertexCache(pIndices, indexCount, weldedCount);
+
+    pMesh->pVertices = AllocateArray<PackedVertex>(weldedCount);
+    pMesh->mVertexCount = OptimizeVertexFetch(pMesh->pVertices, pIndices, indexCount, pWelded, weldedCount);
+    pMesh->pIndices = pIndices;
+    pMesh->mIndexCount = indexCount;
+
+    if (pStats)
+    {
+        pStats->mSoupVertexCount = soupVertexCount;
+        pStats->mVertexCount = pMesh->mVertexCount;
+        pStats->mAcmrWelded = acmrWelded;
+        pStats->mAcmrOptimized = ComputeAcmr(pIndices, indexCount, pMesh->mVertexCount, ACMR_CACHE_SIZE);
+    }
+
+    tf_free(pPacked);
+    tf_free(pOrder);
+    tf_free(pWelded);
+    tf_free(pRemap);
+}
+
+void Mesh::RemoveIndexedMesh(IndexedMesh *pMesh)
+{
+    tf_free(pMesh->pVertices);
+    tf_free(pMesh->pIndices);
+    *pMesh = {};
+}
+
+uint16_t Mesh::PackHalf(float value)
+{
+    uint32_t bits = 0;
+    memcpy(&bits, &value, sizeof(bits));
+
+    const uint32_t sign = (bits >> 16) & 0x8000u;
+    const int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xFFu) - 127 + 15;
+    const uint32_t mantissa = bits & 0x7FFFFFu;
+
+    // Meshes are around unit size, values too small for a normal half are flushed to zero.
+    if (exponent <= 0)
+    {
+        return static_cast<uint16_t>(sign);
+    }
+    if (exponent >= 31)
+    {
+        return static_cast<uint16_t>(sign | 0x7C00u);
+    }
+
+    // Rounds to nearest. A carry out of the mantissa correctly bumps the exponent.
+    uint32_t half = (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+    half += (mantissa >> 12) & 1u;
+    return static_cast<uint16_t>(sign | half);
+}
+
+void Mesh::PackOctahedral(const float *normal, int16_t *pPacked)
+{
+    // Project onto the octahedron |x| + |y| + |z| = 1 and fold the lower half over the diagonals.
+    const float length = fabsf(normal[0]) + fabsf(normal[1]) + fabsf(normal[2]);
+    float x = normal[0] / length;
+    float y = normal[1] / length;
+    if (normal[2] < 0.0f)
+    {
+        const float foldedX = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        const float foldedY = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = foldedX;
+        y = foldedY;
+    }
+
+    pPacked[0] = static_cast<int16_t>(lrintf(std::min(std::max(x, -1.0f), 1.0f) * 32767.0f));
+    pPacked[1] = static_cast<int16_t>(lrintf(std::min(std::max(y, -1.0f), 1.0f) * 32767.0f));
+}
+
+void Mesh::OptimizeVertexCache(uint32_t *pIndices, uint32_t indexCount, uint32_t vertexCount)
+{
+    const uint32_t triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+    {
+        return;
+    }
+
+    // Triangles of vertex v are pVertexTriangles[pTriangleStart[v], pTriangleStart[v] + pRemaining[v]). Emitted
+    // triangles are swapped out of the range, so it only ever holds the ones still to go.
+    uint32_t *pTriangleStart = AllocateArray<uint32_t>(vertexCount + 1);
+    uint32_t *pRemaining = AllocateArray<uint32_t>(vertexCount);
+    uint32_t *pVertexTriangles = AllocateArray<uint32_t>(indexCount);
+    int32_t *pCachePosition = AllocateArray<int32_t>(vertexCount);
+    float *pVertexScore = AllocateArray<float>(vertexCount);
+    float *pTriangleScore = AllocateArray<float>(triangleCount);
+    uint8_t *pEmitted = AllocateArray<uint8_t>(triangleCount);
+    uint32_t *pOutput = AllocateArray<uint32_t>(indexCount);
+
+    memset(pRemaining, 0, sizeof(uint32_t) * vertexCount);
+    for (uint32_t i = 0; i < indexCount; i++)
+    {
+        pRemaining[pIndices[i]]++;
+    }
+    pTriangleStart[0] = 0;
+    for (uint32_t v = 0; v < vertexCount; v++)
+    {
+        pTriangleStart[v + 1] = pTriangleStart[v] + pRemaining[v];
+        pRemaining[v] = 0;
+    }
+    for (uint32_t i = 0; i < indexCount; i++)
+    {
+        const uint32_t v = pIndices[i];
+        pVertexTriangles[pTriangleStart[v] + pRemaining[v]++] = i / 3;
+    }
+
+    for (uint32_t v = 0; v < vertexCount; v++)
+    {
+        pCachePosition[v] = -1;
+        pVertexScore[v] = VertexScore(-1, pRemaining[v]);
+    }
+    for (uint32_t t = 0; t < triangleCount; t++)
+    {
+        pTriangleScore[t] =
+            pVertexScore[pIndices[t * 3]] + pVertexScore[pIndices[t * 3 + 1]] + pVertexScore[pIndices[t * 3 + 2]];
+        pEmitted[t] = 0;
+    }
+
+    // Three extra slots hold what the newest triangle pushes past the end, so those vertices can be rescored.
+    uint32_t cache[VERTEX_CACHE_SIZE + 3];
+    uint32_t newCache[VERTEX_CACHE_SIZE + 3];
+    uint32_t cacheCount = 0;
+    uint32_t scanCursor = 0;
+
+    for (uint32_t emitted = 0; emitted < triangleCount; emitted++)
+    {
+        // Best triangle touching the cache. With nothing cached, start a new strip at the next unemitted one.
+        uint32_t best = UINT32_MAX;
+        float bestScore = -1.0f;
+        for (uint32_t c = 0; c < cacheCount && c < VERTEX_CACHE_SIZE; c++)
+        {
+            const uint32_t v = cache[c];
+            for (uint32_t k = 0; k < pRemaining[v]; k++)
+            {
+                const uint32_t t = pVertexTriangles[pTriangleStart[v] + k];
+                if (pTriangleScore[t] > bestScore)
+                {
+                    best = t;
+                    bestScore = pTriangleScore[t];
+                }
+            }
+        }
+        if (best == UINT32_MAX)
+        {
+            while (pEmitted[scanCursor])
+            {
+                scanCursor++;
+            }
+            best = scanCursor;
+        }
+
+        pEmitted[best] = 1;
+        const uint32_t *pTriangle = pIndices + best * 3;
+        memcpy(pOutput + emitted * 3, pTriangle, sizeof(uint32_t) * 3);
+
+        uint32_t newCount = 0;
+        for (uint32_t k = 0; k < 3; k++)
+        {
+            const uint32_t v = pTriangle[k];
+            uint32_t *pTriangles = pVertexTriangles + pTriangleStart[v];
+            for (uint32_t j = 0; j < pRemaining[v]; j++)
+            {
+                if (pTriangles[j] == best)
+                {
+                    pTriangles[j] = pTriangles[--pRemaining[v]];
+                    break;
+                }
+            }
+            newCache[newCount++] = v;
+        }
+        for (uint32_t c = 0; c < cacheCount; c++)
+        {
+            const uint32_t v = cache[c];
+            if (v != pTriangle[0] && v != pTriangle[1] && v != pTriangle[2])
+            {
+                newCache[newCount++] = v;
+            }
+        }
+
+        for (uint32_t c = 0; c < newCount; c++)
+        {
+            const uint32_t v = newCache[c];
+            pCachePosition[v] = c < VERTEX_CACHE_SIZE ? static_cast<int32_t>(c) : -1;
+            pVertexScore[v] = VertexScore(pCachePosition[v], pRemaining[v]);
+        }
+        for (uint32_t c = 0; c < newCount; c++)
+        {
+            const uint32_t v = newCache[c];
+            for (uint32_t k = 0; k < pRemaining[v]; k++)
+            {
+                const uint32_t t = pVertexTriangles[pTriangleStart[v] + k];
+                pTriangleScore[t] = pVertexScore[pIndices[t * 3]] + pVertexScore[pIndices[t * 3 + 1]] +
+                                    pVertexScore[pIndices[t * 3 + 2]];
+            }
+        }
+
+        cacheCount = newCount < VERTEX_CACHE_SIZE ? newCount : VERTEX_CACHE_SIZE;
+        memcpy(cache, newCache, sizeof(uint32_t) * cacheCount);
+    }
+
+    memcpy(pIndices, pOutput, sizeof(uint32_t) * indexCount);
+
+    tf_free(pTriangleStart);
+    tf_free(pRemaining);
+    tf_free(pVertexTriangles);
+    tf_free(pCachePosition);
+    tf_free(pVertexScore);
+    tf_free(pTriangleScore);
+    tf_free(pEmitted);
+    tf_free(pOutput);
+}
+
+uint32_t Mesh::OptimizeVertexFetch(PackedVertex *pDst, uint32_t *pIndices, uint32_t indexCount,
+                                   const PackedVertex *pSrc, uint32_t vertexCount)
+{
+    uint32_t *pRemap = AllocateArray<uint32_t>(vertexCount);
+    for (uint32_t v = 0; v < vertexCount; v++)
+    {
+        pRemap[v] = UINT32_MAX;
+    }
+
+    uint32_t next = 0;
+    for (uint32_t i = 0; i < indexCount; i++)
+    {
+        const uint32_t v = pIndices[i];
+        if (pRemap[v] == UINT32_MAX)
+        {
+            pRemap[v] = next;
+            pDst[next++] = pSrc[v];
+        }
+        pIndices[i] = pRemap[v];
+    }
+
+    tf_free(pRemap);
+    return next;
+}
+
+float Mesh::ComputeAcmr(const uint32_t *pIndices, uint32_t indexCount, uint32_t vertexCount, uint32_t cacheSize)
+{
+    const uint32_t triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+    {
+        return 0.0f;
+    }
+
+    // A vertex is still in the FIFO if fewer than cacheSize misses happened since it was loaded.
+    uint32_t *pLoadedAt = AllocateArray<uint32_t>(vertexCount);
+    memset(pLoadedAt, 0, sizeof(uint32_t) * vertexCount);
+    uint32_t misses = 0;
+    uint32_t clock = cacheSize + 1;
+    for (uint32_t i = 0; i < indexCount; i++)
+    {
+        const uint32_t v = pIndices[i];
+        if (clock - pLoadedAt[v] > cacheSize)
+        {
+            pLoadedAt[v] = clock++;
+            misses++;
+        }
+    }
+
+    tf_free(pLoadedAt);
+    return static_cast<float>(misses) / static_cast<float>(triangleCount);
+}
@@ -0,0 +1,61 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <cstdint>
+
+namespace Mesh
+{
+    // 12 bytes per vertex. mPosition holds x, y, z as half floats with w = 1, mNormal the octahedral encoded normal
+    // as two snorm16.
+    struct PackedVertex
+    {
+        uint16_t mPosition[4];
+        int16_t mNormal[2];
+    };
+
+    struct IndexedMesh
+    {
+        PackedVertex *pVertices = nullptr;
+        uint32_t *pIndices = nullptr;
+        uint32_t mVertexCount = 0;
+        uint32_t mIndexCount = 0;
+    };
+
+    // What AddIndexedMesh did to the mesh. An unindexed triangle list transforms every vertex, an ACMR of 3.
+    struct MeshStats
+    {
+        uint32_t mSoupVertexCount = 0;
+        uint32_t mVertexCount = 0;
+        float mAcmrWelded = 0.0f;
+        float mAcmrOptimized = 0.0f;
+    };
+
+    // Post-transform cache the triangle order is tuned for.
+    constexpr uint32_t VERTEX_CACHE_SIZE = 32;
+    // FIFO cache the ACMR is measured with, roughly what current GPUs reuse within a batch.
+    constexpr uint32_t ACMR_CACHE_SIZE = 16;
+
+    // Builds an indexed mesh from an unindexed triangle list of (position, normal) float triples, as written by
+    // generateSpherePoints. Vertices that are equal after packing are welded, degenerate triangles dropped, the
+    // triangles reordered for the post-transform cache and the vertices for fetch locality. pStats is optional.
+    void AddIndexedMesh(IndexedMesh *pMesh, const float *pSoup, uint32_t soupVertexCount, MeshStats *pStats);
+    void RemoveIndexedMesh(IndexedMesh *pMesh);
+
+    uint16_t PackHalf(float value);
+    // normal has to be unit length.
+    void PackOctahedral(const float *normal, int16_t *pPacked);
+
+    // Reorders the triangles in place so consecutive ones share cached vertices, using Tom Forsyth's linear-speed
+    // vertex cache optimization.
+    void OptimizeVertexCache(uint32_t *pIndices, uint32_t indexCount, uint32_t vertexCount);
+
+    // Renumbers the vertices in the order the index list first uses them, so the vertex fetch walks pVertices
+    // forwards. Unreferenced vertices are dropped. Returns the new vertex count. pDst must not alias pSrc.
+    uint32_t OptimizeVertexFetch(PackedVertex *pDst, uint32_t *pIndices, uint32_t indexCount,
+                                 const PackedVertex *pSrc, uint32_t vertexCount);
+
+    // Average number of vertices transformed per triangle with a FIFO cache of cacheSize entries.
+    float ComputeAcmr(const uint32_t *pIndices, uint32_t indexCount, uint32_t vertexCount, uint32_t cacheSize);
+} // namespace Mesh
+
+#endif // MESH_H
@@ -0,0 +1,660 @@
+#include "RenderGraph.h"
+
+#include <ILog.h>
+
+namespace RenderGraph
+{
+    namespace
+    {
+        struct Resource
+        {
+            const char *pName;
+            bool mImported;
+            ResourceState mInitialState;
+            ResourceState mFinalState;
+            RenderTargetDesc mDesc;
+            RenderTarget *pRenderTarget;
+
+            // Set by Compile. Lifetime in positions of gOrder, mFirstPass is INVALID_ID if no pass uses it.
+            uint32_t mFirstPass;
+            uint32_t mLastPass;
+            uint64_t mSize;
+            uint64_t mAlignment;
+            // Created in the graph's heap at mOffset. Shared if other render targets use some of the same bytes in
+            // other passes.
+            bool mPlaced;
+            bool mShared;
+            uint64_t mOffset;
+        };
+
+        struct Access
+        {
+            uint32_t mResource;
+            ResourceState mState;
+            LoadActionType mLoadAction;
+        };
+
+        struct Pass
+        {
+            const char *pName;
+            PassFunc pFunc;
+            void *pUserData;
+            uint32_t mColorCount;
+            Access mColors[MAX_PASS_COLORS];
+            Access mDepth;
+            uint32_t mReadCount;
+            Access mReads[MAX_PASS_READS];
+        };
+
+        struct Transition
+        {
+            uint32_t mResource;
+            ResourceState mFrom;
+            ResourceState mTo;
+        };
+
+        Resource gResources[MAX_RESOURCES] = {};
+        uint32_t gResourceCount = 0;
+        Pass gPasses[MAX_PASSES] = {};
+        uint32_t gPassCount = 0;
+
+        // Every pass in dependency order, then the passes left after culling, in execution order. gBatches[i] is
+        // issued ahead of gOrder[i], the last batch ends the frame. A resource changes state at most once per batch.
+        uint32_t gSorted[MAX_PASSES] = {};
+        uint32_t gOrder[MAX_PASSES] = {};
+        uint32_t gOrderCount = 0;
+        Transition gBatches[MAX_PASSES + 1][MAX_RESOURCES] = {};
+        uint32_t gBatchSizes[MAX_PASSES + 1] = {};
+
+        ResourceHeap *pHeap = nullptr;
+        Stats gStats = {};
+
+        // Every resource a pass touches, writes first.
+        uint32_t GetAccesses(const Pass &pass, Access *pAccesses)
+        {
+            uint32_t count = 0;
+            for (uint32_t i = 0; i < pass.mColorCount; i++)
+            {
+                pAccesses[count++] = pass.mColors[i];
+            }
+            if (pass.mDepth.mResource != INVALID_ID)
+            {
+                pAccesses[count++] = pass.mDepth;
+            }
+            for (uint32_t i = 0; i < pass.mReadCount; i++)
+            {
+                pAccesses[count++] = pass.mReads[i];
+            }
+            return count;
+        }
+
+        bool IsWrite(const Access &access) { return access.mState != RESOURCE_STATE_SHADER_RESOURCE; }
+
+        // Orders the passes by the render targets they share. Two passes using one keep the order they were added in
+        // if either writes it, except that the first pass clearing a graph-owned target goes ahead of those added
+        // before it: they read or load what it draws. Ties go to the pass added first. On a cycle, logs it and keeps
+        // the order the passes were added in.
+        bool SortPasses()
+        {
+            bool edges[MAX_PASSES][MAX_PASSES] = {};
+            for (uint32_t r = 0; r < gResourceCount; r++)
+            {
+                // The passes using the resource in the order they see it, and whether they write it.
+                uint32_t users[MAX_PASSES];
+                bool writes[MAX_PASSES];
+                uint32_t userCount = 0;
+                uint32_t clearUser = INVALID_ID;
+                for (uint32_t p = 0; p < gPassCount; p++)
+                {
+                    Access accesses[MAX_PASS_COLORS + 1 + MAX_PASS_READS];
+                    const uint32_t count = GetAccesses(gPasses[p], accesses);
+                    bool uses = false;
+                    bool write = false;
+                    bool clear = false;
+                    for (uint32_t i = 0; i < count; i++)
+                    {
+                        if (accesses[i].mResource == r)
+                        {
+                            uses = true;
+                            write = write || IsWrite(accesses[i]);
+                            clear = clear || (IsWrite(accesses[i]) && accesses[i].mLoadAction != LOAD_ACTION_LOAD);
+                        }
+                    }
+                    if (!uses)
+                    {
+                        continue;
+                    }
+                    if (clear && clearUser == INVALID_ID && !gResources[r].mImported)
+                    {
+                        clearUser = userCount;
+                    }
+                    users[userCount] = p;
+                    writes[userCount++] = write;
+                }
+                for (uint32_t u = clearUser == INVALID_ID ? 0 : clearUser; u > 0; u--)
+                {
+                    const uint32_t user = users[u];
+                    const bool write = writes[u];
+                    users[u] = users[u - 1];
+                    writes[u] = writes[u - 1];
+                    users[u - 1] = user;
+                    writes[u - 1] = write;
+                }
+
+                for (uint32_t a = 0; a < userCount; a++)
+                {
+                    for (uint32_t b = a + 1; b < userCount; b++)
+                    {
+                        edges[users[a]][users[b]] = edges[users[a]][users[b]] || writes[a] || writes[b];
+                    }
+                }
+            }
+
+            uint32_t inDegrees[MAX_PASSES] = {};
+            for (uint32_t a = 0; a < gPassCount; a++)
+            {
+                for (uint32_t b = 0; b < gPassCount; b++)
+                {
+                    inDegrees[b] += edges[a][b] ? 1 : 0;
+                }
+            }
+            bool sorted[MAX_PASSES] = {};
+            for (uint32_t s = 0; s < gPassCount; s++)
+            {
+                uint32_t next = INVALID_ID;
+                for (uint32_t p = 0; p < gPassCount && next == INVALID_ID; p++)
+                {
+                    next = !sorted[p] && inDegrees[p] == 0 ? p : INVALID_ID;
+                }
+                if (next == INVALID_ID)
+                {
+                    LOGF(eERROR, "Render graph: the passes depend on each other in a cycle");
+                    for (uint32_t p = 0; p < gPassCount; p++)
+                    {
+                        gSorted[p] = p;
+                    }
+                    return false;
+                }
+                sorted[next] = true;
+                gSorted[s] = next;
+                for (uint32_t p = 0; p < gPassCount; p++)
+                {
+                    inDegrees[p] -= edges[next][p] ? 1 : 0;
+                }
+            }
+            return true;
+        }
+
+        // Walks the passes backwards from the imported resources, which are what the frame is drawn for. A pass is
+        // kept if a kept pass after it, or the end of the frame, sees one of its writes. A write clearing its target
+        // hides every write before it.
+        void Cull()
+        {
+            bool needed[MAX_RESOURCES] = {};
+            for (uint32_t i = 0; i < gResourceCount; i++)
+            {
+                needed[i] = gResources[i].mImported;
+            }
+
+            bool kept[MAX_PASSES] = {};
+            for (uint32_t s = gPassCount; s-- > 0;)
+            {
+                const uint32_t p = gSorted[s];
+                Access accesses[MAX_PASS_COLORS + 1 + MAX_PASS_READS];
+                const uint32_t count = GetAccesses(gPasses[p], accesses);
+                for (uint32_t i = 0; i < count; i++)
+                {
+                    kept[p] = kept[p] || (IsWrite(accesses[i]) && needed[accesses[i].mResource]);
+                }
+                if (!kept[p])
+                {
+                    continue;
+                }
+                for (uint32_t i = 0; i < count; i++)
+                {
+                    needed[accesses[i].mResource] =
+                        !IsWrite(accesses[i]) || accesses[i].mLoadAction == LOAD_ACTION_LOAD;
+                }
+            }
+
+            gOrderCount = 0;
+            for (uint32_t s = 0; s < gPassCount; s++)
+            {
+                if (kept[gSorted[s]])
+                {
+                    gOrder[gOrderCount++] = gSorted[s];
+                }
+            }
+        }
+
+        // Every read of a graph-owned render target, and every write loading its contents, needs a pass before it
+        // writing the target, or it would see whatever the memory held. Sorting makes sure of that unless no pass
+        // clears the target. So the first use of such a target always clears it. Logs every pass breaking that.
+        bool ValidateOrder()
+        {
+            bool valid = true;
+            bool written[MAX_RESOURCES] = {};
+            for (uint32_t o = 0; o < gOrderCount; o++)
+            {
+                const Pass &pass = gPasses[gOrder[o]];
+                Access accesses[MAX_PASS_COLORS + 1 + MAX_PASS_READS];
+                const uint32_t count = GetAccesses(pass, accesses);
+                for (uint32_t i = 0; i < count; i++)
+                {
+                    const Resource &resource = gResources[accesses[i].mResource];
+                    const bool loads = !IsWrite(accesses[i]) || accesses[i].mLoadAction == LOAD_ACTION_LOAD;
+                    if (!resource.mImported && loads && !written[accesses[i].mResource])
+                    {
+                        LOGF(eERROR, "Render graph: pass %s uses %s before any pass writes it", pass.pName,
+                             resource.pName);
+                        valid = false;
+                    }
+                }
+                for (uint32_t i = 0; i < count; i++)
+                {
+                    written[accesses[i].mResource] = written[accesses[i].mResource] || IsWrite(accesses[i]);
+                }
+            }
+            return valid;
+        }
+
+        // Lifetimes of the resources over the kept passes, and the state each one is left in at the end of the
+        // frame.
+        void FindLifetimes(ResourceState *pLastStates)
+        {
+            for (uint32_t r = 0; r < gResourceCount; r++)
+            {
+                gResources[r].mFirstPass = INVALID_ID;
+                gResources[r].mLastPass = INVALID_ID;
+                gResources[r].mPlaced = false;
+                gResources[r].mShared = false;
+                pLastStates[r] = gResources[r].mImported ? gResources[r].mInitialState : RESOURCE_STATE_UNDEFINED;
+            }
+            for (uint32_t o = 0; o < gOrderCount; o++)
+            {
+                Access accesses[MAX_PASS_COLORS + 1 + MAX_PASS_READS];
+                const uint32_t count = GetAccesses(gPasses[gOrder[o]], accesses);
+                for (uint32_t i = 0; i < count; i++)
+                {
+                    Resource &resource = gResources[accesses[i].mResource];
+                    if (resource.mFirstPass == INVALID_ID)
+                    {
+                        resource.mFirstPass = o;
+                    }
+                    resource.mLastPass = o;
+                    pLastStates[accesses[i].mResource] = accesses[i].mState;
+                }
+            }
+        }
+
+        bool Overlaps(uint64_t beginA, uint64_t endA, uint64_t beginB, uint64_t endB)
+        {
+            return beginA < endB && beginB < endA;
+        }
+
+        // First fit, largest first: every render target goes at the lowest offset clear of the ones alive in any of
+        // its passes. Targets on tile memory stay out, they take none on the GPUs keeping them there. Returns the size
+        // of the heap.
+        uint64_t PlaceResources()
+        {
+            uint32_t sorted[MAX_RESOURCES];
+            uint32_t sortedCount = 0;
+            for (uint32_t r = 0; r < gResourceCount; r++)
+            {
+                if (gResources[r].mImported || gResources[r].mFirstPass == INVALID_ID ||
+                    (gResources[r].mDesc.mFlags & TEXTURE_CREATION_FLAG_ON_TILE))
+                {
+                    continue;
+                }
+                uint32_t i = sortedCount++;
+                for (; i > 0 && gResources[sorted[i - 1]].mSize < gResources[r].mSize; i--)
+                {
+                    sorted[i] = sorted[i - 1];
+                }
+                sorted[i] = r;
+            }
+
+            uint64_t heapSize = 0;
+            for (uint32_t s = 0; s < sortedCount; s++)
+            {
+                Resource &resource = gResources[sorted[s]];
+                uint64_t offset = 0;
+                for (bool moved = true; moved;)
+                {
+                    moved = false;
+                    offset = (offset + resource.mAlignment - 1) / resource.mAlignment * resource.mAlignment;
+                    for (uint32_t t = 0; t < s; t++)
+                    {
+                        const Resource &placed = gResources[sorted[t]];
+                        if (Overlaps(resource.mFirstPass, resource.mLastPass + 1, placed.mFirstPass,
+                                     placed.mLastPass + 1) &&
+                            Overlaps(offset, offset + resource.mSize, placed.mOffset, placed.mOffset + placed.mSize))
+                        {
+                            offset = placed.mOffset + placed.mSize;
+                            moved = true;
+                        }
+                    }
+                }
+                resource.mPlaced = true;
+                resource.mOffset = offset;
+                heapSize = heapSize > offset + resource.mSize ? heapSize : offset + resource.mSize;
+                for (uint32_t t = 0; t < s; t++)
+                {
+                    Resource &placed = gResources[sorted[t]];
+                    if (Overlaps(offset, offset + resource.mSize, placed.mOffset, placed.mOffset + placed.mSize))
+                    {
+                        resource.mShared = true;
+                        placed.mShared = true;
+                    }
+                }
+            }
+            return heapSize;
+        }
+
+        // Position of the last pass using memory the resource shares before its first pass, INVALID_ID if none does.
+        uint32_t GetPreviousOwnerUse(uint32_t r)
+        {
+            const Resource &resource = gResources[r];
+            uint32_t previousUse = INVALID_ID;
+            for (uint32_t q = 0; q < gResourceCount; q++)
+            {
+                const Resource &other = gResources[q];
+                if (q != r && other.mPlaced && other.mLastPass < resource.mFirstPass &&
+                    Overlaps(resource.mOffset, resource.mOffset + resource.mSize, other.mOffset,
+                             other.mOffset + other.mSize) &&
+                    (previousUse == INVALID_ID || other.mLastPass > previousUse))
+                {
+                    previousUse = other.mLastPass;
+                }
+            }
+            return previousUse;
+        }
+
+        // Appends a transition needed by the pass at position o to the first batch already holding others after the
+        // resource's previous use, or to the pass's own batch.
+        void AddTransition(uint32_t o, uint32_t previousUse, const Transition &transition)
+        {
+            uint32_t batch = o;
+            for (uint32_t b = previousUse == INVALID_ID ? 0 : previousUse + 1; b < o; b++)
+            {
+                if (gBatchSizes[b] > 0)
+                {
+                    batch = b;
+                    break;
+                }
+            }
+            gBatches[batch][gBatchSizes[batch]++] = transition;
+        }
+
+        // Transitions into the states every pass needs, skipping resources already in them, and back to the final
+        // states of the imported resources at the end of the frame, in as few batches as their uses allow. A render
+        // target sharing memory starts every frame undefined, another one drew over it. Forge has no aliasing barrier,
+        // so its transition from the undefined state stands in for one: it goes in a batch after the last pass using
+        // the memory before, and the clear its first pass has to make then initializes the memory.
+        void PlanBarriers(const ResourceState *pLastStates)
+        {
+            ResourceState states[MAX_RESOURCES];
+            uint32_t previousUses[MAX_RESOURCES];
+            for (uint32_t r = 0; r < gResourceCount; r++)
+            {
+                states[r] = gResources[r].mImported ? gResources[r].mInitialState
+                            : gResources[r].mShared ? RESOURCE_STATE_UNDEFINED
+                                                    : pLastStates[r];
+                previousUses[r] = gResources[r].mShared ? GetPreviousOwnerUse(r) : INVALID_ID;
+            }
+            for (uint32_t b = 0; b <= gOrderCount; b++)
+            {
+                gBatchSizes[b] = 0;
+            }
+
+            gStats.mTransitionCount = 0;
+            for (uint32_t o = 0; o < gOrderCount; o++)
+            {
+                Access accesses[MAX_PASS_COLORS + 1 + MAX_PASS_READS];
+                const uint32_t count = GetAccesses(gPasses[gOrder[o]], accesses);
+                for (uint32_t i = 0; i < count; i++)
+                {
+                    const uint32_t r = accesses[i].mResource;
+                    if (states[r] != accesses[i].mState)
+                    {
+                        AddTransition(o, previousUses[r], {r, states[r], accesses[i].mState});
+                        states[r] = accesses[i].mState;
+                        gStats.mTransitionCount++;
+                    }
+                    previousUses[r] = o;
+                }
+            }
+            for (uint32_t r = 0; r < gResourceCount; r++)
+            {
+                if (gResources[r].mImported && states[r] != gResources[r].mFinalState)
+                {
+                    AddTransition(gOrderCount, previousUses[r], {r, states[r], gResources[r].mFinalState});
+                    gStats.mTransitionCount++;
+                }
+            }
+
+            gStats.mBarrierCount = 0;
+            for (uint32_t b = 0; b <= gOrderCount; b++)
+            {
+                gStats.mBarrierCount += gBatchSizes[b] > 0 ? 1 : 0;
+            }
+        }
+    } // namespace
+} // namespace RenderGraph
+
+void RenderGraph::Reset()
+{
+    ASSERT(!pHeap);
+    gResourceCount = 0;
+    gPassCount = 0;
+    gOrderCount = 0;
+    gStats = {};
+}
+
+uint32_t RenderGraph::ImportRenderTarget(const char *pName, ResourceState initialState, ResourceState finalState)
+{
+    ASSERT(gResourceCount < MAX_RESOURCES);
+    Resource &resource = gResources[gResourceCount];
+    resource = {};
+    resource.pName = pName;
+    resource.mImported = true;
+    resource.mInitialState = initialState;
+    resource.mFinalState = finalState;
+    return gResourceCount++;
+}
+
+uint32_t RenderGraph::AddRenderTarget(const char *pName, const RenderTargetDesc *pDesc)
+{
+    ASSERT(gResourceCount < MAX_RESOURCES);
+    Resource &resource = gResources[gResourceCount];
+    resource = {};
+    resource.pName = pName;
+    resource.mDesc = *pDesc;
+    return gResourceCount++;
+}
+
+uint32_t RenderGraph::AddPass(const char *pName, PassFunc pFunc, void *pUserData)
+{
+    ASSERT(gPassCount < MAX_PASSES);
+    Pass &pass = gPasses[gPassCount];
+    pass = {};
+    pass.pName = pName;
+    pass.pFunc = pFunc;
+    pass.pUserData = pUserData;
+    pass.mDepth.mResource = INVALID_ID;
+    return gPassCount++;
+}
+
+void RenderGraph::WriteColor(uint32_t pass, uint32_t resource, LoadActionType loadAction)
+{
+    ASSERT(gPasses[pass].mColorCount < MAX_PASS_COLORS);
+    gPasses[pass].mColors[gPasses[pass].mColorCount++] = {resource, RESOURCE_STATE_RENDER_TARGET, loadAction};
+}
+
+void RenderGraph::WriteDepth(uint32_t pass, uint32_t resource, LoadActionType loadAction)
+{
+    gPasses[pass].mDepth = {resource, RESOURCE_STATE_DEPTH_WRITE, loadAction};
+}
+
+void RenderGraph::ReadTexture(uint32_t pass, uint32_t resource)
+{
+    ASSERT(gPasses[pass].mReadCount < MAX_PASS_READS);
+    gPasses[pass].mReads[gPasses[pass].mReadCount++] = {resource, RESOURCE_STATE_SHADER_RESOURCE, LOAD_ACTION_LOAD};
+}
+
+void RenderGraph::Compile(Renderer *pRenderer)
+{
+    const bool sorted = SortPasses();
+    Cull();
+    if (!sorted || !ValidateOrder())
+    {
+        ASSERT(false);
+    }
+    ResourceState lastStates[MAX_RESOURCES];
+    FindLifetimes(lastStates);
+
+    uint64_t heapAlignment = 1;
+    gStats.mDedicatedSize = 0;
+    for (uint32_t r = 0; r < gResourceCount; r++)
+    {
+        Resource &resource = gResources[r];
+        if (resource.mImported || resource.mFirstPass == INVALID_ID)
+        {
+            continue;
+        }
+
+        // Sized as the render target it becomes.
+        TextureDesc textureDesc = {};
+        textureDesc.mFlags = resource.mDesc.mFlags;
+        textureDesc.mWidth = resource.mDesc.mWidth;
+        textureDesc.mHeight = resource.mDesc.mHeight;
+        textureDesc.mDepth = resource.mDesc.mDepth;
+        textureDesc.mArraySize = resource.mDesc.mArraySize;
+        textureDesc.mMipLevels = 1;
+        textureDesc.mSampleCount = resource.mDesc.mSampleCount;
+        textureDesc.mSampleQuality = resource.mDesc.mSampleQuality;
+        textureDesc.mFormat = resource.mDesc.mFormat;
+        textureDesc.mClearValue = resource.mDesc.mClearValue;
+        textureDesc.mStartState = TinyImageFormat_IsDepthOnly(resource.mDesc.mFormat) ||
+                                          TinyImageFormat_IsDepthAndStencil(resource.mDesc.mFormat)
+                                      ? RESOURCE_STATE_DEPTH_WRITE
+                                      : RESOURCE_STATE_RENDER_TARGET;
+        textureDesc.mDescriptors = resource.mDesc.mDescriptors;
+        ResourceSizeAlign sizeAlign = {};
+        getTextureSizeAlign(pRenderer, &textureDesc, &sizeAlign);
+        resource.mSize = sizeAlign.mSize;
+        resource.mAlignment = sizeAlign.mAlignment ? sizeAlign.mAlignment : 1;
+        heapAlignment = heapAlignment > resource.mAlignment ? heapAlignment : resource.mAlignment;
+        gStats.mDedicatedSize += resource.mSize;
+    }
+    gStats.mHeapSize = PlaceResources();
+    if (gStats.mHeapSize > 0)
+    {
+        ResourceHeapDesc heapDesc = {};
+        heapDesc.pName = "Render graph";
+        heapDesc.mSize = gStats.mHeapSize;
+        heapDesc.mAlignment = heapAlignment;
+        heapDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_ONLY;
+        heapDesc.mDescriptors = DESCRIPTOR_TYPE_TEXTURE;
+        addResourceHeap(pRenderer, &heapDesc, &pHeap);
+    }
+    PlanBarriers(lastStates);
+
+    for (uint32_t r = 0; r < gResourceCount; r++)
+    {
+        Resource &resource = gResources[r];
+        if (resource.mImported || resource.mFirstPass == INVALID_ID)
+        {
+            continue;
+        }
+        RenderTargetDesc desc = resource.mDesc;
+        desc.pName = resource.pName;
+        // A target not sharing memory starts the next frame in the state it ends this one in, so it is also created
+        // in it.
+        desc.mStartState = resource.mShared ? RESOURCE_STATE_UNDEFINED : lastStates[r];
+        ResourcePlacement placement = {};
+        if (resource.mPlaced)
+        {
+            desc.mFlags = static_cast<TextureCreationFlags>(desc.mFlags & ~TEXTURE_CREATION_FLAG_OWN_MEMORY_BIT);
+            placement.pHeap = pHeap;
+            placement.mOffset = resource.mOffset;
+            desc.pPlacement = &placement;
+        }
+        addRenderTarget(pRenderer, &desc, &resource.pRenderTarget);
+        ASSERT(resource.pRenderTarget);
+    }
+
+    gStats.mPassCount = gOrderCount;
+    gStats.mCulledPassCount = gPassCount - gOrderCount;
+    LOGF(eINFO, "Render graph: %u passes, %u culled, %u render target transitions in %u barrier calls, %.2f MiB of "
+                "render targets, %.2f MiB heap shared by those placed in it",
+         gStats.mPassCount, gStats.mCulledPassCount, gStats.mTransitionCount, gStats.mBarrierCount,
+         static_cast<double>(gStats.mDedicatedSize) / (1024.0 * 1024.0),
+         static_cast<double>(gStats.mHeapSize) / (1024.0 * 1024.0));
+}
+
+void RenderGraph::Release(Renderer *pRenderer)
+{
+    for (uint32_t r = 0; r < gResourceCount; r++)
+    {
+        Resource &resource = gResources[r];
+        if (!resource.mImported && resource.pRenderTarget)
+        {
+            removeRenderTarget(pRenderer, resource.pRenderTarget);
+        }
+        resource.pRenderTarget = nullptr;
+    }
+    if (pHeap)
+    {
+        removeResourceHeap(pRenderer, pHeap);
+        pHeap = nullptr;
+    }
+}
+
+void RenderGraph::SetRenderTarget(uint32_t resource, RenderTarget *pRenderTarget)
+{
+    ASSERT(gResources[resource].mImported);
+    gResources[resource].pRenderTarget = pRenderTarget;
+}
+
+RenderTarget *RenderGraph::GetRenderTarget(uint32_t resource) { return gResources[resource].pRenderTarget; }
+
+void RenderGraph::Execute(Cmd *pCmd, uint32_t frameIndex)
+{
+    for (uint32_t o = 0; o <= gOrderCount; o++)
+    {
+        if (gBatchSizes[o] > 0)
+        {
+            RenderTargetBarrier barriers[MAX_RESOURCES];
+            for (uint32_t t = 0; t < gBatchSizes[o]; t++)
+            {
+                const Transition &transition = gBatches[o][t];
+                barriers[t] = {gResources[transition.mResource].pRenderTarget, transition.mFrom, transition.mTo};
+            }
+            cmdResourceBarrier(pCmd, 0, nullptr, 0, nullptr, gBatchSizes[o], barriers);
+        }
+        if (o == gOrderCount)
+        {
+            break;
+        }
+
+        const Pass &pass = gPasses[gOrder[o]];
+        BindRenderTargetsDesc bindRenderTargets = {};
+        bindRenderTargets.mRenderTargetCount = pass.mColorCount;
+        for (uint32_t i = 0; i < pass.mColorCount; i++)
+        {
+            bindRenderTargets.mRenderTargets[i] = {gResources[pass.mColors[i].mResource].pRenderTarget,
+                                                   pass.mColors[i].mLoadAction};
+        }
+        if (pass.mDepth.mResource != INVALID_ID)
+        {
+            bindRenderTargets.mDepthStencil = {gResources[pass.mDepth.mResource].pRenderTarget,
+                                               pass.mDepth.mLoadAction};
+        }
+        cmdBindRenderTargets(pCmd, &bindRenderTargets);
+        pass.pFunc(pass.pUserData, pCmd, frameIndex);
+        cmdBindRenderTargets(pCmd, nullptr);
+    }
+}
+
+const RenderGraph::Stats *RenderGraph::GetStats() { return &gStats; }
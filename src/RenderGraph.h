@@ -0,0 +1,65 @@
+#ifndef RENDER_GRAPH_H
+#define RENDER_GRAPH_H
+
+#include <IGraphics.h>
+
+// The raster passes of a frame and the render targets they use. Passes declare what they write and read, Compile
+// orders them by that and works out the barriers between them, merged into as few calls as the passes allow. The
+// render targets the graph owns are placed in one heap, where targets never alive in the same pass share memory.
+// Built on a reload, executed every frame. Buffers and compute work stay outside, with their own barriers.
+namespace RenderGraph
+{
+    constexpr uint32_t MAX_PASSES = 16;
+    constexpr uint32_t MAX_RESOURCES = 16;
+    constexpr uint32_t MAX_PASS_COLORS = 4;
+    constexpr uint32_t MAX_PASS_READS = 4;
+    constexpr uint32_t INVALID_ID = 0xffffffffu;
+
+    typedef void (*PassFunc)(void *pUserData, Cmd *pCmd, uint32_t frameIndex);
+
+    struct Stats
+    {
+        uint32_t mPassCount = 0;
+        // Passes left out because nothing reads what they write.
+        uint32_t mCulledPassCount = 0;
+        // Render target transitions per frame, and the cmdResourceBarrier calls they are issued in. Without batching
+        // every transition is a call of its own.
+        uint32_t mTransitionCount = 0;
+        uint32_t mBarrierCount = 0;
+        // Bytes the graph's render targets would take in allocations of their own, and the size of the heap they are
+        // placed in. Targets on tile memory stay out of it.
+        uint64_t mDedicatedSize = 0;
+        uint64_t mHeapSize = 0;
+    };
+
+    // Forgets every pass and resource. The render targets have to be released first.
+    void Reset();
+
+    // A render target owned by someone else, the swapchain's for one. It is in initialState when the frame starts
+    // and is put back in finalState at its end. Its RenderTarget is set per frame with SetRenderTarget.
+    uint32_t ImportRenderTarget(const char *pName, ResourceState initialState, ResourceState finalState);
+    // A render target created by Compile. Its mStartState and placement are picked by the graph.
+    uint32_t AddRenderTarget(const char *pName, const RenderTargetDesc *pDesc);
+
+    // Passes run in the order their render targets call for, else in the order they are added, their render targets
+    // bound for them and unbound after. A pass reading a graph-owned render target, or loading it, runs after the
+    // first pass added clearing it.
+    uint32_t AddPass(const char *pName, PassFunc pFunc, void *pUserData);
+    void WriteColor(uint32_t pass, uint32_t resource, LoadActionType loadAction);
+    void WriteDepth(uint32_t pass, uint32_t resource, LoadActionType loadAction);
+    // Sampled by the pass's shaders.
+    void ReadTexture(uint32_t pass, uint32_t resource);
+
+    // Sorts and culls the passes, plans the barriers and creates the heap and the render targets.
+    void Compile(Renderer *pRenderer);
+    void Release(Renderer *pRenderer);
+
+    void SetRenderTarget(uint32_t resource, RenderTarget *pRenderTarget);
+    RenderTarget *GetRenderTarget(uint32_t resource);
+
+    void Execute(Cmd *pCmd, uint32_t frameIndex);
+
+    const Stats *GetStats();
+} // namespace RenderGraph
+
+#endif // RENDER_GRAPH_H
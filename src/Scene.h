@@ -0,0 +1,22 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <IGraphics.h>
+#include "Settings.h"
+
+// Entry points of a scene, as DemoScene declares them. MainApp runs the one --scene names, so a new scene only needs
+// an entry in its table.
+struct SceneInterface
+{
+    const char *pName;
+    bool (*pInit)(Renderer *pRenderer, const SceneSettings *pSettings, PipelineCache *pCache);
+    void (*pExit)(Renderer *pRenderer);
+    void (*pAddPasses)(uint32_t backBuffer, uint32_t width, uint32_t height);
+    bool (*pLoad)(ReloadDesc *pReloadDesc, Renderer *pRenderer, RenderTarget *pRenderTarget);
+    void (*pUnload)(ReloadDesc *pReloadDesc, Renderer *pRenderer);
+    void (*pUpdate)(float deltaTime, uint32_t width, uint32_t height, uint32_t frameIndex);
+    void (*pDraw)(Cmd *pCmd, Renderer *pRenderer, uint32_t frameIndex);
+    bool (*pIsResident)();
+};
+
+#endif // SCENE_H
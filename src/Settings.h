@@ -1,6 +1,62 @@
 #ifndef SETTINGS_H
 #define SETTINGS_H
 
-constexpr uint32_t gDataBufferCount = 2;
+#include <cstdint>
+
+// Per-frame resources are declared for this many frames in flight.
+constexpr uint32_t MAX_DATA_BUFFER_COUNT = 4;
+// Frames in flight, 1 to MAX_DATA_BUFFER_COUNT. Set from FrameSettings before anything per-frame is created.
+extern uint32_t gDataBufferCount;
+
+enum class FramePacing
+{
+    // Sample input first and let the CPU run up to gDataBufferCount frames ahead of the GPU.
+    Throughput,
+    // Wait for the GPU to finish the previous frame before sampling input, so each frame shows the freshest input at
+    // the cost of CPU/GPU overlap.
+    LowLatency,
+};
+
+struct FrameSettings
+{
+    uint32_t mFramesInFlight = 2;
+    FramePacing mPacing = FramePacing::Throughput;
+};
+
+// Collisions start switched off above this many spheres unless --collisions is given. Every sphere of the box is in
+// contact with more of the others the more there are, and past this a step takes longer than a frame on one core.
+constexpr uint32_t DEFAULT_COLLISION_SPHERE_LIMIT = 20000;
+
+struct SceneSettings
+{
+    // Number of spheres the instance buffers are sized for.
+    uint32_t mSphereCapacity = 768;
+    // Number of spheres simulated and drawn at startup, can be changed from the UI up to mSphereCapacity.
+    uint32_t mSphereCount = 768;
+    // Seeds every spawn and respawn. Taken from the clock unless --seed is given.
+    uint64_t mSeed = 0;
+    // Simulation time step in seconds. The CPU simulation steps on its own thread this often in real time, 1/60 s
+    // when 0, and replays bit for bit for a given step and seed. The GPU simulation takes one step per frame, of the
+    // frame time when 0.
+    float mFixedDeltaTime = 0.0f;
+    // Quit after this many simulation steps, 0 to run until the window is closed.
+    uint32_t mStepLimit = 0;
+    // Spheres per job when the simulation is split across the job system.
+    uint32_t mChunkSize = 4096;
+    // Run the sphere update in a compute shader instead of on the job system. Picked at startup only, the instance
+    // buffers are laid out differently for each mode.
+    bool mGpuSimulation = false;
+    // Cull in a compute shader and draw the spheres with indirect arguments it fills. Always on with
+    // mGpuSimulation, the CPU never sees the positions there.
+    bool mGpuCulling = false;
+    // Collide the spheres with each other before every CPU simulation step. Can be switched from the UI. The GPU
+    // simulation has no collisions. See DEFAULT_COLLISION_SPHERE_LIMIT.
+    bool mCollisions = true;
+    // Start with the spheres drawn as ray-cast impostors instead of meshes. Can be switched from the UI.
+    bool mImpostors = false;
+    // Create the shaders and pipelines in parallel on the job system instead of one after the other on the loading
+    // thread. Off until a run under the validation layers is clean and the load times are measured.
+    bool mParallelLoad = false;
+};
 
 #endif
\ No newline at end of file